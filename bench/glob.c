@@ -0,0 +1,297 @@
+/**
+ * @file glob.c
+ *
+ * Benchmark for the glob engine in `src/glob_expand.c`.
+ *
+ * Expands a pattern in one large directory, and breaks down where the time
+ * goes by also timing:
+ *
+ * - Reading the directory with `readdir()`, which no expansion can beat.
+ * - Expanding a pattern that matches nothing, which reads the directory and
+ *   matches every name, but collects and sorts no paths.
+ * - Expanding the pattern with the C library's `glob()`, for comparison.
+ *
+ * The expansions are timed without a cache of directory listings, and with one
+ * both when it is empty and when it already holds the directory's listing.
+ *
+ * By default, a temporary directory is filled with 500,000 files, one in five
+ * of which match `*.log`, which takes a while to create. An existing directory
+ * and pattern can be given as arguments instead.
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "glob_expand.h"
+
+/** Number of files in the default directory. */
+#define FILE_COUNT 500000
+
+/** Pattern to expand in the default directory. */
+#define DEFAULT_PATTERN "*.log"
+
+/** Pattern that matches no name in the default directory. */
+#define NO_MATCH_PATTERN "*.none"
+
+/** Number of times each expansion is timed. The fastest time is reported. */
+#define RUN_COUNT 5
+
+/** Returns the current time in seconds. */
+double now();
+
+/**
+ * Prints a label and a time.
+ *
+ * @param label the label
+ * @param secs the time in seconds
+ */
+void print_time(char const *label, double secs);
+
+/**
+ * Creates a temporary directory with `FILE_COUNT` files in it, one in five of
+ * which match `DEFAULT_PATTERN`.
+ *
+ * @param dir_out a buffer to write the path of the directory to, which must
+ * have room for `sizeof("/tmp/acush-glob-bench-XXXXXX")` characters
+ * @return true if successful, false otherwise
+ */
+bool create_files(char *dir_out);
+
+/**
+ * Removes the files and the temporary directory created by `create_files()`.
+ *
+ * @param dir the path of the directory
+ */
+void remove_files(char const *dir);
+
+/**
+ * Times reading the current directory with `readdir()`.
+ *
+ * @return the fastest time in seconds
+ */
+double time_readdir();
+
+/**
+ * Times expanding a pattern with `expand_glob()`.
+ *
+ * @param pattern the pattern
+ * @param cache the cache of directory listings to use, or `NULL`
+ * @param cold whether to empty the cache before each expansion
+ * @param count_out a pointer to write the number of matches to
+ * @return the fastest time in seconds
+ */
+double time_expand_glob(
+    char const *pattern,
+    struct sh_dir_cache *cache,
+    bool cold,
+    size_t *count_out
+);
+
+/**
+ * Times expanding a pattern with the C library's `glob()`.
+ *
+ * @param pattern the pattern
+ * @param count_out a pointer to write the number of matches to
+ * @return the fastest time in seconds
+ */
+double time_libc_glob(char const *pattern, size_t *count_out);
+
+int main(int argc, char **argv) {
+    if (argc != 1 && argc != 3) {
+        fprintf(stderr, "usage: %s [directory pattern]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char dir[] = "/tmp/acush-glob-bench-XXXXXX";
+    char const *pattern = DEFAULT_PATTERN;
+    if (argc == 3) {
+        if (chdir(argv[1]) == -1) {
+            perror(argv[1]);
+            return EXIT_FAILURE;
+        }
+        pattern = argv[2];
+    } else if (!create_files(dir)) {
+        return EXIT_FAILURE;
+    }
+
+    // Directories are only cached once they have not changed for a while.
+    struct stat st;
+    if (stat(".", &st) == 0) {
+        time_t age = time(NULL) - st.st_ctim.tv_sec;
+        if (age <= DIR_CACHE_MIN_AGE) {
+            sleep(DIR_CACHE_MIN_AGE - age + 1);
+        }
+    }
+
+    struct sh_dir_cache cache;
+    init_dir_cache(&cache);
+
+    size_t count, no_match_count;
+    char label[64];
+    print_time("readdir()", time_readdir());
+
+    snprintf(label, sizeof(label), "expand_glob(\"%s\")", NO_MATCH_PATTERN);
+    print_time(
+        label,
+        time_expand_glob(NO_MATCH_PATTERN, NULL, false, &no_match_count)
+    );
+
+    snprintf(label, sizeof(label), "expand_glob(\"%s\")", pattern);
+    print_time(label, time_expand_glob(pattern, NULL, false, &count));
+    print_time(
+        "  with an empty cache",
+        time_expand_glob(pattern, &cache, true, &count)
+    );
+    print_time(
+        "  with a warm cache",
+        time_expand_glob(pattern, &cache, false, &count)
+    );
+
+    snprintf(label, sizeof(label), "glob(\"%s\")", pattern);
+    print_time(label, time_libc_glob(pattern, &count));
+    printf("%zu matches\n", count);
+
+    destroy_dir_cache(&cache);
+    if (argc == 1) {
+        remove_files(dir);
+    }
+    return EXIT_SUCCESS;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void print_time(char const *label, double secs) {
+    printf("%-30s %7.1f ms\n", label, secs * 1e3);
+}
+
+bool create_files(char *dir_out) {
+    if (mkdtemp(dir_out) == NULL || chdir(dir_out) == -1) {
+        perror(dir_out);
+        return false;
+    }
+
+    for (size_t idx = 0; idx < FILE_COUNT; idx++) {
+        char name[32];
+        char const *extension = idx % 5 == 0 ? "log" : "x";
+        snprintf(name, sizeof(name), "f%zu.%s", idx, extension);
+
+        int fd = open(name, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd == -1) {
+            perror(name);
+            remove_files(dir_out);
+            return false;
+        }
+        close(fd);
+    }
+
+    return true;
+}
+
+void remove_files(char const *dir) {
+    for (size_t idx = 0; idx < FILE_COUNT; idx++) {
+        char name[32];
+        char const *extension = idx % 5 == 0 ? "log" : "x";
+        snprintf(name, sizeof(name), "f%zu.%s", idx, extension);
+        unlink(name);
+    }
+
+    if (chdir("/") == -1 || rmdir(dir) == -1) {
+        perror(dir);
+    }
+}
+
+double time_readdir() {
+    double best = 0;
+    for (size_t run = 0; run < RUN_COUNT; run++) {
+        double start = now();
+        DIR *dir = opendir(".");
+        if (dir == NULL) {
+            perror(".");
+            return 0;
+        }
+        while (readdir(dir) != NULL) {
+        }
+        closedir(dir);
+
+        double elapsed = now() - start;
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+double time_expand_glob(
+    char const *pattern,
+    struct sh_dir_cache *cache,
+    bool cold,
+    size_t *count_out
+) {
+    struct sh_arena arena;
+    init_arena(&arena);
+    struct sh_arena_mark mark = arena_mark(&arena);
+
+    double best = 0;
+    for (size_t run = 0; run < RUN_COUNT; run++) {
+        if (cold) {
+            destroy_dir_cache(cache);
+            init_dir_cache(cache);
+        }
+
+        double start = now();
+        char const **paths;
+        *count_out = 0;
+        enum sh_glob_result result = expand_glob(
+            pattern,
+            &arena,
+            cache,
+            NULL,
+            &paths,
+            count_out
+        );
+        double elapsed = now() - start;
+
+        if (result != SH_GLOB_SUCCESS && result != SH_GLOB_NO_MATCH) {
+            fprintf(stderr, "expand_glob() failed with %d\n", result);
+        }
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+        arena_rewind(&arena, mark);
+    }
+
+    destroy_arena(&arena);
+    return best;
+}
+
+double time_libc_glob(char const *pattern, size_t *count_out) {
+    double best = 0;
+    for (size_t run = 0; run < RUN_COUNT; run++) {
+        double start = now();
+        glob_t pg;
+        int ret = glob(pattern, 0, NULL, &pg);
+        double elapsed = now() - start;
+
+        *count_out = ret == 0 ? pg.gl_pathc : 0;
+        globfree(&pg);
+        if (run == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
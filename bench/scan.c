@@ -0,0 +1,121 @@
+/**
+ * @file scan.c
+ *
+ * Benchmark for the text scanner in `src/scan.c`.
+ *
+ * Times every scanner implementation that the CPU supports on a long run of
+ * text, where the vector scanners pay off, and on short words, which are more
+ * typical of command lines typed by hand.
+ *
+ * Build and run with `make bench`.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "scan.h"
+
+/** Number of bytes in the benchmark input. */
+#define INPUT_SIZE (1 << 20)
+
+/** Number of bytes scanned by each timed implementation. */
+#define BYTES_PER_RUN ((size_t) 1 << 30)
+
+// The implementations are not declared in `scan.h`, as the shell only uses
+// `scan_text_end()`, which selects among them.
+char const *scan_text_end_scalar(char const *cp);
+#if defined(__x86_64__) || defined(__i386__)
+char const *scan_text_end_ssse3(char const *cp);
+char const *scan_text_end_avx2(char const *cp);
+#endif
+
+/** A scanner implementation. */
+struct bench_impl {
+    char const *name;                     /**< The implementation's name. */
+    char const *(*scan)(char const *cp); /**< The implementation. */
+    bool supported; /**< Whether the CPU supports the implementation. */
+};
+
+/**
+ * Fills the input with runs of text of the given length separated by spaces.
+ *
+ * @param input a pointer to the input, which has room for `INPUT_SIZE + 1`
+ * bytes
+ * @param run_len the length of each run of text
+ */
+void fill_input(char *input, size_t run_len);
+
+/**
+ * Scans the whole input repeatedly and prints the throughput.
+ *
+ * @param impl a pointer to the implementation to time
+ * @param input the input
+ * @return the number of boundaries found, so that the scans are not optimised
+ * away
+ */
+size_t time_impl(struct bench_impl const *impl, char const *input);
+
+int main() {
+    struct bench_impl impls[] = {
+        {"scalar", scan_text_end_scalar, true},
+#if defined(__x86_64__) || defined(__i386__)
+        {"ssse3", scan_text_end_ssse3, __builtin_cpu_supports("ssse3")},
+        {"avx2", scan_text_end_avx2, __builtin_cpu_supports("avx2")},
+#endif
+    };
+    size_t const run_lens[] = {INPUT_SIZE, 8};
+
+    char *input = malloc(INPUT_SIZE + 1);
+    if (input == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    size_t boundaries = 0;
+    for (size_t i = 0; i < sizeof(run_lens) / sizeof(run_lens[0]); i++) {
+        fill_input(input, run_lens[i]);
+        printf("runs of %zu bytes:\n", run_lens[i]);
+
+        for (size_t j = 0; j < sizeof(impls) / sizeof(impls[0]); j++) {
+            if (impls[j].supported) {
+                boundaries += time_impl(&impls[j], input);
+            } else {
+                printf("  %-8s not supported\n", impls[j].name);
+            }
+        }
+    }
+
+    free(input);
+    return boundaries > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void fill_input(char *input, size_t run_len) {
+    for (size_t i = 0; i < INPUT_SIZE; i++) {
+        // Avoid `2`, which the scanners have to check the next byte for.
+        input[i] = i % (run_len + 1) == run_len ? ' ' : 'a' + i % 20;
+    }
+    input[INPUT_SIZE] = '\0';
+}
+
+size_t time_impl(struct bench_impl const *impl, char const *input) {
+    struct timespec start, end;
+    size_t boundaries = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (size_t i = 0; i < BYTES_PER_RUN / INPUT_SIZE; i++) {
+        char const *cp = input;
+        while (*(cp = impl->scan(cp)) != '\0') {
+            boundaries++;
+            cp++;
+        }
+        boundaries++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double secs =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("  %-8s %6.2f GB/s\n", impl->name, BYTES_PER_RUN / secs / 1e9);
+    return boundaries;
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * Rounds a size up so that the memory after it is suitably aligned for any
+ * type.
+ *
+ * @param size the size to round up
+ * @return the rounded size
+ */
+size_t align_size(size_t size);
+
+/**
+ * Returns a pointer to the start of a chunk's data.
+ *
+ * @param chunk a pointer to the chunk
+ * @return a pointer to the data
+ */
+char *chunk_data(struct sh_arena_chunk *chunk);
+
+/**
+ * Allocates a new chunk.
+ *
+ * @param size the number of bytes of data that the chunk needs to fit
+ * @return a pointer to the chunk, or `NULL` if memory could not be allocated
+ */
+struct sh_arena_chunk *new_chunk(size_t size);
+
+void init_arena(struct sh_arena *arena) {
+    *arena = (struct sh_arena) {
+        .first = NULL,
+        .current = NULL,
+    };
+}
+
+void *arena_alloc(struct sh_arena *arena, size_t size) {
+    size = align_size(size);
+
+    // Move on to the following chunks until one has enough space. Chunks left
+    // over from before a rewind are reused, but skipped if they are too small.
+    struct sh_arena_chunk *chunk = arena->current;
+    while (chunk == NULL || chunk->capacity - chunk->used < size) {
+        struct sh_arena_chunk *next = chunk == NULL ? arena->first
+                                                    : chunk->next;
+        if (next == NULL) {
+            next = new_chunk(size);
+            if (next == NULL) {
+                return NULL;
+            }
+
+            if (chunk == NULL) {
+                arena->first = next;
+            } else {
+                chunk->next = next;
+            }
+        }
+
+        chunk = next;
+        chunk->used = 0;
+        arena->current = chunk;
+    }
+
+    void *ptr = chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+void *arena_grow(
+    struct sh_arena *arena,
+    void *ptr,
+    size_t old_size,
+    size_t new_size
+) {
+    // Grow in place if this was the last allocation.
+    struct sh_arena_chunk *chunk = arena->current;
+    size_t old_aligned = align_size(old_size);
+    size_t new_aligned = align_size(new_size);
+    if (ptr != NULL && chunk != NULL
+        && (char *) ptr + old_aligned == chunk_data(chunk) + chunk->used
+        && new_aligned - old_aligned <= chunk->capacity - chunk->used)
+    {
+        chunk->used += new_aligned - old_aligned;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    if (new_ptr != NULL && ptr != NULL) {
+        memcpy(new_ptr, ptr, old_size);
+    }
+    return new_ptr;
+}
+
+char *arena_strdup(struct sh_arena *arena, char const *str) {
+    size_t len = strlen(str);
+    char *copy = arena_alloc(arena, sizeof(char) * (len + 1));
+    if (copy == NULL) {
+        return NULL;
+    }
+    memcpy(copy, str, len + 1);
+    return copy;
+}
+
+struct sh_arena_mark arena_mark(struct sh_arena const *arena) {
+    return (struct sh_arena_mark) {
+        .chunk = arena->current,
+        .used = arena->current == NULL ? 0 : arena->current->used,
+    };
+}
+
+void arena_rewind(struct sh_arena *arena, struct sh_arena_mark mark) {
+    // Chunks after the current one are reset when they are next used.
+    arena->current = mark.chunk;
+    if (mark.chunk != NULL) {
+        mark.chunk->used = mark.used;
+    }
+}
+
+void destroy_arena(struct sh_arena *arena) {
+    struct sh_arena_chunk *chunk = arena->first;
+    while (chunk != NULL) {
+        struct sh_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    init_arena(arena);
+}
+
+size_t align_size(size_t size) {
+    size_t alignment = _Alignof(max_align_t);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+char *chunk_data(struct sh_arena_chunk *chunk) {
+    return (char *) chunk->data;
+}
+
+struct sh_arena_chunk *new_chunk(size_t size) {
+    size_t capacity = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+    struct sh_arena_chunk *chunk = malloc(
+        sizeof(struct sh_arena_chunk) + capacity
+    );
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    *chunk = (struct sh_arena_chunk) {
+        .next = NULL,
+        .capacity = capacity,
+        .used = 0,
+    };
+    return chunk;
+}
@@ -0,0 +1,120 @@
+/**
+ * @file arena.h
+ *
+ * Declarations for the region allocator.
+ *
+ * An arena hands out memory from large chunks by bumping an offset, and frees
+ * everything allocated since a mark at once by rewinding to the mark. Chunks
+ * are kept after rewinding, so an arena that is used over and over again stops
+ * calling `malloc()` once it has grown large enough.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** The minimum size of an arena chunk's data. */
+#define ARENA_CHUNK_SIZE 4096
+
+/** A chunk of memory in an arena. */
+struct sh_arena_chunk {
+    struct sh_arena_chunk *next; /**< The next chunk. Chunks after the current
+                                    one are not in use. */
+    size_t capacity;             /**< Number of bytes of data. */
+    size_t used;                 /**< Number of bytes of data in use. */
+    max_align_t data[];          /**< The data. */
+};
+
+/** A region allocator. */
+struct sh_arena {
+    struct sh_arena_chunk *first;   /**< The first chunk, or `NULL` if there is
+                                       none. */
+    struct sh_arena_chunk *current; /**< The chunk being allocated from, or
+                                       `NULL` if none is in use. */
+};
+
+/** A position in an arena to rewind to. */
+struct sh_arena_mark {
+    struct sh_arena_chunk *chunk; /**< The chunk being allocated from. */
+    size_t used;                  /**< Number of bytes in use in the chunk. */
+};
+
+/**
+ * Initialises an empty arena.
+ *
+ * @param arena a pointer to the arena to initialise
+ */
+void init_arena(struct sh_arena *arena);
+
+/**
+ * Allocates memory from an arena.
+ *
+ * The memory is suitably aligned for any type, and stays valid until the arena
+ * is rewound to a mark from before the allocation.
+ *
+ * @param arena a pointer to the arena
+ * @param size the number of bytes to allocate
+ * @return a pointer to the memory, or `NULL` if memory could not be allocated
+ */
+void *arena_alloc(struct sh_arena *arena, size_t size);
+
+/**
+ * Grows memory allocated from an arena, keeping its contents.
+ *
+ * The memory is grown in place if it was the last allocation and there is
+ * space for it. Otherwise, it is copied into a new allocation, and the old one
+ * is only reclaimed when the arena is rewound.
+ *
+ * @param arena a pointer to the arena
+ * @param ptr a pointer to the memory, or `NULL` to allocate new memory
+ * @param old_size the number of bytes that were allocated
+ * @param new_size the number of bytes to grow to
+ * @return a pointer to the memory, or `NULL` if memory could not be allocated
+ * (in which case the old memory is left untouched)
+ */
+void *arena_grow(
+    struct sh_arena *arena,
+    void *ptr,
+    size_t old_size,
+    size_t new_size
+);
+
+/**
+ * Copies a string into an arena.
+ *
+ * @param arena a pointer to the arena
+ * @param str the string to copy
+ * @return a pointer to the copy, or `NULL` if memory could not be allocated
+ */
+char *arena_strdup(struct sh_arena *arena, char const *str);
+
+/**
+ * Returns the current position of an arena.
+ *
+ * @param arena a pointer to the arena
+ * @return a mark for the current position
+ */
+struct sh_arena_mark arena_mark(struct sh_arena const *arena);
+
+/**
+ * Frees everything allocated from an arena since a mark was taken.
+ *
+ * The arena must not have been rewound to an earlier mark in the meantime.
+ *
+ * @param arena a pointer to the arena
+ * @param mark the mark to rewind to
+ */
+void arena_rewind(struct sh_arena *arena, struct sh_arena_mark mark);
+
+/**
+ * Destroys an arena.
+ *
+ * This function frees all memory associated with the arena, including
+ * everything allocated from it.
+ *
+ * @param arena a pointer to the arena
+ */
+void destroy_arena(struct sh_arena *arena);
+
+#endif
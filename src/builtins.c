@@ -31,10 +31,20 @@ enum sh_getcwd_error {
  */
 enum sh_getcwd_error allocating_getcwd(char **out);
 
+/**
+ * Parses a limit given to the `globlimit` builtin.
+ *
+ * @param str the string to parse
+ * @param out a pointer to write the limit to
+ * @return true if the string is a non-negative integer, false otherwise
+ */
+bool parse_glob_limit(char const *str, unsigned long *out);
+
 bool is_builtin(char const *name) {
     return strcmp(name, "exit") == 0 || strcmp(name, "history") == 0
            || strcmp(name, "prompt") == 0 || strcmp(name, "pwd") == 0
-           || strcmp(name, "cd") == 0;
+           || strcmp(name, "cd") == 0 || strcmp(name, "globlimit") == 0
+           || strcmp(name, "argbatch") == 0;
 }
 
 int run_builtin(
@@ -68,6 +78,16 @@ int run_builtin(
         return run_pwd(fds, argc, argv);
     }
 
+    // Handle `globlimit` builtin.
+    if (strcmp(argv[0], "globlimit") == 0) {
+        return run_globlimit(ctx, fds, argc, argv);
+    }
+
+    // Handle `argbatch` builtin.
+    if (strcmp(argv[0], "argbatch") == 0) {
+        return run_argbatch(ctx, fds, argc, argv);
+    }
+
     // This function should not be called if `argv[0]` is not a builtin command!
     assert(false);
 }
@@ -133,8 +153,13 @@ enum sh_history_result run_history(
         return SH_HISTORY_UNEXPECTED_ARG_COUNT;
     }
 
-    for (size_t idx = 0; idx < ctx->history_count; idx++) {
-        dprintf(fds.out, "%lu  %s\n", idx + 1, ctx->history[idx]);
+    // Older entries may have been evicted, but the remaining entries keep their
+    // numbers.
+    struct sh_history const *history = &ctx->history;
+    for (size_t idx = history->first_number; idx < history_end_number(history);
+         idx++)
+    {
+        dprintf(fds.out, "%lu  %s\n", idx + 1, history_get(history, idx));
     }
 
     return SH_HISTORY_SUCCESS;
@@ -172,6 +197,77 @@ enum sh_prompt_result run_prompt(
     return SH_PROMPT_SUCCESS;
 }
 
+enum sh_globlimit_result run_globlimit(
+    struct sh_shell_context *ctx,
+    struct sh_builtin_std_fds fds,
+    size_t argc,
+    char const *const *argv
+) {
+    assert(argc >= 1);
+    assert(strcmp(argv[0], "globlimit") == 0);
+
+    struct sh_glob_budget *budget = &ctx->glob_budget;
+
+    // Without arguments, show the current limits.
+    if (argc == 1) {
+        dprintf(fds.out, "timeout: %lu ms\n", budget->timeout_ms);
+        dprintf(fds.out, "max matches: %zu\n", budget->max_matches);
+        return SH_GLOBLIMIT_SUCCESS;
+    }
+
+    if (argc != 3) {
+        dprintf(fds.err, "globlimit: unexpected argument count\n");
+        dprintf(fds.err, "usage: globlimit [<timeout-ms> <max-matches>]\n");
+        return SH_GLOBLIMIT_UNEXPECTED_ARG_COUNT;
+    }
+
+    unsigned long timeout_ms;
+    unsigned long max_matches;
+    if (!parse_glob_limit(argv[1], &timeout_ms)
+        || !parse_glob_limit(argv[2], &max_matches))
+    {
+        dprintf(fds.err, "globlimit: limits must be non-negative integers\n");
+        return SH_GLOBLIMIT_INVALID_LIMIT;
+    }
+
+    budget->timeout_ms = timeout_ms;
+    budget->max_matches = max_matches;
+    return SH_GLOBLIMIT_SUCCESS;
+}
+
+enum sh_argbatch_result run_argbatch(
+    struct sh_shell_context *ctx,
+    struct sh_builtin_std_fds fds,
+    size_t argc,
+    char const *const *argv
+) {
+    assert(argc >= 1);
+    assert(strcmp(argv[0], "argbatch") == 0);
+
+    // Without arguments, show the current setting.
+    if (argc == 1) {
+        dprintf(fds.out, "%s\n", ctx->batch_args ? "on" : "off");
+        return SH_ARGBATCH_SUCCESS;
+    }
+
+    if (argc != 2) {
+        dprintf(fds.err, "argbatch: unexpected argument count\n");
+        dprintf(fds.err, "usage: argbatch [on|off]\n");
+        return SH_ARGBATCH_UNEXPECTED_ARG_COUNT;
+    }
+
+    if (strcmp(argv[1], "on") == 0) {
+        ctx->batch_args = true;
+    } else if (strcmp(argv[1], "off") == 0) {
+        ctx->batch_args = false;
+    } else {
+        dprintf(fds.err, "argbatch: setting must be `on` or `off`\n");
+        return SH_ARGBATCH_INVALID_SETTING;
+    }
+
+    return SH_ARGBATCH_SUCCESS;
+}
+
 enum sh_pwd_result
 run_pwd(struct sh_builtin_std_fds fds, size_t argc, char const *const *argv) {
     // This function should only be called when `argv[0]` is "pwd".
@@ -289,6 +385,23 @@ run_cd(struct sh_builtin_std_fds fds, size_t argc, char const *const *argv) {
     return SH_CD_SUCCESS;
 }
 
+bool parse_glob_limit(char const *str, unsigned long *out) {
+    // `strtoul()` accepts a sign, but a negative limit makes no sense.
+    if (*str < '0' || *str > '9') {
+        return false;
+    }
+
+    errno = 0;
+    char *endptr;
+    unsigned long value = strtoul(str, &endptr, 10);
+    if (*endptr != '\0' || errno == ERANGE) {
+        return false;
+    }
+
+    *out = value;
+    return true;
+}
+
 enum sh_getcwd_error allocating_getcwd(char **out) {
     // Initial buffer size for the current working directory.
     // `PATH_MAX` from `<limits.h` is, unfortunately, not an accurate value for
@@ -127,6 +127,66 @@ enum sh_prompt_result run_prompt(
     char const *const *argv
 );
 
+/** Represents the possible results for the `globlimit` built-in command. */
+enum sh_globlimit_result {
+    SH_GLOBLIMIT_SUCCESS = 0,          /**< Successful execution */
+    SH_GLOBLIMIT_UNEXPECTED_ARG_COUNT, /**< Unexpected number of arguments */
+    SH_GLOBLIMIT_INVALID_LIMIT,        /**< A limit is not a number */
+};
+
+/**
+ * Runs the `globlimit` built-in command.
+ *
+ * Without arguments, the command prints the limits on expanding each glob.
+ * Otherwise, it sets the number of milliseconds that an expansion may take and
+ * the number of paths that it may find, where 0 means no limit.
+ *
+ * @param ctx a pointer to the shell context
+ * @param fds standard streams' file descriptors for the built-in command's
+ * output
+ * @param argc the number of arguments
+ * @param argv the argument vector
+ *
+ * @return the result of the globlimit command
+ */
+enum sh_globlimit_result run_globlimit(
+    struct sh_shell_context *ctx,
+    struct sh_builtin_std_fds fds,
+    size_t argc,
+    char const *const *argv
+);
+
+/** Represents the possible results for the `argbatch` built-in command. */
+enum sh_argbatch_result {
+    SH_ARGBATCH_SUCCESS = 0,          /**< Successful execution */
+    SH_ARGBATCH_UNEXPECTED_ARG_COUNT, /**< Unexpected number of arguments */
+    SH_ARGBATCH_INVALID_SETTING,      /**< The setting is not `on` or `off` */
+};
+
+/**
+ * Runs the `argbatch` built-in command.
+ *
+ * Without arguments, the command prints whether argument batching is on.
+ * Otherwise, it turns it on or off. While it is on, a command whose arguments
+ * do not fit into one `exec()` is run several times in parallel, xargs-style,
+ * each time with as many of the arguments as fit. Its leading options are
+ * passed to every run.
+ *
+ * @param ctx a pointer to the shell context
+ * @param fds standard streams' file descriptors for the built-in command's
+ * output
+ * @param argc the number of arguments
+ * @param argv the argument vector
+ *
+ * @return the result of the argbatch command
+ */
+enum sh_argbatch_result run_argbatch(
+    struct sh_shell_context *ctx,
+    struct sh_builtin_std_fds fds,
+    size_t argc,
+    char const *const *argv
+);
+
 /** Represents the possible results for the `pwd` built-in command. */
 enum sh_pwd_result {
     SH_PWD_SUCCESS = 0,          /**< Successful execution */
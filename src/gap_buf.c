@@ -0,0 +1,190 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gap_buf.h"
+
+/**
+ * Makes sure that the gap can fit at least the given number of characters.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param len the number of characters the gap must fit
+ * @return true if successful, false otherwise
+ */
+bool reserve_gap(struct sh_gap_buf *gb, size_t len);
+
+void init_gap_buf(struct sh_gap_buf *gb) {
+    *gb = (struct sh_gap_buf) {
+        .buf = NULL,
+        .capacity = 0,
+        .gap_start = 0,
+        .gap_end = 0,
+        .edited_from = 0,
+    };
+}
+
+size_t gap_buf_len(struct sh_gap_buf const *gb) {
+    return gb->capacity - (gb->gap_end - gb->gap_start);
+}
+
+size_t gap_buf_cursor(struct sh_gap_buf const *gb) { return gb->gap_start; }
+
+char gap_buf_at(struct sh_gap_buf const *gb, size_t idx) {
+    if (idx < gb->gap_start) {
+        return gb->buf[idx];
+    }
+    return gb->buf[idx + (gb->gap_end - gb->gap_start)];
+}
+
+size_t
+gap_buf_run(struct sh_gap_buf const *gb, size_t idx, char const **run_out) {
+    if (idx < gb->gap_start) {
+        *run_out = gb->buf + idx;
+        return gb->gap_start - idx;
+    }
+
+    size_t storage_idx = idx + (gb->gap_end - gb->gap_start);
+    *run_out = gb->buf + storage_idx;
+    return gb->capacity - storage_idx;
+}
+
+void gap_buf_copy(struct sh_gap_buf const *gb, char *out) {
+    // The text before and after the gap might be empty, in which case the
+    // storage might not be allocated at all.
+    if (gb->gap_start > 0) {
+        memcpy(out, gb->buf, gb->gap_start);
+    }
+    if (gb->capacity > gb->gap_end) {
+        memcpy(
+            out + gb->gap_start,
+            gb->buf + gb->gap_end,
+            gb->capacity - gb->gap_end
+        );
+    }
+}
+
+void gap_buf_move_cursor(struct sh_gap_buf *gb, size_t idx) {
+    size_t len = gap_buf_len(gb);
+    if (idx > len) {
+        idx = len;
+    }
+
+    // Move the characters between the old and new cursor positions to the
+    // other side of the gap.
+    if (idx < gb->gap_start) {
+        size_t count = gb->gap_start - idx;
+        memmove(gb->buf + gb->gap_end - count, gb->buf + idx, count);
+        gb->gap_start -= count;
+        gb->gap_end -= count;
+    } else if (idx > gb->gap_start) {
+        size_t count = idx - gb->gap_start;
+        memmove(gb->buf + gb->gap_start, gb->buf + gb->gap_end, count);
+        gb->gap_start += count;
+        gb->gap_end += count;
+    }
+}
+
+bool gap_buf_insert(struct sh_gap_buf *gb, char const *text, size_t len) {
+    if (!reserve_gap(gb, len)) {
+        return false;
+    }
+
+    gap_buf_mark_edited(gb, gb->gap_start);
+    memcpy(gb->buf + gb->gap_start, text, len);
+    gb->gap_start += len;
+    return true;
+}
+
+size_t gap_buf_delete_before(struct sh_gap_buf *gb, size_t count) {
+    if (count > gb->gap_start) {
+        count = gb->gap_start;
+    }
+
+    gb->gap_start -= count;
+    if (count > 0) {
+        gap_buf_mark_edited(gb, gb->gap_start);
+    }
+    return count;
+}
+
+size_t gap_buf_delete_after(struct sh_gap_buf *gb, size_t count) {
+    if (count > gb->capacity - gb->gap_end) {
+        count = gb->capacity - gb->gap_end;
+    }
+
+    gb->gap_end += count;
+    if (count > 0) {
+        gap_buf_mark_edited(gb, gb->gap_start);
+    }
+    return count;
+}
+
+bool gap_buf_set(struct sh_gap_buf *gb, char const *text, size_t len) {
+    // Empty the buffer by making the gap span all of the storage.
+    gb->gap_start = 0;
+    gb->gap_end = gb->capacity;
+    gap_buf_mark_edited(gb, 0);
+    return gap_buf_insert(gb, text, len);
+}
+
+size_t gap_buf_edited_from(struct sh_gap_buf const *gb) {
+    return gb->edited_from;
+}
+
+void gap_buf_mark_edited(struct sh_gap_buf *gb, size_t idx) {
+    if (idx < gb->edited_from) {
+        gb->edited_from = idx;
+    }
+}
+
+void gap_buf_clear_edits(struct sh_gap_buf *gb) { gb->edited_from = SIZE_MAX; }
+
+char *gap_buf_take(struct sh_gap_buf *gb, size_t *capacity_out) {
+    // Move the gap to the end so that the text is contiguous, and leave space
+    // for the null byte.
+    size_t len = gap_buf_len(gb);
+    gap_buf_move_cursor(gb, len);
+    if (!reserve_gap(gb, 1)) {
+        return NULL;
+    }
+
+    char *str = gb->buf;
+    str[len] = '\0';
+    *capacity_out = gb->capacity;
+
+    init_gap_buf(gb);
+    return str;
+}
+
+void destroy_gap_buf(struct sh_gap_buf *gb) {
+    free(gb->buf);
+    init_gap_buf(gb);
+}
+
+bool reserve_gap(struct sh_gap_buf *gb, size_t len) {
+    if (gb->gap_end - gb->gap_start >= len) {
+        return true;
+    }
+
+    size_t text_len = gap_buf_len(gb);
+    size_t new_capacity = (text_len + len) * 2;
+    if (new_capacity < 64) {
+        new_capacity = 64;
+    }
+
+    char *new_buf = realloc(gb->buf, sizeof(char) * new_capacity);
+    if (new_buf == NULL) {
+        perror("realloc");
+        return false;
+    }
+
+    // Move the text after the gap to the end of the new storage.
+    size_t tail_len = gb->capacity - gb->gap_end;
+    size_t new_gap_end = new_capacity - tail_len;
+    memmove(new_buf + new_gap_end, new_buf + gb->gap_end, tail_len);
+
+    gb->buf = new_buf;
+    gb->capacity = new_capacity;
+    gb->gap_end = new_gap_end;
+    return true;
+}
@@ -0,0 +1,187 @@
+/**
+ * @file gap_buf.h
+ *
+ * Declarations for gap buffers.
+ *
+ * A gap buffer stores text with a gap of unused space at the cursor. Inserting
+ * and deleting at the cursor only changes the size of the gap, so editing
+ * anywhere in the text takes amortised constant time. Moving the cursor moves
+ * the gap, which takes time proportional to the distance moved.
+ */
+
+#ifndef GAP_BUF_H
+#define GAP_BUF_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** A gap buffer. */
+struct sh_gap_buf {
+    char *buf;       /**< Storage for the text and the gap. */
+    size_t capacity; /**< Capacity of the storage. */
+    size_t gap_start; /**< Index of the start of the gap in the storage. This is
+                         also the cursor's position in the text. */
+    size_t gap_end;   /**< Index one past the end of the gap in the storage. */
+    size_t edited_from; /**< Index of the first character in the text that may
+                           have changed since the edits were last cleared. */
+};
+
+/**
+ * Initialises an empty gap buffer.
+ *
+ * No memory is allocated until text is inserted.
+ *
+ * @param gb a pointer to the gap buffer to initialise
+ */
+void init_gap_buf(struct sh_gap_buf *gb);
+
+/**
+ * Returns the number of characters in the gap buffer.
+ *
+ * @param gb a pointer to the gap buffer
+ * @return the number of characters
+ */
+size_t gap_buf_len(struct sh_gap_buf const *gb);
+
+/**
+ * Returns the position of the cursor in the gap buffer.
+ *
+ * @param gb a pointer to the gap buffer
+ * @return the index of the character after the cursor
+ */
+size_t gap_buf_cursor(struct sh_gap_buf const *gb);
+
+/**
+ * Returns the character at the given index of the text.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param idx the index of the character, which must be less than the length
+ * @return the character
+ */
+char gap_buf_at(struct sh_gap_buf const *gb, size_t idx);
+
+/**
+ * Returns the run of characters that are stored contiguously from the given
+ * index of the text.
+ *
+ * The whole text can be visited by calling this function repeatedly, starting
+ * at index 0 and advancing by the returned length each time.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param idx the index to start at, which must be less than the length
+ * @param run_out a pointer to write the start of the run to
+ * @return the number of characters in the run
+ */
+size_t
+gap_buf_run(struct sh_gap_buf const *gb, size_t idx, char const **run_out);
+
+/**
+ * Copies the text of the gap buffer.
+ *
+ * No null byte is written.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param out the buffer to copy to, which must fit `gap_buf_len()` characters
+ */
+void gap_buf_copy(struct sh_gap_buf const *gb, char *out);
+
+/**
+ * Moves the cursor.
+ *
+ * Positions past the end of the text are clamped to the end.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param idx the index to move the cursor to
+ */
+void gap_buf_move_cursor(struct sh_gap_buf *gb, size_t idx);
+
+/**
+ * Inserts text at the cursor and moves the cursor past it.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param text the text to insert
+ * @param len the number of characters in `text`
+ * @return true if successful, false otherwise
+ */
+bool gap_buf_insert(struct sh_gap_buf *gb, char const *text, size_t len);
+
+/**
+ * Deletes characters before the cursor.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param count the maximum number of characters to delete
+ * @return the number of characters deleted
+ */
+size_t gap_buf_delete_before(struct sh_gap_buf *gb, size_t count);
+
+/**
+ * Deletes characters after the cursor.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param count the maximum number of characters to delete
+ * @return the number of characters deleted
+ */
+size_t gap_buf_delete_after(struct sh_gap_buf *gb, size_t count);
+
+/**
+ * Replaces the text of the gap buffer and moves the cursor to the end.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param text the new text
+ * @param len the number of characters in `text`
+ * @return true if successful, false otherwise
+ */
+bool gap_buf_set(struct sh_gap_buf *gb, char const *text, size_t len);
+
+/**
+ * Returns the index of the first character that may have changed since
+ * `gap_buf_clear_edits()` was last called.
+ *
+ * Moving the cursor does not count as a change.
+ *
+ * @param gb a pointer to the gap buffer
+ * @return the index, which may be greater than the length of the text if
+ * nothing changed
+ */
+size_t gap_buf_edited_from(struct sh_gap_buf const *gb);
+
+/**
+ * Records that the text may have changed from the given index onwards.
+ *
+ * This is useful when the text needs to be treated as changed even though it
+ * was not edited, e.g., when something else was displayed in its place.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param idx the index of the first character that may have changed
+ */
+void gap_buf_mark_edited(struct sh_gap_buf *gb, size_t idx);
+
+/**
+ * Forgets about all changes to the text so far.
+ *
+ * @param gb a pointer to the gap buffer
+ */
+void gap_buf_clear_edits(struct sh_gap_buf *gb);
+
+/**
+ * Takes the text out of the gap buffer as a null-terminated string.
+ *
+ * Ownership of the returned memory is passed to the caller, who should free it
+ * once it is no longer needed. The gap buffer is left empty.
+ *
+ * @param gb a pointer to the gap buffer
+ * @param capacity_out a pointer to write the capacity of the string's memory to
+ * @return the string, or `NULL` if memory could not be allocated
+ */
+char *gap_buf_take(struct sh_gap_buf *gb, size_t *capacity_out);
+
+/**
+ * Destroys a gap buffer.
+ *
+ * This function frees all memory associated with the gap buffer.
+ *
+ * @param gb a pointer to the gap buffer
+ */
+void destroy_gap_buf(struct sh_gap_buf *gb);
+
+#endif
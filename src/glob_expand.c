@@ -0,0 +1,2152 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include "glob_expand.h"
+
+/** Size of the buffer that directory entries are read into. */
+#define DIR_BUFFER_SIZE 32768
+
+/** Number of bytes in the bitset of a character class. */
+#define CLASS_BITS_SIZE (256 / 8)
+
+/** Number of paths below which sorting switches to insertion sort. */
+#define INSERTION_SORT_THRESHOLD 16
+
+/** Number of directory entries read between checks of the time limit. */
+#define TIME_CHECK_INTERVAL 1024
+
+/** Maximum number of threads that walk directories for `**`. */
+#define WALK_MAX_THREADS 16
+
+/** A character class that can be named in a bracket expression. */
+struct sh_named_class {
+    char const *name;        /**< The name, e.g. `alpha` for `[:alpha:]`. */
+    int (*is_member)(int c); /**< Checks if a character is in the class. */
+};
+
+/** The character classes that can be named in a bracket expression. */
+static struct sh_named_class const NAMED_CLASSES[] = {
+    {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+    {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+    {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+    {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+};
+
+#ifdef __linux__
+/** A directory entry as returned by `getdents64()`. */
+struct sh_linux_dirent64 {
+    uint64_t d_ino;          /**< Inode number. */
+    int64_t d_off;           /**< Offset of the next entry. */
+    unsigned short d_reclen; /**< Size of this entry. */
+    unsigned char d_type;    /**< File type. */
+    char d_name[];           /**< Null-terminated name. */
+};
+#endif
+
+/** Reads the entries of a directory one at a time. */
+struct sh_dir_reader {
+    int fd; /**< The directory's file descriptor. */
+#ifdef __linux__
+    size_t buf_len; /**< Number of bytes of entries in the buffer. */
+    size_t buf_pos; /**< Offset of the next entry in the buffer. */
+    /** Buffer of entries read by `getdents64()`. */
+    _Alignas(struct sh_linux_dirent64) char buf[DIR_BUFFER_SIZE];
+#else
+    DIR *dir; /**< The directory stream. */
+#endif
+};
+
+/** A growable list of pathnames allocated from an arena. */
+struct sh_path_list {
+    char const **paths; /**< The pathnames. */
+    size_t count;       /**< Number of pathnames. */
+    size_t capacity;    /**< Capacity of `paths`. */
+};
+
+/** An entry in a cached directory listing. */
+struct sh_dir_cache_entry {
+    char const *name;   /**< The entry's name. */
+    size_t len;         /**< Number of characters in the name. */
+    unsigned char type; /**< The entry's type, as a `DT_*` constant. */
+};
+
+/** A cached listing of a directory. */
+struct sh_dir_listing {
+    struct sh_dir_listing *prev; /**< The more recently used listing. */
+    struct sh_dir_listing *next; /**< The less recently used listing. */
+    struct sh_arena arena;       /**< Arena that the listing's path and entries
+                                    are allocated from. */
+    char const *path;            /**< The directory's path, as written in the
+                                    pattern. */
+    dev_t dev;                   /**< The directory's device when read. */
+    ino_t ino;                   /**< The directory's inode when read. */
+    struct timespec mtime;       /**< The directory's modification time when
+                                    read. */
+    struct timespec ctime;       /**< The directory's status change time when
+                                    read. */
+    struct sh_dir_cache_entry *entries; /**< The entries. */
+    size_t count;                       /**< Number of entries. */
+    bool sorted; /**< Whether the entries are sorted by name, which they are
+                    once the listing has been used again. */
+};
+
+/** The state of an expansion, shared by all threads that take part in it. */
+struct sh_glob_state {
+    struct sh_arena *arena;              /**< Arena to allocate the results
+                                            from. */
+    struct sh_dir_cache *cache;          /**< Cache of directory listings, or
+                                            `NULL`. */
+    struct sh_glob_budget const *budget; /**< Limits on the expansion, or
+                                            `NULL`. */
+    struct timespec deadline;            /**< When the expansion runs out of
+                                            time, if it has a time limit. */
+    atomic_size_t path_count;            /**< Number of paths found so far,
+                                            including directories that are
+                                            only searched. */
+    atomic_int abort_result;             /**< Why the expansion was aborted,
+                                            or `SH_GLOB_SUCCESS` if it was
+                                            not. */
+};
+
+/** A queue of directories for a walker to read, which others can steal from. */
+struct sh_walk_queue {
+    pthread_mutex_t mutex; /**< Guards the rest of the queue. */
+    char const **dirs;     /**< The directories' paths. */
+    size_t head;           /**< Index of the oldest directory, which is the
+                              one stolen. */
+    size_t tail;           /**< Index after the newest directory, which is the
+                              one the owner reads next. */
+    size_t capacity;       /**< Capacity of `dirs`. */
+};
+
+/** A thread that reads directories for a recursive walk. */
+struct sh_walk_worker {
+    struct sh_walk *walk;        /**< The walk that the worker is part of. */
+    size_t index;                /**< Index of the worker in the walk. */
+    pthread_t thread;            /**< The thread. Unused for worker 0, which
+                                    runs on the thread that starts the walk. */
+    struct sh_arena arena;       /**< Arena to allocate the worker's paths and
+                                    queue from. */
+    struct sh_walk_queue queue;  /**< Directories for the worker to read. */
+    struct sh_path_list results; /**< Paths found by the worker. */
+};
+
+/** A recursive walk of directories, shared by its workers. */
+struct sh_walk {
+    struct sh_walk_worker *workers; /**< The workers. */
+    size_t worker_count;            /**< Number of workers. */
+    struct sh_glob_state *state;    /**< The expansion. */
+    bool only_dirs;                 /**< Whether only directories are found. */
+    atomic_size_t pending;          /**< Number of directories that are queued
+                                       or being read. */
+    pthread_mutex_t mutex;          /**< Guards `started_count` and the workers
+                                       that sleep on `wake`. */
+    pthread_cond_t wake;            /**< Signalled when a directory is queued
+                                       while workers sleep, and broadcast when
+                                       the walk is over or aborted. */
+    atomic_size_t sleeping_count;   /**< Number of workers that sleep or are
+                                       about to. */
+    size_t started_count;           /**< Number of workers that have been
+                                       started, including worker 0. */
+    atomic_bool all_started;        /**< Whether no more workers can be
+                                       started. */
+};
+
+/**
+ * Parses a bracket expression.
+ *
+ * @param text the pattern containing the bracket expression
+ * @param len the number of characters in the pattern
+ * @param start the index of the opening `[`
+ * @param bits the bitset to write the matched characters to
+ * @param end_out a pointer to write the index after the closing `]` to
+ * @param valid_out a pointer to write whether all named classes in the
+ * bracket expression are valid to
+ * @return true if the bracket expression is terminated within the same
+ * pathname component, false if the `[` is just a literal character
+ */
+bool parse_bracket(
+    char const *text,
+    size_t len,
+    size_t start,
+    uint8_t *bits,
+    size_t *end_out,
+    bool *valid_out
+);
+
+/**
+ * Adds the characters of a named class to a bitset.
+ *
+ * @param name the name of the class (not null-terminated)
+ * @param len the number of characters in the name
+ * @param bits the bitset to add the characters to
+ * @return true if successful, false if there is no class with that name
+ */
+bool add_named_class(char const *name, size_t len, uint8_t *bits);
+
+/**
+ * Checks whether a pattern contains any unescaped `*`, `?` or bracket
+ * expressions.
+ *
+ * @param text the pattern, which may contain `/`
+ * @param len the number of characters in the pattern
+ * @return true if the pattern has magic, false otherwise
+ */
+bool has_magic(char const *text, size_t len);
+
+/**
+ * Removes the escaping backslashes from a pattern.
+ *
+ * @param text the pattern
+ * @param len the number of characters in the pattern
+ * @param out a buffer of at least `len + 1` characters to write the
+ * null-terminated result to
+ */
+void unescape(char const *text, size_t len, char *out);
+
+/**
+ * Returns the number of characters that a sequence of operations without
+ * stars matches.
+ *
+ * @param ops the operations
+ * @param count the number of operations
+ * @return the number of characters matched
+ */
+size_t ops_width(struct sh_glob_op const *ops, size_t count);
+
+/**
+ * Checks whether a sequence of operations without stars matches the start of a
+ * name.
+ *
+ * @param ops the operations
+ * @param count the number of operations
+ * @param name the name, which must have at least `ops_width()` characters
+ * @return true if the operations match, false otherwise
+ */
+bool ops_match(struct sh_glob_op const *ops, size_t count, char const *name);
+
+/**
+ * Checks whether an expansion is within its budget, aborting it if not.
+ *
+ * @param state a pointer to the expansion's state
+ * @param check_time whether to check the time limit too, which is slower than
+ * the other checks
+ * @return true if the expansion can go on, false if it has been aborted
+ */
+bool check_budget(struct sh_glob_state *state, bool check_time);
+
+/**
+ * Aborts an expansion, unless it has already been aborted.
+ *
+ * @param state a pointer to the expansion's state
+ * @param result the reason for aborting
+ */
+void abort_expansion(struct sh_glob_state *state, enum sh_glob_result result);
+
+/**
+ * Adds a path that an expansion found to a list, counting it towards the
+ * budget.
+ *
+ * @param state a pointer to the expansion's state
+ * @param arena the arena to allocate from
+ * @param list a pointer to the list
+ * @param path the path
+ * @return true if the expansion can go on, false if memory could not be
+ * allocated or the expansion has been aborted
+ */
+bool add_found_path(
+    struct sh_glob_state *state,
+    struct sh_arena *arena,
+    struct sh_path_list *list,
+    char const *path
+);
+
+/**
+ * Expands a pattern, adding the matching pathnames to a list unsorted.
+ *
+ * @param state a pointer to the expansion's state
+ * @param pattern the pattern (not null-terminated)
+ * @param len the number of characters in the pattern
+ * @param only_dirs whether to only add directories
+ * @param out a pointer to the list to add to
+ * @return true if successful, false if memory could not be allocated or the
+ * expansion has been aborted
+ */
+bool expand_into(
+    struct sh_glob_state *state,
+    char const *pattern,
+    size_t len,
+    bool only_dirs,
+    struct sh_path_list *out
+);
+
+/**
+ * Adds the pathnames of the entries in a directory that match a compiled
+ * pattern to a list.
+ *
+ * The directory's cached listing is used if it is still up to date.
+ *
+ * @param state a pointer to the expansion's state
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @param pattern a pointer to the compiled pattern
+ * @param only_dirs whether to only add directories
+ * @param out a pointer to the list to add to
+ * @return true if successful, false if memory could not be allocated or the
+ * expansion has been aborted
+ */
+bool expand_in_dir(
+    struct sh_glob_state *state,
+    char const *dir,
+    struct sh_glob_pattern const *pattern,
+    bool only_dirs,
+    struct sh_path_list *out
+);
+
+/**
+ * Adds the pathname of an entry in a directory to a list if it matches a
+ * compiled pattern.
+ *
+ * @param state a pointer to the expansion's state
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @param dir_len the number of characters in the directory's path
+ * @param dir_fd a file descriptor of the directory, or `AT_FDCWD` if it is not
+ * open
+ * @param pattern a pointer to the compiled pattern
+ * @param only_dirs whether to only add directories
+ * @param name the entry's name
+ * @param name_len the number of characters in the name
+ * @param type the entry's type, as a `DT_*` constant
+ * @param out a pointer to the list to add to
+ * @return true if successful, false if memory could not be allocated or the
+ * expansion has been aborted
+ */
+bool add_dir_entry_if_matching(
+    struct sh_glob_state *state,
+    char const *dir,
+    size_t dir_len,
+    int dir_fd,
+    struct sh_glob_pattern const *pattern,
+    bool only_dirs,
+    char const *name,
+    size_t name_len,
+    unsigned char type,
+    struct sh_path_list *out
+);
+
+/**
+ * Finds the up-to-date listing of a directory in a cache, reading the
+ * directory into the cache if needed.
+ *
+ * Directories that were modified too recently are not cached, since later
+ * changes to them might not change their modification times. Neither are
+ * listings with more names than the whole cache allows.
+ *
+ * @param cache a pointer to the cache
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @param listing_out a pointer to write the listing to, or `NULL` if the
+ * directory cannot be cached
+ * @return true if successful, false if memory could not be allocated
+ */
+bool find_dir_listing(
+    struct sh_dir_cache *cache,
+    char const *dir,
+    struct sh_dir_listing const **listing_out
+);
+
+/**
+ * Reads a directory into a new listing.
+ *
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @param st the status of the directory, from before it is read
+ * @param listing_out a pointer to write the listing to, or `NULL` if the
+ * directory cannot be read or has too many names to cache
+ * @return true if successful, false if memory could not be allocated
+ */
+bool read_dir_listing(
+    char const *dir,
+    struct stat const *st,
+    struct sh_dir_listing **listing_out
+);
+
+/**
+ * Sorts the entries of a listing by name, so that the matches found in it are
+ * already sorted.
+ *
+ * If memory cannot be allocated, the listing is left unsorted, which only makes
+ * expanding patterns in it slower.
+ *
+ * @param listing a pointer to the listing
+ */
+void sort_dir_listing(struct sh_dir_listing *listing);
+
+/**
+ * Removes a listing from a cache and frees it.
+ *
+ * @param cache a pointer to the cache
+ * @param listing a pointer to the listing
+ */
+void remove_dir_listing(
+    struct sh_dir_cache *cache,
+    struct sh_dir_listing *listing
+);
+
+/**
+ * Joins a directory's path and a name in the directory the way `glob()` does.
+ *
+ * @param arena the arena to allocate the result from
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @param dir_len the number of characters in the directory's path
+ * @param name the name (not null-terminated)
+ * @param name_len the number of characters in the name
+ * @return the joined path, or `NULL` if memory could not be allocated
+ */
+char *join_path(
+    struct sh_arena *arena,
+    char const *dir,
+    size_t dir_len,
+    char const *name,
+    size_t name_len
+);
+
+/**
+ * Adds a pathname to a list.
+ *
+ * @param arena the arena to allocate from
+ * @param list a pointer to the list
+ * @param path the pathname
+ * @return true if successful, false if memory could not be allocated
+ */
+bool add_path(
+    struct sh_arena *arena,
+    struct sh_path_list *list,
+    char const *path
+);
+
+/**
+ * Checks whether a path exists.
+ *
+ * @param path the path
+ * @param must_be_dir whether the path must also be a directory (or a symbolic
+ * link to one)
+ * @return true if the path exists, false otherwise
+ */
+bool path_exists(char const *path, bool must_be_dir);
+
+/**
+ * Checks whether a directory entry is a directory (or a symbolic link to one).
+ *
+ * Only entries whose type is a symbolic link or unknown need a `stat()` call.
+ *
+ * @param dir_fd a file descriptor of the directory, or `AT_FDCWD`
+ * @param name the entry's name, or its path if `dir_fd` is `AT_FDCWD`
+ * @param type the entry's type, as a `DT_*` constant
+ * @return true if the entry is a directory, false otherwise
+ */
+bool entry_is_dir(int dir_fd, char const *name, unsigned char type);
+
+/**
+ * Opens a directory for reading its entries.
+ *
+ * @param reader a pointer to the reader to initialise
+ * @param path the directory's path
+ * @return true if successful, false otherwise
+ */
+bool open_dir_reader(struct sh_dir_reader *reader, char const *path);
+
+/**
+ * Reads the next entry of a directory.
+ *
+ * The name written out is only valid until the next call.
+ *
+ * @param reader a pointer to the reader
+ * @param name_out a pointer to write the entry's name to
+ * @param type_out a pointer to write the entry's type to, as a `DT_*`
+ * constant
+ * @return true if an entry was read, false at the end of the directory or on
+ * an error
+ */
+bool read_dir_entry(
+    struct sh_dir_reader *reader,
+    char const **name_out,
+    unsigned char *type_out
+);
+
+/**
+ * Closes a directory reader.
+ *
+ * @param reader a pointer to the reader
+ */
+void close_dir_reader(struct sh_dir_reader *reader);
+
+/**
+ * Sorts pathnames by byte value, given that they all share their first `depth`
+ * bytes.
+ *
+ * This is a three-way radix quicksort, which only looks at each byte of the
+ * common prefixes once instead of in every comparison.
+ *
+ * @param paths the pathnames
+ * @param count the number of pathnames
+ * @param depth the number of leading bytes that the pathnames share
+ */
+void sort_paths(char const **paths, size_t count, size_t depth);
+
+/**
+ * Checks whether pathnames are sorted by byte value, with no duplicates.
+ *
+ * @param paths the pathnames
+ * @param count the number of pathnames
+ * @return true if every pathname comes before the next one, false otherwise
+ */
+bool paths_in_order(char const *const *paths, size_t count);
+
+/**
+ * Adds all paths below some directories to a list, as `**` matches them.
+ *
+ * Hidden entries are skipped, and symbolic links are not followed. The
+ * directories are read in parallel by a pool of threads. Each thread reads the
+ * newest directory in its own queue, and steals the oldest directory from
+ * another thread's queue when its own is empty. Threads are only started once
+ * a queue holds more directories than its owner can read at once, so a walk of
+ * a narrow tree stays on the calling thread.
+ *
+ * @param state a pointer to the expansion's state
+ * @param dirs the directories to walk
+ * @param only_dirs whether to only add directories
+ * @param out a pointer to the list to add to
+ * @return true if successful, false if memory could not be allocated or the
+ * expansion has been aborted
+ */
+bool walk_recursively(
+    struct sh_glob_state *state,
+    struct sh_path_list const *dirs,
+    bool only_dirs,
+    struct sh_path_list *out
+);
+
+/**
+ * Reads directories for a walk until there are none left.
+ *
+ * @param arg a pointer to the worker
+ * @return `NULL`
+ */
+void *run_walk_worker(void *arg);
+
+/**
+ * Takes a directory for a worker to read, from its own queue or another
+ * worker's. If there is none, the worker sleeps until one is queued or the walk
+ * is over.
+ *
+ * @param worker a pointer to the worker
+ * @param dir_out a pointer to write the directory's path to
+ * @return true if there was a directory, false if the walk is over
+ */
+bool take_walk_dir(struct sh_walk_worker *worker, char const **dir_out);
+
+/**
+ * Wakes all sleeping workers of a walk, so that they check again whether it is
+ * over.
+ *
+ * @param walk a pointer to the walk
+ */
+void wake_walk_workers(struct sh_walk *walk);
+
+/**
+ * Starts the thread of the next worker of a walk that has not been started, if
+ * there is one.
+ *
+ * @param walk a pointer to the walk
+ */
+void start_walk_worker(struct sh_walk *walk);
+
+/**
+ * Reads a directory for a walk, adding its entries to the worker's results and
+ * its subdirectories to the worker's queue.
+ *
+ * @param worker a pointer to the worker
+ * @param dir the directory's path, or an empty string for the current
+ * directory
+ * @return true if successful, false if memory could not be allocated or the
+ * expansion has been aborted
+ */
+bool walk_dir(struct sh_walk_worker *worker, char const *dir);
+
+/**
+ * Adds a directory to a worker's queue. A sleeping worker is woken to take it,
+ * or if none sleeps and the queue holds other directories, another worker is
+ * started.
+ *
+ * @param worker a pointer to the worker
+ * @param dir the directory's path
+ * @return true if successful, false if memory could not be allocated
+ */
+bool push_walk_dir(struct sh_walk_worker *worker, char const *dir);
+
+/**
+ * Takes the newest directory from a worker's own queue.
+ *
+ * @param worker a pointer to the worker
+ * @param dir_out a pointer to write the directory's path to
+ * @return true if there was a directory, false if the queue is empty
+ */
+bool pop_walk_dir(struct sh_walk_worker *worker, char const **dir_out);
+
+/**
+ * Takes the oldest directory from another worker's queue.
+ *
+ * @param worker a pointer to the worker that steals
+ * @param dir_out a pointer to write the directory's path to
+ * @return true if there was a directory, false if all other queues are empty
+ */
+bool steal_walk_dir(struct sh_walk_worker *worker, char const **dir_out);
+
+void init_dir_cache(struct sh_dir_cache *cache) {
+    *cache = (struct sh_dir_cache) {
+        .first = NULL,
+        .last = NULL,
+        .count = 0,
+        .name_count = 0,
+    };
+}
+
+void destroy_dir_cache(struct sh_dir_cache *cache) {
+    while (cache->first != NULL) {
+        remove_dir_listing(cache, cache->first);
+    }
+}
+
+bool compile_glob_pattern(
+    char const *text,
+    size_t len,
+    struct sh_arena *arena,
+    struct sh_glob_pattern *out
+) {
+    // Every operation consumes at least one character of the pattern, and the
+    // literal characters are never longer than the pattern.
+    struct sh_glob_op *ops = arena_alloc(
+        arena,
+        sizeof(struct sh_glob_op) * (len + 1)
+    );
+    char *literals = arena_alloc(arena, sizeof(char) * (len + 1));
+    if (ops == NULL || literals == NULL) {
+        return false;
+    }
+
+    *out = (struct sh_glob_pattern) {
+        .ops = ops,
+        .op_count = 0,
+        .has_magic = false,
+        .matches_nothing = false,
+    };
+
+    size_t literals_len = 0;
+    size_t idx = 0;
+    while (idx < len) {
+        char c = text[idx];
+        struct sh_glob_op *last = out->op_count == 0
+                                      ? NULL
+                                      : &ops[out->op_count - 1];
+
+        if (c == '*') {
+            if (last == NULL || last->type != SH_GLOB_OP_STAR) {
+                ops[out->op_count++] = (struct sh_glob_op) {
+                    .type = SH_GLOB_OP_STAR,
+                    .len = 0,
+                };
+            }
+            out->has_magic = true;
+            idx++;
+            continue;
+        }
+
+        if (c == '?') {
+            ops[out->op_count++] = (struct sh_glob_op) {
+                .type = SH_GLOB_OP_ANY,
+                .len = 1,
+            };
+            out->has_magic = true;
+            idx++;
+            continue;
+        }
+
+        if (c == '[') {
+            uint8_t bits[CLASS_BITS_SIZE];
+            size_t end;
+            bool valid;
+            if (parse_bracket(text, len, idx, bits, &end, &valid)) {
+                uint8_t *class_bits = arena_alloc(arena, CLASS_BITS_SIZE);
+                if (class_bits == NULL) {
+                    return false;
+                }
+                memcpy(class_bits, bits, CLASS_BITS_SIZE);
+
+                ops[out->op_count++] = (struct sh_glob_op) {
+                    .type = SH_GLOB_OP_CLASS,
+                    .len = 1,
+                    .class_bits = class_bits,
+                };
+                out->has_magic = true;
+                out->matches_nothing |= !valid;
+                idx = end;
+                continue;
+            }
+
+            // An unterminated bracket is just a literal `[`.
+        }
+
+        // Anything else is a literal character, possibly escaped. A trailing
+        // backslash is taken literally.
+        if (c == '\\' && idx + 1 < len) {
+            idx++;
+            c = text[idx];
+        }
+        idx++;
+
+        // The literal characters of consecutive operations are consecutive in
+        // `literals`, so a literal can simply be extended.
+        if (last != NULL && last->type == SH_GLOB_OP_LITERAL) {
+            last->len++;
+        } else {
+            ops[out->op_count++] = (struct sh_glob_op) {
+                .type = SH_GLOB_OP_LITERAL,
+                .len = 1,
+                .literal = literals + literals_len,
+            };
+        }
+        literals[literals_len++] = c;
+    }
+    literals[literals_len] = '\0';
+
+    return true;
+}
+
+bool glob_pattern_matches(
+    struct sh_glob_pattern const *pattern,
+    char const *name,
+    size_t len
+) {
+    if (pattern->matches_nothing) {
+        return false;
+    }
+
+    struct sh_glob_op const *ops = pattern->ops;
+    size_t count = pattern->op_count;
+
+    // A leading period can only be matched by a literal period.
+    if (len > 0 && name[0] == '.'
+        && (count == 0 || ops[0].type != SH_GLOB_OP_LITERAL))
+    {
+        return false;
+    }
+
+    // The operations between stars match a fixed number of characters. The
+    // ones before the first star must match at the start of the name, and the
+    // ones after the last star at the end.
+    size_t first_star = 0;
+    while (first_star < count && ops[first_star].type != SH_GLOB_OP_STAR) {
+        first_star++;
+    }
+
+    size_t prefix_width = ops_width(ops, first_star);
+    if (first_star == count) {
+        return prefix_width == len && ops_match(ops, count, name);
+    }
+
+    size_t last_star = count - 1;
+    while (ops[last_star].type != SH_GLOB_OP_STAR) {
+        last_star--;
+    }
+
+    struct sh_glob_op const *suffix_ops = ops + last_star + 1;
+    size_t suffix_count = count - last_star - 1;
+    size_t suffix_width = ops_width(suffix_ops, suffix_count);
+    if (prefix_width + suffix_width > len || !ops_match(ops, first_star, name)
+        || !ops_match(suffix_ops, suffix_count, name + len - suffix_width))
+    {
+        return false;
+    }
+
+    // Match the operations between each pair of stars as early as possible in
+    // the rest of the name. Leaving more of the name for the later operations
+    // can never make them fail to match.
+    size_t pos = prefix_width;
+    size_t end = len - suffix_width;
+    size_t op = first_star + 1;
+    while (op < last_star) {
+        // Consecutive stars are merged, so there is at least one operation
+        // before the next star.
+        size_t chunk_end = op;
+        while (ops[chunk_end].type != SH_GLOB_OP_STAR) {
+            chunk_end++;
+        }
+        size_t chunk_count = chunk_end - op;
+        size_t width = ops_width(ops + op, chunk_count);
+
+        while (true) {
+            if (pos + width > end) {
+                return false;
+            }
+
+            // Skip straight to where the first literal character could match.
+            if (ops[op].type == SH_GLOB_OP_LITERAL) {
+                char const *candidate = memchr(
+                    name + pos,
+                    ops[op].literal[0],
+                    end - width - pos + 1
+                );
+                if (candidate == NULL) {
+                    return false;
+                }
+                pos = candidate - name;
+            }
+
+            if (ops_match(ops + op, chunk_count, name + pos)) {
+                break;
+            }
+            pos++;
+        }
+
+        pos += width;
+        op = chunk_end + 1;
+    }
+
+    return true;
+}
+
+enum sh_glob_result expand_glob(
+    char const *pattern,
+    struct sh_arena *arena,
+    struct sh_dir_cache *cache,
+    struct sh_glob_budget const *budget,
+    char const ***paths_out,
+    size_t *count_out
+) {
+    struct sh_glob_state state = (struct sh_glob_state) {
+        .arena = arena,
+        .cache = cache,
+        .budget = budget,
+    };
+    atomic_init(&state.path_count, 0);
+    atomic_init(&state.abort_result, SH_GLOB_SUCCESS);
+
+    if (budget != NULL && budget->timeout_ms != 0) {
+        clock_gettime(CLOCK_MONOTONIC, &state.deadline);
+        state.deadline.tv_sec += budget->timeout_ms / 1000;
+        state.deadline.tv_nsec += budget->timeout_ms % 1000 * 1000000;
+        if (state.deadline.tv_nsec >= 1000000000) {
+            state.deadline.tv_sec++;
+            state.deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    struct sh_path_list list = (struct sh_path_list) {
+        .paths = NULL,
+        .count = 0,
+        .capacity = 0,
+    };
+
+    // Anything that stops the expansion without aborting it is a memory error.
+    if (!expand_into(&state, pattern, strlen(pattern), false, &list)) {
+        enum sh_glob_result abort_result = atomic_load(&state.abort_result);
+        return abort_result == SH_GLOB_SUCCESS ? SH_GLOB_MEMORY_ERROR
+                                               : abort_result;
+    }
+
+    if (list.count == 0) {
+        return SH_GLOB_NO_MATCH;
+    }
+
+    // The matches in a sorted listing are found in order, so if they all
+    // come from one directory, they are already sorted.
+    if (paths_in_order(list.paths, list.count)) {
+        *paths_out = list.paths;
+        *count_out = list.count;
+        return SH_GLOB_SUCCESS;
+    }
+
+    sort_paths(list.paths, list.count, 0);
+
+    // Consecutive `**` components can find the same path more than once. Any
+    // other pattern finds every path once.
+    size_t unique_count = list.count;
+    if (strstr(pattern, "**") != NULL) {
+        unique_count = 1;
+        for (size_t idx = 1; idx < list.count; idx++) {
+            if (strcmp(list.paths[idx], list.paths[unique_count - 1]) != 0) {
+                list.paths[unique_count] = list.paths[idx];
+                unique_count++;
+            }
+        }
+    }
+
+    *paths_out = list.paths;
+    *count_out = unique_count;
+    return SH_GLOB_SUCCESS;
+}
+
+bool check_budget(struct sh_glob_state *state, bool check_time) {
+    if (atomic_load(&state->abort_result) != SH_GLOB_SUCCESS) {
+        return false;
+    }
+
+    struct sh_glob_budget const *budget = state->budget;
+    if (budget == NULL) {
+        return true;
+    }
+
+    if (budget->interrupted != NULL && *budget->interrupted) {
+        abort_expansion(state, SH_GLOB_INTERRUPTED);
+        return false;
+    }
+
+    if (budget->max_matches != 0
+        && atomic_load(&state->path_count) > budget->max_matches)
+    {
+        abort_expansion(state, SH_GLOB_TOO_MANY_MATCHES);
+        return false;
+    }
+
+    if (check_time && budget->timeout_ms != 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > state->deadline.tv_sec
+            || (now.tv_sec == state->deadline.tv_sec
+                && now.tv_nsec >= state->deadline.tv_nsec))
+        {
+            abort_expansion(state, SH_GLOB_TIMED_OUT);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void abort_expansion(struct sh_glob_state *state, enum sh_glob_result result) {
+    int expected = SH_GLOB_SUCCESS;
+    atomic_compare_exchange_strong(&state->abort_result, &expected, result);
+}
+
+bool add_found_path(
+    struct sh_glob_state *state,
+    struct sh_arena *arena,
+    struct sh_path_list *list,
+    char const *path
+) {
+    if (!add_path(arena, list, path)) {
+        return false;
+    }
+
+    atomic_fetch_add(&state->path_count, 1);
+    return check_budget(state, false);
+}
+
+bool parse_bracket(
+    char const *text,
+    size_t len,
+    size_t start,
+    uint8_t *bits,
+    size_t *end_out,
+    bool *valid_out
+) {
+    memset(bits, 0, CLASS_BITS_SIZE);
+    bool valid = true;
+
+    size_t idx = start + 1;
+    bool negated = false;
+    if (idx < len && (text[idx] == '!' || text[idx] == '^')) {
+        negated = true;
+        idx++;
+    }
+
+    // A `]` straight after the opening bracket (and negation) is literal.
+    bool first = true;
+    while (true) {
+        if (idx >= len || text[idx] == '/') {
+            return false;
+        }
+
+        unsigned char low = text[idx];
+        if (low == ']' && !first) {
+            break;
+        }
+        first = false;
+
+        // Named classes, e.g. `[:alpha:]`.
+        if (low == '[' && idx + 1 < len && text[idx + 1] == ':') {
+            size_t name_start = idx + 2;
+            size_t name_end = name_start;
+            while (name_end + 1 < len && text[name_end] != '/'
+                   && !(text[name_end] == ':' && text[name_end + 1] == ']'))
+            {
+                name_end++;
+            }
+
+            if (name_end + 1 < len && text[name_end] == ':') {
+                valid &= add_named_class(
+                    text + name_start,
+                    name_end - name_start,
+                    bits
+                );
+                idx = name_end + 2;
+                continue;
+            }
+        }
+
+        if (low == '\\' && idx + 1 < len) {
+            idx++;
+            low = text[idx];
+        }
+        idx++;
+
+        // Ranges, e.g. `a-z`. A `-` right before the closing bracket is
+        // literal.
+        unsigned char high = low;
+        if (idx + 1 < len && text[idx] == '-' && text[idx + 1] != ']') {
+            idx++;
+            high = text[idx];
+            if (high == '\\' && idx + 1 < len) {
+                idx++;
+                high = text[idx];
+            }
+            idx++;
+        }
+
+        for (unsigned int c = low; c <= high; c++) {
+            bits[c / 8] |= 1 << (c % 8);
+        }
+    }
+
+    if (negated) {
+        for (size_t byte = 0; byte < CLASS_BITS_SIZE; byte++) {
+            bits[byte] = ~bits[byte];
+        }
+    }
+
+    *end_out = idx + 1;
+    *valid_out = valid;
+    return true;
+}
+
+bool add_named_class(char const *name, size_t len, uint8_t *bits) {
+    size_t class_count = sizeof(NAMED_CLASSES) / sizeof(NAMED_CLASSES[0]);
+    for (size_t idx = 0; idx < class_count; idx++) {
+        struct sh_named_class const *named_class = &NAMED_CLASSES[idx];
+        if (strlen(named_class->name) != len
+            || strncmp(named_class->name, name, len) != 0)
+        {
+            continue;
+        }
+
+        for (unsigned int c = 0; c < 256; c++) {
+            if (named_class->is_member(c)) {
+                bits[c / 8] |= 1 << (c % 8);
+            }
+        }
+        return true;
+    }
+    return false;
+}
+
+bool has_magic(char const *text, size_t len) {
+    for (size_t idx = 0; idx < len; idx++) {
+        switch (text[idx]) {
+        case '\\':
+            idx++;
+            break;
+        case '*':
+        case '?':
+            return true;
+        case '[': {
+            uint8_t bits[CLASS_BITS_SIZE];
+            size_t end;
+            bool valid;
+            if (parse_bracket(text, len, idx, bits, &end, &valid)) {
+                return true;
+            }
+            break;
+        }
+        }
+    }
+    return false;
+}
+
+void unescape(char const *text, size_t len, char *out) {
+    for (size_t idx = 0; idx < len; idx++) {
+        if (text[idx] == '\\' && idx + 1 < len) {
+            idx++;
+        }
+        *out++ = text[idx];
+    }
+    *out = '\0';
+}
+
+size_t ops_width(struct sh_glob_op const *ops, size_t count) {
+    size_t width = 0;
+    for (size_t idx = 0; idx < count; idx++) {
+        width += ops[idx].len;
+    }
+    return width;
+}
+
+bool ops_match(struct sh_glob_op const *ops, size_t count, char const *name) {
+    for (size_t idx = 0; idx < count; idx++) {
+        struct sh_glob_op const *op = &ops[idx];
+        unsigned char c = *name;
+        switch (op->type) {
+        case SH_GLOB_OP_LITERAL:
+            if (memcmp(name, op->literal, op->len) != 0) {
+                return false;
+            }
+            break;
+        case SH_GLOB_OP_ANY:
+            break;
+        case SH_GLOB_OP_CLASS:
+            if (!(op->class_bits[c / 8] & (1 << (c % 8)))) {
+                return false;
+            }
+            break;
+        case SH_GLOB_OP_STAR:
+            return false;
+        }
+        name += op->len;
+    }
+    return true;
+}
+
+bool expand_into(
+    struct sh_glob_state *state,
+    char const *pattern,
+    size_t len,
+    bool only_dirs,
+    struct sh_path_list *out
+) {
+    // Split the pattern at its last slash.
+    size_t name_start = len;
+    while (name_start > 0 && pattern[name_start - 1] != '/') {
+        name_start--;
+    }
+    char const *name = pattern + name_start;
+    size_t name_len = len - name_start;
+    struct sh_arena *arena = state->arena;
+
+    // Find the directories to look in. Like `glob()`, keep the directory part
+    // as written, except that a pattern in the root directory has no empty
+    // directory part.
+    struct sh_path_list dirs = (struct sh_path_list) {
+        .paths = NULL,
+        .count = 0,
+        .capacity = 0,
+    };
+    if (name_start == 0) {
+        if (!add_path(arena, &dirs, "")) {
+            return false;
+        }
+    } else if (name_start == 1) {
+        if (!add_path(arena, &dirs, "/")) {
+            return false;
+        }
+    } else if (has_magic(pattern, name_start - 1)) {
+        if (!expand_into(state, pattern, name_start - 1, true, &dirs)) {
+            return false;
+        }
+    } else {
+        char *dir = arena_alloc(arena, sizeof(char) * name_start);
+        if (dir == NULL) {
+            return false;
+        }
+        unescape(pattern, name_start - 1, dir);
+        if (!add_path(arena, &dirs, dir)) {
+            return false;
+        }
+    }
+
+    // A `**` component matches any number of directories. In the directory
+    // part of a pattern, that includes none at all. The walk reads directories
+    // on several threads, so it bypasses the cache.
+    if (name_len == 2 && name[0] == '*' && name[1] == '*') {
+        for (size_t idx = 0; only_dirs && idx < dirs.count; idx++) {
+            if (!add_found_path(state, arena, out, dirs.paths[idx])) {
+                return false;
+            }
+        }
+        return walk_recursively(state, &dirs, only_dirs, out);
+    }
+
+    struct sh_glob_pattern compiled;
+    if (!compile_glob_pattern(name, name_len, arena, &compiled)) {
+        return false;
+    }
+
+    for (size_t idx = 0; idx < dirs.count; idx++) {
+        char const *dir = dirs.paths[idx];
+        if (compiled.has_magic) {
+            if (!expand_in_dir(state, dir, &compiled, only_dirs, out)) {
+                return false;
+            }
+            continue;
+        }
+
+        // A literal name only has to be checked for, without reading the
+        // directory. A trailing slash only matches directories.
+        if (!check_budget(state, true)) {
+            return false;
+        }
+
+        char const *literal = compiled.op_count == 0 ? ""
+                                                     : compiled.ops[0].literal;
+        size_t literal_len = compiled.op_count == 0 ? 0 : compiled.ops[0].len;
+        char *path = join_path(arena, dir, strlen(dir), literal, literal_len);
+        if (path == NULL) {
+            return false;
+        }
+
+        if (path_exists(path, only_dirs || name_len == 0)
+            && !add_found_path(state, arena, out, path))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool expand_in_dir(
+    struct sh_glob_state *state,
+    char const *dir,
+    struct sh_glob_pattern const *pattern,
+    bool only_dirs,
+    struct sh_path_list *out
+) {
+    if (!check_budget(state, true)) {
+        return false;
+    }
+
+    size_t dir_len = strlen(dir);
+
+    struct sh_dir_listing const *listing = NULL;
+    if (state->cache != NULL
+        && !find_dir_listing(state->cache, dir, &listing))
+    {
+        return false;
+    }
+
+    if (listing != NULL) {
+        for (size_t idx = 0; idx < listing->count; idx++) {
+            struct sh_dir_cache_entry const *entry = &listing->entries[idx];
+            if ((idx + 1) % TIME_CHECK_INTERVAL == 0
+                && !check_budget(state, true))
+            {
+                return false;
+            }
+
+            if (!add_dir_entry_if_matching(
+                    state,
+                    dir,
+                    dir_len,
+                    AT_FDCWD,
+                    pattern,
+                    only_dirs,
+                    entry->name,
+                    entry->len,
+                    entry->type,
+                    out
+                ))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Directories that cannot be read simply have no matches.
+    struct sh_dir_reader reader;
+    if (!open_dir_reader(&reader, *dir == '\0' ? "." : dir)) {
+        return true;
+    }
+
+    bool success = true;
+    size_t entry_count = 0;
+    char const *name;
+    unsigned char type;
+    while (read_dir_entry(&reader, &name, &type)) {
+        entry_count++;
+        if ((entry_count % TIME_CHECK_INTERVAL == 0
+             && !check_budget(state, true))
+            || !add_dir_entry_if_matching(
+                state,
+                dir,
+                dir_len,
+                reader.fd,
+                pattern,
+                only_dirs,
+                name,
+                strlen(name),
+                type,
+                out
+            ))
+        {
+            success = false;
+            break;
+        }
+    }
+
+    close_dir_reader(&reader);
+    return success;
+}
+
+bool add_dir_entry_if_matching(
+    struct sh_glob_state *state,
+    char const *dir,
+    size_t dir_len,
+    int dir_fd,
+    struct sh_glob_pattern const *pattern,
+    bool only_dirs,
+    char const *name,
+    size_t name_len,
+    unsigned char type,
+    struct sh_path_list *out
+) {
+    if (!glob_pattern_matches(pattern, name, name_len)) {
+        return true;
+    }
+
+    char *path = join_path(state->arena, dir, dir_len, name, name_len);
+    if (path == NULL) {
+        return false;
+    }
+
+    // Without the directory open, entries are checked by their full paths.
+    if (only_dirs
+        && !entry_is_dir(dir_fd, dir_fd == AT_FDCWD ? path : name, type))
+    {
+        return true;
+    }
+
+    return add_found_path(state, state->arena, out, path);
+}
+
+bool find_dir_listing(
+    struct sh_dir_cache *cache,
+    char const *dir,
+    struct sh_dir_listing const **listing_out
+) {
+    *listing_out = NULL;
+
+    struct stat st;
+    if (stat(*dir == '\0' ? "." : dir, &st) != 0) {
+        return true;
+    }
+
+    struct sh_dir_listing *listing = cache->first;
+    while (listing != NULL && strcmp(listing->path, dir) != 0) {
+        listing = listing->next;
+    }
+
+    if (listing != NULL) {
+        // A listing is up to date if the path still leads to the same directory
+        // and it has not been modified since. The status change time also
+        // catches modification times that were set back.
+        if (listing->dev == st.st_dev && listing->ino == st.st_ino
+            && listing->mtime.tv_sec == st.st_mtim.tv_sec
+            && listing->mtime.tv_nsec == st.st_mtim.tv_nsec
+            && listing->ctime.tv_sec == st.st_ctim.tv_sec
+            && listing->ctime.tv_nsec == st.st_ctim.tv_nsec)
+        {
+            // Sorting only pays off for listings that are used more than once.
+            if (!listing->sorted) {
+                sort_dir_listing(listing);
+            }
+
+            // Move the listing to the front.
+            if (listing != cache->first) {
+                listing->prev->next = listing->next;
+                if (listing->next == NULL) {
+                    cache->last = listing->prev;
+                } else {
+                    listing->next->prev = listing->prev;
+                }
+
+                listing->prev = NULL;
+                listing->next = cache->first;
+                cache->first->prev = listing;
+                cache->first = listing;
+            }
+
+            *listing_out = listing;
+            return true;
+        }
+
+        remove_dir_listing(cache, listing);
+    }
+
+    if (st.st_ctim.tv_sec > time(NULL) - DIR_CACHE_MIN_AGE) {
+        return true;
+    }
+
+    if (!read_dir_listing(dir, &st, &listing)) {
+        return false;
+    }
+    if (listing == NULL) {
+        return true;
+    }
+
+    // Make space for the listing by evicting the least recently used ones.
+    while (cache->count == DIR_CACHE_CAPACITY
+           || cache->name_count + listing->count > DIR_CACHE_MAX_NAMES)
+    {
+        remove_dir_listing(cache, cache->last);
+    }
+
+    listing->next = cache->first;
+    if (cache->first == NULL) {
+        cache->last = listing;
+    } else {
+        cache->first->prev = listing;
+    }
+    cache->first = listing;
+    cache->count++;
+    cache->name_count += listing->count;
+
+    *listing_out = listing;
+    return true;
+}
+
+bool read_dir_listing(
+    char const *dir,
+    struct stat const *st,
+    struct sh_dir_listing **listing_out
+) {
+    *listing_out = NULL;
+
+    struct sh_dir_reader reader;
+    if (!open_dir_reader(&reader, *dir == '\0' ? "." : dir)) {
+        return true;
+    }
+
+    struct sh_dir_listing *listing = malloc(sizeof(struct sh_dir_listing));
+    if (listing == NULL) {
+        close_dir_reader(&reader);
+        return false;
+    }
+
+    *listing = (struct sh_dir_listing) {
+        .prev = NULL,
+        .next = NULL,
+        .dev = st->st_dev,
+        .ino = st->st_ino,
+        .mtime = st->st_mtim,
+        .ctime = st->st_ctim,
+        .entries = NULL,
+        .count = 0,
+        .sorted = false,
+    };
+    init_arena(&listing->arena);
+
+    bool success = true;
+    bool too_large = false;
+    size_t capacity = 0;
+    char const *name;
+    unsigned char type;
+    while (read_dir_entry(&reader, &name, &type)) {
+        if (listing->count == DIR_CACHE_MAX_NAMES) {
+            too_large = true;
+            break;
+        }
+
+        // Double the capacity when there is not enough space.
+        if (listing->count == capacity) {
+            size_t new_capacity = capacity == 0 ? 64 : capacity * 2;
+            struct sh_dir_cache_entry *tmp = arena_grow(
+                &listing->arena,
+                listing->entries,
+                sizeof(struct sh_dir_cache_entry) * capacity,
+                sizeof(struct sh_dir_cache_entry) * new_capacity
+            );
+            if (tmp == NULL) {
+                success = false;
+                break;
+            }
+
+            listing->entries = tmp;
+            capacity = new_capacity;
+        }
+
+        // Each name is stored after its type, so that the entries can be
+        // rebuilt from their names once the names are sorted.
+        size_t len = strlen(name);
+        char *name_copy = arena_alloc(
+            &listing->arena,
+            sizeof(char) * (len + 2)
+        );
+        if (name_copy == NULL) {
+            success = false;
+            break;
+        }
+        name_copy[0] = (char) type;
+        memcpy(name_copy + 1, name, len + 1);
+
+        listing->entries[listing->count] = (struct sh_dir_cache_entry) {
+            .name = name_copy + 1,
+            .len = len,
+            .type = type,
+        };
+        listing->count++;
+    }
+    close_dir_reader(&reader);
+
+    listing->path = arena_strdup(&listing->arena, dir);
+    if (listing->path == NULL) {
+        success = false;
+    }
+
+    if (!success || too_large) {
+        destroy_arena(&listing->arena);
+        free(listing);
+        return success;
+    }
+
+    *listing_out = listing;
+    return true;
+}
+
+void sort_dir_listing(struct sh_dir_listing *listing) {
+    char const **names = malloc(sizeof(char const *) * listing->count);
+    if (names == NULL) {
+        return;
+    }
+
+    for (size_t idx = 0; idx < listing->count; idx++) {
+        names[idx] = listing->entries[idx].name;
+    }
+    sort_paths(names, listing->count, 0);
+
+    // Copy the listing into a new arena in sorted order, so that matching the
+    // names one after another still reads them one after another.
+    struct sh_arena arena;
+    init_arena(&arena);
+
+    struct sh_dir_cache_entry *entries = arena_alloc(
+        &arena,
+        sizeof(struct sh_dir_cache_entry) * listing->count
+    );
+    char const *path = arena_strdup(&arena, listing->path);
+    bool success = entries != NULL && path != NULL;
+
+    for (size_t idx = 0; success && idx < listing->count; idx++) {
+        size_t len = strlen(names[idx]);
+        char *name_copy = arena_alloc(&arena, sizeof(char) * (len + 2));
+        if (name_copy == NULL) {
+            success = false;
+            break;
+        }
+        memcpy(name_copy, names[idx] - 1, len + 2);
+
+        entries[idx] = (struct sh_dir_cache_entry) {
+            .name = name_copy + 1,
+            .len = len,
+            .type = (unsigned char) name_copy[0],
+        };
+    }
+    free(names);
+
+    if (!success) {
+        destroy_arena(&arena);
+        return;
+    }
+
+    destroy_arena(&listing->arena);
+    listing->arena = arena;
+    listing->path = path;
+    listing->entries = entries;
+    listing->sorted = true;
+}
+
+void remove_dir_listing(
+    struct sh_dir_cache *cache,
+    struct sh_dir_listing *listing
+) {
+    if (listing->prev == NULL) {
+        cache->first = listing->next;
+    } else {
+        listing->prev->next = listing->next;
+    }
+    if (listing->next == NULL) {
+        cache->last = listing->prev;
+    } else {
+        listing->next->prev = listing->prev;
+    }
+
+    cache->count--;
+    cache->name_count -= listing->count;
+
+    destroy_arena(&listing->arena);
+    free(listing);
+}
+
+char *join_path(
+    struct sh_arena *arena,
+    char const *dir,
+    size_t dir_len,
+    char const *name,
+    size_t name_len
+) {
+    // Names in the current directory have no directory part, and names in the
+    // root directory need no extra separator.
+    size_t separator_len = dir_len == 0 || strcmp(dir, "/") == 0 ? 0 : 1;
+
+    char *path = arena_alloc(
+        arena,
+        sizeof(char) * (dir_len + separator_len + name_len + 1)
+    );
+    if (path == NULL) {
+        return NULL;
+    }
+
+    memcpy(path, dir, dir_len);
+    if (separator_len != 0) {
+        path[dir_len] = '/';
+    }
+    memcpy(path + dir_len + separator_len, name, name_len);
+    path[dir_len + separator_len + name_len] = '\0';
+    return path;
+}
+
+bool add_path(
+    struct sh_arena *arena,
+    struct sh_path_list *list,
+    char const *path
+) {
+    // Double the capacity when there is not enough space.
+    if (list->count == list->capacity) {
+        size_t new_capacity = list->capacity == 0 ? 16 : list->capacity * 2;
+        char const **tmp = arena_grow(
+            arena,
+            list->paths,
+            sizeof(char const *) * list->capacity,
+            sizeof(char const *) * new_capacity
+        );
+        if (tmp == NULL) {
+            return false;
+        }
+
+        list->paths = tmp;
+        list->capacity = new_capacity;
+    }
+
+    list->paths[list->count] = path;
+    list->count++;
+    return true;
+}
+
+bool path_exists(char const *path, bool must_be_dir) {
+    struct stat st;
+    if (must_be_dir) {
+        return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    return lstat(path, &st) == 0;
+}
+
+bool entry_is_dir(int dir_fd, char const *name, unsigned char type) {
+    if (type == DT_DIR) {
+        return true;
+    }
+    if (type != DT_LNK && type != DT_UNKNOWN) {
+        return false;
+    }
+
+    struct stat st;
+    return fstatat(dir_fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+bool open_dir_reader(struct sh_dir_reader *reader, char const *path) {
+    reader->fd = openat(
+        AT_FDCWD,
+        path,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC
+    );
+    if (reader->fd == -1) {
+        return false;
+    }
+
+#ifdef __linux__
+    reader->buf_len = 0;
+    reader->buf_pos = 0;
+#else
+    reader->dir = fdopendir(reader->fd);
+    if (reader->dir == NULL) {
+        close(reader->fd);
+        return false;
+    }
+#endif
+    return true;
+}
+
+bool read_dir_entry(
+    struct sh_dir_reader *reader,
+    char const **name_out,
+    unsigned char *type_out
+) {
+#ifdef __linux__
+    // Read as many entries as fit in the buffer at once.
+    while (reader->buf_pos >= reader->buf_len) {
+        long nread = syscall(
+            SYS_getdents64,
+            reader->fd,
+            reader->buf,
+            sizeof(reader->buf)
+        );
+        if (nread == -1 && errno == EINTR) {
+            continue;
+        }
+        if (nread <= 0) {
+            return false;
+        }
+
+        reader->buf_len = nread;
+        reader->buf_pos = 0;
+    }
+
+    struct sh_linux_dirent64 const *entry
+        = (struct sh_linux_dirent64 const *) (reader->buf + reader->buf_pos);
+    reader->buf_pos += entry->d_reclen;
+    *name_out = entry->d_name;
+    *type_out = entry->d_type;
+#else
+    struct dirent const *entry = readdir(reader->dir);
+    if (entry == NULL) {
+        return false;
+    }
+    *name_out = entry->d_name;
+    *type_out = entry->d_type;
+#endif
+    return true;
+}
+
+void close_dir_reader(struct sh_dir_reader *reader) {
+#ifdef __linux__
+    close(reader->fd);
+#else
+    closedir(reader->dir);
+#endif
+}
+
+void sort_paths(char const **paths, size_t count, size_t depth) {
+    while (count > INSERTION_SORT_THRESHOLD) {
+        // Partition the paths by their byte at `depth` into those less than,
+        // equal to and greater than the median of three of them.
+        unsigned char first = paths[0][depth];
+        unsigned char middle = paths[count / 2][depth];
+        unsigned char last = paths[count - 1][depth];
+        unsigned char pivot = first < middle
+                                  ? (middle < last  ? middle
+                                     : first < last ? last
+                                                    : first)
+                                  : (first < last    ? first
+                                     : middle < last ? last
+                                                     : middle);
+
+        size_t less_end = 0;
+        size_t greater_start = count;
+        size_t idx = 0;
+        while (idx < greater_start) {
+            unsigned char c = paths[idx][depth];
+            char const *tmp = paths[idx];
+            if (c < pivot) {
+                paths[idx++] = paths[less_end];
+                paths[less_end++] = tmp;
+            } else if (c > pivot) {
+                paths[idx] = paths[--greater_start];
+                paths[greater_start] = tmp;
+            } else {
+                idx++;
+            }
+        }
+
+        sort_paths(paths, less_end, depth);
+        sort_paths(paths + greater_start, count - greater_start, depth);
+
+        // The paths equal at `depth` are sorted by their next byte, unless
+        // they have all ended (in which case they are identical).
+        if (pivot == '\0') {
+            return;
+        }
+        paths += less_end;
+        count = greater_start - less_end;
+        depth++;
+    }
+
+    for (size_t idx = 1; idx < count; idx++) {
+        char const *path = paths[idx];
+        size_t pos = idx;
+        while (pos > 0 && strcmp(paths[pos - 1] + depth, path + depth) > 0) {
+            paths[pos] = paths[pos - 1];
+            pos--;
+        }
+        paths[pos] = path;
+    }
+}
+
+bool paths_in_order(char const *const *paths, size_t count) {
+    for (size_t idx = 1; idx < count; idx++) {
+        if (strcmp(paths[idx - 1], paths[idx]) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool walk_recursively(
+    struct sh_glob_state *state,
+    struct sh_path_list const *dirs,
+    bool only_dirs,
+    struct sh_path_list *out
+) {
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t worker_count = cpu_count < 1                   ? 1
+                          : cpu_count > WALK_MAX_THREADS ? WALK_MAX_THREADS
+                                                           : cpu_count;
+
+    struct sh_arena *arena = state->arena;
+    struct sh_walk_worker *workers = arena_alloc(
+        arena,
+        sizeof(struct sh_walk_worker) * worker_count
+    );
+    if (workers == NULL) {
+        return false;
+    }
+
+    struct sh_walk walk = (struct sh_walk) {
+        .workers = workers,
+        .worker_count = worker_count,
+        .state = state,
+        .only_dirs = only_dirs,
+        .started_count = 1,
+    };
+    atomic_init(&walk.pending, dirs->count);
+    atomic_init(&walk.sleeping_count, 0);
+    atomic_init(&walk.all_started, worker_count == 1);
+    pthread_mutex_init(&walk.mutex, NULL);
+    pthread_cond_init(&walk.wake, NULL);
+
+    for (size_t idx = 0; idx < worker_count; idx++) {
+        struct sh_walk_worker *worker = &workers[idx];
+        *worker = (struct sh_walk_worker) {
+            .walk = &walk,
+            .index = idx,
+            .queue = (struct sh_walk_queue) {
+                .dirs = NULL,
+                .head = 0,
+                .tail = 0,
+                .capacity = 0,
+            },
+            .results = (struct sh_path_list) {
+                .paths = NULL,
+                .count = 0,
+                .capacity = 0,
+            },
+        };
+        init_arena(&worker->arena);
+        pthread_mutex_init(&worker->queue.mutex, NULL);
+    }
+
+    // Queue the starting directories for worker 0, which starts other workers
+    // to steal them if there are several. They are all counted as pending
+    // first, so that the walk cannot look over before they are queued.
+    for (size_t idx = 0; idx < dirs->count; idx++) {
+        if (!push_walk_dir(&workers[0], dirs->paths[idx])) {
+            atomic_fetch_sub(&walk.pending, 1);
+            abort_expansion(state, SH_GLOB_MEMORY_ERROR);
+        }
+    }
+
+    // Workers are only started while directories are pending, so none are
+    // started once worker 0 sees the walk over.
+    run_walk_worker(&workers[0]);
+    for (size_t idx = 1; idx < walk.started_count; idx++) {
+        pthread_join(workers[idx].thread, NULL);
+    }
+    pthread_cond_destroy(&walk.wake);
+    pthread_mutex_destroy(&walk.mutex);
+
+    // Move the results into the caller's arena, since the workers' arenas are
+    // destroyed.
+    bool success = atomic_load(&state->abort_result) == SH_GLOB_SUCCESS;
+    for (size_t idx = 0; idx < worker_count; idx++) {
+        struct sh_walk_worker *worker = &workers[idx];
+        for (size_t path_idx = 0;
+             success && path_idx < worker->results.count;
+             path_idx++)
+        {
+            char *path = arena_strdup(arena, worker->results.paths[path_idx]);
+            success = path != NULL && add_path(arena, out, path);
+        }
+
+        pthread_mutex_destroy(&worker->queue.mutex);
+        destroy_arena(&worker->arena);
+    }
+
+    return success;
+}
+
+void *run_walk_worker(void *arg) {
+    struct sh_walk_worker *worker = arg;
+    struct sh_walk *walk = worker->walk;
+
+    char const *dir;
+    while (take_walk_dir(worker, &dir)) {
+        // Once the expansion is aborted, the remaining directories are only
+        // drained, which the sleeping workers are woken to help with. Anything
+        // else that stops reading is a memory error.
+        if (atomic_load(&walk->state->abort_result) == SH_GLOB_SUCCESS
+            && !walk_dir(worker, dir))
+        {
+            abort_expansion(walk->state, SH_GLOB_MEMORY_ERROR);
+            wake_walk_workers(walk);
+        }
+
+        // The walk is over once no directories are queued or being read, since
+        // only directories being read can queue more.
+        if (atomic_fetch_sub(&walk->pending, 1) == 1) {
+            wake_walk_workers(walk);
+        }
+    }
+
+    return NULL;
+}
+
+bool take_walk_dir(struct sh_walk_worker *worker, char const **dir_out) {
+    struct sh_walk *walk = worker->walk;
+    if (pop_walk_dir(worker, dir_out) || steal_walk_dir(worker, dir_out)) {
+        return true;
+    }
+
+    // A worker that queues a directory checks for sleeping workers after
+    // queueing it, so the queues are checked again after counting this worker
+    // as sleeping, or the directory could be missed by both.
+    pthread_mutex_lock(&walk->mutex);
+    atomic_fetch_add(&walk->sleeping_count, 1);
+    bool found;
+    while (!(found = pop_walk_dir(worker, dir_out)
+                     || steal_walk_dir(worker, dir_out))
+           && atomic_load(&walk->pending) != 0)
+    {
+        pthread_cond_wait(&walk->wake, &walk->mutex);
+    }
+    atomic_fetch_sub(&walk->sleeping_count, 1);
+    pthread_mutex_unlock(&walk->mutex);
+
+    return found;
+}
+
+void wake_walk_workers(struct sh_walk *walk) {
+    pthread_mutex_lock(&walk->mutex);
+    pthread_cond_broadcast(&walk->wake);
+    pthread_mutex_unlock(&walk->mutex);
+}
+
+void start_walk_worker(struct sh_walk *walk) {
+    pthread_mutex_lock(&walk->mutex);
+
+    // If a thread cannot be started, the running workers steal the directories
+    // that it would have.
+    if (walk->started_count < walk->worker_count) {
+        struct sh_walk_worker *worker = &walk->workers[walk->started_count];
+        if (pthread_create(&worker->thread, NULL, run_walk_worker, worker)
+            == 0)
+        {
+            walk->started_count++;
+        } else {
+            atomic_store(&walk->all_started, true);
+        }
+    }
+    if (walk->started_count == walk->worker_count) {
+        atomic_store(&walk->all_started, true);
+    }
+
+    pthread_mutex_unlock(&walk->mutex);
+}
+
+bool walk_dir(struct sh_walk_worker *worker, char const *dir) {
+    struct sh_glob_state *state = worker->walk->state;
+    if (!check_budget(state, true)) {
+        return false;
+    }
+
+    // Directories that cannot be read simply have no matches.
+    struct sh_dir_reader reader;
+    if (!open_dir_reader(&reader, *dir == '\0' ? "." : dir)) {
+        return true;
+    }
+
+    size_t dir_len = strlen(dir);
+    bool success = true;
+    size_t entry_count = 0;
+    char const *name;
+    unsigned char type;
+    while (read_dir_entry(&reader, &name, &type)) {
+        entry_count++;
+        if (entry_count % TIME_CHECK_INTERVAL == 0
+            && !check_budget(state, true))
+        {
+            success = false;
+            break;
+        }
+
+        // Like `*`, `**` does not match hidden names, which also skips `.` and
+        // `..`.
+        if (name[0] == '.') {
+            continue;
+        }
+
+        struct stat st;
+        bool is_dir = type == DT_DIR
+                      || (type == DT_UNKNOWN
+                          && fstatat(reader.fd, name, &st, AT_SYMLINK_NOFOLLOW)
+                                 == 0
+                          && S_ISDIR(st.st_mode));
+        if (worker->walk->only_dirs && !is_dir) {
+            continue;
+        }
+
+        char *path = join_path(
+            &worker->arena,
+            dir,
+            dir_len,
+            name,
+            strlen(name)
+        );
+        if (path == NULL
+            || !add_found_path(state, &worker->arena, &worker->results, path))
+        {
+            success = false;
+            break;
+        }
+
+        if (is_dir) {
+            atomic_fetch_add(&worker->walk->pending, 1);
+            if (!push_walk_dir(worker, path)) {
+                atomic_fetch_sub(&worker->walk->pending, 1);
+                success = false;
+                break;
+            }
+        }
+    }
+
+    close_dir_reader(&reader);
+    return success;
+}
+
+bool push_walk_dir(struct sh_walk_worker *worker, char const *dir) {
+    struct sh_walk_queue *queue = &worker->queue;
+    pthread_mutex_lock(&queue->mutex);
+
+    // Move the directories to the front if there is space there, or else
+    // double the capacity.
+    bool success = true;
+    if (queue->tail == queue->capacity && queue->head > 0) {
+        memmove(
+            queue->dirs,
+            queue->dirs + queue->head,
+            sizeof(char const *) * (queue->tail - queue->head)
+        );
+        queue->tail -= queue->head;
+        queue->head = 0;
+    } else if (queue->tail == queue->capacity) {
+        size_t new_capacity = queue->capacity == 0 ? 16 : queue->capacity * 2;
+        char const **tmp = arena_grow(
+            &worker->arena,
+            queue->dirs,
+            sizeof(char const *) * queue->capacity,
+            sizeof(char const *) * new_capacity
+        );
+        if (tmp == NULL) {
+            success = false;
+        } else {
+            queue->dirs = tmp;
+            queue->capacity = new_capacity;
+        }
+    }
+
+    if (success) {
+        queue->dirs[queue->tail] = dir;
+        queue->tail++;
+    }
+    size_t queued_count = queue->tail - queue->head;
+
+    pthread_mutex_unlock(&queue->mutex);
+
+    // Sleeping workers are counted while holding the walk's mutex, so the
+    // signal cannot come between their last look at the queues and sleeping.
+    struct sh_walk *walk = worker->walk;
+    if (!success) {
+        return false;
+    } else if (atomic_load(&walk->sleeping_count) > 0) {
+        pthread_mutex_lock(&walk->mutex);
+        pthread_cond_signal(&walk->wake);
+        pthread_mutex_unlock(&walk->mutex);
+    } else if (queued_count > 1 && !atomic_load(&walk->all_started)) {
+        start_walk_worker(walk);
+    }
+    return true;
+}
+
+bool pop_walk_dir(struct sh_walk_worker *worker, char const **dir_out) {
+    struct sh_walk_queue *queue = &worker->queue;
+    pthread_mutex_lock(&queue->mutex);
+
+    bool popped = queue->tail > queue->head;
+    if (popped) {
+        queue->tail--;
+        *dir_out = queue->dirs[queue->tail];
+    }
+    if (queue->tail == queue->head) {
+        queue->head = 0;
+        queue->tail = 0;
+    }
+
+    pthread_mutex_unlock(&queue->mutex);
+    return popped;
+}
+
+bool steal_walk_dir(struct sh_walk_worker *worker, char const **dir_out) {
+    struct sh_walk *walk = worker->walk;
+    for (size_t offset = 1; offset < walk->worker_count; offset++) {
+        struct sh_walk_queue *queue
+            = &walk->workers[(worker->index + offset) % walk->worker_count]
+                   .queue;
+        pthread_mutex_lock(&queue->mutex);
+
+        bool stolen = queue->tail > queue->head;
+        if (stolen) {
+            *dir_out = queue->dirs[queue->head];
+            queue->head++;
+        }
+        if (queue->tail == queue->head) {
+            queue->head = 0;
+            queue->tail = 0;
+        }
+
+        pthread_mutex_unlock(&queue->mutex);
+        if (stolen) {
+            return true;
+        }
+    }
+    return false;
+}
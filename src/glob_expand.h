@@ -0,0 +1,191 @@
+/**
+ * @file glob_expand.h
+ *
+ * Declarations for expanding glob patterns into pathnames.
+ *
+ * Patterns follow the syntax and results of the C library's `glob()` without
+ * any flags: `*`, `?` and bracket expressions (with ranges, negation and
+ * character classes like `[:alpha:]`) match within a single pathname
+ * component, a backslash escapes the character after it, and a leading period
+ * in a name is only matched by a literal period. In addition, a `**` component
+ * matches any number of directories recursively, as in bash with `globstar`.
+ *
+ * Each component of a pattern is compiled once into a sequence of operations,
+ * with bracket expressions compiled into bitsets. Directories are read in large
+ * batches with `getdents64()` where it is available, and the types of their
+ * entries are used instead of calling `stat()` on them. Matches are sorted by
+ * byte value, which is also how `glob()` sorts them in the C locale (the shell
+ * never changes the locale). Listings of directories can be cached, so that
+ * expanding patterns in the same directories again skips reading them. Cached
+ * listings are sorted once they are used again, so that the matches found in
+ * them need no sorting. The directories below a `**` are read in parallel by a
+ * pool of threads that steal work from each other.
+ */
+
+#ifndef GLOB_EXPAND_H
+#define GLOB_EXPAND_H
+
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+/** The maximum number of directory listings to cache. */
+#define DIR_CACHE_CAPACITY 64
+
+/** The maximum total number of names in cached directory listings. */
+#define DIR_CACHE_MAX_NAMES (1 << 20)
+
+/**
+ * Number of seconds since a directory's status last changed before its listing
+ * is cached. A change made within the same tick of a coarse timestamp as the
+ * listing was read would otherwise go unnoticed.
+ */
+#define DIR_CACHE_MIN_AGE 2
+
+/** Represents the type of an operation in a compiled glob pattern. */
+enum sh_glob_op_type {
+    SH_GLOB_OP_LITERAL, /**< Matches a fixed string. */
+    SH_GLOB_OP_ANY,     /**< Matches any one character (`?`). */
+    SH_GLOB_OP_CLASS,   /**< Matches one character in a set (`[...]`). */
+    SH_GLOB_OP_STAR,    /**< Matches any string (`*`). */
+};
+
+/** An operation in a compiled glob pattern. */
+struct sh_glob_op {
+    enum sh_glob_op_type type; /**< The type of the operation. */
+    size_t len; /**< Number of characters matched. Unused for stars. */
+    union {
+        char const *literal;       /**< The string to match, for literals. */
+        uint8_t const *class_bits; /**< Bitset of the characters to match, for
+                                      classes. */
+    };
+};
+
+/** A glob pattern for a single pathname component, compiled for matching. */
+struct sh_glob_pattern {
+    struct sh_glob_op *ops; /**< The operations, in order. Consecutive literal
+                               characters are merged into one operation, and so
+                               are consecutive stars. */
+    size_t op_count;        /**< Number of operations. */
+    bool has_magic; /**< Whether the pattern has any operations other than a
+                       literal. If not, it matches its literal text only. */
+    bool matches_nothing; /**< Whether the pattern has an invalid character
+                             class, which makes it match nothing at all. */
+};
+
+/**
+ * A cache of directory listings, for expanding patterns in the same
+ * directories again without reading them.
+ *
+ * Listings are kept in order of use, and the least recently used ones are
+ * evicted first. A listing is only used while the directory's device, inode,
+ * modification time and status change time are unchanged.
+ */
+struct sh_dir_cache {
+    struct sh_dir_listing *first; /**< The most recently used listing, or
+                                     `NULL` if there is none. */
+    struct sh_dir_listing *last;  /**< The least recently used listing, or
+                                     `NULL` if there is none. */
+    size_t count;                 /**< Number of listings. */
+    size_t name_count;            /**< Total number of names in listings. */
+};
+
+/**
+ * Limits on an expansion, so that a pattern that matches far more than intended
+ * cannot stall the shell.
+ */
+struct sh_glob_budget {
+    unsigned long timeout_ms; /**< Number of milliseconds that the expansion may
+                                 take, or 0 for no limit. */
+    size_t max_matches;       /**< Number of paths that the expansion may find,
+                                 including directories that it searches, or 0
+                                 for no limit. */
+    volatile sig_atomic_t const *interrupted; /**< A flag that aborts the
+                                                 expansion once it is set, or
+                                                 `NULL`. */
+};
+
+/** Represents the result of expanding a glob pattern. */
+enum sh_glob_result {
+    SH_GLOB_SUCCESS,          /**< At least one pathname matched. */
+    SH_GLOB_NO_MATCH,         /**< No pathnames matched. */
+    SH_GLOB_MEMORY_ERROR,     /**< Memory could not be allocated. */
+    SH_GLOB_INTERRUPTED,      /**< The expansion was interrupted. */
+    SH_GLOB_TIMED_OUT,        /**< The expansion ran out of time. */
+    SH_GLOB_TOO_MANY_MATCHES, /**< The expansion found too many paths. */
+};
+
+/**
+ * Initialises an empty cache of directory listings.
+ *
+ * @param cache a pointer to the cache to initialise
+ */
+void init_dir_cache(struct sh_dir_cache *cache);
+
+/**
+ * Destroys a cache of directory listings.
+ *
+ * This function frees all memory associated with the cache.
+ *
+ * @param cache a pointer to the cache
+ */
+void destroy_dir_cache(struct sh_dir_cache *cache);
+
+/**
+ * Compiles a glob pattern for a single pathname component.
+ *
+ * @param text the pattern, which must not contain `/`
+ * @param len the number of characters in the pattern
+ * @param arena the arena to allocate the compiled pattern from
+ * @param out a pointer to the compiled pattern to set
+ * @return true if successful, false if memory could not be allocated
+ */
+bool compile_glob_pattern(
+    char const *text,
+    size_t len,
+    struct sh_arena *arena,
+    struct sh_glob_pattern *out
+);
+
+/**
+ * Checks whether a name matches a compiled glob pattern.
+ *
+ * @param pattern a pointer to the compiled pattern
+ * @param name the name to match
+ * @param len the number of characters in the name
+ * @return true if the name matches, false otherwise
+ */
+bool glob_pattern_matches(
+    struct sh_glob_pattern const *pattern,
+    char const *name,
+    size_t len
+);
+
+/**
+ * Expands a glob pattern into the sorted list of pathnames that match it.
+ *
+ * Directories that cannot be read are skipped, as `glob()` does by default.
+ * The expansion is aborted as soon as it goes over its budget.
+ *
+ * @param pattern the pattern to expand
+ * @param arena the arena to allocate the list and the pathnames from
+ * @param cache the cache of directory listings to use, or `NULL` to read every
+ * directory
+ * @param budget the limits on the expansion, or `NULL` for none
+ * @param paths_out a pointer to write the list of pathnames to
+ * @param count_out a pointer to write the number of pathnames to
+ * @return the result of the expansion
+ */
+enum sh_glob_result expand_glob(
+    char const *pattern,
+    struct sh_arena *arena,
+    struct sh_dir_cache *cache,
+    struct sh_glob_budget const *budget,
+    char const ***paths_out,
+    size_t *count_out
+);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hist_index.h"
+
+#define EMPTY_SLOT UINT32_MAX
+
+/**
+ * Packs three bytes into a trigram.
+ *
+ * @param bytes a pointer to the first of the three bytes
+ * @return the trigram
+ */
+uint32_t make_trigram(char const *bytes);
+
+/**
+ * Finds the slot for a trigram in the hash table.
+ *
+ * @param index a pointer to the index, which must have at least one slot
+ * @param trigram the trigram to find
+ * @return the slot holding the trigram, or the unused slot it would go in
+ */
+struct sh_trigram_postings *
+find_slot(struct sh_hist_index const *index, uint32_t trigram);
+
+/**
+ * Makes sure that the hash table has space for another trigram.
+ *
+ * @param index a pointer to the index
+ * @return true if successful, false otherwise
+ */
+bool reserve_slot(struct sh_hist_index *index);
+
+/**
+ * Adds an entry to a trigram's list.
+ *
+ * @param postings a pointer to the trigram's list
+ * @param entry the index of the entry
+ * @return true if successful, false otherwise
+ */
+bool add_posting(struct sh_trigram_postings *postings, uint32_t entry);
+
+void init_hist_index(struct sh_hist_index *index) {
+    *index = (struct sh_hist_index) {
+        .slots = NULL,
+        .slot_capacity = 0,
+        .slot_count = 0,
+    };
+}
+
+bool hist_index_add(
+    struct sh_hist_index *index,
+    size_t entry,
+    char const *line
+) {
+    size_t len = strlen(line);
+    for (size_t idx = 0; idx + HIST_INDEX_MIN_QUERY <= len; idx++) {
+        if (!reserve_slot(index)) {
+            return false;
+        }
+
+        uint32_t trigram = make_trigram(line + idx);
+        struct sh_trigram_postings *postings = find_slot(index, trigram);
+        if (postings->trigram == EMPTY_SLOT) {
+            postings->trigram = trigram;
+            index->slot_count++;
+        }
+
+        // Trigrams that occur more than once in the line only need to be
+        // recorded once.
+        if (postings->count > 0
+            && postings->entries[postings->count - 1] == entry)
+        {
+            continue;
+        }
+
+        if (!add_posting(postings, entry)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool hist_index_lookup(
+    struct sh_hist_index const *index,
+    char const *query,
+    size_t len,
+    uint32_t const **entries_out,
+    size_t *count_out
+) {
+    if (len < HIST_INDEX_MIN_QUERY) {
+        return false;
+    }
+
+    *entries_out = NULL;
+    *count_out = 0;
+    if (index->slot_count == 0) {
+        return true;
+    }
+
+    // Use the rarest trigram of the query.
+    struct sh_trigram_postings const *best = NULL;
+    for (size_t idx = 0; idx + HIST_INDEX_MIN_QUERY <= len; idx++) {
+        struct sh_trigram_postings const *postings
+            = find_slot(index, make_trigram(query + idx));
+
+        // Nothing contains this trigram, so nothing contains the query.
+        if (postings->trigram == EMPTY_SLOT) {
+            return true;
+        }
+
+        if (best == NULL || postings->count < best->count) {
+            best = postings;
+        }
+    }
+
+    *entries_out = best->entries;
+    *count_out = best->count;
+    return true;
+}
+
+void destroy_hist_index(struct sh_hist_index *index) {
+    for (size_t idx = 0; idx < index->slot_capacity; idx++) {
+        free(index->slots[idx].entries);
+    }
+    free(index->slots);
+    init_hist_index(index);
+}
+
+uint32_t make_trigram(char const *bytes) {
+    unsigned char const *ubytes = (unsigned char const *) bytes;
+    return (uint32_t) ubytes[0] << 16 | (uint32_t) ubytes[1] << 8 | ubytes[2];
+}
+
+struct sh_trigram_postings *
+find_slot(struct sh_hist_index const *index, uint32_t trigram) {
+    // Fibonacci hashing (taking the well-mixed high bits of the product),
+    // followed by linear probing.
+    size_t mask = index->slot_capacity - 1;
+    size_t idx = (size_t) ((trigram * UINT64_C(0x9E3779B97F4A7C15)) >> 32)
+                 & mask;
+    while (index->slots[idx].trigram != EMPTY_SLOT
+           && index->slots[idx].trigram != trigram)
+    {
+        idx = (idx + 1) & mask;
+    }
+    return &index->slots[idx];
+}
+
+bool reserve_slot(struct sh_hist_index *index) {
+    // Keep the load factor at or below 1/2.
+    if ((index->slot_count + 1) * 2 <= index->slot_capacity) {
+        return true;
+    }
+
+    size_t new_capacity = index->slot_capacity == 0
+                              ? 1024
+                              : index->slot_capacity * 2;
+    struct sh_trigram_postings *new_slots = malloc(
+        sizeof(struct sh_trigram_postings) * new_capacity
+    );
+    if (new_slots == NULL) {
+        perror("malloc");
+        return false;
+    }
+    for (size_t idx = 0; idx < new_capacity; idx++) {
+        new_slots[idx] = (struct sh_trigram_postings) {
+            .trigram = EMPTY_SLOT,
+            .count = 0,
+            .capacity = 0,
+            .entries = NULL,
+        };
+    }
+
+    // Rehash the existing trigrams into the new table.
+    struct sh_hist_index new_index = {
+        .slots = new_slots,
+        .slot_capacity = new_capacity,
+        .slot_count = index->slot_count,
+    };
+    for (size_t idx = 0; idx < index->slot_capacity; idx++) {
+        if (index->slots[idx].trigram != EMPTY_SLOT) {
+            *find_slot(&new_index, index->slots[idx].trigram)
+                = index->slots[idx];
+        }
+    }
+
+    free(index->slots);
+    *index = new_index;
+    return true;
+}
+
+bool add_posting(struct sh_trigram_postings *postings, uint32_t entry) {
+    if (postings->count == postings->capacity) {
+        uint32_t new_capacity = postings->capacity == 0
+                                    ? 4
+                                    : postings->capacity * 2;
+        uint32_t *tmp = realloc(
+            postings->entries,
+            sizeof(uint32_t) * new_capacity
+        );
+        if (tmp == NULL) {
+            perror("realloc");
+            return false;
+        }
+        postings->entries = tmp;
+        postings->capacity = new_capacity;
+    }
+
+    postings->entries[postings->count] = entry;
+    postings->count++;
+    return true;
+}
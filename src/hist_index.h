@@ -0,0 +1,92 @@
+/**
+ * @file hist_index.h
+ *
+ * Declarations for the command history's substring index.
+ *
+ * The index maps every trigram (sequence of three bytes) that occurs in a
+ * history entry to the list of entries it occurs in. Any entry containing a
+ * query of three or more bytes must appear in the list of every trigram of the
+ * query, so only the entries in the shortest of those lists need to be checked
+ * for a match.
+ */
+
+#ifndef HIST_INDEX_H
+#define HIST_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** The shortest query that can be looked up in the index. */
+#define HIST_INDEX_MIN_QUERY 3
+
+/** The list of entries that a trigram occurs in. */
+struct sh_trigram_postings {
+    uint32_t trigram; /**< The trigram, or `UINT32_MAX` for an unused slot. */
+    uint32_t count;   /**< Number of entries in the list. */
+    uint32_t capacity; /**< Capacity of the list. */
+    uint32_t *entries; /**< Indices of the entries, in ascending order. */
+};
+
+/** Substring index over the command history. */
+struct sh_hist_index {
+    struct sh_trigram_postings *slots; /**< Hash table of trigrams. */
+    size_t slot_capacity; /**< Number of slots (always a power of two). */
+    size_t slot_count;    /**< Number of slots in use. */
+};
+
+/**
+ * Initialises an empty index.
+ *
+ * @param index a pointer to the index to initialise
+ */
+void init_hist_index(struct sh_hist_index *index);
+
+/**
+ * Adds a history entry to the index.
+ *
+ * Entries must be added in ascending order of their indices.
+ *
+ * @param index a pointer to the index
+ * @param entry the index of the history entry
+ * @param line the contents of the history entry
+ * @return true if successful, false if memory could not be allocated
+ */
+bool hist_index_add(
+    struct sh_hist_index *index,
+    size_t entry,
+    char const *line
+);
+
+/**
+ * Looks up the candidate entries for a substring query.
+ *
+ * Every entry containing the query is among the candidates, but not every
+ * candidate contains the query — callers must check each candidate.
+ *
+ * @param index a pointer to the index
+ * @param query the query
+ * @param len the number of bytes in the query
+ * @param entries_out a pointer to write the candidates (in ascending order) to
+ * @param count_out a pointer to write the number of candidates to
+ * @return false if the query is shorter than `HIST_INDEX_MIN_QUERY` and cannot
+ * be looked up, true otherwise
+ */
+bool hist_index_lookup(
+    struct sh_hist_index const *index,
+    char const *query,
+    size_t len,
+    uint32_t const **entries_out,
+    size_t *count_out
+);
+
+/**
+ * Destroys an index.
+ *
+ * This function frees all memory associated with the index.
+ *
+ * @param index a pointer to the index
+ */
+void destroy_hist_index(struct sh_hist_index *index);
+
+#endif
@@ -0,0 +1,217 @@
+#include <stdio.h>
+
+#include "hist_prefix.h"
+
+/**
+ * Finds the child of a node for the given byte.
+ *
+ * @param index a pointer to the index
+ * @param node the index of the parent node
+ * @param byte the byte to find
+ * @return the index of the child node, or `HIST_PREFIX_NO_NODE` if there is
+ * none
+ */
+uint32_t find_child(
+    struct sh_hist_prefix_index const *index,
+    uint32_t node,
+    unsigned char byte
+);
+
+/**
+ * Adds a child to a node.
+ *
+ * The root node is created first if the index is empty.
+ *
+ * @param index a pointer to the index
+ * @param parent the index of the parent node
+ * @param byte the last byte of the child's prefix
+ * @return the index of the child node, or `HIST_PREFIX_NO_NODE` if memory could
+ * not be allocated
+ */
+uint32_t add_child(
+    struct sh_hist_prefix_index *index,
+    uint32_t parent,
+    unsigned char byte
+);
+
+/**
+ * Makes sure that the nodes array has space for the given number of nodes.
+ *
+ * @param index a pointer to the index
+ * @param count the number of nodes needed
+ * @return true if successful, false otherwise
+ */
+bool reserve_nodes(struct sh_hist_prefix_index *index, size_t count);
+
+/**
+ * Adds an entry to a node's list.
+ *
+ * @param node a pointer to the node
+ * @param entry the index of the entry
+ * @return true if successful, false otherwise
+ */
+bool add_node_entry(struct sh_trie_node *node, uint32_t entry);
+
+void init_hist_prefix_index(struct sh_hist_prefix_index *index) {
+    *index = (struct sh_hist_prefix_index) {
+        .nodes = NULL,
+        .node_count = 0,
+        .node_capacity = 0,
+    };
+}
+
+bool hist_prefix_index_add(
+    struct sh_hist_prefix_index *index,
+    size_t entry,
+    char const *line
+) {
+    // Make sure the root node exists.
+    if (index->node_count == 0) {
+        if (!reserve_nodes(index, 1)) {
+            return false;
+        }
+        index->nodes[0] = (struct sh_trie_node) {
+            .first_child = HIST_PREFIX_NO_NODE,
+            .next_sibling = HIST_PREFIX_NO_NODE,
+            .byte = '\0',
+            .count = 0,
+            .capacity = 0,
+            .entries = NULL,
+        };
+        index->node_count = 1;
+    }
+
+    uint32_t node = 0;
+    for (size_t depth = 0; depth < HIST_PREFIX_MAX_DEPTH && line[depth] != '\0';
+         depth++)
+    {
+        uint32_t child = find_child(index, node, line[depth]);
+        if (child == HIST_PREFIX_NO_NODE) {
+            child = add_child(index, node, line[depth]);
+            if (child == HIST_PREFIX_NO_NODE) {
+                return false;
+            }
+        }
+        node = child;
+
+        // If adding the entry failed partway before, it may already be listed.
+        struct sh_trie_node *trie_node = &index->nodes[node];
+        if (trie_node->count > 0
+            && trie_node->entries[trie_node->count - 1] == entry)
+        {
+            continue;
+        }
+
+        if (!add_node_entry(trie_node, entry)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void hist_prefix_index_lookup(
+    struct sh_hist_prefix_index const *index,
+    char const *prefix,
+    size_t len,
+    uint32_t const **entries_out,
+    size_t *count_out
+) {
+    *entries_out = NULL;
+    *count_out = 0;
+    if (index->node_count == 0) {
+        return;
+    }
+
+    uint32_t node = 0;
+    for (size_t depth = 0; depth < len && depth < HIST_PREFIX_MAX_DEPTH;
+         depth++)
+    {
+        node = find_child(index, node, prefix[depth]);
+        if (node == HIST_PREFIX_NO_NODE) {
+            return;
+        }
+    }
+
+    *entries_out = index->nodes[node].entries;
+    *count_out = index->nodes[node].count;
+}
+
+void destroy_hist_prefix_index(struct sh_hist_prefix_index *index) {
+    for (size_t idx = 0; idx < index->node_count; idx++) {
+        free(index->nodes[idx].entries);
+    }
+    free(index->nodes);
+    init_hist_prefix_index(index);
+}
+
+uint32_t find_child(
+    struct sh_hist_prefix_index const *index,
+    uint32_t node,
+    unsigned char byte
+) {
+    uint32_t child = index->nodes[node].first_child;
+    while (child != HIST_PREFIX_NO_NODE && index->nodes[child].byte != byte) {
+        child = index->nodes[child].next_sibling;
+    }
+    return child;
+}
+
+uint32_t add_child(
+    struct sh_hist_prefix_index *index,
+    uint32_t parent,
+    unsigned char byte
+) {
+    if (!reserve_nodes(index, index->node_count + 1)) {
+        return HIST_PREFIX_NO_NODE;
+    }
+
+    uint32_t child = index->node_count;
+    index->nodes[child] = (struct sh_trie_node) {
+        .first_child = HIST_PREFIX_NO_NODE,
+        .next_sibling = index->nodes[parent].first_child,
+        .byte = byte,
+        .count = 0,
+        .capacity = 0,
+        .entries = NULL,
+    };
+    index->nodes[parent].first_child = child;
+    index->node_count++;
+    return child;
+}
+
+bool reserve_nodes(struct sh_hist_prefix_index *index, size_t count) {
+    if (count <= index->node_capacity) {
+        return true;
+    }
+
+    size_t new_capacity = count * 2;
+    struct sh_trie_node *tmp = realloc(
+        index->nodes,
+        sizeof(struct sh_trie_node) * new_capacity
+    );
+    if (tmp == NULL) {
+        perror("realloc");
+        return false;
+    }
+    index->nodes = tmp;
+    index->node_capacity = new_capacity;
+    return true;
+}
+
+bool add_node_entry(struct sh_trie_node *node, uint32_t entry) {
+    if (node->count == node->capacity) {
+        uint32_t new_capacity = node->capacity == 0 ? 1 : node->capacity * 2;
+        uint32_t *tmp = realloc(node->entries, sizeof(uint32_t) * new_capacity);
+        if (tmp == NULL) {
+            perror("realloc");
+            return false;
+        }
+        node->entries = tmp;
+        node->capacity = new_capacity;
+    }
+
+    node->entries[node->count] = entry;
+    node->count++;
+    return true;
+}
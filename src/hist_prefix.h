@@ -0,0 +1,101 @@
+/**
+ * @file hist_prefix.h
+ *
+ * Declarations for the command history's prefix index.
+ *
+ * The index is a trie over the first `HIST_PREFIX_MAX_DEPTH` bytes of every
+ * history entry. Each node lists the entries that start with the node's
+ * prefix, so the most recent entry starting with a prefix is found by walking
+ * down the trie and taking the last entry in the list.
+ */
+
+#ifndef HIST_PREFIX_H
+#define HIST_PREFIX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/**
+ * The maximum depth of the trie. Entries are only listed under prefixes of up
+ * to this many bytes.
+ */
+#define HIST_PREFIX_MAX_DEPTH 32
+
+/** Marks the absence of a node. */
+#define HIST_PREFIX_NO_NODE UINT32_MAX
+
+/** A node of the trie. */
+struct sh_trie_node {
+    uint32_t first_child;  /**< The first child node. */
+    uint32_t next_sibling; /**< The next node with the same parent. */
+    unsigned char byte;    /**< The last byte of the node's prefix. */
+
+    uint32_t count;    /**< Number of entries in the list. */
+    uint32_t capacity; /**< Capacity of the list. */
+    uint32_t *entries; /**< Indices of the entries starting with the node's
+                          prefix, in ascending order. */
+};
+
+/** Prefix index over the command history. */
+struct sh_hist_prefix_index {
+    struct sh_trie_node *nodes; /**< The nodes. The root node (for the empty
+                                   prefix) comes first and lists no entries. */
+    size_t node_count;          /**< Number of nodes. */
+    size_t node_capacity;       /**< Capacity of the nodes array. */
+};
+
+/**
+ * Initialises an empty index.
+ *
+ * @param index a pointer to the index to initialise
+ */
+void init_hist_prefix_index(struct sh_hist_prefix_index *index);
+
+/**
+ * Adds a history entry to the index.
+ *
+ * Entries must be added in ascending order of their indices.
+ *
+ * @param index a pointer to the index
+ * @param entry the index of the history entry
+ * @param line the contents of the history entry
+ * @return true if successful, false if memory could not be allocated
+ */
+bool hist_prefix_index_add(
+    struct sh_hist_prefix_index *index,
+    size_t entry,
+    char const *line
+);
+
+/**
+ * Looks up the entries starting with a prefix.
+ *
+ * If the prefix is longer than `HIST_PREFIX_MAX_DEPTH`, the entries starting
+ * with its first `HIST_PREFIX_MAX_DEPTH` bytes are returned instead, and
+ * callers must check each of them.
+ *
+ * @param index a pointer to the index
+ * @param prefix the prefix, which must not be empty
+ * @param len the number of bytes in the prefix
+ * @param entries_out a pointer to write the entries (in ascending order) to
+ * @param count_out a pointer to write the number of entries to
+ */
+void hist_prefix_index_lookup(
+    struct sh_hist_prefix_index const *index,
+    char const *prefix,
+    size_t len,
+    uint32_t const **entries_out,
+    size_t *count_out
+);
+
+/**
+ * Destroys an index.
+ *
+ * This function frees all memory associated with the index.
+ *
+ * @param index a pointer to the index
+ */
+void destroy_hist_prefix_index(struct sh_hist_prefix_index *index);
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "history.h"
+
+/**
+ * Adds an entry to the ring, evicting the oldest entry if the history is full.
+ *
+ * @param history a pointer to the history, whose limit must not be 0
+ * @param line the entry's text, which must not point into the history
+ * @return true if successful, false otherwise
+ */
+bool add_to_ring(struct sh_history *history, char const *line);
+
+/**
+ * Evicts the oldest entry in the ring.
+ *
+ * @param history a pointer to the history, whose ring must not be empty
+ */
+void evict_oldest(struct sh_history *history);
+
+/**
+ * Recomputes the number of the oldest entry kept.
+ *
+ * @param history a pointer to the history
+ */
+void update_first_number(struct sh_history *history);
+
+/**
+ * Makes sure that the ring of offsets has space for another entry.
+ *
+ * @param history a pointer to the history
+ * @return true if successful, false otherwise
+ */
+bool reserve_offset(struct sh_history *history);
+
+/**
+ * Makes sure that the arena has space for the given number of bytes at its
+ * end.
+ *
+ * Space is reclaimed from evicted entries before the arena is grown.
+ *
+ * @param history a pointer to the history
+ * @param len the number of bytes needed
+ * @return true if successful, false otherwise
+ */
+bool reserve_arena(struct sh_history *history, size_t len);
+
+/**
+ * Brings the substring and prefix indexes up to date with the entries kept.
+ *
+ * This is called whenever an entry is added, so each new entry is indexed as it
+ * arrives, and searches find the indexes up to date. The entries loaded from
+ * the history file are the exception: they are only indexed along with the
+ * first entry added or the first search, whichever comes first, since reading
+ * them when the file is opened would make starting the shell take longer as
+ * the history grows. Searches call this as well, which also retries entries
+ * that could not be indexed before.
+ *
+ * Evicted entries are never looked at again, but they still take up space in
+ * the indexes. Rebuilding the indexes once every `limit` evictions keeps their
+ * size proportional to the entries kept, at an amortised constant cost per
+ * entry.
+ *
+ * @param history a pointer to the history
+ * @return true if successful, false otherwise
+ */
+bool update_indexes(struct sh_history *history);
+
+/**
+ * Finds the first of a list of entries that is not less than the given number.
+ *
+ * @param entries the entries, in ascending order
+ * @param count the number of entries
+ * @param number the number to compare against
+ * @return the position of the first such entry in the list, or `count` if
+ * there is none
+ */
+size_t lower_bound(uint32_t const *entries, size_t count, size_t number);
+
+/**
+ * Checks whether a line starts with a prefix.
+ *
+ * @param line the line to check
+ * @param prefix the prefix
+ * @param len the number of bytes in the prefix
+ * @return true if the line starts with the prefix, false otherwise
+ */
+bool starts_with(char const *line, char const *prefix, size_t len);
+
+void init_history(struct sh_history *history, size_t limit) {
+    *history = (struct sh_history) {
+        .limit = limit,
+        .first_number = 0,
+        .shared = false,
+
+        .ring_first_number = 0,
+        .count = 0,
+
+        .offsets = NULL,
+        .offsets_capacity = 0,
+        .offsets_head = 0,
+
+        .arena = NULL,
+        .arena_capacity = 0,
+        .arena_len = 0,
+        .arena_start = 0,
+
+        .index_first_number = 0,
+        .index_end = 0,
+    };
+    init_history_file(&history->file);
+    init_hist_index(&history->index);
+    init_hist_prefix_index(&history->prefix_index);
+}
+
+bool history_load_file(
+    struct sh_history *history,
+    char const *path,
+    bool shared
+) {
+    if (!open_history_file(&history->file, path)) {
+        return false;
+    }
+
+    // The history file's entries come before any others.
+    history->ring_first_number = history_file_count(&history->file);
+    history->shared = shared;
+    update_first_number(history);
+    return true;
+}
+
+bool history_add(struct sh_history *history, char const *line) {
+    if (history->limit == 0) {
+        return true;
+    }
+
+    if (!history->shared) {
+        return add_to_ring(history, line)
+               && history_file_append(&history->file, line);
+    }
+
+    // The entry is read back from the history file along with anything other
+    // shells appended before it, so that entries are numbered in the order
+    // they are in the history file. If it could not be appended, we still keep
+    // it in this shell.
+    if (!history_file_append(&history->file, line)) {
+        add_to_ring(history, line);
+        return false;
+    }
+    return history_merge(history);
+}
+
+bool history_merge(struct sh_history *history) {
+    if (!history->shared || history->limit == 0) {
+        return true;
+    }
+
+    char const *records;
+    size_t len;
+    if (!history_file_read_new(&history->file, &records, &len)) {
+        return false;
+    }
+
+    for (size_t pos = 0; pos < len; pos += strlen(records + pos) + 1) {
+        if (!add_to_ring(history, records + pos)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t history_end_number(struct sh_history const *history) {
+    return history->ring_first_number + history->count;
+}
+
+char const *history_get(struct sh_history const *history, size_t number) {
+    if (number < history->first_number
+        || number >= history_end_number(history))
+    {
+        return NULL;
+    }
+
+    if (number < history->ring_first_number) {
+        return history_file_get(&history->file, number);
+    }
+
+    size_t slot = (history->offsets_head
+                   + (number - history->ring_first_number))
+                  % history->offsets_capacity;
+    return history->arena + history->offsets[slot];
+}
+
+bool history_find_substring(
+    struct sh_history *history,
+    char const *query,
+    size_t before,
+    size_t *number_out
+) {
+    // Without an up-to-date index, fall back to scanning.
+    bool use_index = update_indexes(history);
+
+    size_t end_number = history_end_number(history);
+    if (before > end_number) {
+        before = end_number;
+    }
+
+    uint32_t const *candidates;
+    size_t candidates_count;
+    if (!use_index
+        || !hist_index_lookup(
+            &history->index,
+            query,
+            strlen(query),
+            &candidates,
+            &candidates_count
+        ))
+    {
+        // The query is too short for the index, so scan the history instead.
+        for (size_t number = before; number > history->first_number; number--)
+        {
+            if (strstr(history_get(history, number - 1), query) != NULL) {
+                *number_out = number - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Skip the candidates that are too recent. Candidates older than the oldest
+    // entry kept have been evicted.
+    size_t end = lower_bound(candidates, candidates_count, before);
+    for (size_t idx = end; idx >= 1; idx--) {
+        size_t number = candidates[idx - 1];
+        if (number < history->first_number) {
+            break;
+        }
+
+        if (strstr(history_get(history, number), query) != NULL) {
+            *number_out = number;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool history_find_prefix(
+    struct sh_history *history,
+    char const *prefix,
+    size_t len,
+    size_t before,
+    size_t *number_out
+) {
+    size_t end_number = history_end_number(history);
+    if (before > end_number) {
+        before = end_number;
+    }
+
+    // Every entry starts with the empty prefix.
+    if (len == 0) {
+        if (before <= history->first_number) {
+            return false;
+        }
+        *number_out = before - 1;
+        return true;
+    }
+
+    // Without an up-to-date index, fall back to scanning.
+    if (!update_indexes(history)) {
+        for (size_t number = before; number > history->first_number; number--)
+        {
+            if (starts_with(history_get(history, number - 1), prefix, len)) {
+                *number_out = number - 1;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t const *candidates;
+    size_t candidates_count;
+    hist_prefix_index_lookup(
+        &history->prefix_index,
+        prefix,
+        len,
+        &candidates,
+        &candidates_count
+    );
+
+    // Prefixes within the trie's depth match every candidate, so the most
+    // recent candidate before `before` is the answer.
+    size_t end = lower_bound(candidates, candidates_count, before);
+    for (size_t idx = end; idx >= 1; idx--) {
+        size_t number = candidates[idx - 1];
+        if (number < history->first_number) {
+            break;
+        }
+
+        if (len <= HIST_PREFIX_MAX_DEPTH
+            || starts_with(history_get(history, number), prefix, len))
+        {
+            *number_out = number;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool history_find_prefix_forward(
+    struct sh_history *history,
+    char const *prefix,
+    size_t len,
+    size_t from,
+    size_t *number_out
+) {
+    size_t end_number = history_end_number(history);
+    if (from < history->first_number) {
+        from = history->first_number;
+    }
+
+    // Every entry starts with the empty prefix.
+    if (len == 0) {
+        if (from >= end_number) {
+            return false;
+        }
+        *number_out = from;
+        return true;
+    }
+
+    // Without an up-to-date index, fall back to scanning.
+    if (!update_indexes(history)) {
+        for (size_t number = from; number < end_number; number++) {
+            if (starts_with(history_get(history, number), prefix, len)) {
+                *number_out = number;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t const *candidates;
+    size_t candidates_count;
+    hist_prefix_index_lookup(
+        &history->prefix_index,
+        prefix,
+        len,
+        &candidates,
+        &candidates_count
+    );
+
+    for (size_t idx = lower_bound(candidates, candidates_count, from);
+         idx < candidates_count;
+         idx++)
+    {
+        size_t number = candidates[idx];
+        if (len <= HIST_PREFIX_MAX_DEPTH
+            || starts_with(history_get(history, number), prefix, len))
+        {
+            *number_out = number;
+            return true;
+        }
+    }
+    return false;
+}
+
+void destroy_history(struct sh_history *history) {
+    free(history->offsets);
+    free(history->arena);
+    close_history_file(&history->file);
+    destroy_hist_index(&history->index);
+    destroy_hist_prefix_index(&history->prefix_index);
+    init_history(history, history->limit);
+}
+
+bool add_to_ring(struct sh_history *history, char const *line) {
+    if (history->count == history->limit) {
+        evict_oldest(history);
+    }
+
+    size_t len = strlen(line) + 1;
+    if (!reserve_offset(history) || !reserve_arena(history, len)) {
+        return false;
+    }
+
+    memcpy(history->arena + history->arena_len, line, len);
+    size_t slot = (history->offsets_head + history->count)
+                  % history->offsets_capacity;
+    history->offsets[slot] = history->arena_len;
+    history->arena_len += len;
+    history->count++;
+    update_first_number(history);
+
+    // The entry is kept even if it cannot be indexed yet, since searches
+    // retry it.
+    update_indexes(history);
+    return true;
+}
+
+void evict_oldest(struct sh_history *history) {
+    history->offsets_head = (history->offsets_head + 1)
+                            % history->offsets_capacity;
+    history->ring_first_number++;
+    history->count--;
+
+    // The evicted entry's bytes are reclaimed by `reserve_arena()`.
+    history->arena_start = history->count > 0
+                               ? history->offsets[history->offsets_head]
+                               : history->arena_len;
+}
+
+void update_first_number(struct sh_history *history) {
+    size_t end_number = history_end_number(history);
+    history->first_number = end_number > history->limit
+                                ? end_number - history->limit
+                                : 0;
+}
+
+bool reserve_offset(struct sh_history *history) {
+    if (history->count < history->offsets_capacity) {
+        return true;
+    }
+
+    // Grow the ring up to the limit.
+    size_t new_capacity = history->offsets_capacity == 0
+                              ? 16
+                              : history->offsets_capacity * 2;
+    if (new_capacity > history->limit) {
+        new_capacity = history->limit;
+    }
+
+    size_t *new_offsets = malloc(sizeof(size_t) * new_capacity);
+    if (new_offsets == NULL) {
+        perror("malloc");
+        return false;
+    }
+
+    // Unwrap the ring so that the oldest entry is at the start.
+    for (size_t idx = 0; idx < history->count; idx++) {
+        new_offsets[idx] = history->offsets
+            [(history->offsets_head + idx) % history->offsets_capacity];
+    }
+
+    free(history->offsets);
+    history->offsets = new_offsets;
+    history->offsets_capacity = new_capacity;
+    history->offsets_head = 0;
+    return true;
+}
+
+bool reserve_arena(struct sh_history *history, size_t len) {
+    if (history->arena_len + len <= history->arena_capacity) {
+        return true;
+    }
+
+    // Reclaim the space used by evicted entries once it makes up at least half
+    // of the arena, so that each byte is moved an amortised constant number of
+    // times.
+    size_t live_len = history->arena_len - history->arena_start;
+    if (history->arena_start > 0 && history->arena_start >= live_len) {
+        memmove(
+            history->arena,
+            history->arena + history->arena_start,
+            live_len
+        );
+        for (size_t idx = 0; idx < history->count; idx++) {
+            history->offsets
+                [(history->offsets_head + idx) % history->offsets_capacity]
+                -= history->arena_start;
+        }
+        history->arena_len = live_len;
+        history->arena_start = 0;
+
+        if (history->arena_len + len <= history->arena_capacity) {
+            return true;
+        }
+    }
+
+    size_t new_capacity = (history->arena_len + len) * 2;
+    char *tmp = realloc(history->arena, sizeof(char) * new_capacity);
+    if (tmp == NULL) {
+        perror("realloc");
+        return false;
+    }
+    history->arena = tmp;
+    history->arena_capacity = new_capacity;
+    return true;
+}
+
+bool update_indexes(struct sh_history *history) {
+    if (history->first_number - history->index_first_number
+            >= history->limit
+        || history->index_end < history->first_number)
+    {
+        destroy_hist_index(&history->index);
+        destroy_hist_prefix_index(&history->prefix_index);
+        history->index_first_number = history->first_number;
+        history->index_end = history->first_number;
+    }
+
+    // If adding an entry fails partway, the indexes may list the entry in some
+    // places, which does no harm since both indexes skip entries that are
+    // already listed. The entry is added again next time.
+    size_t end_number = history_end_number(history);
+    for (; history->index_end < end_number; history->index_end++) {
+        char const *line = history_get(history, history->index_end);
+        if (!hist_index_add(&history->index, history->index_end, line)
+            || !hist_prefix_index_add(
+                &history->prefix_index,
+                history->index_end,
+                line
+            ))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+size_t lower_bound(uint32_t const *entries, size_t count, size_t number) {
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid] < number) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+bool starts_with(char const *line, char const *prefix, size_t len) {
+    return strncmp(line, prefix, len) == 0;
+}
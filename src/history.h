@@ -0,0 +1,202 @@
+/**
+ * @file history.h
+ *
+ * Declarations for the command history.
+ *
+ * The history keeps up to a fixed number of the most recent entries. When it
+ * is full, adding an entry evicts the oldest one. Every entry has a number that
+ * does not change when older entries are evicted.
+ *
+ * Entries can be loaded from a history file (see `history_file.h`), in which
+ * case they are numbered before the entries added afterwards, and are read
+ * straight from the file's mapping. Entries added afterwards are also appended
+ * to the history file.
+ *
+ * The history file can be shared with other shells. Entries are then numbered
+ * in the order they are in the history file, and the entries other shells
+ * append are merged in by `history_merge()`.
+ *
+ * The text of entries added after the history file was loaded is packed into a
+ * single arena, and the entries' offsets into the arena are kept in a ring, so
+ * there is no allocation per entry.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "hist_index.h"
+#include "hist_prefix.h"
+#include "history_file.h"
+
+/** The command history. */
+struct sh_history {
+    size_t limit;        /**< Maximum number of entries kept. */
+    size_t first_number; /**< Number of the oldest entry kept. */
+
+    struct sh_history_file file; /**< The history file. Its entries are
+                                    numbered from 0. */
+    bool shared; /**< Whether the history file is shared with other shells. */
+
+    size_t ring_first_number; /**< Number of the oldest entry in the ring. */
+    size_t count;             /**< Number of entries in the ring. */
+    size_t *offsets; /**< Ring of the entries' offsets into the arena, from
+                        oldest to newest. */
+    size_t offsets_capacity; /**< Capacity of the ring. */
+    size_t offsets_head;     /**< Position of the oldest entry in the ring. */
+
+    char *arena; /**< The entries' text, as consecutive null-terminated strings
+                    from oldest to newest. */
+    size_t arena_capacity; /**< Capacity of the arena. */
+    size_t arena_len;      /**< Number of bytes used in the arena. */
+    size_t arena_start; /**< Offset of the oldest entry's text in the arena.
+                           Bytes before it belong to evicted entries. */
+
+    struct sh_hist_index index; /**< Substring index over the entries. */
+    struct sh_hist_prefix_index prefix_index; /**< Prefix index over the
+                                                 entries. */
+    size_t index_first_number; /**< The first entry number when the indexes
+                                  were last rebuilt. Evicted entries are only
+                                  removed from the indexes by rebuilding them.
+                                */
+    size_t index_end; /**< Number of the first entry not in the indexes yet.
+                         Entries are indexed as they are added, and the
+                         entries loaded from the history file are indexed
+                         when they are first needed. */
+};
+
+/**
+ * Initialises an empty history.
+ *
+ * @param history a pointer to the history to initialise
+ * @param limit the maximum number of entries to keep
+ */
+void init_history(struct sh_history *history, size_t limit);
+
+/**
+ * Loads the entries of a history file and appends entries added from now on to
+ * it.
+ *
+ * This function must be called before any entries are added. The entries are
+ * read from the history file only when they are needed.
+ *
+ * @param history a pointer to the history
+ * @param path the path of the history file, which is created if needed
+ * @param shared whether to merge in the entries other shells append to the
+ * history file
+ * @return true if successful, false otherwise
+ */
+bool history_load_file(
+    struct sh_history *history,
+    char const *path,
+    bool shared
+);
+
+/**
+ * Adds an entry to the history, evicting the oldest entry if the history is
+ * full.
+ *
+ * @param history a pointer to the history
+ * @param line the entry's text, which must not point into the history
+ * @return true if successful, false if memory could not be allocated or the
+ * entry could not be appended to the history file
+ */
+bool history_add(struct sh_history *history, char const *line);
+
+/**
+ * Adds the entries that other shells have appended to the history file since
+ * it was last read, if the history file is shared.
+ *
+ * @param history a pointer to the history
+ * @return true if successful, false otherwise
+ */
+bool history_merge(struct sh_history *history);
+
+/**
+ * Returns the number that the next entry added will have.
+ *
+ * The entries kept are numbered from `history->first_number` up to (but not
+ * including) this number.
+ *
+ * @param history a pointer to the history
+ * @return the number of the next entry
+ */
+size_t history_end_number(struct sh_history const *history);
+
+/**
+ * Returns the text of an entry.
+ *
+ * The returned pointer is invalidated by the next call to `history_add()`.
+ *
+ * @param history a pointer to the history
+ * @param number the number of the entry
+ * @return the entry's text, or `NULL` if there is no such entry (anymore)
+ */
+char const *history_get(struct sh_history const *history, size_t number);
+
+/**
+ * Finds the most recent entry containing the given substring.
+ *
+ * @param history a pointer to the history
+ * @param query the substring to search for
+ * @param before only entries with a number less than this are searched
+ * @param number_out a pointer to write the number of the matching entry to
+ * @return true if a matching entry was found, false otherwise
+ */
+bool history_find_substring(
+    struct sh_history *history,
+    char const *query,
+    size_t before,
+    size_t *number_out
+);
+
+/**
+ * Finds the most recent entry starting with the given prefix.
+ *
+ * @param history a pointer to the history
+ * @param prefix the prefix to search for
+ * @param len the number of bytes in the prefix
+ * @param before only entries with a number less than this are searched
+ * @param number_out a pointer to write the number of the matching entry to
+ * @return true if a matching entry was found, false otherwise
+ */
+bool history_find_prefix(
+    struct sh_history *history,
+    char const *prefix,
+    size_t len,
+    size_t before,
+    size_t *number_out
+);
+
+/**
+ * Finds the oldest entry starting with the given prefix, starting from the
+ * given entry.
+ *
+ * @param history a pointer to the history
+ * @param prefix the prefix to search for
+ * @param len the number of bytes in the prefix
+ * @param from only entries with a number greater than or equal to this are
+ * searched
+ * @param number_out a pointer to write the number of the matching entry to
+ * @return true if a matching entry was found, false otherwise
+ */
+bool history_find_prefix_forward(
+    struct sh_history *history,
+    char const *prefix,
+    size_t len,
+    size_t from,
+    size_t *number_out
+);
+
+/**
+ * Destroys a history.
+ *
+ * This function frees all memory associated with the history.
+ *
+ * @param history a pointer to the history
+ */
+void destroy_history(struct sh_history *history);
+
+#endif
@@ -0,0 +1,354 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history_file.h"
+
+/**
+ * Maps a whole file into memory for reading.
+ *
+ * @param fd the file descriptor of the file
+ * @param map_out a pointer to write the mapping to, or `NULL` if the file is
+ * empty
+ * @param len_out a pointer to write the length of the mapping to
+ * @return true if successful, false otherwise
+ */
+bool map_file(int fd, void const **map_out, size_t *len_out);
+
+/**
+ * Determines how many of the index file's offsets can be trusted.
+ *
+ * The index file is trusted as a whole if its last offset points to the start
+ * of a complete record. Otherwise (e.g., if the history file was replaced), it
+ * is ignored.
+ *
+ * @param file a pointer to the history file, with both files mapped
+ * @return the number of offsets that can be used
+ */
+size_t count_valid_offsets(struct sh_history_file const *file);
+
+/**
+ * Finds the records after the ones covered by the index file, and extends the
+ * index file with them (see `extend_index_file()`).
+ *
+ * @param file a pointer to the history file, with both files mapped
+ * @return true if successful, false otherwise
+ */
+bool scan_tail(struct sh_history_file *file);
+
+/**
+ * Extends the index file with the offsets of the records it did not cover.
+ *
+ * @param file a pointer to the history file, with the tail scanned
+ * @return true if successful, false otherwise
+ */
+bool extend_index_file(struct sh_history_file *file);
+
+void init_history_file(struct sh_history_file *file) {
+    *file = (struct sh_history_file) {
+        .data_fd = -1,
+        .index_fd = -1,
+
+        .data = NULL,
+        .data_len = 0,
+
+        .offsets = NULL,
+        .offsets_count = 0,
+        .offsets_map_len = 0,
+
+        .tail_offsets = NULL,
+        .tail_count = 0,
+
+        .read_len = 0,
+        .new_records = NULL,
+        .new_records_capacity = 0,
+    };
+}
+
+bool open_history_file(struct sh_history_file *file, char const *path) {
+    size_t path_len = strlen(path);
+    size_t suffix_len = strlen(HISTORY_INDEX_SUFFIX);
+    char *index_path = malloc(sizeof(char) * (path_len + suffix_len + 1));
+    if (index_path == NULL) {
+        perror("malloc");
+        return false;
+    }
+    memcpy(index_path, path, path_len);
+    memcpy(index_path + path_len, HISTORY_INDEX_SUFFIX, suffix_len + 1);
+
+    // `O_APPEND` makes every record land at the end of the file, even if
+    // something else has appended to it in the meantime.
+    file->data_fd = open(
+        path,
+        O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+        S_IRUSR | S_IWUSR
+    );
+    if (file->data_fd < 0) {
+        perror(path);
+        free(index_path);
+        return false;
+    }
+
+    file->index_fd = open(
+        index_path,
+        O_RDWR | O_CREAT | O_CLOEXEC,
+        S_IRUSR | S_IWUSR
+    );
+    if (file->index_fd < 0) {
+        perror(index_path);
+        free(index_path);
+        close_history_file(file);
+        return false;
+    }
+    free(index_path);
+
+    void const *data;
+    void const *offsets;
+    if (!map_file(file->data_fd, &data, &file->data_len)) {
+        close_history_file(file);
+        return false;
+    }
+    file->data = data;
+
+    if (!map_file(file->index_fd, &offsets, &file->offsets_map_len)) {
+        close_history_file(file);
+        return false;
+    }
+    file->offsets = offsets;
+    file->offsets_count = count_valid_offsets(file);
+
+    if (!scan_tail(file)) {
+        close_history_file(file);
+        return false;
+    }
+
+    return true;
+}
+
+size_t history_file_count(struct sh_history_file const *file) {
+    return file->offsets_count + file->tail_count;
+}
+
+char const *history_file_get(struct sh_history_file const *file, size_t idx) {
+    if (idx < file->offsets_count) {
+        return file->data + file->offsets[idx];
+    }
+    return file->data + file->tail_offsets[idx - file->offsets_count];
+}
+
+bool history_file_append(struct sh_history_file *file, char const *line) {
+    if (file->data_fd < 0) {
+        return true;
+    }
+
+    // Write the record (including the null byte) in one go, so that it is not
+    // interleaved with records appended by anything else.
+    size_t len = strlen(line) + 1;
+    size_t written = 0;
+    while (written < len) {
+        ssize_t ret = write(file->data_fd, line + written, len - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            return false;
+        }
+        written += ret;
+    }
+
+    return true;
+}
+
+bool history_file_read_new(
+    struct sh_history_file *file,
+    char const **records_out,
+    size_t *len_out
+) {
+    *records_out = NULL;
+    *len_out = 0;
+    if (file->data_fd < 0) {
+        return true;
+    }
+
+    struct stat st;
+    if (fstat(file->data_fd, &st) < 0) {
+        perror("fstat");
+        return false;
+    }
+
+    // The history file only ever grows, unless it was replaced, in which case
+    // there is nothing sensible to read.
+    if ((size_t) st.st_size <= file->read_len) {
+        return true;
+    }
+
+    size_t len = st.st_size - file->read_len;
+    if (file->new_records_capacity < len) {
+        char *tmp = realloc(file->new_records, sizeof(char) * len);
+        if (tmp == NULL) {
+            perror("realloc");
+            return false;
+        }
+        file->new_records = tmp;
+        file->new_records_capacity = len;
+    }
+    *records_out = file->new_records;
+
+    size_t read_len = 0;
+    while (read_len < len) {
+        ssize_t ret = pread(
+            file->data_fd,
+            file->new_records + read_len,
+            len - read_len,
+            file->read_len + read_len
+        );
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("pread");
+            return false;
+        }
+        if (ret == 0) {
+            break;
+        }
+        read_len += ret;
+    }
+
+    // Only take the complete records. The rest is read again next time.
+    while (read_len > 0 && file->new_records[read_len - 1] != '\0') {
+        read_len--;
+    }
+
+    *len_out = read_len;
+    file->read_len += read_len;
+    return true;
+}
+
+void close_history_file(struct sh_history_file *file) {
+    if (file->data != NULL) {
+        munmap((void *) file->data, file->data_len);
+    }
+    if (file->offsets != NULL) {
+        munmap((void *) file->offsets, file->offsets_map_len);
+    }
+    if (file->data_fd >= 0) {
+        close(file->data_fd);
+    }
+    if (file->index_fd >= 0) {
+        close(file->index_fd);
+    }
+    free(file->tail_offsets);
+    free(file->new_records);
+
+    init_history_file(file);
+}
+
+bool map_file(int fd, void const **map_out, size_t *len_out) {
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("fstat");
+        return false;
+    }
+
+    *map_out = NULL;
+    *len_out = st.st_size;
+    if (st.st_size == 0) {
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return false;
+    }
+
+    *map_out = map;
+    return true;
+}
+
+size_t count_valid_offsets(struct sh_history_file const *file) {
+    size_t count = file->offsets_map_len / sizeof(uint64_t);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t first = file->offsets[0];
+    uint64_t last = file->offsets[count - 1];
+    if (first != 0 || last >= file->data_len
+        || (last > 0 && file->data[last - 1] != '\0')
+        || memchr(file->data + last, '\0', file->data_len - last) == NULL)
+    {
+        return 0;
+    }
+
+    return count;
+}
+
+bool scan_tail(struct sh_history_file *file) {
+    size_t pos = 0;
+    if (file->offsets_count > 0) {
+        char const *last = history_file_get(file, file->offsets_count - 1);
+        pos = (last - file->data) + strlen(last) + 1;
+    }
+
+    size_t tail_capacity = 0;
+    while (pos < file->data_len) {
+        // A record without a null byte is incomplete, so stop there.
+        char const *end = memchr(
+            file->data + pos,
+            '\0',
+            file->data_len - pos
+        );
+        if (end == NULL) {
+            break;
+        }
+
+        // Grow the tail offsets array if needed.
+        if (file->tail_count == tail_capacity) {
+            size_t new_capacity = tail_capacity == 0 ? 64 : tail_capacity * 2;
+            uint64_t *tmp = realloc(
+                file->tail_offsets,
+                sizeof(uint64_t) * new_capacity
+            );
+            if (tmp == NULL) {
+                perror("realloc");
+                return false;
+            }
+            file->tail_offsets = tmp;
+            tail_capacity = new_capacity;
+        }
+
+        file->tail_offsets[file->tail_count] = pos;
+        file->tail_count++;
+        pos = (end - file->data) + 1;
+    }
+    file->read_len = pos;
+
+    // This is only an optimisation for the next time the history file is
+    // opened, so failures are ignored.
+    extend_index_file(file);
+    return true;
+}
+
+bool extend_index_file(struct sh_history_file *file) {
+    // An index file that was ignored is rewritten from scratch.
+    size_t valid_len = sizeof(uint64_t) * file->offsets_count;
+    if (valid_len != file->offsets_map_len
+        && ftruncate(file->index_fd, valid_len) < 0)
+    {
+        return false;
+    }
+
+    // Anything else extending the index file at the same time writes the same
+    // offsets to the same places.
+    size_t tail_len = sizeof(uint64_t) * file->tail_count;
+    return tail_len == 0
+           || pwrite(file->index_fd, file->tail_offsets, tail_len, valid_len)
+                  == (ssize_t) tail_len;
+}
@@ -0,0 +1,132 @@
+/**
+ * @file history_file.h
+ *
+ * Declarations for the persistent history file.
+ *
+ * The history file is a sequence of records, each consisting of a command line
+ * followed by a null byte. Records are only ever appended, each with a single
+ * `write()`.
+ *
+ * Alongside the history file is an index file (the history file's path with
+ * `HISTORY_INDEX_SUFFIX` appended), containing the offset of each record as a
+ * native 64-bit integer. The index file only needs to cover a prefix of the
+ * records — records after the ones it covers are found by scanning the history
+ * file, and the index file is extended with them.
+ *
+ * When opened, both files are mapped into memory. Records are read straight
+ * from the mapping, and only when they are needed, so opening the history file
+ * does not take longer as the history grows.
+ *
+ * Several shells can append to the same history file at once. Each keeps track
+ * of how far it has read the history file, so the records appended since can be
+ * read without reading the whole file again.
+ */
+
+#ifndef HISTORY_FILE_H
+#define HISTORY_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Suffix of the index file's path. */
+#define HISTORY_INDEX_SUFFIX ".idx"
+
+/** An open history file. */
+struct sh_history_file {
+    int data_fd;  /**< The history file, or -1 if not open. */
+    int index_fd; /**< The index file, or -1 if not open. */
+
+    char const *data; /**< Mapping of the history file as it was opened. */
+    size_t data_len;  /**< Length of the mapping. */
+
+    uint64_t const *offsets; /**< Mapping of the index file. */
+    size_t offsets_count;    /**< Number of valid offsets in the mapping. */
+    size_t offsets_map_len;  /**< Length of the index file's mapping. */
+
+    uint64_t *tail_offsets; /**< Offsets of the records that the index file did
+                               not cover when it was opened. */
+    size_t tail_count;      /**< Number of offsets in `tail_offsets`. */
+
+    size_t read_len; /**< Offset of the end of the last complete record read. */
+    char *new_records; /**< Buffer for the records read since the history file
+                          was opened. */
+    size_t new_records_capacity; /**< Capacity of `new_records`. */
+};
+
+/**
+ * Initialises a history file that is not open.
+ *
+ * @param file a pointer to the history file to initialise
+ */
+void init_history_file(struct sh_history_file *file);
+
+/**
+ * Opens and maps a history file, creating it if it does not exist.
+ *
+ * @param file a pointer to a history file initialised by
+ * `init_history_file()`
+ * @param path the path of the history file
+ * @return true if successful, false otherwise
+ */
+bool open_history_file(struct sh_history_file *file, char const *path);
+
+/**
+ * Returns the number of records that were in the history file when it was
+ * opened.
+ *
+ * @param file a pointer to the history file
+ * @return the number of records
+ */
+size_t history_file_count(struct sh_history_file const *file);
+
+/**
+ * Returns a record that was in the history file when it was opened.
+ *
+ * @param file a pointer to the history file
+ * @param idx the index of the record, which must be less than
+ * `history_file_count()`
+ * @return the record's command line
+ */
+char const *history_file_get(struct sh_history_file const *file, size_t idx);
+
+/**
+ * Appends a record to the history file.
+ *
+ * The record is not visible through `history_file_get()`.
+ *
+ * @param file a pointer to the history file
+ * @param line the record's command line
+ * @return true if successful, false otherwise
+ */
+bool history_file_append(struct sh_history_file *file, char const *line);
+
+/**
+ * Reads the records appended to the history file since it was opened or last
+ * read from.
+ *
+ * Records that are not complete yet are left to be read next time.
+ *
+ * @param file a pointer to the history file
+ * @param records_out a pointer to write the records to, as consecutive
+ * null-terminated strings. They are valid until the next call.
+ * @param len_out a pointer to write the total length of the records to
+ * @return true if successful, false otherwise
+ */
+bool history_file_read_new(
+    struct sh_history_file *file,
+    char const **records_out,
+    size_t *len_out
+);
+
+/**
+ * Closes a history file.
+ *
+ * This function unmaps the history file and frees all memory associated with
+ * it. Closing a history file that is not open does nothing.
+ *
+ * @param file a pointer to the history file
+ */
+void close_history_file(struct sh_history_file *file);
+
+#endif
@@ -1,15 +1,23 @@
 #include <assert.h>
 #include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include "gap_buf.h"
 #include "input.h"
 
 #define CH_BACKSPACE 127
+#define CH_CTRL_A 0x01
+#define CH_CTRL_E 0x05
+#define CH_CTRL_G 0x07
+#define CH_CTRL_R 0x12
 
 #define C0_BACKSPACE 0x08
 #define C0_START 0x00
@@ -20,32 +28,125 @@
 #define CSI_UP 'A'
 #define CSI_DOWN 'B'
 #define CSI_FORWARD 'C'
+#define CSI_BACK 'D'
+#define CSI_END 'F'
+#define CSI_HOME 'H'
+#define CSI_ERASE_DISPLAY 'J'
 #define CSI_CPR 'R'
+#define CSI_KEY '~'
 
 #define DSR_POS "6n"
 
+#define KEY_HOME "1~"
+#define KEY_HOME_ALT "7~"
+#define KEY_DELETE "3~"
+#define KEY_END "4~"
+#define KEY_END_ALT "8~"
+
+#define SEARCH_PROMPT "(reverse-i-search)`"
+#define SEARCH_FAILED_PROMPT "(failed reverse-i-search)`"
+#define SEARCH_PROMPT_END "': "
+
+#define PASTE_START "200~"
+#define PASTE_END "201~"
+#define BRACKETED_PASTE_ON "\x1b[?2004h"
+#define BRACKETED_PASTE_OFF "\x1b[?2004l"
+
+/**
+ * Moves the cursor to the next line after a character was written to the last
+ * column. Writing a space makes the terminal wrap the line itself (rather than
+ * seeing a hard line break), so the line can still be rewrapped when the window
+ * is resized.
+ */
+#define FORCE_WRAP " \r"
+
+#define INPUT_CHUNK_SIZE 4096
+
+/** Bytes read from the terminal that have not been processed yet. */
+struct sh_input_stream {
+    char buf[INPUT_CHUNK_SIZE]; /**< Bytes read from the terminal. */
+    size_t len;                 /**< Number of bytes in the buffer. */
+    size_t pos;                 /**< Index of the next unprocessed byte. */
+    bool in_paste; /**< Whether a bracketed paste is in progress. */
+};
+
+/**
+ * The terminal is shared by the whole shell, so bytes that were read past the
+ * end of the current command line are kept here for the next call to
+ * `read_input()`.
+ */
+static struct sh_input_stream input_stream = {
+    .len = 0,
+    .pos = 0,
+    .in_paste = false,
+};
+
+/** Set by `handle_sigwinch()` when the terminal window has been resized. */
+static volatile sig_atomic_t win_size_dirty = 0;
+
+/**
+ * Keeps track of what has been drawn on the terminal for the edit buffer.
+ *
+ * Output is accumulated in `out` and written to the terminal in one go by
+ * `flush_output()`.
+ */
+struct sh_render_state {
+    char *drawn;           /**< Contents of the edit buffer as last drawn. */
+    size_t drawn_capacity; /**< Capacity of the drawn buffer. */
+    size_t drawn_len;      /**< Number of characters drawn. */
+    size_t drawn_cursor;   /**< Index in the drawn buffer that the terminal's
+                              cursor is at. */
+
+    char *out;           /**< Buffer for output to write to the terminal. */
+    size_t out_capacity; /**< Capacity of the output buffer. */
+    size_t out_len;      /**< Number of bytes in the output buffer. */
+};
+
 /** Contains textual information for user input. */
 struct sh_input_context {
-    size_t cursor_line; /**< The line the cursor is on. */
-    size_t cursor_col;  /**< The column the cursor is on. */
+    size_t origin_col; /**< The column the edit buffer starts on (1-indexed). */
 
-    unsigned short win_width;  /**< Width of the terminal window. */
-    unsigned short win_height; /**< Height of the terminal window. */
+    bool cpr_pending;  /**< Whether a cursor position report is outstanding. */
+    size_t cpr_offset; /**< Index in the drawn edit buffer that the cursor was at
+                          when the outstanding position report was requested. */
 
-    char *edit_buf; /**< Buffer containing the text to edit and display. */
-    size_t edit_buf_capacity; /**< Capacity of the edit buffer. */
-    size_t edit_buf_len; /**< Number of characters in the edit buffer (excluding
-                            the null byte). */
-    size_t edit_buf_cursor; /**< Index of the cursor in the edit buffer. */
+    struct sh_render_state render; /**< What is currently on the terminal. */
+
+    unsigned short win_width;  /**< Width of the terminal window. This is only
+                                  refreshed when the window is resized. */
+    unsigned short win_height; /**< Height of the terminal window. This is only
+                                  refreshed when the window is resized. */
+
+    struct sh_gap_buf edit_buf; /**< The text to edit and display. The gap
+                                   buffer's cursor is the editing cursor. */
+
+    char *paste_buf;           /**< Buffer for collecting pasted text. */
+    size_t paste_buf_capacity; /**< Capacity of the paste buffer. */
+    size_t paste_buf_len;      /**< Number of characters in the paste buffer. */
 
     char *new_cmdline;           /**< Buffer for saving a new command line. */
     size_t new_cmdline_capacity; /**< Capacity of the new commandline buffer. */
     size_t new_cmdline_len; /**< Number of characters in the new commandline
                                buffer (excluding the null byte). */
 
-    struct sh_shell_context const *sh_ctx; /**< Pointer to the shell context. */
+    bool searching; /**< Whether a reverse history search is in progress. */
+    char *search_query;           /**< The text being searched for. */
+    size_t search_query_capacity; /**< Capacity of the search query buffer. */
+    size_t search_query_len; /**< Number of characters in the search query
+                                (excluding the null byte). */
+    bool search_has_match;   /**< Whether a history item has been found. */
+    size_t search_match;     /**< Index of the history item found. */
+    bool search_failed; /**< Whether the last search did not find anything. */
+    struct sh_gap_buf search_display; /**< What is displayed in place of the
+                                         edit buffer during a search. */
+
+    struct sh_shell_context *sh_ctx; /**< Pointer to the shell context. */
     size_t history_idx; /**< The index of the currently selected command history
                            item. */
+    size_t history_prefix_len; /**< Number of characters at the start of the
+                                  new command line that history items must
+                                  start with to be selected by the arrow keys.
+                                */
 };
 
 /**
@@ -56,19 +157,41 @@ struct sh_input_context {
  */
 void init_input_context(
     struct sh_input_context *input_ctx,
-    struct sh_shell_context const *sh_ctx
+    struct sh_shell_context *sh_ctx
 );
 
 /**
  * Handles backspace input.
  *
  * This function handles the backspace key, modifying the input buffer and
- * updating the cursor position.
+ * updating the cursor position. The display is updated by the next call to
+ * `render()`.
  *
  * @param input_ctx a pointer to the input context
  */
 void handle_backspace(struct sh_input_context *input_ctx);
 
+/**
+ * Handles the delete key.
+ *
+ * This function deletes the character after the cursor. The display is updated
+ * by the next call to `render()`.
+ *
+ * @param input_ctx a pointer to the input context
+ */
+void handle_delete(struct sh_input_context *input_ctx);
+
+/**
+ * Moves the cursor within the edit buffer.
+ *
+ * The display is updated by the next call to `render()`.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param idx the index to move the cursor to, which is clamped to the end of
+ * the edit buffer
+ */
+void move_cursor(struct sh_input_context *input_ctx, size_t idx);
+
 /**
  * Handles CSI (Control Sequence Introducer) sequences.
  *
@@ -83,7 +206,9 @@ char handle_csi(struct sh_input_context *input_ctx);
 /**
  * Handles the "up" arrow key.
  *
- * This function moves up through the command history.
+ * This function moves up through the command history. If a command line was
+ * typed before moving away from it, only history items starting with it are
+ * selected.
  *
  * @param input_ctx a pointer to the input context
  * @return true if successful, false otherwise
@@ -93,12 +218,79 @@ bool handle_up(struct sh_input_context *input_ctx);
 /**
  * Handles the "down" arrow key.
  *
- * This function moves down through the command history.
+ * This function moves down through the command history, selecting only history
+ * items starting with the command line typed before moving away from it.
  *
  * @param input_ctx a pointer to the input context
  */
 void handle_down(struct sh_input_context *input_ctx);
 
+/**
+ * Saves the edit buffer as the new command line, so that it can be restored
+ * after looking through the history.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool save_new_cmdline(struct sh_input_context *input_ctx);
+
+/**
+ * Starts a reverse search through the history.
+ *
+ * While searching, the edit buffer is not shown. Instead, the search query and
+ * the most recent history item containing it are shown.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool start_search(struct sh_input_context *input_ctx);
+
+/**
+ * Handles a byte of input during a reverse history search.
+ *
+ * Text is added to the search query, backspace removes from it, Ctrl-R moves
+ * to the next older match and Ctrl-G cancels the search. Any other byte ends
+ * the search with the current match in the edit buffer, and is not consumed,
+ * so that it can be handled as usual.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param c the next byte of input
+ * @param consumed_out a pointer to write whether the byte was consumed to
+ * @return true if successful, false otherwise
+ */
+bool handle_search_input(
+    struct sh_input_context *input_ctx,
+    int c,
+    bool *consumed_out
+);
+
+/**
+ * Searches the history for the search query and updates what is displayed.
+ *
+ * If nothing is found, the previous match is kept.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param before only history items with an index less than this are searched
+ * @return true if successful, false otherwise
+ */
+bool update_search(struct sh_input_context *input_ctx, size_t before);
+
+/**
+ * Ends the reverse history search and puts the current match into the edit
+ * buffer.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool accept_search(struct sh_input_context *input_ctx);
+
+/**
+ * Ends the reverse history search, leaving the edit buffer as it was.
+ *
+ * @param input_ctx a pointer to the input context
+ */
+void cancel_search(struct sh_input_context *input_ctx);
+
 /**
  * Handles CSI CPR (Cursor Position Report) sequences.
  *
@@ -112,15 +304,113 @@ void handle_down(struct sh_input_context *input_ctx);
 bool handle_cpr(struct sh_input_context *input_ctx, char const *bytes);
 
 /**
- * Inserts a character into the input buffer.
+ * Inserts text into the input buffer.
  *
- * This function inserts a character at the current cursor position and updates
- * the display.
+ * This function inserts the text at the current cursor position. The display
+ * is updated by the next call to `render()`.
  *
  * @param input_ctx a pointer to the input context
- * @param c the character to insert
+ * @param text the text to insert
+ * @param len the number of characters in `text`
+ * @return true if successful, false otherwise
+ */
+bool insert_text(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+);
+
+/**
+ * Handles text that is part of a bracketed paste.
+ *
+ * Pasted text is collected and only inserted into the edit buffer once the
+ * paste ends (or a line break is pasted), so that it is inserted and rendered
+ * in one go.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param text the pasted text
+ * @param len the number of characters in `text`
+ * @return true if successful, false otherwise
+ */
+bool handle_paste_text(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+);
+
+/**
+ * Inserts the collected pasted text into the edit buffer.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool flush_paste(struct sh_input_context *input_ctx);
+
+/**
+ * Waits until there is input to read from the terminal.
+ *
+ * Unlike `read()`, waiting is not resumed after a signal is handled, which
+ * gives the caller a chance to react to window resizes.
+ *
+ * @return false if the wait was interrupted by a signal, true otherwise
+ */
+bool wait_for_input();
+
+/**
+ * Returns the next byte of input without consuming it.
+ *
+ * If all buffered input has been processed, this function blocks until more
+ * input is read from the terminal. Input is read in chunks of up to
+ * `INPUT_CHUNK_SIZE` bytes.
+ *
+ * @return the next byte, or `EOF` on end of file or error
+ */
+int peek_byte();
+
+/**
+ * Returns and consumes the next byte of input.
+ *
+ * See `peek_byte()`.
+ *
+ * @return the next byte, or `EOF` on end of file or error
+ */
+int next_byte();
+
+/**
+ * Consumes the run of text bytes at the front of the buffered input.
+ *
+ * This function does not read from the terminal.
+ *
+ * @param text_out a pointer to write the start of the run to
+ * @return the number of bytes in the run
+ */
+size_t take_text_run(char const **text_out);
+
+/**
+ * Checks whether there is input that was read but not yet processed.
+ *
+ * @return true if there is buffered input, false otherwise
+ */
+bool has_buffered_input();
+
+/**
+ * Checks whether a byte is text to be inserted into the edit buffer as-is.
+ *
+ * @param c the byte to check
+ * @return true if the byte is text, false if it is a control character
+ */
+bool is_text_byte(int c);
+
+/**
+ * Enables or disables bracketed paste mode.
+ *
+ * In bracketed paste mode, the terminal surrounds pasted text with
+ * `PASTE_START` and `PASTE_END` control sequences.
+ *
+ * @param enable whether to enable bracketed paste mode
+ * @return true if successful, false otherwise
  */
-void insert_char(struct sh_input_context *input_ctx, char c);
+bool set_bracketed_paste(bool enable);
 
 /**
  * Updates the window size.
@@ -132,6 +422,19 @@ void insert_char(struct sh_input_context *input_ctx, char c);
  */
 bool update_win_size(struct sh_input_context *input_ctx);
 
+/**
+ * Handles a resize of the terminal window.
+ *
+ * This function refreshes the cached window size. If the width changed, the
+ * terminal will have rewrapped the command line, so the prompt and edit buffer
+ * are redrawn from the start of the command line and the cursor position is
+ * resynchronised.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool handle_resize(struct sh_input_context *input_ctx);
+
 /**
  * Requests the current cursor position.
  *
@@ -142,6 +445,109 @@ bool update_win_size(struct sh_input_context *input_ctx);
  */
 bool request_cursor_pos();
 
+/**
+ * Resynchronises the tracked cursor position with the terminal.
+ *
+ * The terminal's report arrives asynchronously and is handled by
+ * `handle_cpr()`. Since the report describes where the cursor was when the
+ * request was processed, the cursor's index into the drawn edit buffer is
+ * recorded so that the origin of the edit buffer can be recovered from the
+ * report.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool sync_cursor_pos(struct sh_input_context *input_ctx);
+
+/**
+ * Replaces the contents of the edit buffer and moves the cursor to the end.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param text the new contents
+ * @param len the number of characters in `text`
+ * @return true if successful, false otherwise
+ */
+bool set_edit_buf(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+);
+
+/**
+ * Brings the terminal up to date with the edit buffer.
+ *
+ * The edit buffer is compared with what was last drawn. Only the characters
+ * after the first difference are redrawn, and the resulting output is sent to
+ * the terminal with a single `write()`.
+ *
+ * During a reverse history search, the search is drawn instead of the edit
+ * buffer.
+ *
+ * @param input_ctx a pointer to the input context
+ * @return true if successful, false otherwise
+ */
+bool render(struct sh_input_context *input_ctx);
+
+/**
+ * Computes where a character of the edit buffer is displayed.
+ *
+ * The row is relative to the row the edit buffer starts on. Both the row and
+ * column are 0-indexed.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param idx the index into the edit buffer
+ * @param row_out a pointer to write the row to
+ * @param col_out a pointer to write the column to
+ */
+void screen_pos(
+    struct sh_input_context const *input_ctx,
+    size_t idx,
+    size_t *row_out,
+    size_t *col_out
+);
+
+/**
+ * Appends bytes to the render output buffer.
+ *
+ * @param render a pointer to the render state
+ * @param bytes the bytes to append
+ * @param len the number of bytes to append
+ * @return true if successful, false otherwise
+ */
+bool append_output(
+    struct sh_render_state *render,
+    char const *bytes,
+    size_t len
+);
+
+/**
+ * Appends a CSI sequence with a numeric parameter to the render output buffer.
+ *
+ * @param render a pointer to the render state
+ * @param n the numeric parameter
+ * @param final the final byte of the sequence
+ * @return true if successful, false otherwise
+ */
+bool append_csi(struct sh_render_state *render, size_t n, char final);
+
+/**
+ * Appends the control sequences to move the terminal's cursor to the given
+ * index of the drawn edit buffer.
+ *
+ * @param input_ctx a pointer to the input context
+ * @param idx the index to move the cursor to
+ * @return true if successful, false otherwise
+ */
+bool append_cursor_move(struct sh_input_context *input_ctx, size_t idx);
+
+/**
+ * Writes out the render output buffer.
+ *
+ * @param render a pointer to the render state
+ * @return true if successful, false otherwise
+ */
+bool flush_output(struct sh_render_state *render);
+
 /**
  * Terminates input.
  *
@@ -167,9 +573,15 @@ bool enable_raw_mode(struct termios *orig_termios) {
         return false;
     }
 
+    return resume_raw_mode(orig_termios);
+}
+
+bool resume_raw_mode(struct termios const *orig_termios) {
     struct termios raw = *orig_termios;
     raw.c_lflag &= ~(ECHO | ICANON);
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) < 0) {
+
+    // `TCSADRAIN` (unlike `TCSAFLUSH`) keeps any input the user typed ahead.
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, &raw) < 0) {
         perror("tcsetattr");
         return false;
     }
@@ -178,7 +590,7 @@ bool enable_raw_mode(struct termios *orig_termios) {
 }
 
 bool restore_term_mode(struct termios const *orig_termios) {
-    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, orig_termios) < 0) {
+    if (tcsetattr(STDIN_FILENO, TCSADRAIN, orig_termios) < 0) {
         perror("tcsetattr");
         return false;
     }
@@ -186,192 +598,197 @@ bool restore_term_mode(struct termios const *orig_termios) {
 }
 
 ssize_t read_input(
-    struct sh_shell_context const *sh_ctx,
+    struct sh_shell_context *sh_ctx,
     char **out,
     size_t *out_capacity
 ) {
-    struct termios orig_termios;
-    if (!enable_raw_mode(&orig_termios)) {
+    // Without a terminal, there is nothing to edit.
+    if (!sh_ctx->is_interactive) {
         return -1;
     }
 
     struct sh_input_context input_ctx;
     init_input_context(&input_ctx, sh_ctx);
 
-    // Allocate memory for the edit buffer.
-    {
-        size_t new_edit_buf_capacity = 64;
-        char *new_edit_buf = malloc(sizeof(char) * new_edit_buf_capacity);
-        if (new_edit_buf == NULL) {
-            perror("malloc");
-            return -1;
-        }
-        input_ctx.edit_buf_capacity = new_edit_buf_capacity;
-        input_ctx.edit_buf = new_edit_buf;
-    }
-
     update_win_size(&input_ctx);
 
-    // Request the cursor's position.
+    // Request the cursor's position once for this prompt. Afterwards, the
+    // position is tracked locally.
     // Response from the terminal is retrieved from the CPR control sequence
     // (handled in `handle_csi()`).
-    request_cursor_pos();
+    sync_cursor_pos(&input_ctx);
+    set_bracketed_paste(true);
 
-    char c;
-    while ((c = getchar()) != '\n') {
+    while (true) {
+        if (win_size_dirty) {
+            handle_resize(&input_ctx);
+        }
+
+        // Only redraw once all input that has already arrived is processed.
+        // This way, input that arrives in bulk (e.g., typeahead) is drawn at
+        // once. Pastes are drawn when they end.
+        if (!has_buffered_input() && !input_stream.in_paste) {
+            render(&input_ctx);
+        }
+
+        // Check for resizes again if we were interrupted while waiting.
+        if (!has_buffered_input() && !wait_for_input()) {
+            continue;
+        }
+
+        int c = peek_byte();
         if (c == EOF) {
-            if (errno == EINTR) {
+            goto err;
+        }
+
+        // While searching the history, most keys edit the search instead.
+        if (input_ctx.searching) {
+            bool consumed;
+            if (!handle_search_input(&input_ctx, c, &consumed)) {
+                goto err;
+            }
+            if (consumed) {
                 continue;
-            } else {
-                perror("getchar");
             }
         }
 
-        // Grow the edit buffer if needed.
-        if (input_ctx.edit_buf_len + 1 >= input_ctx.edit_buf_capacity) {
-            size_t new_buf_capacity = input_ctx.edit_buf_capacity * 2;
-            char *new_buffer = realloc(
-                input_ctx.edit_buf,
-                sizeof(char) * new_buf_capacity
-            );
-            if (new_buffer == NULL) {
-                perror("realloc");
+        // Insert runs of text all at once.
+        if (is_text_byte(c)) {
+            char const *text;
+            size_t len = take_text_run(&text);
+            bool ok = input_stream.in_paste
+                          ? handle_paste_text(&input_ctx, text, len)
+                          : insert_text(&input_ctx, text, len);
+            if (!ok) {
                 goto err;
             }
-            input_ctx.edit_buf = new_buffer;
-            input_ctx.edit_buf_capacity = new_buf_capacity;
+            continue;
         }
 
-        bool should_request_cursor_update = true;
-        if (c == CSI_START_INTRO_1 && (c = getchar()) == CSI_START_INTRO_2) {
-            // Handle CSI control sequences.
-            // We don't want to request for a cursor update if we just handled
-            // `CSI_CPR` since that would cause an infinite loop.
-            if (handle_csi(&input_ctx) == CSI_CPR) {
-                should_request_cursor_update = false;
+        next_byte();
+        if (c == '\n') {
+            break;
+        }
+
+        if (input_stream.in_paste && c != CSI_START_INTRO_1) {
+            // Pasted tabs become spaces. Other control characters in a paste
+            // are dropped.
+            if (c == '\t' && !handle_paste_text(&input_ctx, " ", 1)) {
+                goto err;
             }
+        } else if (c == CSI_START_INTRO_1 && peek_byte() == CSI_START_INTRO_2) {
+            // Handle CSI control sequences.
+            next_byte();
+            handle_csi(&input_ctx);
         } else if (c == CH_BACKSPACE || c == C0_BACKSPACE) {
             // Handle backspace.
             handle_backspace(&input_ctx);
-        } else if (c >= C0_START && c <= C0_END) {
-            // Ignore other C0 control codes.
+        } else if (c == CH_CTRL_A) {
+            move_cursor(&input_ctx, 0);
+        } else if (c == CH_CTRL_E) {
+            move_cursor(&input_ctx, SIZE_MAX);
+        } else if (c == CH_CTRL_R) {
+            if (!start_search(&input_ctx)) {
+                goto err;
+            }
         } else {
-            // Handle other characters.
-            insert_char(&input_ctx, c);
-        }
-
-        if (should_request_cursor_update) {
-            request_cursor_pos();
+            // Ignore other C0 control codes.
         }
-
-        fflush(stdout);
     }
 
     // We only reach this point if the user enters a newline.
-    assert(c == '\n');
-
+    // A line break in the middle of a paste also ends the line. The rest of
+    // the paste is handled by the next call to `read_input()`.
+    flush_paste(&input_ctx);
     terminate_input(&input_ctx);
 
-    restore_term_mode(&orig_termios);
-
-    *out_capacity = input_ctx.edit_buf_capacity;
-    *out = input_ctx.edit_buf;
-
-    input_ctx.edit_buf = NULL;
+    ssize_t len = gap_buf_len(&input_ctx.edit_buf);
+    char *line = gap_buf_take(&input_ctx.edit_buf, out_capacity);
     destroy_input_context(&input_ctx);
+    if (line == NULL) {
+        return -1;
+    }
 
-    return input_ctx.edit_buf_len;
+    *out = line;
+    return len;
 
 err:
+    set_bracketed_paste(false);
     destroy_input_context(&input_ctx);
     return -1;
 }
 
 void init_input_context(
     struct sh_input_context *input_ctx,
-    struct sh_shell_context const *sh_ctx
+    struct sh_shell_context *sh_ctx
 ) {
     *input_ctx = (struct sh_input_context) {
-        // These are 1-indexed!
-        .cursor_line = 0,
-        .cursor_col = 0,
+        // Until the terminal reports the cursor position, assume that the
+        // prompt (followed by a space) starts at the first column.
+        .origin_col = strlen(sh_ctx->prompt) + 2,
+
+        .cpr_pending = false,
+        .cpr_offset = 0,
+
+        .render = (struct sh_render_state) {
+            .drawn = NULL,
+            .drawn_capacity = 0,
+            .drawn_len = 0,
+            .drawn_cursor = 0,
+
+            .out = NULL,
+            .out_capacity = 0,
+            .out_len = 0,
+        },
 
         .win_width = 0,
         .win_height = 0,
 
-        .edit_buf = NULL,
-        .edit_buf_capacity = 0,
-        .edit_buf_len = 0,
-        .edit_buf_cursor = 0,
+        .paste_buf = NULL,
+        .paste_buf_capacity = 0,
+        .paste_buf_len = 0,
 
         .new_cmdline = NULL,
         .new_cmdline_capacity = 0,
         .new_cmdline_len = 0,
 
+        .searching = false,
+        .search_query = NULL,
+        .search_query_capacity = 0,
+        .search_query_len = 0,
+        .search_has_match = false,
+        .search_match = 0,
+        .search_failed = false,
+
         .sh_ctx = sh_ctx,
-        .history_idx = sh_ctx->history_count,
+        .history_idx = history_end_number(&sh_ctx->history),
+        .history_prefix_len = 0,
     };
+
+    init_gap_buf(&input_ctx->edit_buf);
+    init_gap_buf(&input_ctx->search_display);
 }
 
 void handle_backspace(struct sh_input_context *input_ctx) {
-    if (input_ctx->edit_buf_len <= 0) {
-        return;
-    }
-
-    // If the cursor is at the first column, backspace should first move the
-    // cursor up by one line and all the way to the right.
-    if (input_ctx->cursor_col == 1) {
-        // Move the cursor up by one line.
-        printf("%c%c%c", CSI_START_INTRO_1, CSI_START_INTRO_2, CSI_UP);
-
-        // It is not easy to get the width of the terminal. However, we  can
-        // just move the cursor to the right by a large enough number since
-        // well-behaved terminals will prevent the cursor from "going off".
-        printf(
-            "%c%c%d%c",
-            CSI_START_INTRO_1,
-            CSI_START_INTRO_2,
-            1024,
-            CSI_FORWARD
-        );
-
-        // Finally, we erase the character at the current position.
-        printf(" ");
-
-        // After inserting a character at the last column, the terminal gets
-        // into a weird state where the cursor is at the last column, but
-        // printing a character will move the cursor to the next line and
-        // display the character there (i.e., at the first column of the next
-        // line). Since we printed a " " at the last column, this behaviour will
-        // occur. Moving the cursor forward (even though it is at the last
-        // column) seems to remove this state.
-        printf("%c%c%c", CSI_START_INTRO_1, CSI_START_INTRO_2, CSI_FORWARD);
-
-        input_ctx->cursor_col = input_ctx->win_width;
-        input_ctx->cursor_line--;
-    } else {
-        // "\b" moves the cursor back by one and does not actually erase
-        // any characters. Hence, we use " " to overwrite the character
-        // with a space so that it looks like it has been deleted. Since
-        // " " was written, we need to move the cursor back again using
-        // "\b".
-        printf("\b \b");
+    gap_buf_delete_before(&input_ctx->edit_buf, 1);
+}
 
-        input_ctx->cursor_col--;
-    }
+void handle_delete(struct sh_input_context *input_ctx) {
+    gap_buf_delete_after(&input_ctx->edit_buf, 1);
+}
 
-    input_ctx->edit_buf_len--;
-    input_ctx->edit_buf_cursor--;
+void move_cursor(struct sh_input_context *input_ctx, size_t idx) {
+    gap_buf_move_cursor(&input_ctx->edit_buf, idx);
 }
 
 char handle_csi(struct sh_input_context *input_ctx) {
     char buf[32]; // Should be more than large enough.
     size_t idx = 0;
-    char c = '\0';
+    int c = '\0';
     do {
-        c = getchar();
+        c = next_byte();
         if (c == EOF) {
-            return false;
+            return '\0';
         }
 
         buf[idx] = c;
@@ -379,21 +796,34 @@ char handle_csi(struct sh_input_context *input_ctx) {
 
         // The buffer was too small, so we need to clean up a little. Extremely
         // unlikely to happen.
-        if (idx >= sizeof(buf)) {
-            // Consume all the input characters until the next alphabetical
-            // character.
-            while (!(c >= 'A' && c <= 'z')) {
-                c = getchar();
+        if (idx >= sizeof(buf) - 1) {
+            // Consume all the input characters until the final byte.
+            while (c != EOF && !(c >= '@' && c <= '~')) {
+                c = next_byte();
             }
-            return false;
+            return '\0';
         }
-    } while (!(c >= 'A' && c <= 'z'));
-    // We will assume that sequences are ended with an alphabetical
-    // character (seems to be the case).
+    } while (!(c >= '@' && c <= '~'));
+    // Sequences are ended by a final byte in the range `@` to `~`.
 
     buf[idx] = '\0';
 
+    size_t cursor = gap_buf_cursor(&input_ctx->edit_buf);
     switch (buf[idx - 1]) {
+    case CSI_FORWARD:
+        move_cursor(input_ctx, cursor + 1);
+        return CSI_FORWARD;
+    case CSI_BACK:
+        if (cursor > 0) {
+            move_cursor(input_ctx, cursor - 1);
+        }
+        return CSI_BACK;
+    case CSI_HOME:
+        move_cursor(input_ctx, 0);
+        return CSI_HOME;
+    case CSI_END:
+        move_cursor(input_ctx, SIZE_MAX);
+        return CSI_END;
     case CSI_UP:
         handle_up(input_ctx);
         return CSI_UP;
@@ -403,7 +833,23 @@ char handle_csi(struct sh_input_context *input_ctx) {
     case CSI_CPR:
         handle_cpr(input_ctx, buf);
         return CSI_CPR;
-        break;
+    case CSI_KEY:
+        if (strcmp(buf, PASTE_START) == 0) {
+            input_stream.in_paste = true;
+        } else if (strcmp(buf, PASTE_END) == 0) {
+            input_stream.in_paste = false;
+            flush_paste(input_ctx);
+        } else if (strcmp(buf, KEY_DELETE) == 0) {
+            handle_delete(input_ctx);
+        } else if (strcmp(buf, KEY_HOME) == 0
+                   || strcmp(buf, KEY_HOME_ALT) == 0)
+        {
+            move_cursor(input_ctx, 0);
+        } else if (strcmp(buf, KEY_END) == 0 || strcmp(buf, KEY_END_ALT) == 0)
+        {
+            move_cursor(input_ctx, SIZE_MAX);
+        }
+        return CSI_KEY;
     default:
         // Don't know how to handle, so do nothing.
         return '\0';
@@ -411,115 +857,260 @@ char handle_csi(struct sh_input_context *input_ctx) {
 }
 
 bool handle_up(struct sh_input_context *input_ctx) {
-    if (input_ctx->sh_ctx->history_count == 0 || input_ctx->history_idx == 0) {
-        return true;
-    }
+    struct sh_history *history = &input_ctx->sh_ctx->history;
 
     // If we're moving away from the new commandline, then we need
-    // to save it.
-    if (input_ctx->history_idx == input_ctx->sh_ctx->history_count) {
-        if (input_ctx->new_cmdline_capacity < input_ctx->edit_buf_len + 1) {
-            size_t new_buf_capacity = (input_ctx->edit_buf_len + 1) * 2;
-            char *new_buffer = realloc(
-                input_ctx->new_cmdline,
-                sizeof(char) * new_buf_capacity
-            );
-            if (new_buffer == NULL) {
-                perror("realloc");
-                free(input_ctx->new_cmdline);
-                return false;
-            }
-            input_ctx->new_cmdline = new_buffer;
-            input_ctx->new_cmdline_capacity = new_buf_capacity;
+    // to save it. What was typed so far filters the history items.
+    size_t prefix_len = input_ctx->history_prefix_len;
+    if (input_ctx->history_idx == history_end_number(history)) {
+        if (!save_new_cmdline(input_ctx)) {
+            return false;
         }
+        prefix_len = input_ctx->new_cmdline_len;
+    }
 
-        strncpy(
+    size_t number;
+    if (!history_find_prefix(
+            history,
             input_ctx->new_cmdline,
-            input_ctx->edit_buf,
-            input_ctx->edit_buf_len
-        );
-        input_ctx->new_cmdline_len = input_ctx->edit_buf_len;
-        input_ctx->new_cmdline[input_ctx->new_cmdline_len] = '\0';
+            prefix_len,
+            input_ctx->history_idx,
+            &number
+        ))
+    {
+        return true;
     }
 
-    // Delete all characters on `stdout`.
-    size_t char_count = input_ctx->edit_buf_len;
-    for (size_t idx = 0; idx < char_count; idx++) {
-        handle_backspace(input_ctx);
+    // Copy the previous line into the edit buffer.
+    // `render()` takes care of replacing what is on the terminal.
+    input_ctx->history_idx = number;
+    input_ctx->history_prefix_len = prefix_len;
+    char const *history_line = history_get(history, input_ctx->history_idx);
+    return set_edit_buf(input_ctx, history_line, strlen(history_line));
+}
+
+void handle_down(struct sh_input_context *input_ctx) {
+    struct sh_history *history = &input_ctx->sh_ctx->history;
+    size_t history_end = history_end_number(history);
+    if (input_ctx->history_idx >= history_end) {
+        return;
     }
 
-    // Copy the previous line into the edit buffer.
-    input_ctx->history_idx--;
-    size_t len = strlen(input_ctx->sh_ctx->history[input_ctx->history_idx]);
-    if (input_ctx->edit_buf_capacity < len + 1) {
+    // Copy the next line into the buffer, or go back to the new command line if
+    // there is none.
+    size_t number;
+    if (!history_find_prefix_forward(
+            history,
+            input_ctx->new_cmdline,
+            input_ctx->history_prefix_len,
+            input_ctx->history_idx + 1,
+            &number
+        ))
+    {
+        number = history_end;
+    }
+
+    input_ctx->history_idx = number;
+    size_t len;
+    char const *history_line;
+    if (input_ctx->history_idx == history_end) {
+        len = input_ctx->new_cmdline_len;
+        history_line = input_ctx->new_cmdline;
+    } else {
+        history_line = history_get(history, input_ctx->history_idx);
+        len = strlen(history_line);
+    }
+
+    set_edit_buf(input_ctx, history_line, len);
+}
+
+bool save_new_cmdline(struct sh_input_context *input_ctx) {
+    size_t len = gap_buf_len(&input_ctx->edit_buf);
+    if (input_ctx->new_cmdline_capacity < len + 1) {
         size_t new_buf_capacity = (len + 1) * 2;
         char *new_buffer = realloc(
-            input_ctx->edit_buf,
+            input_ctx->new_cmdline,
             sizeof(char) * new_buf_capacity
         );
         if (new_buffer == NULL) {
             perror("realloc");
-            free(input_ctx->edit_buf);
             return false;
         }
-        input_ctx->edit_buf = new_buffer;
-        input_ctx->edit_buf_capacity = new_buf_capacity;
+        input_ctx->new_cmdline = new_buffer;
+        input_ctx->new_cmdline_capacity = new_buf_capacity;
     }
 
-    strncpy(
-        input_ctx->edit_buf,
-        input_ctx->sh_ctx->history[input_ctx->history_idx],
-        len
-    );
-
-    input_ctx->edit_buf_len = len;
-    input_ctx->edit_buf_cursor = len;
-    input_ctx->edit_buf[input_ctx->edit_buf_len] = '\0';
+    gap_buf_copy(&input_ctx->edit_buf, input_ctx->new_cmdline);
+    input_ctx->new_cmdline_len = len;
+    input_ctx->new_cmdline[input_ctx->new_cmdline_len] = '\0';
+    return true;
+}
 
-    // Replace the output on `stdout` with the previous line.
-    printf("%s", input_ctx->edit_buf);
+bool start_search(struct sh_input_context *input_ctx) {
+    // Searching may replace the new command line with a history item, so save
+    // it first (as when moving up through the history).
+    size_t history_end = history_end_number(&input_ctx->sh_ctx->history);
+    if (input_ctx->history_idx == history_end && !save_new_cmdline(input_ctx)) {
+        return false;
+    }
 
-    return true;
+    input_ctx->searching = true;
+    input_ctx->search_query_len = 0;
+    input_ctx->search_has_match = false;
+    input_ctx->search_failed = false;
+    return update_search(input_ctx, history_end);
 }
 
-void handle_down(struct sh_input_context *input_ctx) {
-    if (input_ctx->sh_ctx->history_count == 0
-        || input_ctx->history_idx >= input_ctx->sh_ctx->history_count)
-    {
-        return;
+bool handle_search_input(
+    struct sh_input_context *input_ctx,
+    int c,
+    bool *consumed_out
+) {
+    *consumed_out = true;
+    size_t history_end = history_end_number(&input_ctx->sh_ctx->history);
+
+    // Text extends the query. The current match is searched again, since it
+    // may still contain the longer query.
+    if (is_text_byte(c)) {
+        char const *text;
+        size_t len = take_text_run(&text);
+
+        // Grow the query buffer if needed.
+        // `+ 1` for the null byte.
+        size_t new_len = input_ctx->search_query_len + len;
+        if (new_len + 1 > input_ctx->search_query_capacity) {
+            size_t new_capacity = (new_len + 1) * 2;
+            char *tmp = realloc(
+                input_ctx->search_query,
+                sizeof(char) * new_capacity
+            );
+            if (tmp == NULL) {
+                perror("realloc");
+                return false;
+            }
+            input_ctx->search_query = tmp;
+            input_ctx->search_query_capacity = new_capacity;
+        }
+
+        memcpy(
+            input_ctx->search_query + input_ctx->search_query_len,
+            text,
+            len
+        );
+        input_ctx->search_query_len = new_len;
+        input_ctx->search_query[new_len] = '\0';
+        return update_search(
+            input_ctx,
+            input_ctx->search_has_match ? input_ctx->search_match + 1
+                                        : history_end
+        );
     }
 
-    // Delete all characters on `stdout`.
-    size_t char_count = input_ctx->edit_buf_len;
-    for (size_t idx = 0; idx < char_count; idx++) {
-        handle_backspace(input_ctx);
+    switch (c) {
+    case CH_CTRL_R:
+        // Move on to an older match.
+        next_byte();
+        return update_search(
+            input_ctx,
+            input_ctx->search_has_match ? input_ctx->search_match
+                                        : history_end
+        );
+    case CH_BACKSPACE:
+    case C0_BACKSPACE:
+        // A shorter query may match more recent items, so start over.
+        next_byte();
+        if (input_ctx->search_query_len > 0) {
+            input_ctx->search_query_len--;
+            input_ctx->search_query[input_ctx->search_query_len] = '\0';
+        }
+        input_ctx->search_has_match = false;
+        return update_search(input_ctx, history_end);
+    case CH_CTRL_G:
+        next_byte();
+        cancel_search(input_ctx);
+        return true;
+    default:
+        // Leave the byte to be handled as usual.
+        *consumed_out = false;
+        return accept_search(input_ctx);
     }
+}
 
-    // Copy the next line into the buffer.
-    input_ctx->history_idx++;
-    size_t len;
-    char *history_line;
-    if (input_ctx->history_idx == input_ctx->sh_ctx->history_count) {
-        len = input_ctx->new_cmdline_len;
-        history_line = input_ctx->new_cmdline;
+bool update_search(struct sh_input_context *input_ctx, size_t before) {
+    struct sh_shell_context *sh_ctx = input_ctx->sh_ctx;
+    char const *query = input_ctx->search_query_len > 0
+                            ? input_ctx->search_query
+                            : "";
+
+    size_t match;
+    if (input_ctx->search_query_len == 0) {
+        input_ctx->search_failed = false;
+    } else if (find_command_by_substring(sh_ctx, query, before, &match)) {
+        input_ctx->search_has_match = true;
+        input_ctx->search_match = match;
+        input_ctx->search_failed = false;
     } else {
-        len = strlen(input_ctx->sh_ctx->history[input_ctx->history_idx]);
-        history_line = input_ctx->sh_ctx->history[input_ctx->history_idx];
+        input_ctx->search_failed = true;
+    }
+
+    // Show the search in place of the edit buffer. `render()` only redraws the
+    // part that changed.
+    struct sh_gap_buf *display = &input_ctx->search_display;
+    char const *prompt = input_ctx->search_failed ? SEARCH_FAILED_PROMPT
+                                                  : SEARCH_PROMPT;
+    if (!gap_buf_set(display, prompt, strlen(prompt))
+        || !gap_buf_insert(display, query, input_ctx->search_query_len)
+        || !gap_buf_insert(
+            display,
+            SEARCH_PROMPT_END,
+            strlen(SEARCH_PROMPT_END)
+        ))
+    {
+        return false;
+    }
+
+    if (input_ctx->search_has_match) {
+        // Put the cursor where the query occurs in the match.
+        char const *line = get_command_by_index(
+            sh_ctx,
+            input_ctx->search_match
+        );
+        size_t line_start = gap_buf_len(display);
+        if (!gap_buf_insert(display, line, strlen(line))) {
+            return false;
+        }
+
+        char const *at = strstr(line, query);
+        if (at != NULL) {
+            gap_buf_move_cursor(display, line_start + (at - line));
+        }
     }
 
-    // The only way to move back down is to have moved up before.
-    // When we move up, we may grow the buffer. However, the buffer
-    // will never shrink, so, when moving down, the buffer is
-    // guaranteed to have enough space.
-    assert(input_ctx->edit_buf_capacity >= len + 1);
+    return true;
+}
+
+bool accept_search(struct sh_input_context *input_ctx) {
+    input_ctx->searching = false;
+
+    if (!input_ctx->search_has_match) {
+        // The edit buffer is unchanged, but needs to be drawn again.
+        gap_buf_mark_edited(&input_ctx->edit_buf, 0);
+        return true;
+    }
 
-    strncpy(input_ctx->edit_buf, history_line, len);
-    input_ctx->edit_buf_len = len;
-    input_ctx->edit_buf_cursor = len;
-    input_ctx->edit_buf[input_ctx->edit_buf_len] = '\0';
+    // The arrow keys no longer filter by what was typed.
+    input_ctx->history_idx = input_ctx->search_match;
+    input_ctx->history_prefix_len = 0;
+    char const *line = get_command_by_index(
+        input_ctx->sh_ctx,
+        input_ctx->search_match
+    );
+    return set_edit_buf(input_ctx, line, strlen(line));
+}
 
-    // Replace the output on `stdout` with the next line.
-    printf("%s", input_ctx->edit_buf);
+void cancel_search(struct sh_input_context *input_ctx) {
+    input_ctx->searching = false;
+    gap_buf_mark_edited(&input_ctx->edit_buf, 0);
 }
 
 bool handle_cpr(struct sh_input_context *input_ctx, char const *bytes) {
@@ -530,25 +1121,142 @@ bool handle_cpr(struct sh_input_context *input_ctx, char const *bytes) {
         return false;
     }
 
-    input_ctx->cursor_line = line;
-    input_ctx->cursor_col = col;
+    // Ignore unsolicited reports.
+    if (!input_ctx->cpr_pending || line == 0 || col == 0) {
+        return false;
+    }
+    input_ctx->cpr_pending = false;
+
+    // The report gives the position of the cursor when it was at
+    // `cpr_offset` in the drawn edit buffer, so walk back by that many cells
+    // to find where the edit buffer starts.
+    size_t width = input_ctx->win_width > 0 ? input_ctx->win_width : SIZE_MAX;
+    size_t cells = (line - 1) * width + (col - 1);
+    if (cells < input_ctx->cpr_offset) {
+        return false;
+    }
+    cells -= input_ctx->cpr_offset;
+
+    input_ctx->origin_col = cells % width + 1;
     return true;
 }
 
-void insert_char(struct sh_input_context *input_ctx, char c) {
-    input_ctx->edit_buf[input_ctx->edit_buf_len] = c;
-    input_ctx->edit_buf_len++;
-    input_ctx->edit_buf_cursor++;
+bool insert_text(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+) {
+    return gap_buf_insert(&input_ctx->edit_buf, text, len);
+}
 
-    // Write the character to `stdout`.
-    putchar(c);
+bool handle_paste_text(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+) {
+    // Grow the paste buffer if needed.
+    if (input_ctx->paste_buf_len + len > input_ctx->paste_buf_capacity) {
+        size_t new_capacity = (input_ctx->paste_buf_len + len) * 2;
+        char *tmp = realloc(input_ctx->paste_buf, sizeof(char) * new_capacity);
+        if (tmp == NULL) {
+            perror("realloc");
+            return false;
+        }
+        input_ctx->paste_buf = tmp;
+        input_ctx->paste_buf_capacity = new_capacity;
+    }
 
-    // Check if the cursor is at the last column.
-    update_win_size(input_ctx);
-    if (input_ctx->cursor_col == input_ctx->win_width) {
-        // Move the cursor down by one line and to the first column.
-        printf("\n");
+    memcpy(input_ctx->paste_buf + input_ctx->paste_buf_len, text, len);
+    input_ctx->paste_buf_len += len;
+    return true;
+}
+
+bool flush_paste(struct sh_input_context *input_ctx) {
+    if (input_ctx->paste_buf_len == 0) {
+        return true;
     }
+
+    bool ok = insert_text(
+        input_ctx,
+        input_ctx->paste_buf,
+        input_ctx->paste_buf_len
+    );
+    input_ctx->paste_buf_len = 0;
+    return ok;
+}
+
+bool wait_for_input() {
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    if (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        return false;
+    }
+
+    // Let `read()` report any other errors.
+    return true;
+}
+
+int peek_byte() {
+    while (!has_buffered_input()) {
+        ssize_t ret = read(STDIN_FILENO, input_stream.buf, INPUT_CHUNK_SIZE);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret < 0) {
+            perror("read");
+            return EOF;
+        }
+
+        if (ret == 0) {
+            return EOF;
+        }
+
+        input_stream.len = ret;
+        input_stream.pos = 0;
+    }
+
+    return (unsigned char) input_stream.buf[input_stream.pos];
+}
+
+int next_byte() {
+    int c = peek_byte();
+    if (c != EOF) {
+        input_stream.pos++;
+    }
+    return c;
+}
+
+size_t take_text_run(char const **text_out) {
+    char const *start = input_stream.buf + input_stream.pos;
+    size_t avail = input_stream.len - input_stream.pos;
+    size_t len = 0;
+    while (len < avail && is_text_byte((unsigned char) start[len])) {
+        len++;
+    }
+
+    input_stream.pos += len;
+    *text_out = start;
+    return len;
+}
+
+bool has_buffered_input() { return input_stream.pos < input_stream.len; }
+
+bool discard_input_line() {
+    int c;
+    do {
+        c = next_byte();
+    } while (c != '\n' && c != EOF);
+    return c != EOF;
+}
+
+bool is_text_byte(int c) {
+    return !((c >= C0_START && c <= C0_END) || c == CH_BACKSPACE);
+}
+
+bool set_bracketed_paste(bool enable) {
+    char const *seq = enable ? BRACKETED_PASTE_ON : BRACKETED_PASTE_OFF;
+    size_t len = strlen(seq);
+    return write(STDOUT_FILENO, seq, len) == (ssize_t) len;
 }
 
 bool update_win_size(struct sh_input_context *input_ctx) {
@@ -562,23 +1270,316 @@ bool update_win_size(struct sh_input_context *input_ctx) {
     return true;
 }
 
+void handle_sigwinch(int signo) { win_size_dirty = 1; }
+
+bool handle_resize(struct sh_input_context *input_ctx) {
+    win_size_dirty = 0;
+
+    unsigned short old_win_width = input_ctx->win_width;
+    if (!update_win_size(input_ctx) || input_ctx->win_width == old_win_width) {
+        return true;
+    }
+
+    struct sh_render_state *render_state = &input_ctx->render;
+
+    // Terminals rewrap the command line to the new width, so work out which
+    // row the cursor is now on and go back to the start of the command line.
+    // Everything from there on is erased and redrawn.
+    size_t width = input_ctx->win_width > 0 ? input_ctx->win_width : SIZE_MAX;
+    size_t cursor_cells = (input_ctx->origin_col - 1)
+                          + render_state->drawn_cursor;
+    size_t rows = cursor_cells / width;
+    if ((rows > 0 && !append_csi(render_state, rows, CSI_UP))
+        || !append_output(render_state, "\r", 1)
+        || !append_csi(render_state, 0, CSI_ERASE_DISPLAY))
+    {
+        return false;
+    }
+
+    char const *prompt = input_ctx->sh_ctx->prompt;
+    size_t prompt_len = strlen(prompt);
+    if (!append_output(render_state, prompt, prompt_len)
+        || !append_output(render_state, " ", 1))
+    {
+        return false;
+    }
+
+    // Move to the next line ourselves if the prompt ends at the last column.
+    // See `render()`.
+    size_t prompt_cells = prompt_len + 1;
+    if (prompt_cells % width == 0
+        && !append_output(render_state, FORCE_WRAP, strlen(FORCE_WRAP)))
+    {
+        return false;
+    }
+
+    input_ctx->origin_col = prompt_cells % width + 1;
+    input_ctx->cpr_pending = false;
+    render_state->drawn_len = 0;
+    render_state->drawn_cursor = 0;
+
+    // Draw the edit buffer and only then ask for the cursor position, so that
+    // the report refers to the redrawn command line.
+    return render(input_ctx) && sync_cursor_pos(input_ctx);
+}
+
 bool request_cursor_pos() {
-    return printf("%c%c%s", CSI_START_INTRO_1, CSI_START_INTRO_2, DSR_POS) == 4;
+    static char const REQUEST[] = {
+        CSI_START_INTRO_1,
+        CSI_START_INTRO_2,
+        DSR_POS[0],
+        DSR_POS[1],
+    };
+    return write(STDOUT_FILENO, REQUEST, sizeof(REQUEST)) == sizeof(REQUEST);
+}
+
+bool sync_cursor_pos(struct sh_input_context *input_ctx) {
+    if (!request_cursor_pos()) {
+        return false;
+    }
+
+    // The request is written immediately, so it refers to where the cursor
+    // was left by the last render.
+    input_ctx->cpr_pending = true;
+    input_ctx->cpr_offset = input_ctx->render.drawn_cursor;
+    return true;
+}
+
+bool set_edit_buf(
+    struct sh_input_context *input_ctx,
+    char const *text,
+    size_t len
+) {
+    return gap_buf_set(&input_ctx->edit_buf, text, len);
+}
+
+bool render(struct sh_input_context *input_ctx) {
+    struct sh_render_state *render = &input_ctx->render;
+    struct sh_gap_buf *edit_buf = input_ctx->searching
+                                      ? &input_ctx->search_display
+                                      : &input_ctx->edit_buf;
+    size_t len = gap_buf_len(edit_buf);
+
+    // Find where the edit buffer starts to differ from what was drawn.
+    // Everything before the first edit since the last render is known to be
+    // the same, so we only need to compare from there.
+    size_t common_len = gap_buf_edited_from(edit_buf);
+    if (common_len > len) {
+        common_len = len;
+    }
+    if (common_len > render->drawn_len) {
+        common_len = render->drawn_len;
+    }
+    while (common_len < len && common_len < render->drawn_len
+           && gap_buf_at(edit_buf, common_len) == render->drawn[common_len])
+    {
+        common_len++;
+    }
+
+    if (common_len < len || common_len < render->drawn_len) {
+        // Make space to remember what is drawn.
+        if (render->drawn_capacity < len) {
+            char *tmp = realloc(render->drawn, sizeof(char) * len * 2);
+            if (tmp == NULL) {
+                perror("realloc");
+                return false;
+            }
+            render->drawn = tmp;
+            render->drawn_capacity = len * 2;
+        }
+
+        // Redraw everything after the first difference.
+        if (!append_cursor_move(input_ctx, common_len)) {
+            return false;
+        }
+        size_t idx = common_len;
+        while (idx < len) {
+            char const *run;
+            size_t run_len = gap_buf_run(edit_buf, idx, &run);
+            if (!append_output(render, run, run_len)) {
+                return false;
+            }
+            memcpy(render->drawn + idx, run, run_len);
+            idx += run_len;
+        }
+        render->drawn_cursor = len;
+
+        // After writing to the last column, terminals leave the cursor there
+        // until the next character is written, so explicitly move to the next
+        // line to keep the cursor where we think it is.
+        size_t row;
+        size_t col;
+        screen_pos(input_ctx, len, &row, &col);
+        if (len > common_len && col == 0
+            && !append_output(render, FORCE_WRAP, strlen(FORCE_WRAP)))
+        {
+            return false;
+        }
+
+        // Erase whatever is left of the old contents.
+        if (len < render->drawn_len
+            && !append_csi(render, 0, CSI_ERASE_DISPLAY))
+        {
+            return false;
+        }
+
+        render->drawn_len = len;
+    }
+    gap_buf_clear_edits(edit_buf);
+
+    if (!append_cursor_move(input_ctx, gap_buf_cursor(edit_buf))) {
+        return false;
+    }
+
+    return flush_output(render);
+}
+
+void screen_pos(
+    struct sh_input_context const *input_ctx,
+    size_t idx,
+    size_t *row_out,
+    size_t *col_out
+) {
+    // Treat an unknown window width as an infinitely wide window.
+    size_t width = input_ctx->win_width > 0 ? input_ctx->win_width : SIZE_MAX;
+    size_t cells = (input_ctx->origin_col - 1) + idx;
+
+    *row_out = cells / width;
+    *col_out = cells % width;
+}
+
+bool append_output(
+    struct sh_render_state *render,
+    char const *bytes,
+    size_t len
+) {
+    // Grow the buffer if needed.
+    if (render->out_len + len > render->out_capacity) {
+        size_t new_capacity = (render->out_len + len) * 2;
+        char *tmp = realloc(render->out, sizeof(char) * new_capacity);
+        if (tmp == NULL) {
+            perror("realloc");
+            return false;
+        }
+        render->out = tmp;
+        render->out_capacity = new_capacity;
+    }
+
+    memcpy(render->out + render->out_len, bytes, len);
+    render->out_len += len;
+    return true;
+}
+
+bool append_csi(struct sh_render_state *render, size_t n, char final) {
+    char buf[32]; // Should be more than large enough.
+    int len = snprintf(
+        buf,
+        sizeof(buf),
+        "%c%c%zu%c",
+        CSI_START_INTRO_1,
+        CSI_START_INTRO_2,
+        n,
+        final
+    );
+    assert(len > 0 && (size_t) len < sizeof(buf));
+    return append_output(render, buf, len);
+}
+
+bool append_cursor_move(struct sh_input_context *input_ctx, size_t idx) {
+    struct sh_render_state *render = &input_ctx->render;
+
+    size_t from_row;
+    size_t from_col;
+    screen_pos(input_ctx, render->drawn_cursor, &from_row, &from_col);
+
+    size_t to_row;
+    size_t to_col;
+    screen_pos(input_ctx, idx, &to_row, &to_col);
+
+    bool ok = true;
+    if (to_row < from_row) {
+        ok = ok && append_csi(render, from_row - to_row, CSI_UP);
+    } else if (to_row > from_row) {
+        ok = ok && append_csi(render, to_row - from_row, CSI_DOWN);
+    }
+
+    if (to_col == 0 && from_col != 0) {
+        ok = ok && append_output(render, "\r", 1);
+    } else if (to_col < from_col) {
+        ok = ok && append_csi(render, from_col - to_col, CSI_BACK);
+    } else if (to_col > from_col) {
+        ok = ok && append_csi(render, to_col - from_col, CSI_FORWARD);
+    }
+
+    if (ok) {
+        render->drawn_cursor = idx;
+    }
+    return ok;
+}
+
+bool flush_output(struct sh_render_state *render) {
+    size_t written = 0;
+    while (written < render->out_len) {
+        ssize_t ret = write(
+            STDOUT_FILENO,
+            render->out + written,
+            render->out_len - written
+        );
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("write");
+            render->out_len = 0;
+            return false;
+        }
+        written += ret;
+    }
+
+    render->out_len = 0;
+    return true;
 }
 
 void terminate_input(struct sh_input_context *input_ctx) {
-    input_ctx->edit_buf[input_ctx->edit_buf_len] = '\0';
-    printf("\n");
+    // Move the cursor past the end of the command line before going to the
+    // next line.
+    move_cursor(input_ctx, SIZE_MAX);
+    if (render(input_ctx)) {
+        append_output(
+            &input_ctx->render,
+            BRACKETED_PASTE_OFF,
+            strlen(BRACKETED_PASTE_OFF)
+        );
+        append_output(&input_ctx->render, "\n", 1);
+        flush_output(&input_ctx->render);
+    }
 }
 
 void destroy_input_context(struct sh_input_context *input_ctx) {
-    free(input_ctx->edit_buf);
-    input_ctx->edit_buf = NULL;
-    input_ctx->edit_buf_capacity = 0;
-    input_ctx->edit_buf_len = 0;
-    input_ctx->edit_buf_cursor = 0;
+    destroy_gap_buf(&input_ctx->edit_buf);
+    destroy_gap_buf(&input_ctx->search_display);
+
+    free(input_ctx->search_query);
+    input_ctx->search_query = NULL;
+    input_ctx->search_query_capacity = 0;
+    input_ctx->search_query_len = 0;
+
+    free(input_ctx->paste_buf);
+    input_ctx->paste_buf = NULL;
+    input_ctx->paste_buf_capacity = 0;
+    input_ctx->paste_buf_len = 0;
 
     free(input_ctx->new_cmdline);
     input_ctx->new_cmdline_capacity = 0;
     input_ctx->new_cmdline_len = 0;
+
+    free(input_ctx->render.drawn);
+    input_ctx->render.drawn = NULL;
+    input_ctx->render.drawn_capacity = 0;
+    input_ctx->render.drawn_len = 0;
+
+    free(input_ctx->render.out);
+    input_ctx->render.out = NULL;
+    input_ctx->render.out_capacity = 0;
+    input_ctx->render.out_len = 0;
 }
@@ -18,16 +18,30 @@
  * This function modifies the terminal attributes to enable raw mode,
  * which disables canonical mode and echo.
  *
+ * Input that has not been read yet is kept.
+ *
  * @param orig_termios a pointer to store the original terminal attributes
  * @return true if successful, false otherwise
  */
 bool enable_raw_mode(struct termios *orig_termios);
 
+/**
+ * Enables raw mode for terminal input again after the terminal was restored to
+ * its original mode.
+ *
+ * Input that has not been read yet is kept.
+ *
+ * @param orig_termios a pointer to the original terminal attributes, as saved
+ * by `enable_raw_mode()`
+ * @return true if successful, false otherwise
+ */
+bool resume_raw_mode(struct termios const *orig_termios);
+
 /**
  * Restores the terminal to its original mode.
  *
  * This function restores the terminal attributes to the state they were in
- * before raw mode was enabled.
+ * before raw mode was enabled. Input that has not been read yet is kept.
  *
  * @param orig_termios a pointer to the original terminal attributes
  * @return true if successful, false otherwise
@@ -41,15 +55,36 @@ bool restore_term_mode(struct termios const *orig_termios);
  * provided buffer. This function allocates memory — callers should free the
  * memory once it is no longer needed.
  *
+ * The terminal must already be in raw mode (see `enable_raw_mode()`).
+ *
  * @param ctx the shell context
  * @param out a pointer to the buffer to store the input
  * @param out_capacity a pointer to store the size of the buffer
  * @return the number of bytes read into the buffer, or -1 on error
  */
 ssize_t read_input(
-    struct sh_shell_context const *ctx,
+    struct sh_shell_context *ctx,
     char **out,
     size_t *out_capacity
 );
 
+/**
+ * Handler for the `SIGWINCH` signal.
+ *
+ * This handler marks the cached terminal window size as outdated. The line
+ * editor refreshes the size and redraws the command line the next time it
+ * checks.
+ */
+void handle_sigwinch(int signo);
+
+/**
+ * Discards input up to and including the next newline.
+ *
+ * This function should be used to skip the rest of a line after
+ * `read_input()` fails.
+ *
+ * @return false if the end of the input was reached, true otherwise
+ */
+bool discard_input_line();
+
 #endif
@@ -1,31 +1,278 @@
 #include <assert.h>
-#include <glob.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+#include "glob_expand.h"
 #include "lex.h"
-#include "raw_lex.h"
+#include "scan.h"
+
+/** Represents the classes of characters that the lexer distinguishes. */
+enum sh_char_class {
+    SH_CHAR_TEXT,         // Everything else.
+    SH_CHAR_END,          // The terminating null character.
+    SH_CHAR_WHITESPACE,   // A single whitespace character.
+    SH_CHAR_OPERATOR,     // & ; ! | < >
+    SH_CHAR_2_ANGLE_R,    // 2>
+    SH_CHAR_SINGLE_QUOTE, // '
+    SH_CHAR_DOUBLE_QUOTE, // "
+    SH_CHAR_GLOB,         // * ? [
+    SH_CHAR_BACKSLASH,    // `\`
+    SH_CHAR_CLASS_COUNT,  // The number of character classes.
+};
+
+/**
+ * The class of each character. `2` is text unless followed by `>`, which
+ * `classify()` checks separately.
+ */
+static uint8_t const CHAR_CLASSES[256] = {
+    ['\0'] = SH_CHAR_END,          [' '] = SH_CHAR_WHITESPACE,
+    ['\n'] = SH_CHAR_WHITESPACE,   ['\t'] = SH_CHAR_WHITESPACE,
+    ['\f'] = SH_CHAR_WHITESPACE,   ['\r'] = SH_CHAR_WHITESPACE,
+    ['\v'] = SH_CHAR_WHITESPACE,   ['&'] = SH_CHAR_OPERATOR,
+    [';'] = SH_CHAR_OPERATOR,      ['!'] = SH_CHAR_OPERATOR,
+    ['|'] = SH_CHAR_OPERATOR,      ['<'] = SH_CHAR_OPERATOR,
+    ['>'] = SH_CHAR_OPERATOR,      ['\''] = SH_CHAR_SINGLE_QUOTE,
+    ['"'] = SH_CHAR_DOUBLE_QUOTE,  ['*'] = SH_CHAR_GLOB,
+    ['?'] = SH_CHAR_GLOB,          ['['] = SH_CHAR_GLOB,
+    ['\\'] = SH_CHAR_BACKSLASH,
+};
+
+/** Represents what the lexer does on a transition. */
+enum sh_lex_action {
+    SH_LEX_ACTION_NONE,        /**< Do nothing. */
+    SH_LEX_ACTION_APPEND,      /**< Append the input to the current word. */
+    SH_LEX_ACTION_APPEND_ESCAPED, /**< Append the input to the current word,
+                                     escaping it if the word is a glob pattern
+                                     so that the expansion takes it
+                                     literally. */
+    SH_LEX_ACTION_APPEND_GLOB,    /**< Append an unescaped glob metacharacter to
+                                     the current word, making the word a glob
+                                     pattern. */
+    SH_LEX_ACTION_EMIT,           /**< Output the input as a token. */
+    SH_LEX_ACTION_END_WORD,       /**< End the current word. */
+    SH_LEX_ACTION_END_WORD_LITERAL, /**< End the current word without
+                                       expanding it, even if it is a glob
+                                       pattern. */
+    SH_LEX_ACTION_END_WORD_EMIT,  /**< End the current word, then output the
+                                     input as a token. */
+    SH_LEX_ACTION_SPLIT_2_ANGLE_R, /**< Append the `2` of an escaped `2>` to the
+                                      current word, end the word, then output
+                                      a `>` token. */
+    SH_LEX_ACTION_UNTERMINATED,    /**< Fail because a quoted string is not
+                                      terminated. */
+};
+
+/** A transition of the lexer's state machine. */
+struct sh_lex_transition {
+    uint8_t next_state; /**< The state to change to. */
+    uint8_t action;     /**< The action to perform. */
+};
+
+/** Shorthand for the entries of `TRANSITIONS`. */
+#define TRANSITION(state, action)                                              \
+    {SH_LEX_STATE_##state, SH_LEX_ACTION_##action}
+
+/**
+ * The lexer's state machine, indexed by the current state and the class of the
+ * input.
+ *
+ * Reaching the end of the input always finishes the lex, whichever transition
+ * is taken. A backslash escapes whatever comes after it, even within quotes.
+ * Backslashes are not kept in words; escaped input is appended literally
+ * instead.
+ */
+static struct sh_lex_transition const
+    TRANSITIONS[SH_LEX_STATE_COUNT][SH_CHAR_CLASS_COUNT] = {
+        [SH_LEX_STATE_DULL] = {
+            [SH_CHAR_TEXT] = TRANSITION(WORD_UNQUOTED, APPEND),
+            [SH_CHAR_END] = TRANSITION(DULL, EMIT),
+            [SH_CHAR_WHITESPACE] = TRANSITION(DULL, NONE),
+            [SH_CHAR_OPERATOR] = TRANSITION(DULL, EMIT),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(DULL, EMIT),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(WORD_SINGLE_QUOTED, NONE),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(WORD_DOUBLE_QUOTED, NONE),
+            [SH_CHAR_GLOB] = TRANSITION(WORD_UNQUOTED, APPEND_GLOB),
+            [SH_CHAR_BACKSLASH] = TRANSITION(WORD_UNQUOTED_ESCAPE, NONE),
+        },
+        [SH_LEX_STATE_WORD_UNQUOTED] = {
+            [SH_CHAR_TEXT] = TRANSITION(WORD_UNQUOTED, APPEND),
+            [SH_CHAR_END] = TRANSITION(DULL, END_WORD_EMIT),
+            [SH_CHAR_WHITESPACE] = TRANSITION(DULL, END_WORD),
+            [SH_CHAR_OPERATOR] = TRANSITION(DULL, END_WORD_EMIT),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(DULL, END_WORD_EMIT),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(WORD_SINGLE_QUOTED, NONE),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(WORD_DOUBLE_QUOTED, NONE),
+            [SH_CHAR_GLOB] = TRANSITION(WORD_UNQUOTED, APPEND_GLOB),
+            [SH_CHAR_BACKSLASH] = TRANSITION(WORD_UNQUOTED_ESCAPE, NONE),
+        },
+        // A trailing backslash ends the word without an end token. The word
+        // is not expanded, as a pattern ending in a lone backslash matches
+        // nothing.
+        [SH_LEX_STATE_WORD_UNQUOTED_ESCAPE] = {
+            [SH_CHAR_TEXT] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_END] = TRANSITION(DULL, END_WORD_LITERAL),
+            [SH_CHAR_WHITESPACE] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_OPERATOR] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(DULL, SPLIT_2_ANGLE_R),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_GLOB] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+            [SH_CHAR_BACKSLASH] = TRANSITION(WORD_UNQUOTED, APPEND_ESCAPED),
+        },
+        [SH_LEX_STATE_WORD_SINGLE_QUOTED] = {
+            [SH_CHAR_TEXT] = TRANSITION(WORD_SINGLE_QUOTED, APPEND),
+            [SH_CHAR_END] = TRANSITION(WORD_SINGLE_QUOTED, UNTERMINATED),
+            [SH_CHAR_WHITESPACE] = TRANSITION(WORD_SINGLE_QUOTED, APPEND),
+            [SH_CHAR_OPERATOR] = TRANSITION(WORD_SINGLE_QUOTED, APPEND),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(WORD_SINGLE_QUOTED, APPEND),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(WORD_UNQUOTED, NONE),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(WORD_SINGLE_QUOTED, APPEND),
+            [SH_CHAR_GLOB] = TRANSITION(WORD_SINGLE_QUOTED, APPEND_ESCAPED),
+            [SH_CHAR_BACKSLASH] = TRANSITION(WORD_SINGLE_QUOTED_ESCAPE, NONE),
+        },
+        // A trailing backslash in a quoted string ends the lex without ending
+        // the word or outputting an end token.
+        [SH_LEX_STATE_WORD_SINGLE_QUOTED_ESCAPE] = {
+            [SH_CHAR_TEXT] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_END] = TRANSITION(WORD_SINGLE_QUOTED, NONE),
+            [SH_CHAR_WHITESPACE] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_OPERATOR] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_GLOB] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_BACKSLASH] = TRANSITION(
+                WORD_SINGLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+        },
+        [SH_LEX_STATE_WORD_DOUBLE_QUOTED] = {
+            [SH_CHAR_TEXT] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND),
+            [SH_CHAR_END] = TRANSITION(WORD_DOUBLE_QUOTED, UNTERMINATED),
+            [SH_CHAR_WHITESPACE] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND),
+            [SH_CHAR_OPERATOR] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(WORD_UNQUOTED, NONE),
+            [SH_CHAR_GLOB] = TRANSITION(WORD_DOUBLE_QUOTED, APPEND_ESCAPED),
+            [SH_CHAR_BACKSLASH] = TRANSITION(WORD_DOUBLE_QUOTED_ESCAPE, NONE),
+        },
+        [SH_LEX_STATE_WORD_DOUBLE_QUOTED_ESCAPE] = {
+            [SH_CHAR_TEXT] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_END] = TRANSITION(WORD_DOUBLE_QUOTED, NONE),
+            [SH_CHAR_WHITESPACE] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_OPERATOR] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_2_ANGLE_R] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_SINGLE_QUOTE] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_DOUBLE_QUOTE] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_GLOB] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+            [SH_CHAR_BACKSLASH] = TRANSITION(
+                WORD_DOUBLE_QUOTED,
+                APPEND_ESCAPED
+            ),
+        },
+};
+
+/**
+ * Classifies the input at the given character pointer.
+ *
+ * @param cp the character pointer to classify
+ * @param len_out a pointer to write the number of characters of input in the
+ * class to. For text, this is the whole run of text characters.
+ * @return the class of the input
+ */
+enum sh_char_class classify(char const *cp, size_t *len_out);
 
 /**
- * Returns the corresponding token type from the given raw token type.
+ * Returns the token type of an operator or the end of the input.
  *
- * If there is no corresponding token type, an assertion failure will be raised!
+ * If the input is not an operator or the end of the input, an assertion
+ * failure will be raised!
  *
- * @param raw_token_type the raw token type to get the corresponding token type
- * for
- * @return the corresonding token type
+ * @param cp the character pointer to the input
+ * @param char_class the class of the input
+ * @return the corresponding token type
  */
 enum sh_token_type
-token_type_from_raw_token_type(enum sh_raw_token_type raw_token_type);
+operator_token_type(char const *cp, enum sh_char_class char_class);
 
-/** Represents the result of appending to a dynamically allocated buffer. */
+/**
+ * Returns the text of a token of the given type.
+ *
+ * Word tokens have no fixed text, so an assertion failure will be raised for
+ * them!
+ *
+ * @param token_type the token type to get the text for
+ * @return the statically allocated text
+ */
+char const *token_text_from_token_type(enum sh_token_type token_type);
+
+/** Represents the result of appending to an arena-allocated buffer. */
 enum sh_append_result {
     SH_APPEND_SUCCESS,
     SH_APPEND_MEMORY_ERROR,
 };
 
+/**
+ * Grows the concatenation buffer of the given context, if needed, to fit text
+ * of the given length.
+ *
+ * @param ctx the lex context whose concatenation buffer is to be grown
+ * @param text_len the length of the text to fit (exclusive of the null
+ * character)
+ *
+ * @return `SH_APPEND_SUCCESS` if successful or `SH_APPEND_MEMORY_ERROR` if
+ * memory allocation failed
+ */
+enum sh_append_result
+reserve_catbuf(struct sh_lex_context *ctx, size_t text_len);
+
 /**
  * Appends the given text content to the concatenation buffer of the given
  * context.
@@ -40,6 +287,56 @@ enum sh_append_result {
 enum sh_append_result
 append_to_catbuf(struct sh_lex_context *ctx, char const *text, size_t text_len);
 
+/**
+ * Appends the given text content to the concatenation buffer of the given
+ * context literally.
+ *
+ * If the concatenation buffer holds a glob pattern, the first character of the
+ * text is escaped with a backslash. The rest of the text is ordinary text, or
+ * else it would not be in the same character class. Otherwise, the text is
+ * appended as is.
+ *
+ * @param ctx the lex context whose concatenation buffer is to be appended to
+ * @param text the text content to append to the concatenation buffer
+ * @param the length of the text content (exclusive of the null character)
+ *
+ * @return `SH_APPEND_SUCCESS` if successful or `SH_APPEND_MEMORY_ERROR` if
+ * memory allocation failed
+ */
+enum sh_append_result append_escaped_to_catbuf(
+    struct sh_lex_context *ctx,
+    char const *text,
+    size_t text_len
+);
+
+/**
+ * Turns the literal text in the concatenation buffer of the given context into
+ * a glob pattern, by escaping its glob metacharacters with backslashes.
+ *
+ * @param ctx the lex context whose concatenation buffer is to be converted
+ *
+ * @return `SH_APPEND_SUCCESS` if successful or `SH_APPEND_MEMORY_ERROR` if
+ * memory allocation failed
+ */
+enum sh_append_result make_catbuf_pattern(struct sh_lex_context *ctx);
+
+/**
+ * Turns the glob pattern in the concatenation buffer of the given context back
+ * into literal text, by removing the backslashes that escape its characters.
+ * Literal text is left as is.
+ *
+ * @param ctx the lex context whose concatenation buffer is to be converted
+ */
+void make_catbuf_literal(struct sh_lex_context *ctx);
+
+/**
+ * Checks whether a character has a special meaning in a glob pattern.
+ *
+ * @param c the character to check
+ * @return true if the character must be escaped to be taken literally
+ */
+bool is_glob_metachar(char c);
+
 /**
  * Appends the given token to the token buffer of the given context.
  *
@@ -53,24 +350,23 @@ enum sh_append_result
 append_to_tokbuf(struct sh_lex_context *ctx, struct sh_token token);
 
 /**
- * Checks if the given raw token type indicates the start of an unquoted section
- * of a word.
+ * Appends a token of the given type, with its static text, to the token buffer
+ * of the given context.
  *
- * A raw token type indicates as such if it is one of the following:
- * `SH_RAW_TOKEN_TEXT`, `SH_RAW_TOKEN_BACKSLASH`, `SH_RAW_TOKEN_ASTERISK`,
- * `SH_RAW_TOKEN_QUESTION` or `SH_RAW_TOKEN_SQUARE_BRACKET_L`.
+ * @param ctx the lex context whose token buffer is to be appended to
+ * @param type the type of the token
  *
- * @param raw_tok_type the raw token type to check
- * @return `true` if the raw token type indicates the start of an unquoted
- * section of a word and `false` otherwise
+ * @return `SH_APPEND_SUCCESS` if successful or `SH_APPEND_MEMORY_ERROR` if
+ * memory allocation failed
  */
-bool is_unquoted_section_marker(enum sh_raw_token_type raw_tok_type);
+enum sh_append_result
+emit_token(struct sh_lex_context *ctx, enum sh_token_type type);
 
 /** Represents the result of ending a word token. */
 enum sh_end_word_result {
     SH_END_WORD_SUCCESS,
     SH_END_WORD_MEMORY_ERROR,
-    SH_END_WORD_GLOB_ABORTED,
+    SH_END_WORD_GLOB_ERROR,
 };
 
 /**
@@ -79,43 +375,137 @@ enum sh_end_word_result {
  * This function should only be called after the completion of lexing a word
  * token!
  *
- * This function attempts to expand the current contents of the concatenation
- * buffer by treating the contents as a glob pattern. If the expansion is
- * successful, all resulting paths are converted into word tokens and added to
- * the token buffer of the context. If the expansion yields no matching results,
- * then the concatenation buffer is converted to a word token after removing the
- * escaping backslashes (since those backslashes are for escaping metacharacters
- * before passing to `glob()`).
+ * If the concatenation buffer holds literal text, it is converted to a word
+ * token directly. Otherwise, this function attempts to expand the glob pattern
+ * in the concatenation buffer. If the expansion is successful, all resulting
+ * paths are converted into word tokens and added to the token buffer of the
+ * context. If the expansion yields no matching results, then the concatenation
+ * buffer is converted to a word token after removing the escaping backslashes
+ * (since those backslashes are for escaping metacharacters before expanding
+ * the pattern).
  *
  * @param ctx the lex context
  * @return the result of attempting to end the word
  */
 enum sh_end_word_result end_word(struct sh_lex_context *ctx);
 
-void init_lex_context(struct sh_lex_context *ctx_out, char const *input) {
+/**
+ * Converts the result of ending a word into the result of a lex.
+ *
+ * @param end_word_result the result of ending a word
+ * @return the corresponding lex result, or `SH_LEX_ONGOING` if successful
+ */
+enum sh_lex_result lex_result_from_end_word_result(
+    enum sh_end_word_result end_word_result
+);
+
+/**
+ * Records a token into the skeleton that the given context is recording into,
+ * if any.
+ *
+ * The text of words is copied into the skeleton's arena, while operators keep
+ * their static text. If memory cannot be allocated, the skeleton is marked as
+ * failed and nothing more is recorded into it, but the lex carries on.
+ *
+ * @param ctx the lex context
+ * @param type the type of the token
+ * @param is_pattern whether the token is a word that is a glob pattern
+ * @param text the text of the token, or the pattern for a glob pattern
+ */
+void record_token(
+    struct sh_lex_context *ctx,
+    enum sh_token_type type,
+    bool is_pattern,
+    char const *text
+);
+
+/**
+ * Outputs the next token of the skeleton that the given context is replaying.
+ *
+ * @param ctx the lex context
+ * @return the result of the lex
+ */
+enum sh_lex_result replay_token(struct sh_lex_context *ctx);
+
+void init_lex_context(
+    struct sh_lex_context *ctx_out,
+    char const *input,
+    struct sh_arena *arena,
+    struct sh_dir_cache *dir_cache,
+    struct sh_glob_budget const *glob_budget
+) {
     // Initialise the context.
     *ctx_out = (struct sh_lex_context) {
+        .arena = arena,
+        .dir_cache = dir_cache,
+        .glob_budget = glob_budget,
+        .glob_result = SH_GLOB_SUCCESS,
+
         .tokbuf_capacity = 0,
         .tokbuf_len = 0,
         .tokbuf = NULL,
 
+        .cp = input,
+        .finished = false,
         .state = SH_LEX_STATE_DULL,
-        .escape = false,
 
         .catbuf_capacity = 0,
         .catbuf_len = 0,
         .catbuf = NULL,
+        .catbuf_is_pattern = false,
+
+        .recording = NULL,
+        .replay = NULL,
+        .replay_idx = 0,
     };
+}
+
+void init_lex_replay_context(
+    struct sh_lex_context *ctx_out,
+    struct sh_token_skeleton const *skeleton,
+    struct sh_arena *arena,
+    struct sh_dir_cache *dir_cache,
+    struct sh_glob_budget const *glob_budget
+) {
+    assert(!skeleton->failed);
 
-    // Initialise the raw lex context.
-    init_raw_lex_context(&ctx_out->raw_ctx, input);
+    init_lex_context(ctx_out, "", arena, dir_cache, glob_budget);
+    ctx_out->replay = skeleton;
+}
+
+void init_token_skeleton(
+    struct sh_token_skeleton *skeleton,
+    struct sh_arena *arena
+) {
+    *skeleton = (struct sh_token_skeleton) {
+        .arena = arena,
+        .capacity = 0,
+        .count = 0,
+        .tokens = NULL,
+        .has_patterns = false,
+        .failed = false,
+    };
+}
+
+void record_lex(
+    struct sh_lex_context *ctx,
+    struct sh_token_skeleton *skeleton
+) {
+    ctx->recording = skeleton;
 }
 
 enum sh_lex_result lex(struct sh_lex_context *ctx) {
+    if (ctx->finished) {
+        return SH_LEX_END;
+    }
+
     // Allocate memory for the concatenation buffer if not yet done.
     if (ctx->catbuf == NULL) {
         size_t new_catbuf_capacity = 16;
-        char *new_catbuf = malloc(sizeof(char) * new_catbuf_capacity);
+        char *new_catbuf = arena_alloc(
+            ctx->arena,
+            sizeof(char) * new_catbuf_capacity
+        );
         if (new_catbuf == NULL) {
             return SH_LEX_MEMORY_ERROR;
         }
@@ -125,289 +515,312 @@ enum sh_lex_result lex(struct sh_lex_context *ctx) {
         ctx->catbuf[0] = '\0';
     }
 
-    // Keep track of the return value.
-    enum sh_lex_result result = SH_LEX_ONGOING;
-
-    // Get the next raw token.
-    struct sh_raw_token raw_token;
-    enum sh_raw_lex_result raw_lex_result = raw_lex(&ctx->raw_ctx, &raw_token);
-
-    // Decide whether to continue based on the results of the raw lex.
-    switch (raw_lex_result) {
-    case SH_RAW_LEX_END:
-        result = SH_LEX_END;
-        goto ret;
-    case SH_RAW_LEX_MEMORY_ERROR:
-        result = SH_LEX_MEMORY_ERROR;
-        goto ret;
-    case SH_RAW_LEX_GLOB_ERROR:
-        result = SH_LEX_GLOB_ERROR;
-        goto ret;
-    case SH_RAW_LEX_ONGOING:
-        break;
+    if (ctx->replay != NULL) {
+        return replay_token(ctx);
     }
 
-    assert(raw_lex_result == SH_RAW_LEX_ONGOING);
-
-    // Determine which state to change to.
-    enum sh_lex_state old_state = ctx->state;
-    if (ctx->escape) {
-        // Don't do any state transitions if we're escaping the current token.
-        assert(
-            old_state == SH_LEX_STATE_WORD_QUOTED
-            || old_state == SH_LEX_STATE_WORD_UNQUOTED
-        );
-    } else if (old_state == SH_LEX_STATE_WORD_QUOTED
-        && raw_token.type == ctx->start_quote.type)
-    {
-        // Reached the closing quote for a quoted string.
-        ctx->state = SH_LEX_STATE_WORD_QUOTED_END;
-    } else if (old_state == SH_LEX_STATE_WORD_QUOTED && raw_token.type == SH_RAW_TOKEN_END)
-    {
-        // Reached the end of the token sequence even though we haven't
-        // terminated the current quoted string.
-        result = SH_LEX_UNTERMINATED_QUOTE;
-        goto ret;
-    } else if (old_state == SH_LEX_STATE_WORD_QUOTED) {
-        // No state transition — the only way to leave the quoted state is to
-        // see the end quote.
-    } else if (is_unquoted_section_marker(raw_token.type)) {
-        // Start of an unquoted section of a word.
-        ctx->state = SH_LEX_STATE_WORD_UNQUOTED;
-    } else if (raw_token.type == SH_RAW_TOKEN_DOUBLE_QUOTE || raw_token.type == SH_RAW_TOKEN_SINGLE_QUOTE)
-    {
-        // Start of a quoted section of a word.
-        ctx->state = SH_LEX_STATE_WORD_QUOTED;
-        ctx->start_quote = raw_token;
-
-        // We don't actually need to do anything with the opening quote.
-        result = SH_LEX_ONGOING;
-        goto ret;
-    } else {
-        // Everything else would just be the dull state.
-        ctx->state = SH_LEX_STATE_DULL;
-    }
+    // Keep going until a token has been output or the input has ended.
+    size_t tokbuf_len = ctx->tokbuf_len;
+    while (!ctx->finished && ctx->tokbuf_len == tokbuf_len) {
+        char const *cp = ctx->cp;
+        size_t len;
+        enum sh_char_class char_class = classify(cp, &len);
+        struct sh_lex_transition transition
+            = TRANSITIONS[ctx->state][char_class];
+
+        enum sh_lex_result result = SH_LEX_ONGOING;
+        switch ((enum sh_lex_action) transition.action) {
+        case SH_LEX_ACTION_NONE:
+            break;
 
-    // If we exited a word, then write the token.
-    if ((old_state == SH_LEX_STATE_WORD_QUOTED_END
-         || old_state == SH_LEX_STATE_WORD_UNQUOTED)
-        && (ctx->state == SH_LEX_STATE_DULL || raw_token.type == SH_RAW_TOKEN_END))
-    {
-        enum sh_end_word_result end_word_result = end_word(ctx);
-        switch (end_word_result) {
-        case SH_END_WORD_MEMORY_ERROR:
-            result = SH_LEX_MEMORY_ERROR;
-            goto ret;
-        case SH_END_WORD_GLOB_ABORTED:
-            result = SH_LEX_GLOB_ERROR;
-            goto ret;
-        case SH_END_WORD_SUCCESS:
+        case SH_LEX_ACTION_APPEND:
+            if (append_to_catbuf(ctx, cp, len) != SH_APPEND_SUCCESS) {
+                return SH_LEX_MEMORY_ERROR;
+            }
             break;
-        }
-    }
 
-    // Perform the actions for the current state.
-    switch (ctx->state) {
-    case SH_LEX_STATE_DULL: {
-        // Check if the token is a whitespace token. Whitespace tokens are
-        // thrown away for the dull state.
-        if (raw_token.type == SH_RAW_TOKEN_WHITESPACE) {
+        case SH_LEX_ACTION_APPEND_ESCAPED:
+            if (append_escaped_to_catbuf(ctx, cp, len) != SH_APPEND_SUCCESS) {
+                return SH_LEX_MEMORY_ERROR;
+            }
             break;
-        }
 
-        // At this point, the token must be one of the other special characters.
+        case SH_LEX_ACTION_APPEND_GLOB:
+            if ((!ctx->catbuf_is_pattern
+                 && make_catbuf_pattern(ctx) != SH_APPEND_SUCCESS)
+                || append_to_catbuf(ctx, cp, len) != SH_APPEND_SUCCESS)
+            {
+                return SH_LEX_MEMORY_ERROR;
+            }
+            break;
 
-        struct sh_token token = (struct sh_token) {
-            .type = token_type_from_raw_token_type(raw_token.type),
-            .text = raw_token.text, // This is guaranteed to be statically
-                                    // allocated, so no copying is necessary.
-        };
+        case SH_LEX_ACTION_EMIT:
+            if (emit_token(ctx, operator_token_type(cp, char_class))
+                != SH_APPEND_SUCCESS)
+            {
+                return SH_LEX_MEMORY_ERROR;
+            }
+            break;
 
-        if (append_to_tokbuf(ctx, token) != SH_APPEND_SUCCESS) {
-            result = SH_LEX_MEMORY_ERROR;
-            goto ret;
-        }
+        case SH_LEX_ACTION_END_WORD:
+            result = lex_result_from_end_word_result(end_word(ctx));
+            break;
 
-        break;
-    }
+        case SH_LEX_ACTION_END_WORD_LITERAL:
+            make_catbuf_literal(ctx);
+            result = lex_result_from_end_word_result(end_word(ctx));
+            break;
 
-    case SH_LEX_STATE_WORD_QUOTED:
-    case SH_LEX_STATE_WORD_UNQUOTED: {
-        // Handle escaped characters.
-        if (ctx->escape) {
-            // Special case for `2>`. We need to escape the `2` and add it to
-            // the word, but create a separate special for token `>`.
-            if (ctx->state == SH_LEX_STATE_WORD_UNQUOTED
-                && raw_token.type == SH_RAW_TOKEN_2_ANGLE_BRACKET_R)
-            {
-                // Append the escaped "2".
-                if (append_to_catbuf(ctx, "2", 1) != SH_APPEND_SUCCESS) {
-                    result = SH_LEX_MEMORY_ERROR;
-                    goto ret;
-                }
-
-                // We need to end the current word since `>` is a special token.
-                enum sh_end_word_result end_word_result = end_word(ctx);
-                switch (end_word_result) {
-                case SH_END_WORD_MEMORY_ERROR:
-                    result = SH_LEX_MEMORY_ERROR;
-                    goto ret;
-                case SH_END_WORD_GLOB_ABORTED:
-                    result = SH_LEX_GLOB_ERROR;
-                    goto ret;
-                case SH_END_WORD_SUCCESS:
-                    break;
-                }
-
-                // Create and append the `>` token.
-                struct sh_token angle_r_tok = (struct sh_token) {
-                    .type = SH_TOKEN_ANGLE_BRACKET_R,
-                    .text = ">",
-                };
-
-                if (append_to_tokbuf(ctx, angle_r_tok) != SH_APPEND_SUCCESS) {
-                    result = SH_LEX_MEMORY_ERROR;
-                    goto ret;
-                }
-
-                // This is the only time we'll change the state from here.
-                ctx->state = SH_LEX_STATE_DULL;
-            } else if (append_to_catbuf(ctx, raw_token.text, strlen(raw_token.text)) != SH_APPEND_SUCCESS)
+        case SH_LEX_ACTION_END_WORD_EMIT:
+            result = lex_result_from_end_word_result(end_word(ctx));
+            if (result == SH_LEX_ONGOING
+                && emit_token(ctx, operator_token_type(cp, char_class))
+                       != SH_APPEND_SUCCESS)
             {
                 result = SH_LEX_MEMORY_ERROR;
-                goto ret;
             }
-
-            ctx->escape = false;
             break;
-        }
 
-        // If the token is a backslash, then we need to escape the next token.
-        if (raw_token.type == SH_RAW_TOKEN_BACKSLASH) {
-            // Backslash followed by any character will make that character be
-            // taken literally, so we can just add a backslash unconditionally.
-            // Keep in mind that we are building a string to pass to `glob()`.
-            if (append_to_catbuf(ctx, "\\", 1) != SH_APPEND_SUCCESS) {
+        case SH_LEX_ACTION_SPLIT_2_ANGLE_R:
+            // The `2` is escaped and belongs to the word, but the `>` is still
+            // special.
+            if (append_to_catbuf(ctx, cp, 1) != SH_APPEND_SUCCESS) {
+                return SH_LEX_MEMORY_ERROR;
+            }
+            result = lex_result_from_end_word_result(end_word(ctx));
+            if (result == SH_LEX_ONGOING
+                && emit_token(ctx, SH_TOKEN_ANGLE_BRACKET_R)
+                       != SH_APPEND_SUCCESS)
+            {
                 result = SH_LEX_MEMORY_ERROR;
-                goto ret;
             }
-            ctx->escape = true;
             break;
-        }
 
-        // Otherwise, we need to add the token's text.
-        // However, if we're inside a quote, characters special to `glob()` need
-        // to be escaped.
-        if (ctx->state == SH_LEX_STATE_WORD_QUOTED
-            && (raw_token.type == SH_RAW_TOKEN_ASTERISK
-                || raw_token.type == SH_RAW_TOKEN_QUESTION
-                || raw_token.type == SH_RAW_TOKEN_SQUARE_BRACKET_L)
-            && append_to_catbuf(ctx, "\\", 1) != SH_APPEND_SUCCESS)
-        {
-            result = SH_LEX_MEMORY_ERROR;
-            goto ret;
+        case SH_LEX_ACTION_UNTERMINATED:
+            return SH_LEX_UNTERMINATED_QUOTE;
         }
 
-        // Finally, add the text of the current token.
-        if (append_to_catbuf(ctx, raw_token.text, strlen(raw_token.text))
-            != SH_APPEND_SUCCESS)
-        {
-            result = SH_LEX_MEMORY_ERROR;
-            goto ret;
+        if (result != SH_LEX_ONGOING) {
+            return result;
         }
 
-        break;
-    }
-
-    case SH_LEX_STATE_WORD_QUOTED_END:
-        break;
+        ctx->cp += len;
+        ctx->state = transition.next_state;
+        if (char_class == SH_CHAR_END) {
+            ctx->finished = true;
+        }
     }
 
-ret:
-    if (result != SH_LEX_END) {
-        destroy_raw_token(&raw_token);
-    }
-    return result;
+    return SH_LEX_ONGOING;
 }
 
-void destroy_lex_context(struct sh_lex_context *ctx) {
-    free(ctx->catbuf);
-    ctx->catbuf = NULL;
-    ctx->catbuf_len = 0;
-    ctx->catbuf_capacity = 0;
+void reset_lex_buffers(struct sh_lex_context *ctx) {
+    // Words are only ever in progress within a call to `lex()`.
+    assert(ctx->catbuf_len == 0);
 
-    for (size_t idx = 0; idx < ctx->tokbuf_len; idx++) {
-        destroy_token(&ctx->tokbuf[idx]);
-    }
-
-    free(ctx->tokbuf);
-    ctx->tokbuf = NULL;
-    ctx->tokbuf_len = 0;
     ctx->tokbuf_capacity = 0;
+    ctx->tokbuf_len = 0;
+    ctx->tokbuf = NULL;
+
+    ctx->catbuf_capacity = 0;
+    ctx->catbuf = NULL;
 }
 
-void destroy_token(struct sh_token *token) {
-    // Only the `text` `SH_TOKEN_WORD` is dynamically allocated. Other token
-    // types use static allocation.
-    if (token->type == SH_TOKEN_WORD) {
-        // NOTE: This is a safe cast since we are no longer using it. Strangely,
-        // `free()` takes in a non-const pointer. Linus Torvalds (creator of
-        // Linux) seems to agree that `free()` shouldn't take in a non-const
-        // pointer.
-        free((char *) token->text);
-        token->text = NULL;
+enum sh_char_class classify(char const *cp, size_t *len_out) {
+    enum sh_char_class char_class = CHAR_CLASSES[(unsigned char) *cp];
+    if (char_class != SH_CHAR_TEXT) {
+        *len_out = char_class == SH_CHAR_END ? 0 : 1;
+        return char_class;
     }
+
+    // `2>` is special, but `2` on its own is text.
+    if (*cp == '2' && *(cp + 1) == '>') {
+        *len_out = 2;
+        return SH_CHAR_2_ANGLE_R;
+    }
+
+    // Every state treats the characters in a run of text the same way, so the
+    // whole run is handled at once.
+    *len_out = scan_text_end(cp + 1) - cp;
+    return SH_CHAR_TEXT;
 }
 
 enum sh_token_type
-token_type_from_raw_token_type(enum sh_raw_token_type raw_token_type) {
-    switch (raw_token_type) {
-    case SH_RAW_TOKEN_AMP:
+operator_token_type(char const *cp, enum sh_char_class char_class) {
+    if (char_class == SH_CHAR_END) {
+        return SH_TOKEN_END;
+    }
+    if (char_class == SH_CHAR_2_ANGLE_R) {
+        return SH_TOKEN_2_ANGLE_BRACKET_R;
+    }
+
+    switch (*cp) {
+    case '&':
         return SH_TOKEN_AMP;
-    case SH_RAW_TOKEN_SEMICOLON:
+    case ';':
         return SH_TOKEN_SEMICOLON;
-    case SH_RAW_TOKEN_EXCLAM:
+    case '!':
         return SH_TOKEN_EXCLAM;
-    case SH_RAW_TOKEN_PIPE:
+    case '|':
         return SH_TOKEN_PIPE;
-    case SH_RAW_TOKEN_ANGLE_BRACKET_L:
+    case '<':
         return SH_TOKEN_ANGLE_BRACKET_L;
-    case SH_RAW_TOKEN_ANGLE_BRACKET_R:
+    case '>':
         return SH_TOKEN_ANGLE_BRACKET_R;
-    case SH_RAW_TOKEN_2_ANGLE_BRACKET_R:
-        return SH_TOKEN_2_ANGLE_BRACKET_R;
-    case SH_RAW_TOKEN_END:
-        return SH_TOKEN_END;
     default:
         assert(false);
     }
 }
 
+char const *token_text_from_token_type(enum sh_token_type token_type) {
+    switch (token_type) {
+    case SH_TOKEN_AMP:
+        return "&";
+    case SH_TOKEN_SEMICOLON:
+        return ";";
+    case SH_TOKEN_EXCLAM:
+        return "!";
+    case SH_TOKEN_PIPE:
+        return "|";
+    case SH_TOKEN_ANGLE_BRACKET_L:
+        return "<";
+    case SH_TOKEN_ANGLE_BRACKET_R:
+        return ">";
+    case SH_TOKEN_2_ANGLE_BRACKET_R:
+        return "2>";
+    case SH_TOKEN_END:
+        return "";
+    default:
+        assert(false);
+    }
+}
+
+enum sh_append_result
+reserve_catbuf(struct sh_lex_context *ctx, size_t text_len) {
+    // `+ 1` for null character.
+    if (ctx->catbuf_len + text_len + 1 <= ctx->catbuf_capacity) {
+        return SH_APPEND_SUCCESS;
+    }
+
+    size_t new_capacity = ctx->catbuf_capacity + text_len * 2 + 1;
+    char *tmp = arena_grow(
+        ctx->arena,
+        ctx->catbuf,
+        sizeof(char) * ctx->catbuf_capacity,
+        sizeof(char) * new_capacity
+    );
+    if (tmp == NULL) {
+        return SH_APPEND_MEMORY_ERROR;
+    }
+
+    ctx->catbuf_capacity = new_capacity;
+    ctx->catbuf = tmp;
+    return SH_APPEND_SUCCESS;
+}
+
 enum sh_append_result append_to_catbuf(
     struct sh_lex_context *ctx,
     char const *text,
     size_t text_len
 ) {
-    // Grow the buffer if needed.
-    // `+ 1` for null character.
-    if (ctx->catbuf_len + text_len + 1 > ctx->catbuf_capacity) {
-        size_t new_capacity = ctx->catbuf_capacity + text_len * 2 + 1;
-        char *tmp = realloc(ctx->catbuf, sizeof(char) * new_capacity);
-        if (tmp == NULL) {
-            return SH_APPEND_MEMORY_ERROR;
-        }
-
-        ctx->catbuf_capacity = new_capacity;
-        ctx->catbuf = tmp;
+    if (reserve_catbuf(ctx, text_len) != SH_APPEND_SUCCESS) {
+        return SH_APPEND_MEMORY_ERROR;
     }
 
     // Append the text to the buffer.
-    strncpy(ctx->catbuf + ctx->catbuf_len, text, text_len);
+    memcpy(ctx->catbuf + ctx->catbuf_len, text, text_len);
     ctx->catbuf_len += text_len;
     ctx->catbuf[ctx->catbuf_len] = '\0';
     return SH_APPEND_SUCCESS;
 }
 
+enum sh_append_result append_escaped_to_catbuf(
+    struct sh_lex_context *ctx,
+    char const *text,
+    size_t text_len
+) {
+    if (!ctx->catbuf_is_pattern) {
+        return append_to_catbuf(ctx, text, text_len);
+    }
+
+    // Only the first character is escaped, but it may be any character, since
+    // characters like `]` and `-` are also special within brackets.
+    if (append_to_catbuf(ctx, "\\", 1) != SH_APPEND_SUCCESS
+        || append_to_catbuf(ctx, text, text_len) != SH_APPEND_SUCCESS)
+    {
+        return SH_APPEND_MEMORY_ERROR;
+    }
+    return SH_APPEND_SUCCESS;
+}
+
+enum sh_append_result make_catbuf_pattern(struct sh_lex_context *ctx) {
+    ctx->catbuf_is_pattern = true;
+
+    // The text so far comes before the first unescaped metacharacter, so it is
+    // outside of any brackets, and only the metacharacters need escaping.
+    size_t metachar_count = 0;
+    for (size_t idx = 0; idx < ctx->catbuf_len; idx++) {
+        if (is_glob_metachar(ctx->catbuf[idx])) {
+            metachar_count++;
+        }
+    }
+
+    if (metachar_count == 0) {
+        return SH_APPEND_SUCCESS;
+    }
+
+    if (reserve_catbuf(ctx, metachar_count) != SH_APPEND_SUCCESS) {
+        return SH_APPEND_MEMORY_ERROR;
+    }
+
+    // Escape the metacharacters from the back, so that nothing is overwritten
+    // before it has been moved.
+    size_t new_len = ctx->catbuf_len + metachar_count;
+    char *pwrite = ctx->catbuf + new_len;
+    *pwrite = '\0';
+    for (size_t idx = ctx->catbuf_len; idx > 0; idx--) {
+        char c = ctx->catbuf[idx - 1];
+        *--pwrite = c;
+        if (is_glob_metachar(c)) {
+            *--pwrite = '\\';
+        }
+    }
+    ctx->catbuf_len = new_len;
+    return SH_APPEND_SUCCESS;
+}
+
+void make_catbuf_literal(struct sh_lex_context *ctx) {
+    // Literal text has no escaping backslashes to remove.
+    if (!ctx->catbuf_is_pattern) {
+        return;
+    }
+    ctx->catbuf_is_pattern = false;
+
+    // We only remove one backslash if there are two consecutive backslashes
+    // since the second backslash is escaped.
+    char *pread = ctx->catbuf;
+    char *pwrite = ctx->catbuf;
+    while (*pread != '\0') {
+        // Handle escaped backslashes.
+        if (*pread == '\\' && *(pread + 1) == '\\') {
+            pread++;
+            *pwrite = *pread;
+            pwrite++;
+        } else if (*pread != '\\') {
+            *pwrite = *pread;
+            pwrite++;
+        }
+        pread++;
+    }
+    *pwrite = '\0';
+    ctx->catbuf_len = pwrite - ctx->catbuf;
+}
+
+bool is_glob_metachar(char c) {
+    enum sh_char_class char_class = CHAR_CLASSES[(unsigned char) c];
+    return char_class == SH_CHAR_GLOB || char_class == SH_CHAR_BACKSLASH;
+}
+
 enum sh_append_result
 append_to_tokbuf(struct sh_lex_context *ctx, struct sh_token token) {
     // Grow the buffer if needed.
@@ -417,8 +830,10 @@ append_to_tokbuf(struct sh_lex_context *ctx, struct sh_token token) {
                                   ? 4
                                   : ctx->tokbuf_capacity * 2;
 
-        struct sh_token *tmp = realloc(
+        struct sh_token *tmp = arena_grow(
+            ctx->arena,
             ctx->tokbuf,
+            sizeof(struct sh_token) * ctx->tokbuf_capacity,
             sizeof(struct sh_token) * new_capacity
         );
 
@@ -437,45 +852,73 @@ append_to_tokbuf(struct sh_lex_context *ctx, struct sh_token token) {
     return SH_APPEND_SUCCESS;
 }
 
+enum sh_append_result
+emit_token(struct sh_lex_context *ctx, enum sh_token_type type) {
+    struct sh_token token = (struct sh_token) {
+        .type = type,
+        .text = token_text_from_token_type(type),
+    };
+    record_token(ctx, type, false, token.text);
+    return append_to_tokbuf(ctx, token);
+}
+
 enum sh_end_word_result end_word(struct sh_lex_context *ctx) {
+    // Patterns are recorded before they are expanded, so that replaying them
+    // expands them again.
+    record_token(ctx, SH_TOKEN_WORD, ctx->catbuf_is_pattern, ctx->catbuf);
+
+    // Words without unescaped metacharacters can never be expanded, so they
+    // skip the expansion. Their escapes have already been removed.
+    if (!ctx->catbuf_is_pattern) {
+        struct sh_token token = (struct sh_token) {
+            .type = SH_TOKEN_WORD,
+            .text = ctx->catbuf,
+        };
+
+        if (append_to_tokbuf(ctx, token) != SH_APPEND_SUCCESS) {
+            return SH_END_WORD_MEMORY_ERROR;
+        }
+
+        // `token.text` points to `catbuf` now, so start a new one.
+        ctx->catbuf_capacity = 0;
+        ctx->catbuf_len = 0;
+        ctx->catbuf = NULL;
+        return SH_END_WORD_SUCCESS;
+    }
+
     // Keep track of the result.
     enum sh_end_word_result result = SH_END_WORD_SUCCESS;
 
-    // Expand globs.
-    glob_t pg;
-    int glob_ret = glob(ctx->catbuf, 0, NULL, &pg);
-
-    if (glob_ret == GLOB_NOSPACE) {
+    // Expand globs. The resulting paths are allocated from the arena, so they
+    // can be used as token text directly.
+    char const **paths;
+    size_t path_count;
+    enum sh_glob_result glob_result = expand_glob(
+        ctx->catbuf,
+        ctx->arena,
+        ctx->dir_cache,
+        ctx->glob_budget,
+        &paths,
+        &path_count
+    );
+
+    if (glob_result == SH_GLOB_MEMORY_ERROR) {
         result = SH_END_WORD_MEMORY_ERROR;
         goto ret;
     }
 
-    if (glob_ret == GLOB_ABORTED) {
-        result = SH_END_WORD_GLOB_ABORTED;
+    // The expansion went over its budget or was interrupted.
+    if (glob_result != SH_GLOB_SUCCESS && glob_result != SH_GLOB_NO_MATCH) {
+        ctx->glob_result = glob_result;
+        result = SH_END_WORD_GLOB_ERROR;
         goto ret;
     }
 
-    // If there is no match or any other error, we follow bash's behaviour and
-    // treat the word literally.
-    if (glob_ret == GLOB_NOMATCH || glob_ret < 0) {
+    // If there is no match, we follow bash's behaviour and treat the word
+    // literally.
+    if (glob_result == SH_GLOB_NO_MATCH) {
         // We must first remove backslashes since they are no longer needed.
-        // However, we only remove one backslash if there are two consecutive
-        // backslashes since the second backslash is escaped.
-        char *pread = ctx->catbuf;
-        char *pwrite = ctx->catbuf;
-        while (*pread != '\0') {
-            // Handle escaped backslashes.
-            if (*pread == '\\' && *(pread + 1) == '\\') {
-                pread++;
-                *pwrite = *pread;
-                pwrite++;
-            } else if (*pread != '\\') {
-                *pwrite = *pread;
-                pwrite++;
-            }
-            pread++;
-        }
-        *pwrite = '\0';
+        make_catbuf_literal(ctx);
 
         // Create and append the token.
         struct sh_token token = (struct sh_token) {
@@ -488,7 +931,7 @@ enum sh_end_word_result end_word(struct sh_lex_context *ctx) {
             goto ret;
         }
 
-        // Don't free `catbuf` because `token.text` points to it!
+        // `token.text` points to `catbuf` now, so start a new one.
         ctx->catbuf_capacity = 0;
         ctx->catbuf_len = 0;
         ctx->catbuf = NULL;
@@ -497,27 +940,13 @@ enum sh_end_word_result end_word(struct sh_lex_context *ctx) {
         goto ret;
     }
 
-    // At this point, the `glob()` must have been successful.
-    assert(glob_ret == 0);
-    for (size_t idx = 0; idx < pg.gl_pathc; idx++) {
-        // We don't want to use the pointers from `pg.gl_pathv` directly because
-        // `pg` needs to be cleaned up with `globfree()`, so we copy each glob
-        // result.
-        size_t text_len = strlen(pg.gl_pathv[idx]);
-        char *text = malloc(sizeof(char) * (text_len + 1));
-        if (text == NULL) {
-            result = SH_END_WORD_MEMORY_ERROR;
-            goto ret;
-        }
-
-        // Copy the characters into `text`.
-        strncpy(text, pg.gl_pathv[idx], text_len);
-        text[text_len] = '\0';
-
+    // At this point, the expansion must have been successful.
+    assert(glob_result == SH_GLOB_SUCCESS);
+    for (size_t idx = 0; idx < path_count; idx++) {
         // Create and append the token.
         struct sh_token token = (struct sh_token) {
             .type = SH_TOKEN_WORD,
-            .text = text,
+            .text = paths[idx],
         };
 
         if (append_to_tokbuf(ctx, token) != SH_APPEND_SUCCESS) {
@@ -527,18 +956,113 @@ enum sh_end_word_result end_word(struct sh_lex_context *ctx) {
     }
 
 ret:
-    // No need to free `catbuf` since it can be reused.
-    // Let `destroy_lex_context()` handle the freeing.
-    ctx->catbuf_len = 0;
+    // `catbuf` can be reused for the next word, unless the token took it.
+    if (ctx->catbuf != NULL) {
+        ctx->catbuf_len = 0;
+        ctx->catbuf[0] = '\0';
+    }
+    ctx->catbuf_is_pattern = false;
 
-    globfree(&pg);
     return result;
 }
 
-bool is_unquoted_section_marker(enum sh_raw_token_type raw_tok_type) {
-    return raw_tok_type == SH_RAW_TOKEN_TEXT
-           || raw_tok_type == SH_RAW_TOKEN_BACKSLASH
-           || raw_tok_type == SH_RAW_TOKEN_ASTERISK
-           || raw_tok_type == SH_RAW_TOKEN_QUESTION
-           || raw_tok_type == SH_RAW_TOKEN_SQUARE_BRACKET_L;
+enum sh_lex_result lex_result_from_end_word_result(
+    enum sh_end_word_result end_word_result
+) {
+    switch (end_word_result) {
+    case SH_END_WORD_MEMORY_ERROR:
+        return SH_LEX_MEMORY_ERROR;
+    case SH_END_WORD_GLOB_ERROR:
+        return SH_LEX_GLOB_ERROR;
+    case SH_END_WORD_SUCCESS:
+        break;
+    }
+    return SH_LEX_ONGOING;
+}
+
+void record_token(
+    struct sh_lex_context *ctx,
+    enum sh_token_type type,
+    bool is_pattern,
+    char const *text
+) {
+    struct sh_token_skeleton *skeleton = ctx->recording;
+    if (skeleton == NULL || skeleton->failed) {
+        return;
+    }
+
+    // Grow the array if needed.
+    if (skeleton->count == skeleton->capacity) {
+        size_t new_capacity = skeleton->capacity == 0
+                                  ? 8
+                                  : skeleton->capacity * 2;
+        struct sh_skeleton_token *tmp = arena_grow(
+            skeleton->arena,
+            skeleton->tokens,
+            sizeof(struct sh_skeleton_token) * skeleton->capacity,
+            sizeof(struct sh_skeleton_token) * new_capacity
+        );
+        if (tmp == NULL) {
+            skeleton->failed = true;
+            return;
+        }
+
+        skeleton->capacity = new_capacity;
+        skeleton->tokens = tmp;
+    }
+
+    // Words are built in `catbuf`, which is reused, so their text is copied.
+    if (type == SH_TOKEN_WORD) {
+        text = arena_strdup(skeleton->arena, text);
+        if (text == NULL) {
+            skeleton->failed = true;
+            return;
+        }
+    }
+
+    skeleton->tokens[skeleton->count] = (struct sh_skeleton_token) {
+        .type = type,
+        .is_pattern = is_pattern,
+        .text = text,
+    };
+    skeleton->count++;
+    if (is_pattern) {
+        skeleton->has_patterns = true;
+    }
+}
+
+enum sh_lex_result replay_token(struct sh_lex_context *ctx) {
+    struct sh_token_skeleton const *skeleton = ctx->replay;
+    if (ctx->replay_idx == skeleton->count) {
+        ctx->finished = true;
+        return SH_LEX_END;
+    }
+
+    struct sh_skeleton_token const *token = &skeleton->tokens[ctx->replay_idx];
+    ctx->replay_idx++;
+
+    // Patterns are put back into `catbuf`, where the lexer left them, and
+    // expanded again.
+    if (token->is_pattern) {
+        if (append_to_catbuf(ctx, token->text, strlen(token->text))
+            != SH_APPEND_SUCCESS)
+        {
+            return SH_LEX_MEMORY_ERROR;
+        }
+        ctx->catbuf_is_pattern = true;
+        return lex_result_from_end_word_result(end_word(ctx));
+    }
+
+    struct sh_token replayed = (struct sh_token) {
+        .type = token->type,
+        .text = token->text,
+    };
+    if (append_to_tokbuf(ctx, replayed) != SH_APPEND_SUCCESS) {
+        return SH_LEX_MEMORY_ERROR;
+    }
+
+    if (token->type == SH_TOKEN_END) {
+        ctx->finished = true;
+    }
+    return SH_LEX_ONGOING;
 }
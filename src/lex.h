@@ -10,7 +10,8 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
-#include "raw_lex.h"
+#include "arena.h"
+#include "glob_expand.h"
 
 /** Represents the type of a token. */
 enum sh_token_type {
@@ -35,38 +36,95 @@ struct sh_token {
     char const *text;
 };
 
+/** A token of a command line from before its globs are expanded. */
+struct sh_skeleton_token {
+    enum sh_token_type type; /**< The type of the token. */
+    bool is_pattern;  /**< Whether the token is a word that is a glob pattern,
+                         which is expanded again whenever it is replayed. */
+    char const *text; /**< The text of the token. Patterns keep the
+                         backslashes that escape their literal characters. */
+};
+
+/**
+ * The tokens of a command line from before its globs are expanded, which can be
+ * replayed without lexing the command line again.
+ */
+struct sh_token_skeleton {
+    struct sh_arena *arena; /**< Arena to allocate the tokens and their text
+                               from. */
+    size_t capacity;        /**< Capacity of the tokens array. */
+    size_t count;           /**< Number of tokens. */
+    struct sh_skeleton_token *tokens; /**< The tokens, ending with an end
+                                         token once the lex has ended. */
+    bool has_patterns; /**< Whether any of the tokens is a glob pattern. */
+    bool failed;       /**< Whether memory could not be allocated for a token,
+                          which leaves the skeleton incomplete. */
+};
+
 /** Represents the possible states of the lexer. */
 enum sh_lex_state {
-    SH_LEX_STATE_DULL,        /**< Not in a quoted string, unquoted section of a
-                                  word or at the closing quote for a string. */
-    SH_LEX_STATE_WORD_QUOTED, /**< In a quoted string. */
-    SH_LEX_STATE_WORD_QUOTED_END, /**< At the closing quote for a string. */
-    SH_LEX_STATE_WORD_UNQUOTED,   /**< In an unquoted section of a word. */
+    SH_LEX_STATE_DULL,            /**< Not in a word. */
+    SH_LEX_STATE_WORD_UNQUOTED,   /**< In a word, outside of quotes. */
+    SH_LEX_STATE_WORD_UNQUOTED_ESCAPE, /**< After a backslash in a word,
+                                          outside of quotes. */
+    SH_LEX_STATE_WORD_SINGLE_QUOTED,   /**< In a single-quoted string. */
+    SH_LEX_STATE_WORD_SINGLE_QUOTED_ESCAPE, /**< After a backslash in a
+                                               single-quoted string. */
+    SH_LEX_STATE_WORD_DOUBLE_QUOTED,        /**< In a double-quoted string. */
+    SH_LEX_STATE_WORD_DOUBLE_QUOTED_ESCAPE, /**< After a backslash in a
+                                               double-quoted string. */
+    SH_LEX_STATE_COUNT, /**< The number of states. */
 };
 
 /** Keeps track of various context information required by a lex. */
 struct sh_lex_context {
+    /** Arena to allocate the buffers and the tokens' text from. */
+    struct sh_arena *arena;
+
+    /** Cache of directory listings for expanding globs, or `NULL`. */
+    struct sh_dir_cache *dir_cache;
+
+    /** Limits on expanding each glob, or `NULL`. */
+    struct sh_glob_budget const *glob_budget;
+
+    /** The result of the glob expansion that failed, if lexing ended with
+       `SH_LEX_GLOB_ERROR`. */
+    enum sh_glob_result glob_result;
+
     /** Buffer for storing the output tokens. */
     size_t tokbuf_capacity;
     size_t tokbuf_len;
     struct sh_token *tokbuf;
 
-    /** Raw lexer. */
-    struct sh_raw_lex_context raw_ctx;
+    /** The current character being processed in the input string. */
+    char const *cp;
+
+    /** Keeps track of whether lexing has ended. */
+    bool finished;
 
     /** The current state of the lexer. */
     enum sh_lex_state state;
 
-    /** Whether the (first character of the) next token should be escaped. */
-    bool escape;
-
-    /** Keeps track of the start quote type (' or ") when in a quoted string */
-    struct sh_raw_token start_quote;
-
     /** Buffer for concatenating strings and word sections. */
     size_t catbuf_capacity;
     size_t catbuf_len;
     char *catbuf;
+
+    /**
+     * Whether the concatenation buffer holds a glob pattern rather than literal
+     * text. It becomes a pattern once an unescaped glob metacharacter is
+     * appended, at which point the text already in it is escaped.
+     */
+    bool catbuf_is_pattern;
+
+    /** The skeleton to record the output tokens into, or `NULL`. */
+    struct sh_token_skeleton *recording;
+
+    /** The skeleton to replay instead of lexing an input string, or `NULL`. */
+    struct sh_token_skeleton const *replay;
+
+    /** Index of the next token to replay. */
+    size_t replay_idx;
 };
 
 /** Represents the result of a call to `lex()`. */
@@ -84,54 +142,115 @@ enum sh_lex_result {
     /** Indicates a failure to allocate memory. */
     SH_LEX_MEMORY_ERROR,
 
-    /** Indicates a failure while expanding globs. */
+    /** Indicates that a glob expansion was aborted. The context's
+       `glob_result` says why. */
     SH_LEX_GLOB_ERROR,
 };
 
 /**
  * Initialises a lex context for the given input string.
  *
+ * Everything the lex allocates comes from the given arena, so the tokens stay
+ * valid until the arena is rewound, and there is nothing to destroy
+ * separately.
+ *
+ * @param ctx_out a pointer to the context to initialise
  * @param input the input string
+ * @param arena the arena to allocate from
+ * @param dir_cache the cache of directory listings to expand globs with, or
+ * `NULL` to read every directory
+ * @param glob_budget the limits on expanding each glob, or `NULL` for none
+ */
+void init_lex_context(
+    struct sh_lex_context *ctx_out,
+    char const *input,
+    struct sh_arena *arena,
+    struct sh_dir_cache *dir_cache,
+    struct sh_glob_budget const *glob_budget
+);
+
+/**
+ * Initialises a lex context that replays the tokens of a skeleton instead of
+ * lexing an input string.
+ *
+ * Words that are glob patterns are expanded again, so the output tokens are
+ * the same as lexing the recorded input string again would give. The
+ * skeleton's tokens must stay valid until the lex has ended.
+ *
  * @param ctx_out a pointer to the context to initialise
+ * @param skeleton the skeleton to replay, which must be complete
+ * @param arena the arena to allocate from
+ * @param dir_cache the cache of directory listings to expand globs with, or
+ * `NULL` to read every directory
+ * @param glob_budget the limits on expanding each glob, or `NULL` for none
+ */
+void init_lex_replay_context(
+    struct sh_lex_context *ctx_out,
+    struct sh_token_skeleton const *skeleton,
+    struct sh_arena *arena,
+    struct sh_dir_cache *dir_cache,
+    struct sh_glob_budget const *glob_budget
+);
+
+/**
+ * Initialises an empty token skeleton.
+ *
+ * @param skeleton a pointer to the skeleton to initialise
+ * @param arena the arena to allocate the tokens and their text from
+ */
+void init_token_skeleton(
+    struct sh_token_skeleton *skeleton,
+    struct sh_arena *arena
+);
+
+/**
+ * Makes a lexer record the tokens that it outputs into a skeleton, with the
+ * glob patterns that words are expanded from instead of the expansions.
+ *
+ * This should be called before the first call to `lex()`.
+ *
+ * @param ctx the lex context
+ * @param skeleton the skeleton to record into
  */
-void init_lex_context(struct sh_lex_context *ctx_out, char const *input);
+void record_lex(
+    struct sh_lex_context *ctx,
+    struct sh_token_skeleton *skeleton
+);
 
 /**
  * Lexes an input string specified by the context into a sequence of tokens.
  *
  * This function is reentrant and should be called with a lex context
- * initialised by `init_lex_context()`. Each lex should have this function
- * called multiple times with the same context.
+ * initialised by `init_lex_context()` or `init_lex_replay_context()`. Each lex
+ * should have this function called multiple times with the same context. Each
+ * call reads the input until at least one token has been output or the input
+ * has ended.
  *
- * Output tokens are stored in the lex context.
+ * Output tokens are appended to the lex context's token buffer. Tokens that
+ * have been consumed may be dropped from it in between calls by setting
+ * `tokbuf_len` to 0, so that the buffer is reused.
  *
  * The behaviour of this function filters out whitespace, combines quotes and
- * text into words and expands globs.
+ * text into words and expands globs. The input is read one character (or run
+ * of plain text) at a time by a table-driven state machine, without splitting
+ * it into intermediate tokens first.
  *
  * For the return value, see `enum sh_lex_result`.
  *
  * @param ctx the lex context
- * @param token_in a pointer to write the token to
- *
  * @return the result of the current iteration
  */
 enum sh_lex_result lex(struct sh_lex_context *ctx);
 
 /**
- * Destroys the given lex context.
+ * Makes the lexer allocate its buffers again the next time it needs them.
  *
- * @param ctx the lex context to destroy
- */
-void destroy_lex_context(struct sh_lex_context *ctx);
-
-/**
- * Destroys a token.
+ * This allows the arena to be rewound to a mark taken in between tokens, once
+ * every token in the token buffer has been consumed, even if the buffers were
+ * allocated after the mark.
  *
- * This function should be called on all tokens returned by
- * `lex()` once they are no longer needed.
- *
- * @param token the token to destroy
+ * @param ctx the lex context
  */
-void destroy_token(struct sh_token *token);
+void reset_lex_buffers(struct sh_lex_context *ctx);
 
 #endif
@@ -0,0 +1,230 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "lex.h"
+#include "line_cache.h"
+#include "parse.h"
+
+/**
+ * Hashes a command line's text with 64-bit FNV-1a.
+ *
+ * @param line the text to hash
+ * @param len the length of the text
+ * @return the hash
+ */
+uint64_t hash_line(char const *line, size_t len);
+
+/**
+ * Parses the skeleton of a line without globs into the line's parts.
+ *
+ * @param cached a pointer to the line
+ * @return true if successful, false if the skeleton could not be parsed or
+ * memory could not be allocated
+ */
+bool parse_cached_line(struct sh_cached_line *cached);
+
+/**
+ * Removes a line from a cache and frees it.
+ *
+ * @param cache a pointer to the cache
+ * @param cached a pointer to the line
+ */
+void remove_cached_line(
+    struct sh_line_cache *cache,
+    struct sh_cached_line *cached
+);
+
+void init_line_cache(struct sh_line_cache *cache) {
+    *cache = (struct sh_line_cache) {
+        .first = NULL,
+        .last = NULL,
+        .count = 0,
+    };
+}
+
+void destroy_line_cache(struct sh_line_cache *cache) {
+    while (cache->first != NULL) {
+        remove_cached_line(cache, cache->first);
+    }
+}
+
+struct sh_cached_line *
+find_cached_line(struct sh_line_cache *cache, char const *line) {
+    size_t len = strlen(line);
+    if (len > LINE_CACHE_MAX_LINE_LENGTH) {
+        return NULL;
+    }
+
+    uint64_t hash = hash_line(line, len);
+    struct sh_cached_line *cached = cache->first;
+    while (cached != NULL
+           && (cached->hash != hash || cached->len != len
+               || memcmp(cached->line, line, len) != 0))
+    {
+        cached = cached->next;
+    }
+
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    // Move the line to the front.
+    if (cached != cache->first) {
+        cached->prev->next = cached->next;
+        if (cached->next == NULL) {
+            cache->last = cached->prev;
+        } else {
+            cached->next->prev = cached->prev;
+        }
+
+        cached->prev = NULL;
+        cached->next = cache->first;
+        cache->first->prev = cached;
+        cache->first = cached;
+    }
+
+    return cached;
+}
+
+struct sh_cached_line *new_cached_line(char const *line) {
+    size_t len = strlen(line);
+    if (len > LINE_CACHE_MAX_LINE_LENGTH) {
+        return NULL;
+    }
+
+    struct sh_cached_line *cached = malloc(sizeof(struct sh_cached_line));
+    if (cached == NULL) {
+        return NULL;
+    }
+
+    *cached = (struct sh_cached_line) {
+        .prev = NULL,
+        .next = NULL,
+        .hash = hash_line(line, len),
+        .len = len,
+        .parts = NULL,
+        .part_count = 0,
+    };
+    init_arena(&cached->arena);
+    init_token_skeleton(&cached->skeleton, &cached->arena);
+
+    cached->line = arena_strdup(&cached->arena, line);
+    if (cached->line == NULL) {
+        free_cached_line(cached);
+        return NULL;
+    }
+
+    return cached;
+}
+
+void add_cached_line(
+    struct sh_line_cache *cache,
+    struct sh_cached_line *cached
+) {
+    if (!cached->skeleton.has_patterns && !parse_cached_line(cached)) {
+        free_cached_line(cached);
+        return;
+    }
+
+    // Make space for the line by evicting the least recently used one.
+    if (cache->count == LINE_CACHE_CAPACITY) {
+        remove_cached_line(cache, cache->last);
+    }
+
+    cached->next = cache->first;
+    if (cache->first == NULL) {
+        cache->last = cached;
+    } else {
+        cache->first->prev = cached;
+    }
+    cache->first = cached;
+    cache->count++;
+}
+
+void free_cached_line(struct sh_cached_line *cached) {
+    destroy_arena(&cached->arena);
+    free(cached);
+}
+
+uint64_t hash_line(char const *line, size_t len) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (size_t idx = 0; idx < len; idx++) {
+        hash ^= (unsigned char) line[idx];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+bool parse_cached_line(struct sh_cached_line *cached) {
+    // There are no globs to expand, so no directories are read.
+    struct sh_lex_context lex_ctx;
+    init_lex_replay_context(
+        &lex_ctx,
+        &cached->skeleton,
+        &cached->arena,
+        NULL,
+        NULL
+    );
+
+    struct sh_parse_context parse_ctx;
+    init_parse_context(&parse_ctx, &lex_ctx, &cached->arena);
+
+    size_t capacity = 0;
+    while (true) {
+        struct sh_ast_part part;
+        if (parse_next(&parse_ctx, &part) != SH_PARSE_SUCCESS) {
+            return false;
+        }
+        if (part.type == SH_PART_END) {
+            return true;
+        }
+
+        // Double the capacity when there is not enough space.
+        if (cached->part_count == capacity) {
+            size_t new_capacity = capacity == 0 ? 4 : capacity * 2;
+            struct sh_ast_part *tmp = arena_grow(
+                &cached->arena,
+                cached->parts,
+                sizeof(struct sh_ast_part) * capacity,
+                sizeof(struct sh_ast_part) * new_capacity
+            );
+            if (tmp == NULL) {
+                return false;
+            }
+
+            cached->parts = tmp;
+            capacity = new_capacity;
+        }
+
+        cached->parts[cached->part_count] = part;
+        cached->part_count++;
+
+        // A repeat is the whole line.
+        if (part.type == SH_PART_REPEAT) {
+            return true;
+        }
+    }
+}
+
+void remove_cached_line(
+    struct sh_line_cache *cache,
+    struct sh_cached_line *cached
+) {
+    if (cached->prev == NULL) {
+        cache->first = cached->next;
+    } else {
+        cached->prev->next = cached->next;
+    }
+    if (cached->next == NULL) {
+        cache->last = cached->prev;
+    } else {
+        cached->next->prev = cached->prev;
+    }
+
+    cache->count--;
+
+    free_cached_line(cached);
+}
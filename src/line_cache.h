@@ -0,0 +1,124 @@
+/**
+ * @file line_cache.h
+ *
+ * Declarations for caching command lines that have been lexed and parsed.
+ *
+ * Running the same command line again, whether it is typed again or repeated
+ * with `!`, looks it up by its text instead of lexing and parsing it again. A
+ * line without globs is cached as its parsed parts, which are run directly. A
+ * line with globs is cached as its tokens from before the globs are expanded,
+ * which are replayed so that the globs are expanded again, and parsed.
+ */
+
+#ifndef LINE_CACHE_H
+#define LINE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+#include "lex.h"
+#include "parse.h"
+
+/** The maximum number of command lines to cache. */
+#define LINE_CACHE_CAPACITY 64
+
+/** The maximum length of a command line to cache. */
+#define LINE_CACHE_MAX_LINE_LENGTH 4096
+
+/** A cached command line. */
+struct sh_cached_line {
+    struct sh_cached_line *prev; /**< The more recently used line. */
+    struct sh_cached_line *next; /**< The less recently used line. */
+    struct sh_arena arena;       /**< Arena that everything for the line is
+                                    allocated from. */
+    uint64_t hash;               /**< Hash of the line's text. */
+    size_t len;                  /**< Length of the line's text. */
+    char const *line;            /**< The line's text. */
+    struct sh_token_skeleton skeleton; /**< The line's tokens, from before
+                                          its globs are expanded. */
+    struct sh_ast_part *parts; /**< The line's parts, not including the end of
+                                  the line, if it has no globs. Unused
+                                  otherwise. */
+    size_t part_count;         /**< Number of parts. */
+};
+
+/**
+ * A cache of command lines.
+ *
+ * Lines are kept in order of use, and the least recently used ones are evicted
+ * first.
+ */
+struct sh_line_cache {
+    struct sh_cached_line *first; /**< The most recently used line, or `NULL`
+                                     if there is none. */
+    struct sh_cached_line *last;  /**< The least recently used line, or `NULL`
+                                     if there is none. */
+    size_t count;                 /**< Number of lines. */
+};
+
+/**
+ * Initialises an empty cache of command lines.
+ *
+ * @param cache a pointer to the cache to initialise
+ */
+void init_line_cache(struct sh_line_cache *cache);
+
+/**
+ * Destroys a cache of command lines.
+ *
+ * This function frees all memory associated with the cache.
+ *
+ * @param cache a pointer to the cache
+ */
+void destroy_line_cache(struct sh_line_cache *cache);
+
+/**
+ * Looks up a command line in a cache, and marks it as the most recently used
+ * line if it is found.
+ *
+ * @param cache a pointer to the cache
+ * @param line the command line's text
+ * @return a pointer to the cached line, or `NULL` if it is not cached
+ */
+struct sh_cached_line *
+find_cached_line(struct sh_line_cache *cache, char const *line);
+
+/**
+ * Creates a line to be cached, with an empty skeleton that the line's lex can
+ * be recorded into.
+ *
+ * @param line the command line's text
+ * @return a pointer to the new line, or `NULL` if the line is too long to cache
+ * or memory could not be allocated
+ */
+struct sh_cached_line *new_cached_line(char const *line);
+
+/**
+ * Adds a line to a cache as its most recently used line, evicting the least
+ * recently used line if the cache is full.
+ *
+ * The line's skeleton must have been recorded from a lex that reached the end
+ * of the line. If the line has no globs, its skeleton is parsed into its parts
+ * first. Should that fail, the line is freed instead.
+ *
+ * A line that is in use is never evicted as long as fewer than
+ * `LINE_CACHE_CAPACITY` lines have been added since it was looked up.
+ *
+ * @param cache a pointer to the cache
+ * @param cached a pointer to the line, which the cache takes ownership of
+ */
+void add_cached_line(
+    struct sh_line_cache *cache,
+    struct sh_cached_line *cached
+);
+
+/**
+ * Frees a line that has not been added to a cache.
+ *
+ * @param cached a pointer to the line
+ */
+void free_cached_line(struct sh_cached_line *cached);
+
+#endif
@@ -0,0 +1,58 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "history.h"
+#include "input.h"
+#include "run.h"
+#include "shell.h"
+
+int main() {
+    setup_signals();
+
+    struct sh_shell_context sh_ctx;
+    if (init_shell_context(&sh_ctx) != SH_INIT_SHELL_CONTEXT_SUCCESS) {
+        perror("shell context initialisation");
+        return EXIT_FAILURE;
+    }
+
+    // Main loop.
+    bool should_exit = false;
+    int exit_code = EXIT_SUCCESS;
+    while (!should_exit) {
+        // Pick up the commands that other shells sharing the history file have
+        // run since the last prompt.
+        history_merge(&sh_ctx.history);
+
+        printf("%s ", sh_ctx.prompt);
+        fflush(stdout);
+
+        // Read user input command.
+        char *line = NULL;
+        size_t line_capacity = 0;
+        // `line_len` contains the number of characters in the line (including
+        // the null byte), not the capacity!
+        ssize_t line_len = read_input(&sh_ctx, &line, &line_capacity);
+        if (line_len < 0) {
+            // Consume the rest of the input in `stdin`. There is nothing more
+            // to do once the input has ended.
+            if (!discard_input_line()) {
+                should_exit = true;
+            }
+
+            continue;
+        }
+
+        run(&sh_ctx, line);
+        if (sh_ctx.should_exit) {
+            should_exit = true;
+            exit_code = sh_ctx.exit_code;
+        }
+
+        free(line);
+    }
+
+    destroy_shell_context(&sh_ctx);
+    return exit_code;
+}
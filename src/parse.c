@@ -1,56 +1,54 @@
 #include "parse.h"
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "arena.h"
 #include "lex.h"
 
-/** Contains context information for parsing. */
-struct sh_parse_context {
-    struct sh_token *tokens; /**< Sequence of tokens. */
-    size_t token_count;      /**< Number of tokens in the sequence. */
-    size_t token_idx;        /**< Current index in the token sequence. */
-};
-
 /**
- * Destroys a simple command AST node and frees associated memory.
+ * Returns the next token without consuming it.
  *
- * @param simple_cmd pointer to the simple command node to destroy
- */
-void destroy_simple_cmd(struct sh_ast_simple_cmd *simple_cmd);
-
-/**
- * Destroys a command AST node and frees associated memory.
+ * If every token in the lexer's token buffer has been consumed, the buffer is
+ * emptied and more of the input is lexed.
  *
- * @param cmd pointer to the command node to destroy
- */
-void destroy_cmd(struct sh_ast_cmd *cmd);
-
-/**
- * Destroys a job AST node and frees associated memory.
- *
- * @param job pointer to the job node to destroy
+ * @param ctx pointer to the context
+ * @param out pointer to write the token to
+ * @return `SH_PARSE_SUCCESS` if successful, `SH_PARSE_LEX_ERROR` if lexing
+ * failed (in which case the context's `lex_result` is set), or
+ * `SH_PARSE_UNEXPECTED_END` if the input ended without an end token
  */
-void destroy_job(struct sh_ast_job *job);
+enum sh_parse_result
+peek_token(struct sh_parse_context *ctx, struct sh_token *out);
 
 /**
- * Destroys a command line AST node and frees associated memory.
+ * Consumes the token that was last returned by `peek_token()`.
  *
- * @param cmd_line pointer to the command line node to destroy
+ * @param ctx pointer to the context
  */
-void destroy_cmd_line(struct sh_ast_cmd_line *cmd_line);
+void consume_token(struct sh_parse_context *ctx);
 
 /**
- * Parses a command line AST node from the given token context.
+ * Returns the number of tokens that have been lexed but not yet consumed.
  *
  * @param ctx pointer to the context
- * @param out pointer to the command line AST node to write to
- * @return the result of the parsing operation
+ * @return the number of tokens
  */
-enum sh_parse_result
-parse_cmd_line(struct sh_parse_context *ctx, struct sh_ast_cmd_line *out);
+size_t buffered_token_count(struct sh_parse_context const *ctx);
+
+/** Keeps track of a job's arrays while the job is being parsed. */
+struct sh_job_builder {
+    struct sh_ast_job job;        /**< The job parsed so far. */
+    size_t cmds_capacity;         /**< Capacity of the job's commands. */
+    size_t word_count;            /**< Number of words, including the null
+                                     pointers after each command's. */
+    size_t words_capacity;        /**< Capacity of the job's words. */
+    size_t redirection_count;     /**< Number of redirections. */
+    size_t redirections_capacity; /**< Capacity of the job's redirections. */
+};
 
 /**
  * Parses a job AST node from the given token context.
@@ -63,320 +61,313 @@ enum sh_parse_result
 parse_job(struct sh_parse_context *ctx, struct sh_ast_job *out);
 
 /**
- * Parses a command AST node from the given token context.
+ * Parses a command AST node from the given token context, and appends it to
+ * the job being built.
  *
  * @param ctx pointer to the context
- * @param out pointer to the command AST node to write to
+ * @param builder pointer to the job being built
  * @return the result of the parsing operation
  */
 enum sh_parse_result
-parse_cmd(struct sh_parse_context *ctx, struct sh_ast_cmd *out);
+parse_cmd(struct sh_parse_context *ctx, struct sh_job_builder *builder);
 
 /**
- * Parses a simple command AST node from the given token context.
+ * Makes space for a number of elements in one of a job's arrays.
  *
- * @param ctx pointer to the context
- * @param out pointer to the simple command AST node to write to
- * @return the result of the parsing operation
+ * The array's capacity is at least doubled when it grows, and is limited to
+ * what 32-bit indices can address.
+ *
+ * @param arena the arena to allocate from
+ * @param array the array, or `NULL` if it has not been allocated yet
+ * @param capacity a pointer to the array's capacity, which is updated
+ * @param elem_size the size of an element
+ * @param needed the number of elements to make space for
+ * @return a pointer to the array, or `NULL` if memory could not be allocated or
+ * the array would be too large to index
  */
-enum sh_parse_result
-parse_simple_cmd(struct sh_parse_context *ctx, struct sh_ast_simple_cmd *out);
+void *reserve_job_array(
+    struct sh_arena *arena,
+    void *array,
+    size_t *capacity,
+    size_t elem_size,
+    size_t needed
+);
+
+void init_parse_context(
+    struct sh_parse_context *ctx_out,
+    struct sh_lex_context *lex_ctx,
+    struct sh_arena *arena
+) {
+    *ctx_out = (struct sh_parse_context) {
+        .lex_ctx = lex_ctx,
+        .token_idx = 0,
+        .arena = arena,
+        .started = false,
+        .seen_end = false,
+        .lex_result = SH_LEX_ONGOING,
+    };
+}
 
 enum sh_parse_result
-parse(struct sh_token tokens[], size_t token_count, struct sh_ast_root *out) {
-    struct sh_parse_context ctx =
-        {.tokens = tokens, .token_count = token_count, .token_idx = 0};
+parse_next(struct sh_parse_context *ctx, struct sh_ast_part *out) {
+    struct sh_token token;
+    enum sh_parse_result peek_result = peek_token(ctx, &token);
+    if (peek_result != SH_PARSE_SUCCESS) {
+        return peek_result;
+    }
 
-    struct sh_ast_root root = (struct sh_ast_root) {.emptiness = SH_ROOT_EMPTY};
+    // Try parsing history (e.g., `!foobar`), which has to be the whole command
+    // line.
+    bool is_first = !ctx->started;
+    ctx->started = true;
+    if (is_first && token.type == SH_TOKEN_EXCLAM) {
+        consume_token(ctx);
+        enum sh_parse_result peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+        if (token.type != SH_TOKEN_WORD) {
+            return SH_PARSE_COMMAND_LINE_FAIL;
+        }
+        consume_token(ctx);
+        char const *repeat_query = token.text;
+
+        // If there are still tokens remaining, that means there are tokens we
+        // don't know how to parse.
+        peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+        if (token.type != SH_TOKEN_END) {
+            return SH_PARSE_UNEXPECTED_TOKENS;
+        }
 
-    // No tokens, so an empty root.
-    if (ctx.token_count == 0 || tokens[0].type == SH_TOKEN_END) {
-        *out = root;
+        out->type = SH_PART_REPEAT;
+        out->repeat_query = repeat_query;
         return SH_PARSE_SUCCESS;
     }
 
-    enum sh_parse_result result = parse_cmd_line(&ctx, &root.cmd_line);
-    if (result != SH_PARSE_SUCCESS) {
-        return result;
+    // No tokens left to parse.
+    if (token.type == SH_TOKEN_END) {
+        out->type = SH_PART_END;
+        return SH_PARSE_SUCCESS;
     }
 
-    root.emptiness = SH_ROOT_NONEMPTY;
-
-    // If there are still tokens remaining, that means there are tokens we don't
-    // know how to parse.
-    if (ctx.token_idx >= ctx.token_count
-        || tokens[ctx.token_idx].type != SH_TOKEN_END)
-    {
-        destroy_ast(&root);
-        return SH_PARSE_UNEXPECTED_TOKENS;
+    struct sh_ast_job job;
+    enum sh_parse_result parse_job_result = parse_job(ctx, &job);
+    if (parse_job_result != SH_PARSE_SUCCESS) {
+        return parse_job_result;
     }
 
-    *out = root;
-    return SH_PARSE_SUCCESS;
-}
-
-void destroy_ast(struct sh_ast_root *ast) {
-    if (ast->emptiness == SH_ROOT_EMPTY
-        || ast->cmd_line.type == SH_COMMAND_REPEAT)
-    {
-        return;
+    // At this point, we expect a trailing `&` or `;`, or the end of the command
+    // line. The `&` or `;` is consumed, but nothing after it is looked at yet,
+    // so that the job can run before the rest of the line is lexed.
+    peek_result = peek_token(ctx, &token);
+    if (peek_result != SH_PARSE_SUCCESS) {
+        return peek_result;
     }
 
-    struct sh_ast_cmd_line *cmd_line = &ast->cmd_line;
-    assert(cmd_line->type == SH_COMMAND_JOBS);
-    destroy_cmd_line(cmd_line);
-}
-
-void destroy_simple_cmd(struct sh_ast_simple_cmd *simple_cmd) {
-    free(simple_cmd->argv);
-}
-
-void destroy_cmd(struct sh_ast_cmd *cmd) {
-    free(cmd->redirections);
-    struct sh_ast_simple_cmd *simple_cmd = &cmd->simple_cmd;
-    destroy_simple_cmd(simple_cmd);
-}
-
-void destroy_job(struct sh_ast_job *job) {
-    for (size_t idx = 0; idx < job->cmd_count; idx++) {
-        struct sh_ast_cmd *cmd = &job->piped_cmds[idx];
-        destroy_cmd(cmd);
+    enum sh_job_type job_type;
+    switch (token.type) {
+    case SH_TOKEN_AMP:
+        job_type = SH_JOB_BG;
+        consume_token(ctx);
+        break;
+    case SH_TOKEN_SEMICOLON:
+        job_type = SH_JOB_FG;
+        consume_token(ctx);
+        break;
+    case SH_TOKEN_END:
+        job_type = SH_JOB_FG;
+        break;
+    default:
+        // There are tokens we don't know how to parse.
+        return SH_PARSE_UNEXPECTED_TOKENS;
     }
-    free(job->piped_cmds);
+
+    out->type = SH_PART_JOB;
+    out->job_desc = (struct sh_job_desc) {
+        .type = job_type,
+        .job = job,
+    };
+    return SH_PARSE_SUCCESS;
 }
 
-void destroy_cmd_line(struct sh_ast_cmd_line *cmd_line) {
-    for (size_t idx = 0; idx < cmd_line->job_count; idx++) {
-        struct sh_job_desc *job_desc = &cmd_line->job_descs[idx];
-        struct sh_ast_job *job = &job_desc->job;
-        destroy_job(job);
-    }
-    free(cmd_line->job_descs);
+void reset_parse_buffers(struct sh_parse_context *ctx) {
+    reset_lex_buffers(ctx->lex_ctx);
+    ctx->token_idx = 0;
 }
 
 enum sh_parse_result
-parse_cmd_line(struct sh_parse_context *ctx, struct sh_ast_cmd_line *out) {
-    // No tokens left to parse.
-    if (ctx->token_idx >= ctx->token_count
-        || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-    {
-        return SH_PARSE_UNEXPECTED_END;
-    }
-
-    // Try parsing history (e.g., `!foobar`).
-    if (ctx->tokens[ctx->token_idx].type == SH_TOKEN_EXCLAM) {
-        ctx->token_idx++;
-        if (ctx->token_idx >= ctx->token_count
-            || ctx->tokens[ctx->token_idx].type != SH_TOKEN_WORD)
-        {
-            return SH_PARSE_COMMAND_LINE_FAIL;
-        }
-        out->type = SH_COMMAND_REPEAT;
-        out->repeat_query = ctx->tokens[ctx->token_idx].text;
-        ctx->token_idx++;
-        return SH_PARSE_SUCCESS;
-    }
-
-    // At this point, the command line was not for repeating a command, so try
-    // parsing jobs.
-
-    // Allocate memory for the job AST nodes.
-    // We start with a capacity of 4 and grow it later if necessary.
-    size_t job_descs_capacity = 4;
-    struct sh_job_desc *job_descs = malloc(
-        sizeof(struct sh_job_desc) * job_descs_capacity
-    );
-    if (job_descs == NULL) {
-        return SH_PARSE_MEMORY_ERROR;
-    }
-    size_t job_count = 0;
-
-    // A command line has at least one job, so we try parsing the first job.
-    struct sh_ast_job job;
-    enum sh_parse_result parse_job_result = parse_job(ctx, &job);
-    if (parse_job_result != SH_PARSE_SUCCESS) {
-        free(job_descs);
-        return parse_job_result;
-    }
-
-    // At this point, we expect a trailing `&` or `;` and, possibly, more jobs.
-    // If there is no `&` or `;`, however, we will not consider it an error
-    // here; we will instead leave it to the `parse()` function to check for
-    // any remaining unparsed tokens.
-    while (parse_job_result == SH_PARSE_SUCCESS
-           && ctx->token_idx < ctx->token_count
-           && (ctx->tokens[ctx->token_idx].type == SH_TOKEN_AMP
-               || ctx->tokens[ctx->token_idx].type == SH_TOKEN_SEMICOLON))
-    {
-        job_descs[job_count] = (struct sh_job_desc) {
-            .type = ctx->tokens[ctx->token_idx].type == SH_TOKEN_AMP
-                        ? SH_JOB_BG
-                        : SH_JOB_FG,
-            .job = job,
-        };
-        job_count++;
-        ctx->token_idx++;
-
-        // Double the size of the jobs array when there is not enough
-        // space.
-        if (job_count == job_descs_capacity) {
-            job_descs_capacity *= 2;
-            struct sh_job_desc *tmp = realloc(
-                job_descs,
-                sizeof(struct sh_job_desc) * job_descs_capacity
-            );
-            if (tmp == NULL) {
-                for (size_t idx = 0; idx < job_count; idx++) {
-                    destroy_job(&job_descs[idx].job);
-                }
-                free(job_descs);
-                return SH_PARSE_MEMORY_ERROR;
+peek_token(struct sh_parse_context *ctx, struct sh_token *out) {
+    struct sh_lex_context *lex_ctx = ctx->lex_ctx;
+    while (ctx->token_idx == lex_ctx->tokbuf_len) {
+        // Every token has been consumed, so the buffer can be reused.
+        lex_ctx->tokbuf_len = 0;
+        ctx->token_idx = 0;
+
+        enum sh_lex_result lex_result = lex(lex_ctx);
+        if (lex_result == SH_LEX_END) {
+            // The end token is never consumed, but it is dropped when the
+            // buffers are reset. An input that ends in the middle of an escape
+            // has no end token at all, and cannot be parsed.
+            if (!ctx->seen_end) {
+                return SH_PARSE_UNEXPECTED_END;
             }
-            job_descs = tmp;
-        }
 
-        // Don't try parsing further if there are no more tokens.
-        if (ctx->token_idx >= ctx->token_count
-            || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-        {
-            break;
+            *out = (struct sh_token) {.type = SH_TOKEN_END, .text = NULL};
+            return SH_PARSE_SUCCESS;
         }
 
-        parse_job_result = parse_job(ctx, &job);
-    }
-
-    // If we exited the loop because of an error during parsing of a job, then
-    // we need to return the error.
-    if (parse_job_result != SH_PARSE_SUCCESS) {
-        for (size_t idx = 0; idx < job_count; idx++) {
-            destroy_job(&job_descs[idx].job);
+        if (lex_result != SH_LEX_ONGOING) {
+            ctx->lex_result = lex_result;
+            return SH_PARSE_LEX_ERROR;
         }
-        free(job_descs);
-        return parse_job_result;
     }
 
-    // Handle the case where the last job does not have a trailing `&` or `;`.
-    if (parse_job_result == SH_PARSE_SUCCESS
-        && ctx->tokens[ctx->token_idx - 1].type != SH_TOKEN_AMP
-        && ctx->tokens[ctx->token_idx - 1].type != SH_TOKEN_SEMICOLON)
-    {
-        job_descs[job_count] = (struct sh_job_desc) {
-            .type = SH_JOB_FG,
-            .job = job,
-        };
-        job_count++;
+    *out = lex_ctx->tokbuf[ctx->token_idx];
+    if (out->type == SH_TOKEN_END) {
+        ctx->seen_end = true;
     }
-
-    out->type = SH_COMMAND_JOBS;
-    out->job_descs = job_descs;
-    out->job_count = job_count;
     return SH_PARSE_SUCCESS;
 }
 
+void consume_token(struct sh_parse_context *ctx) {
+    assert(ctx->token_idx < ctx->lex_ctx->tokbuf_len);
+    assert(ctx->lex_ctx->tokbuf[ctx->token_idx].type != SH_TOKEN_END);
+    ctx->token_idx++;
+}
+
+size_t buffered_token_count(struct sh_parse_context const *ctx) {
+    return ctx->lex_ctx->tokbuf_len - ctx->token_idx;
+}
+
 enum sh_parse_result
 parse_job(struct sh_parse_context *ctx, struct sh_ast_job *out) {
-    // No tokens to parse.
-    if (ctx->token_idx >= ctx->token_count
-        || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-    {
-        return SH_PARSE_UNEXPECTED_END;
-    }
-
-    // Allocate memory for the command AST nodes.
-    // We start with a capacity of 4 and grow it later if necessary.
-    size_t cmds_capacity = 4;
-    struct sh_ast_cmd *cmds = malloc(sizeof(struct sh_ast_cmd) * cmds_capacity);
-    if (cmds == NULL) {
-        return SH_PARSE_MEMORY_ERROR;
-    }
-    size_t cmd_count = 0;
+    struct sh_job_builder builder = (struct sh_job_builder) {
+        .job = (struct sh_ast_job) {
+            .cmd_count = 0,
+            .piped_cmds = NULL,
+            .words = NULL,
+            .redirections = NULL,
+        },
+        .cmds_capacity = 0,
+        .word_count = 0,
+        .words_capacity = 0,
+        .redirection_count = 0,
+        .redirections_capacity = 0,
+    };
 
     // A job has at least one command, so we try parsing the first command.
-    struct sh_ast_cmd cmd;
-    enum sh_parse_result parse_cmd_result = parse_cmd(ctx, &cmd);
+    enum sh_parse_result parse_cmd_result = parse_cmd(ctx, &builder);
     if (parse_cmd_result != SH_PARSE_SUCCESS) {
-        free(cmds);
         return parse_cmd_result;
     }
-    cmds[cmd_count] = cmd;
-    cmd_count++;
 
     // If the next symbol is a pipe, then try parsing more commands.
-    while (ctx->token_idx < ctx->token_count
-           && ctx->tokens[ctx->token_idx].type == SH_TOKEN_PIPE)
-    {
-        ctx->token_idx++;
-
-        parse_cmd_result = parse_cmd(ctx, &cmd);
+    struct sh_token token;
+    while (true) {
+        enum sh_parse_result peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+        if (token.type != SH_TOKEN_PIPE) {
+            break;
+        }
+        consume_token(ctx);
 
         // If the parsing of a command failed, then we don't know how to
         // continue.
+        parse_cmd_result = parse_cmd(ctx, &builder);
         if (parse_cmd_result != SH_PARSE_SUCCESS) {
-            free(cmds);
             return parse_cmd_result;
         }
-
-        // Parsing of a command was successful, so add the command's node
-        // to the array.
-        cmds[cmd_count] = cmd;
-        cmd_count++;
-
-        // Grow the command node array if needed.
-        if (cmd_count == cmds_capacity) {
-            cmds_capacity *= 2;
-            struct sh_ast_cmd *tmp = realloc(
-                cmds,
-                sizeof(struct sh_ast_cmd) * cmds_capacity
-            );
-            if (tmp == NULL) {
-                free(cmds);
-                return SH_PARSE_MEMORY_ERROR;
-            }
-            cmds = tmp;
-        }
     }
 
-    out->piped_cmds = cmds;
-    out->cmd_count = cmd_count;
+    *out = builder.job;
     return SH_PARSE_SUCCESS;
 }
 
 enum sh_parse_result
-parse_cmd(struct sh_parse_context *ctx, struct sh_ast_cmd *out) {
+parse_cmd(struct sh_parse_context *ctx, struct sh_job_builder *builder) {
+    struct sh_ast_job *job = &builder->job;
+
+    struct sh_token token;
+    enum sh_parse_result peek_result = peek_token(ctx, &token);
+    if (peek_result != SH_PARSE_SUCCESS) {
+        return peek_result;
+    }
+
     // No tokens to parse.
-    if (ctx->token_idx >= ctx->token_count
-        || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-    {
+    if (token.type == SH_TOKEN_END) {
         return SH_PARSE_UNEXPECTED_END;
     }
 
-    struct sh_ast_simple_cmd simple_cmd;
-    enum sh_parse_result parse_simple_cmd_result = parse_simple_cmd(
-        ctx,
-        &simple_cmd
-    );
+    // If the current token is not a word, then we
+    // can't parse a simple command.
+    if (token.type != SH_TOKEN_WORD) {
+        return SH_PARSE_SIMPLE_COMMAND_FAIL;
+    }
 
-    if (parse_simple_cmd_result != SH_PARSE_SUCCESS) {
-        return parse_simple_cmd_result;
+    struct sh_ast_cmd *cmds = reserve_job_array(
+        ctx->arena,
+        job->piped_cmds,
+        &builder->cmds_capacity,
+        sizeof(struct sh_ast_cmd),
+        job->cmd_count + 1
+    );
+    if (cmds == NULL) {
+        return SH_PARSE_MEMORY_ERROR;
     }
+    job->piped_cmds = cmds;
 
+    // The arrays never hold more elements than 32-bit indices can address, so
+    // the indices and counts fit.
     struct sh_ast_cmd cmd = (struct sh_ast_cmd) {
-        .simple_cmd = simple_cmd,
-        .redirection_capacity = 0,
+        .argv_idx = (uint32_t) builder->word_count,
+        .argc = 0,
+        .redirection_idx = (uint32_t) builder->redirection_count,
         .redirection_count = 0,
-        .redirections = NULL,
     };
 
-    // Parse redirections.
-    while (ctx->token_idx < ctx->token_count
-           && (ctx->tokens[ctx->token_idx].type == SH_TOKEN_ANGLE_BRACKET_L
-               || ctx->tokens[ctx->token_idx].type == SH_TOKEN_ANGLE_BRACKET_R
-               || ctx->tokens[ctx->token_idx].type == SH_TOKEN_2_ANGLE_BRACKET_R
-           ))
+    // Parse the arguments.
+    while (token.type == SH_TOKEN_WORD) {
+        // Make space for the word and the terminating null pointer. A glob
+        // expands into many words at once, so make space for all of the words
+        // that have been lexed already.
+        if (builder->word_count + 2 > builder->words_capacity) {
+            char const **words = reserve_job_array(
+                ctx->arena,
+                job->words,
+                &builder->words_capacity,
+                sizeof(char const *),
+                builder->word_count + buffered_token_count(ctx) + 1
+            );
+            if (words == NULL) {
+                return SH_PARSE_MEMORY_ERROR;
+            }
+            job->words = words;
+        }
+
+        job->words[builder->word_count] = token.text;
+        builder->word_count++;
+        cmd.argc++;
+        consume_token(ctx);
+
+        enum sh_parse_result peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+    }
+
+    // Terminating null pointer.
+    job->words[builder->word_count] = NULL;
+    builder->word_count++;
 
-    {
+    // Parse redirections.
+    while (true) {
         enum sh_redirect_type redirect_type;
-        switch (ctx->tokens[ctx->token_idx].type) {
+        switch (token.type) {
         case SH_TOKEN_ANGLE_BRACKET_L:
             redirect_type = SH_REDIRECT_STDIN;
             break;
@@ -387,110 +378,89 @@ parse_cmd(struct sh_parse_context *ctx, struct sh_ast_cmd *out) {
             redirect_type = SH_REDIRECT_STDERR;
             break;
         default:
-            assert(false);
+            job->piped_cmds[job->cmd_count] = cmd;
+            job->cmd_count++;
+            return SH_PARSE_SUCCESS;
         }
+        consume_token(ctx);
 
-        ctx->token_idx++;
-        if (ctx->token_idx >= ctx->token_count
-            || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-        {
-            destroy_cmd(&cmd);
+        enum sh_parse_result peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+        if (token.type == SH_TOKEN_END) {
             return SH_PARSE_COMMAND_FAIL;
         }
+        consume_token(ctx);
 
-        char const *redirect_file = ctx->tokens[ctx->token_idx].text;
-        ctx->token_idx++;
-
-        // Double the size of the redirections array when there is not enough
-        // space.
-        if (cmd.redirection_count == cmd.redirection_capacity) {
-            size_t new_capacity = cmd.redirection_capacity == 0
-                                      ? 2
-                                      : cmd.redirection_capacity * 2;
-
-            struct sh_redirection_desc *tmp = realloc(
-                cmd.redirections,
-                sizeof(struct sh_redirection_desc) * new_capacity
-            );
+        char const *redirect_file = token.text;
 
-            if (tmp == NULL) {
-                destroy_cmd(&cmd);
-                return SH_PARSE_MEMORY_ERROR;
-            }
-
-            cmd.redirections = tmp;
-            cmd.redirection_capacity = new_capacity;
+        struct sh_redirection_desc *redirections = reserve_job_array(
+            ctx->arena,
+            job->redirections,
+            &builder->redirections_capacity,
+            sizeof(struct sh_redirection_desc),
+            builder->redirection_count + 1
+        );
+        if (redirections == NULL) {
+            return SH_PARSE_MEMORY_ERROR;
         }
-
-        cmd.redirections[cmd.redirection_count] = (struct sh_redirection_desc) {
-            .type = redirect_type,
-            .file = redirect_file,
-        };
+        job->redirections = redirections;
+
+        job->redirections[builder->redirection_count]
+            = (struct sh_redirection_desc) {
+                .type = redirect_type,
+                .file = redirect_file,
+            };
+        builder->redirection_count++;
         cmd.redirection_count++;
-    }
 
-    *out = cmd;
-    return SH_PARSE_SUCCESS;
+        peek_result = peek_token(ctx, &token);
+        if (peek_result != SH_PARSE_SUCCESS) {
+            return peek_result;
+        }
+    }
 }
 
-enum sh_parse_result
-parse_simple_cmd(struct sh_parse_context *ctx, struct sh_ast_simple_cmd *out) {
-    // No tokens to parse.
-    if (ctx->token_idx >= ctx->token_count
-        || ctx->tokens[ctx->token_idx].type == SH_TOKEN_END)
-    {
-        return SH_PARSE_UNEXPECTED_END;
+void *reserve_job_array(
+    struct sh_arena *arena,
+    void *array,
+    size_t *capacity,
+    size_t elem_size,
+    size_t needed
+) {
+    if (needed <= *capacity) {
+        return array;
     }
 
-    // If the current token is not a word, then we
-    // can't parse a simple command.
-    if (ctx->tokens[ctx->token_idx].type != SH_TOKEN_WORD) {
-        return SH_PARSE_SIMPLE_COMMAND_FAIL;
+    if (needed > UINT32_MAX) {
+        return NULL;
     }
 
-    // Count the number of `SH_TOKEN_WORDS` first so that we know how much
-    // memory to allocate.
-    size_t end_idx = ctx->token_idx;
-    while (end_idx < ctx->token_count
-           && ctx->tokens[end_idx].type == SH_TOKEN_WORD)
-    {
-        end_idx++;
+    // Start with a capacity of 4 and double it from there, unless more is
+    // needed at once.
+    size_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+    if (new_capacity < needed) {
+        new_capacity = needed;
     }
-
-    // Now, allocate memory for the arguments.
-    size_t argc = end_idx - ctx->token_idx;
-    // + 1 for the terminating null pointer.
-    char const **argv = malloc(sizeof(char *) * (argc + 1));
-    if (argv == NULL) {
-        return SH_PARSE_MEMORY_ERROR;
+    if (new_capacity > UINT32_MAX) {
+        new_capacity = UINT32_MAX;
     }
 
-    // Fill up `argv`.
-    for (size_t idx = ctx->token_idx; idx < end_idx; idx++) {
-        assert(ctx->tokens[idx].type == SH_TOKEN_WORD);
-        argv[idx - ctx->token_idx] = ctx->tokens[idx].text;
+    void *tmp = arena_grow(
+        arena,
+        array,
+        elem_size * *capacity,
+        elem_size * new_capacity
+    );
+    if (tmp == NULL) {
+        return NULL;
     }
 
-    // Terminating null pointer.
-    argv[argc] = NULL;
-
-    // Update the context's index.
-    ctx->token_idx = end_idx;
-    *out = (struct sh_ast_simple_cmd) {
-        .argc = argc,
-        .argv = argv,
-    };
-
-    return SH_PARSE_SUCCESS;
+    *capacity = new_capacity;
+    return tmp;
 }
 
-/**
- * Displays a command line AST node for debugging purposes.
- *
- * @param cmd_line pointer to the command line AST node to display
- */
-void display_cmd_line(FILE *stream, struct sh_ast_cmd_line *cmd_line);
-
 /**
  * Displays the job AST node for debugging purposes.
  *
@@ -501,73 +471,47 @@ void display_job(FILE *stream, struct sh_ast_job *job);
 /**
  * Displays the command AST node for debugging purposes.
  *
+ * @param job pointer to the job AST node that the command belongs to
  * @param cmd pointer to the command AST node to display
  */
-void display_cmd(FILE *stream, struct sh_ast_cmd *cmd);
+void display_cmd(FILE *stream, struct sh_ast_job *job, struct sh_ast_cmd *cmd);
 
-/**
- * Displays the simple command AST node for debugging purposes.
- *
- * @param simple_cmd pointer to the simple command AST node to display
- */
-void display_simple_cmd(FILE *stream, struct sh_ast_simple_cmd *simple_cmd);
-
-void display_ast(FILE *stream, struct sh_ast_root *ast) {
-    fprintf(stream, "ROOT\n");
-    if (ast->emptiness == SH_ROOT_NONEMPTY) {
-        display_cmd_line(stream, &ast->cmd_line);
-    }
-}
-
-void display_cmd_line(FILE *stream, struct sh_ast_cmd_line *cmd_line) {
-    fprintf(stream, "  COMMAND_LINE\n");
-    if (cmd_line->type == SH_COMMAND_REPEAT) {
-        fprintf(stream, "    repeat: %s\n", cmd_line->repeat_query);
-    } else { // SH_COMMAND_JOBS
-        fprintf(stream, "    job count: %lu\n", cmd_line->job_count);
-        for (size_t idx = 0; idx < cmd_line->job_count; idx++) {
-            fprintf(
-                stream,
-                "    %s ",
-                cmd_line->job_descs[idx].type == SH_JOB_FG ? "FOREGROUND"
-                                                           : "BACKGROUND"
-            );
-            display_job(stream, &cmd_line->job_descs[idx].job);
-        }
+void display_ast_part(FILE *stream, struct sh_ast_part *part) {
+    fprintf(stream, "PART\n");
+    if (part->type == SH_PART_REPEAT) {
+        fprintf(stream, "  repeat: %s\n", part->repeat_query);
+    } else if (part->type == SH_PART_JOB) {
+        fprintf(
+            stream,
+            "  %s ",
+            part->job_desc.type == SH_JOB_FG ? "FOREGROUND" : "BACKGROUND"
+        );
+        display_job(stream, &part->job_desc.job);
+    } else { // SH_PART_END
+        fprintf(stream, "  end\n");
     }
 }
 
 void display_job(FILE *stream, struct sh_ast_job *job) {
     fprintf(stream, "JOB\n");
-    fprintf(stream, "      command count: %lu\n", job->cmd_count);
-    for (size_t idx = 0; idx < job->cmd_count; idx++) {
-        display_cmd(stream, &job->piped_cmds[idx]);
+    fprintf(stream, "      command count: %" PRIu32 "\n", job->cmd_count);
+    for (uint32_t idx = 0; idx < job->cmd_count; idx++) {
+        display_cmd(stream, job, &job->piped_cmds[idx]);
     }
 }
 
-void display_cmd(FILE *stream, struct sh_ast_cmd *cmd) {
+void display_cmd(FILE *stream, struct sh_ast_job *job, struct sh_ast_cmd *cmd) {
     fprintf(stream, "      COMMAND\n");
-    display_simple_cmd(stream, &cmd->simple_cmd);
-    for (size_t idx = 0; idx < cmd->redirection_count; idx++) {
-        fprintf(
-            stream,
-            "        redirect type: %d\n",
-            cmd->redirections[idx].type
-        );
-        fprintf(
-            stream,
-            "        redirect file: %s\n",
-            cmd->redirections[idx].file
-        );
-    }
-}
-
-void display_simple_cmd(FILE *stream, struct sh_ast_simple_cmd *simple_cmd) {
-    fprintf(stream, "        SIMPLE COMMAND\n");
-    fprintf(stream, "          argc: %lu\n", simple_cmd->argc);
-    fprintf(stream, "          argv: ");
-    for (size_t idx = 0; idx < simple_cmd->argc; idx++) {
-        fprintf(stream, "%s ", simple_cmd->argv[idx]);
+    fprintf(stream, "        argc: %" PRIu32 "\n", cmd->argc);
+    fprintf(stream, "        argv: ");
+    for (uint32_t idx = 0; idx < cmd->argc; idx++) {
+        fprintf(stream, "%s ", job->words[cmd->argv_idx + idx]);
     };
     fprintf(stream, "\n");
+    for (uint32_t idx = 0; idx < cmd->redirection_count; idx++) {
+        struct sh_redirection_desc *redir
+            = &job->redirections[cmd->redirection_idx + idx];
+        fprintf(stream, "        redirect type: %d\n", redir->type);
+        fprintf(stream, "        redirect file: %s\n", redir->file);
+    }
 }
@@ -6,16 +6,13 @@
 #ifndef PARSE_H
 #define PARSE_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#include "arena.h"
 #include "lex.h"
 
-/** Represents a simple shell command. */
-struct sh_ast_simple_cmd {
-    size_t argc;       /**< Number of arguments. */
-    char const **argv; /**< Argument strings */
-};
-
 /** Represents which standard stream to redirect. */
 enum sh_redirect_type {
     SH_REDIRECT_STDOUT, /**< Redirect stdout (`>`). */
@@ -32,24 +29,43 @@ struct sh_redirection_desc {
     char const *file;
 };
 
-/** Represents a shell command with redirection. */
+/**
+ * Represents a shell command with redirection.
+ *
+ * The command's arguments and redirections are slices of its job's arrays,
+ * which are linked by index.
+ */
 struct sh_ast_cmd {
-    /** The simple command to (potentially) redirect. */
-    struct sh_ast_simple_cmd simple_cmd;
-
-    size_t redirection_capacity;
-    size_t redirection_count;
-    struct sh_redirection_desc *redirections;
+    uint32_t argv_idx; /**< Index of the first argument in the job's `words`.
+                          The arguments are followed by a null pointer, so
+                          the slice can be passed to `exec()` directly. */
+    uint32_t argc;     /**< Number of arguments. */
+    uint32_t redirection_idx;   /**< Index of the first redirection in the
+                                   job's `redirections`. */
+    uint32_t redirection_count; /**< Number of redirections. */
 };
 
-/** Represents a shell job containing piped commands. */
+/**
+ * Represents a shell job containing piped commands.
+ *
+ * The whole job is stored in three contiguous arrays, so that building it
+ * takes a small number of allocations and walking it stays within them.
+ */
 struct sh_ast_job {
     /** Number of commands. */
-    size_t cmd_count;
+    uint32_t cmd_count;
 
     /** Commands to pipe. The first command is piped to the second, the second
      * to the third, etc. */
     struct sh_ast_cmd *piped_cmds;
+
+    /** The arguments of all commands, in order. Each command's arguments are
+     * followed by a null pointer. */
+    char const **words;
+
+    /** The redirections of all commands, in order, or `NULL` if there are
+     * none. */
+    struct sh_redirection_desc *redirections;
 };
 
 /** Indicates whether the job should run in the foreground (`;` or omitted) or
@@ -65,44 +81,22 @@ struct sh_job_desc {
     struct sh_ast_job job;
 };
 
-/** Represents a command line input. */
-struct sh_ast_cmd_line {
-    /** Indicates whether the command line is for repeating a command from the
-     * history or for executing a sequence of jobs.  */
-    enum { SH_COMMAND_REPEAT, SH_COMMAND_JOBS } type;
+/** Represents a part of a command line, as parsed by `parse_next()`. */
+struct sh_ast_part {
+    /** Indicates whether the part repeats a command from the history, is a job
+     * to execute or marks the end of the command line. */
+    enum { SH_PART_REPEAT, SH_PART_JOB, SH_PART_END } type;
 
-    /** Union with two members. The `repeat` member is set when the command line
-     * type is `SH_COMMAND_REPEAT`. The struct member (containing `job_count`
-     * and `job_descs`) is set when the type is `SH_COMMAND_JOBS`. */
+    /** Union with two members. The `repeat_query` member is set when the part
+     * type is `SH_PART_REPEAT`. The `job_desc` member is set when the type is
+     * `SH_PART_JOB`. */
     union {
         /** A string representing the start substring or index of the command to
          * search for and repeat. E.g., a number like "1" or a string "ec". */
         char const *repeat_query;
 
-        struct {
-            size_t job_count; /**< Number of jobs in the command line. */
-            struct sh_job_desc *job_descs; /**< Job descriptions to execute. */
-        };
-    };
-};
-
-/**
- * Represents the root of the abstract syntax tree (AST).
- *
- * The root will either be empty (representing an empty input) or nonempty, in
- * which case it will contain a child representing the command line.
- */
-struct sh_ast_root {
-    /** Indicates if the root is empty. */
-    enum { SH_ROOT_EMPTY, SH_ROOT_NONEMPTY } emptiness;
-
-    // A union is technically not needed, but it's used here to
-    // semantically indicate that `cmd_line` can be uninitialised (when the root
-    // is empty).
-    union {
-        /** The command line node. This will be set when `emptiness` is
-         * `SH_ROOT_NONEMPTY`. */
-        struct sh_ast_cmd_line cmd_line;
+        /** The job to execute. */
+        struct sh_job_desc job_desc;
     };
 };
 
@@ -110,6 +104,8 @@ struct sh_ast_root {
 enum sh_parse_result {
     SH_PARSE_SUCCESS,             /**< Successful parse. */
     SH_PARSE_MEMORY_ERROR,        /**< Memory error during parsing. */
+    SH_PARSE_LEX_ERROR,           /**< Lexing failed. The context's
+                                     `lex_result` says why. */
     SH_PARSE_UNEXPECTED_TOKENS,   /**< Unexpected tokens encountered. */
     SH_PARSE_COMMAND_LINE_FAIL,   /**< Command line parsing failure. */
     SH_PARSE_JOB_FAIL,            /**< Job parsing failure. */
@@ -119,28 +115,77 @@ enum sh_parse_result {
 };
 
 /**
- * Parses a sequence of tokens into an abstract syntax tree (AST).
+ * Contains context information for parsing.
+ *
+ * Tokens are pulled from a lexer as the parser needs them, and the lexer's
+ * token buffer is reused once all of its tokens have been consumed. This keeps
+ * the tokens in memory bounded by what the current job needs, rather than by
+ * the whole command line.
+ */
+struct sh_parse_context {
+    struct sh_lex_context *lex_ctx; /**< The lexer to pull tokens from. */
+    size_t token_idx; /**< Index of the next token in the lexer's token
+                         buffer. */
+    struct sh_arena *arena; /**< Arena to allocate the AST nodes from. */
+    bool started;           /**< Whether a part has been parsed. */
+    bool seen_end;          /**< Whether the lexer has output the end
+                               token. */
+    enum sh_lex_result lex_result; /**< The result of the lex that failed, if
+                                      parsing failed with
+                                      `SH_PARSE_LEX_ERROR`. */
+};
+
+/**
+ * Initialises a parse context that pulls tokens from the given lexer.
+ *
+ * @param ctx_out a pointer to the context to initialise
+ * @param lex_ctx the lexer to pull tokens from, which must not have been used
+ * yet
+ * @param arena the arena to allocate the AST's nodes from
+ */
+void init_parse_context(
+    struct sh_parse_context *ctx_out,
+    struct sh_lex_context *lex_ctx,
+    struct sh_arena *arena
+);
+
+/**
+ * Parses the next part of a command line into an abstract syntax tree (AST).
+ *
+ * The first call parses either a whole command line that repeats a command
+ * from the history, or the first job. Each further call parses the next job,
+ * including the `&` or `;` after it, until the end of the command line. Only
+ * as much of the input is lexed as the part needs, and nothing after its `&` or
+ * `;`, so a job can be run before the rest of the line is lexed.
  *
- * @param tokens sequence of tokens to parse
- * @param token_count number of tokens
- * @param out pointer to the AST root to set
+ * The AST's nodes are allocated from the context's arena. Once a job has run,
+ * the arena can be rewound to a mark taken before parsing it, as long as
+ * `reset_parse_buffers()` is called afterwards. Nodes allocated by a failed
+ * parse are left to the arena as well.
+ *
+ * @param ctx pointer to the context
+ * @param out pointer to the part to set
  * @return the result of the parsing operation
  */
 enum sh_parse_result
-parse(struct sh_token tokens[], size_t token_count, struct sh_ast_root *out);
+parse_next(struct sh_parse_context *ctx, struct sh_ast_part *out);
 
 /**
- * Destroys the AST and frees associated memory.
+ * Makes the parser and its lexer allocate their buffers again the next time
+ * they need them.
+ *
+ * This should be called after rewinding the arena to a mark taken before a
+ * part was parsed, since the buffers may have been allocated after the mark.
  *
- * @param ast_root pointer to the AST root to destroy
+ * @param ctx pointer to the context
  */
-void destroy_ast(struct sh_ast_root *ast_root);
+void reset_parse_buffers(struct sh_parse_context *ctx);
 
 /**
- * Displays the AST for debugging purposes.
+ * Displays a part of a command line's AST for debugging purposes.
  *
- * @param ast_root pointer to the root of the AST to display
+ * @param part pointer to the part to display
  */
-void display_ast(FILE *stream, struct sh_ast_root *ast_root);
+void display_ast_part(FILE *stream, struct sh_ast_part *part);
 
 #endif
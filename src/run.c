@@ -1,17 +1,36 @@
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
 #include "builtins.h"
+#include "input.h"
+#include "line_cache.h"
 #include "parse.h"
 #include "run.h"
 #include "shell.h"
 
+/**
+ * Number of bytes of `exec()`'s argument space that are left unused, for the
+ * program's path and anything else the kernel puts there. Follows what `xargs`
+ * leaves.
+ */
+#define ARG_SPACE_HEADROOM 2048
+
+/** Number of standard file descriptors that can be redirected. */
+#define STD_FILENO_COUNT 3
+
+/** The environment, which `exec()` passes along with the arguments. */
+extern char **environ;
+
 /**
  * A descriptor for piping, indicating the file descriptors for the ends of
  * pipes.
@@ -59,43 +78,43 @@ struct sh_spawn_desc {
 
     /** Describes piping for the spawned command. */
     struct sh_pipe_desc pipe_desc;
+
+    /** Whether the pipe for standard input should be kept open after spawning
+     * the command, because more processes will be spawned to read from it. */
+    bool keep_pipe_left;
+
+    /** The files already opened for the redirections by `open_redirections()`,
+     * or `NULL` if they are opened when the command is spawned. */
+    int const *redirect_fds;
 };
 
 /**
- * Runs an abstract syntax tree (AST).
- *
- * This function runs the command line represented by the given AST.
+ * Runs the parts of a cached command line that has no globs, without lexing or
+ * parsing it.
  *
  * @param ctx a pointer to the shell context
- * @param root a pointer to the root of the AST
- * @param line the original command line string
+ * @param cached a pointer to the cached line
  */
-void run_ast(
+void run_cached_line(
     struct sh_shell_context *ctx,
-    struct sh_ast_root const *root,
-    char const *line
+    struct sh_cached_line const *cached
 );
 
 /**
- * Runs a command line AST node.
- *
- * This function handles command repetition and job execution.
+ * Repeats a command from the history.
  *
  * @param ctx a pointer to the shell context
- * @param cmd_line a pointer to the command line AST node
- * @param line the original command line string
+ * @param repeat_query the index of the command, or a prefix to search for
  */
-void run_cmd_line(
-    struct sh_shell_context *ctx,
-    struct sh_ast_cmd_line const *cmd_line,
-    char const *line
-);
+void run_repeat(struct sh_shell_context *ctx, char const *repeat_query);
 
 /**
  * Runs a job described by the given job descriptor.
  *
  * This function handles job execution, including managing process groups
- * and piping between commands.
+ * and piping between commands. Unless arguments are batched, a job with a
+ * program whose arguments do not fit into `exec()`'s argument space is refused
+ * before any of its commands are spawned.
  *
  * @param ctx a pointer to the shell context
  * @param job_desc a pointer to the job descriptor
@@ -112,20 +131,25 @@ void run_job_desc(
  * and creating child processes for external commands.
  *
  * @param ctx a pointer to the shell context
+ * @param job a pointer to the job AST node that the command belongs to
  * @param cmd a pointer to the command AST node
  * @param pgid the process group ID of the job
  * @param job_type the type of job (foreground or background)
  * @param pipe_desc a descriptor for handling piping between commands
+ * @param spawned_out a pointer to write the number of spawned processes to
  *
- * @return the PID of the spawned process, or 0 if the command is a foreground
- * builtin
+ * @return the PID of the (first) spawned process, 0 if no process was spawned
+ * because the command is a foreground builtin or a program that could not be
+ * run, or -1 if an error occurred
  */
 pid_t run_cmd(
     struct sh_shell_context *ctx,
+    struct sh_ast_job const *job,
     struct sh_ast_cmd const *cmd,
     pid_t pgid,
     enum sh_job_type job_type,
-    struct sh_pipe_desc pipe_desc
+    struct sh_pipe_desc pipe_desc,
+    size_t *spawned_out
 );
 
 /**
@@ -134,9 +158,11 @@ pid_t run_cmd(
  * This function handles redirections and piping for built-in commands
  * that are executed in the foreground.
  *
+ * If a redirection's file cannot be opened, the command is not run.
+ *
  * @param ctx a pointer to the shell context
  * @param desc a descriptor for spawning the command
- * @return 0 on success
+ * @return 0 on success, or -1 if the command was not run
  */
 int run_builtin_fg(struct sh_shell_context *ctx, struct sh_spawn_desc desc);
 
@@ -146,10 +172,16 @@ int run_builtin_fg(struct sh_shell_context *ctx, struct sh_spawn_desc desc);
  * This function handles the creation of child processes, setting up
  * redirections, and running built-in or external commands.
  *
+ * Unless `desc.keep_pipe_left` is set, the shell's ends of the pipe for
+ * standard input are closed, whether or not a process is spawned. The files in
+ * `desc.redirect_fds` are left open.
+ *
  * @param ctx a pointer to the shell context
  * @param pgid the process group ID for the new process
  * @param desc a descriptor containing details for spawning the command
- * @return the PID of the spawned process, or -1 if an error occurred
+ * @return the PID of the spawned process, 0 if the command is a program that
+ * could not be run (in which case an error message has been printed), or -1 if
+ * an error occurred
  */
 pid_t spawn(
     struct sh_shell_context *ctx,
@@ -157,104 +189,407 @@ pid_t spawn(
     struct sh_spawn_desc desc
 );
 
-void run(struct sh_shell_context *ctx, char const *line) {
-    struct sh_lex_context lex_ctx;
-    init_lex_context(&lex_ctx, line);
+/**
+ * Spawns a process running the program of the given spawn descriptor with
+ * `posix_spawnp()`.
+ *
+ * Unlike `fork()`, this does not copy the shell's page tables, so it stays
+ * fast however much memory the shell uses. The process group, signal
+ * dispositions, signal mask, pipes and redirections are set up in the child
+ * process the same way as after forking.
+ *
+ * @param pgid the process group ID for the new process
+ * @param desc a descriptor containing details for spawning the command, whose
+ * redirections' files must have been opened
+ * @return the PID of the spawned process, 0 if the program could not be run (in
+ * which case an error message has been printed), or -1 if an error occurred
+ */
+pid_t spawn_program(pid_t pgid, struct sh_spawn_desc desc);
 
-    enum sh_lex_result lex_result;
-    do {
-        lex_result = lex(&lex_ctx);
-    } while (lex_result == SH_LEX_ONGOING);
+/**
+ * Sets the attributes for spawning a process into the given process group with
+ * the signal dispositions and signal mask that `spawn()` gives forked
+ * processes.
+ *
+ * @param attr a pointer to the initialised attributes
+ * @param pgid the process group ID for the new process
+ * @return 0 if successful, or an error number otherwise
+ */
+int set_spawn_attributes(posix_spawnattr_t *attr, pid_t pgid);
 
-    if (lex_result == SH_LEX_MEMORY_ERROR) {
-        fprintf(stderr, "error: memory failure\n");
-    } else if (lex_result == SH_LEX_UNTERMINATED_QUOTE) {
-        fprintf(stderr, "error: unterminated quote\n");
-        add_line_to_history(ctx, line);
-    } else if (lex_result == SH_LEX_GLOB_ERROR) {
-        fprintf(stderr, "error: glob error\n");
-        add_line_to_history(ctx, line);
+/**
+ * Adds the file actions for the piping and redirections of the given spawn
+ * descriptor.
+ *
+ * @param actions a pointer to the initialised file actions
+ * @param desc a descriptor containing details for spawning the command, whose
+ * redirections' files must have been opened
+ * @return 0 if successful, or an error number otherwise
+ */
+int add_spawn_file_actions(
+    posix_spawn_file_actions_t *actions,
+    struct sh_spawn_desc desc
+);
+
+/**
+ * Prints why `posix_spawnp()` failed to run the program of the given spawn
+ * descriptor.
+ *
+ * @param desc a descriptor containing details for spawning the command
+ * @param err the error number returned by `posix_spawnp()`
+ */
+void print_spawn_error(struct sh_spawn_desc desc, int err);
+
+/**
+ * Opens the files of the given spawn descriptor's redirections, in order.
+ *
+ * A redirection replaces any earlier one of the same standard file descriptor,
+ * whose file is closed. The files are opened with `O_CLOEXEC`, so they are not
+ * leaked into programs that do not redirect to them.
+ *
+ * @param desc a descriptor containing details for spawning the command
+ * @param fds_out an array to write the opened files to, indexed by the standard
+ * file descriptor they replace, with -1 for the ones not redirected
+ * @return true if successful, false if a file could not be opened (in which
+ * case an error message has been printed and no file is left open)
+ */
+bool open_redirections(
+    struct sh_spawn_desc desc,
+    int fds_out[STD_FILENO_COUNT]
+);
+
+/**
+ * Closes the files opened by `open_redirections()`.
+ *
+ * @param fds the opened files, with -1 for the ones not redirected
+ */
+void close_redirections(int const fds[STD_FILENO_COUNT]);
+
+/**
+ * Checks whether any redirection of the given spawn descriptor is to or from a
+ * FIFO.
+ *
+ * @param desc a descriptor containing details for spawning the command
+ * @return true if a redirection's file is a FIFO, false otherwise
+ */
+bool has_fifo_redirection(struct sh_spawn_desc desc);
+
+/**
+ * Returns the flags to open a redirection's file with.
+ *
+ * @param type the type of the redirection
+ * @return the flags for `open()`
+ */
+int redirection_open_flags(enum sh_redirect_type type);
+
+/**
+ * Returns the standard file descriptor that a redirection replaces.
+ *
+ * @param type the type of the redirection
+ * @return the file descriptor
+ */
+int redirection_std_fileno(enum sh_redirect_type type);
+
+/**
+ * Spawns a process for each batch of arguments of the given spawn descriptor.
+ *
+ * Every batch gets the command and its leading options (up to and including
+ * `--`), followed by as many of the remaining arguments as fit into the given
+ * space. All batches are spawned into the same process group, so they run in
+ * parallel.
+ *
+ * @param ctx a pointer to the shell context
+ * @param pgid the process group ID for the new processes
+ * @param desc a descriptor containing details for spawning the command
+ * @param space the number of bytes of arguments that each batch may take up
+ * @param spawned_out a pointer to write the number of spawned processes to
+ * @return the PID of the first spawned process, 0 if the program could not be
+ * run, or -1 if none was spawned otherwise
+ */
+pid_t spawn_batches(
+    struct sh_shell_context *ctx,
+    pid_t pgid,
+    struct sh_spawn_desc desc,
+    size_t space,
+    size_t *spawned_out
+);
+
+/**
+ * Closes both ends of the pipe for standard input of a spawned command, if
+ * there is one.
+ *
+ * @param pipe_desc a descriptor for the command's piping
+ */
+void close_pipe_left(struct sh_pipe_desc pipe_desc);
+
+/**
+ * Returns the number of bytes that arguments may take up when running a
+ * program with `exec()` in the current environment.
+ *
+ * @return the number of bytes
+ */
+size_t exec_arg_space();
+
+/**
+ * Returns the number of bytes that an argument takes up in `exec()`'s argument
+ * space, including its terminator and the pointer to it.
+ *
+ * @param arg the argument
+ * @return the number of bytes
+ */
+size_t exec_arg_size(char const *arg);
+
+/**
+ * Returns the number of bytes that an argument vector takes up in `exec()`'s
+ * argument space.
+ *
+ * @param argc the number of arguments
+ * @param argv the arguments
+ * @return the number of bytes
+ */
+size_t exec_args_size(size_t argc, char const *const *argv);
+
+/**
+ * Checks that the arguments of every program in a job fit into `exec()`'s
+ * argument space, since a glob can easily expand to more arguments than that.
+ *
+ * An error message is printed for the first program whose arguments do not
+ * fit.
+ *
+ * @param job a pointer to the job AST node
+ * @return true if the arguments of every program fit, false otherwise
+ */
+bool job_args_fit(struct sh_ast_job const *job);
+
+/**
+ * Prints why a glob expansion was aborted.
+ *
+ * @param ctx a pointer to the shell context
+ * @param glob_result the result of the expansion
+ */
+void print_glob_error(
+    struct sh_shell_context const *ctx,
+    enum sh_glob_result glob_result
+);
+
+void run(struct sh_shell_context *ctx, char const *line) {
+    // Everything allocated for the command line is freed at once when it has
+    // finished running. Taking a mark instead of resetting the whole arena lets
+    // `!` run another command line from within this one.
+    struct sh_arena_mark mark = arena_mark(&ctx->arena);
+
+    // A line that has been run before is not lexed again. If it has globs, its
+    // tokens are replayed to expand them again. Otherwise, it is not parsed
+    // again either. The cached line stays at the front of the cache while it
+    // runs, and only a `!` can run another line in the meantime, so it is not
+    // evicted.
+    struct sh_cached_line *cached = find_cached_line(&ctx->line_cache, line);
+    if (cached != NULL && !cached->skeleton.has_patterns) {
+        run_cached_line(ctx, cached);
+        arena_rewind(&ctx->arena, mark);
+        return;
+    }
+
+    // A line that is not cached yet is recorded as it is lexed, so that it can
+    // be cached once it has been parsed to the end.
+    struct sh_cached_line *new_cached = NULL;
+    struct sh_lex_context lex_ctx;
+    if (cached != NULL) {
+        init_lex_replay_context(
+            &lex_ctx,
+            &cached->skeleton,
+            &ctx->arena,
+            &ctx->dir_cache,
+            &ctx->glob_budget
+        );
     } else {
-        struct sh_ast_root ast;
-        enum sh_parse_result parse_result = parse(
-            lex_ctx.tokbuf,
-            lex_ctx.tokbuf_len,
-            &ast
+        init_lex_context(
+            &lex_ctx,
+            line,
+            &ctx->arena,
+            &ctx->dir_cache,
+            &ctx->glob_budget
         );
 
+        new_cached = new_cached_line(line);
+        if (new_cached != NULL) {
+            record_lex(&lex_ctx, &new_cached->skeleton);
+        }
+    }
+
+    // The parser pulls tokens from the lexer as it needs them, and each job is
+    // run as soon as it has been parsed, before the rest of the line is lexed.
+    struct sh_parse_context parse_ctx;
+    init_parse_context(&parse_ctx, &lex_ctx, &ctx->arena);
+
+    // The line is added to the history before its first job runs, or once it
+    // turns out to be invalid.
+    bool added_to_history = false;
+    bool parsed_to_end = false;
+    while (true) {
+        // Everything allocated for a job is freed once it has run, so memory
+        // is bounded by the current job rather than the whole line.
+        struct sh_arena_mark job_mark = arena_mark(&ctx->arena);
+
+        // Expanding globs can take a long time, so let Ctrl+C interrupt it.
+        catch_sigint();
+        struct sh_ast_part part;
+        enum sh_parse_result parse_result = parse_next(&parse_ctx, &part);
+        ignore_stop_signals();
+
+        if (parse_result == SH_PARSE_LEX_ERROR
+            && parse_ctx.lex_result == SH_LEX_MEMORY_ERROR)
+        {
+            fprintf(stderr, "error: memory failure\n");
+            break;
+        }
+
         if (parse_result != SH_PARSE_SUCCESS) {
-            printf("error: failed to parse command line\n");
+            if (parse_result != SH_PARSE_LEX_ERROR) {
+                printf("error: failed to parse command line\n");
+            } else if (parse_ctx.lex_result == SH_LEX_UNTERMINATED_QUOTE) {
+                fprintf(stderr, "error: unterminated quote\n");
+            } else {
+                assert(parse_ctx.lex_result == SH_LEX_GLOB_ERROR);
+                print_glob_error(ctx, lex_ctx.glob_result);
+            }
+
+            if (!added_to_history) {
+                add_line_to_history(ctx, line);
+            }
+            break;
+        }
+
+        // Nothing (more) to run.
+        if (part.type == SH_PART_END) {
+            parsed_to_end = true;
+            break;
+        }
+
+        if (part.type == SH_PART_REPEAT) {
+            // No need to add to history for the `!` command line. Follows
+            // Bash's behaviour.
+            parsed_to_end = true;
+            run_repeat(ctx, part.repeat_query);
+            break;
+        }
+
+        if (!added_to_history) {
             add_line_to_history(ctx, line);
+            added_to_history = true;
+        }
+
+        run_job_desc(ctx, &part.job_desc);
+
+        arena_rewind(&ctx->arena, job_mark);
+        reset_parse_buffers(&parse_ctx);
+    }
+
+    if (new_cached != NULL) {
+        if (parsed_to_end && !new_cached->skeleton.failed) {
+            add_cached_line(&ctx->line_cache, new_cached);
         } else {
-            run_ast(ctx, &ast, line);
-            destroy_ast(&ast);
+            free_cached_line(new_cached);
         }
     }
-    destroy_lex_context(&lex_ctx);
+    arena_rewind(&ctx->arena, mark);
 
     return;
 }
 
-void run_ast(
+void run_cached_line(
     struct sh_shell_context *ctx,
-    struct sh_ast_root const *root,
-    char const *line
+    struct sh_cached_line const *cached
 ) {
-    // Nothing to run.
-    if (root->emptiness == SH_ROOT_EMPTY) {
-        return;
-    }
+    for (size_t idx = 0; idx < cached->part_count; idx++) {
+        struct sh_ast_part const *part = &cached->parts[idx];
+        if (part->type == SH_PART_REPEAT) {
+            run_repeat(ctx, part->repeat_query);
+            return;
+        }
+
+        if (idx == 0) {
+            add_line_to_history(ctx, cached->line);
+        }
 
-    run_cmd_line(ctx, &root->cmd_line, line);
+        struct sh_arena_mark job_mark = arena_mark(&ctx->arena);
+        run_job_desc(ctx, &part->job_desc);
+        arena_rewind(&ctx->arena, job_mark);
+    }
 }
 
-void run_cmd_line(
-    struct sh_shell_context *ctx,
-    struct sh_ast_cmd_line const *cmd_line,
-    char const *line
+void print_glob_error(
+    struct sh_shell_context const *ctx,
+    enum sh_glob_result glob_result
 ) {
-    if (cmd_line->type == SH_COMMAND_REPEAT) {
-        char *endptr;
-        size_t cmd_one_idx = strtoul(cmd_line->repeat_query, &endptr, 10);
-        size_t cmd_idx = cmd_one_idx - 1;
-
-        // If the query is a number, we use it as an index into the history.
-        // Otherwise, we perform a search to find the latest command whose
-        // prefix matches.
-        char *queried_line = *endptr == '\0'
-                                 ? get_command_by_index(ctx, cmd_idx)
-                                 : get_command_by_prefix(
-                                     ctx,
-                                     cmd_line->repeat_query
-                                 );
-
-        if (queried_line == NULL) {
-            fprintf(stderr, "error: no such command in history\n");
-            return;
-        }
+    switch (glob_result) {
+    case SH_GLOB_INTERRUPTED:
+        fprintf(stderr, "error: glob expansion interrupted\n");
+        break;
+    case SH_GLOB_TIMED_OUT:
+        fprintf(
+            stderr,
+            "error: glob expansion took longer than %lu ms (see `globlimit`)\n",
+            ctx->glob_budget.timeout_ms
+        );
+        break;
+    case SH_GLOB_TOO_MANY_MATCHES:
+        fprintf(
+            stderr,
+            "error: glob expansion found more than %zu paths (see "
+            "`globlimit`)\n",
+            ctx->glob_budget.max_matches
+        );
+        break;
+    default:
+        fprintf(stderr, "error: glob error\n");
+        break;
+    }
+}
 
-        // Echo the command.
-        // Follows Bash's behaviour.
-        printf("%s\n", queried_line);
+void run_repeat(struct sh_shell_context *ctx, char const *repeat_query) {
+    char *endptr;
+    size_t cmd_one_idx = strtoul(repeat_query, &endptr, 10);
+    size_t cmd_idx = cmd_one_idx - 1;
 
-        // No need to add to history for the `!` command line. Follows Bash's
-        // behaviour.
+    // If the query is a number, we use it as an index into the history.
+    // Otherwise, we perform a search to find the latest command whose prefix
+    // matches.
+    char const *history_line = *endptr == '\0'
+                                   ? get_command_by_index(ctx, cmd_idx)
+                                   : get_command_by_prefix(ctx, repeat_query);
 
-        run(ctx, queried_line);
+    if (history_line == NULL) {
+        fprintf(stderr, "error: no such command in history\n");
         return;
     }
 
-    add_line_to_history(ctx, line);
-
-    for (size_t idx = 0; idx < cmd_line->job_count; idx++) {
-        run_job_desc(ctx, &cmd_line->job_descs[idx]);
+    // The history's memory can move (or be evicted) once lines are added to
+    // it, which running the command does, so work on a copy.
+    char *queried_line = arena_strdup(&ctx->arena, history_line);
+    if (queried_line == NULL) {
+        fprintf(stderr, "error: memory failure\n");
+        return;
     }
+
+    // Echo the command.
+    // Follows Bash's behaviour.
+    printf("%s\n", queried_line);
+
+    run(ctx, queried_line);
 }
 
 void run_job_desc(
     struct sh_shell_context *ctx,
     struct sh_job_desc const *job_desc
 ) {
+    struct sh_ast_job const *job = &job_desc->job;
+
+    // Refuse the whole job rather than leave a pipeline half spawned.
+    if (!ctx->batch_args && !job_args_fit(job)) {
+        return;
+    }
+
     // Since the SIGCHLD handler consumes child processes, we need to block
     // SIGCHLD first so that we can properly wait for the child processes
     // here.
@@ -267,10 +602,27 @@ void run_job_desc(
     // `sigaddset`) to fail is programmer error.
     assert(sigprocmask_ret == 0);
 
-    struct sh_ast_job const *job = &job_desc->job;
     pid_t pids_count = 0;
     pid_t pgid = 0;
 
+    // The terminal is in raw mode for the line editor. Programs run in the
+    // foreground expect the terminal's original mode, so switch back to it
+    // before spawning them. Builtins run in the shell itself and do not care.
+    bool should_toggle_term_mode = false;
+    if (job_desc->type == SH_JOB_FG && ctx->is_interactive) {
+        for (size_t idx = 0; idx < job->cmd_count; idx++) {
+            uint32_t argv_idx = job->piped_cmds[idx].argv_idx;
+            if (!is_builtin(job->words[argv_idx])) {
+                should_toggle_term_mode = true;
+                break;
+            }
+        }
+    }
+
+    if (should_toggle_term_mode) {
+        restore_term_mode(&ctx->orig_termios);
+    }
+
     // If there is only one command, no piping is required.
     if (job->cmd_count == 1) {
         struct sh_pipe_desc pipe_desc = (struct sh_pipe_desc) {
@@ -278,18 +630,21 @@ void run_job_desc(
             .redirect_stdout = false,
         };
 
+        size_t spawned;
         pid_t pid = run_cmd(
             ctx,
+            job,
             &job->piped_cmds[0],
             pgid,
             job_desc->type,
-            pipe_desc
+            pipe_desc,
+            &spawned
         );
 
         // The command was spawned successfully and is not a foreground builtin.
         if (pid > 0) {
-            // Keep track of the PID.
-            pids_count++;
+            // Keep track of the PIDs.
+            pids_count += spawned;
 
             // Set the group ID to the PID.
             pgid = pid;
@@ -297,7 +652,6 @@ void run_job_desc(
     } else {
         // Multiple commands, so piping is required.
         int pipes[job->cmd_count - 1][2];
-        size_t pipes_len = 0;
         for (size_t idx = 0; idx < job->cmd_count; idx++) {
             struct sh_pipe_desc pipe_desc;
 
@@ -314,34 +668,43 @@ void run_job_desc(
                 // Create a new pipe, but not on the last iteration since there
                 // should only be `job->cmd_count - 1` pipes.
                 if (pipe(pipes[idx]) < 0) {
-                    // Probably not a good idea to continue on failure.
+                    // Probably not a good idea to continue on failure. Nothing
+                    // will read from the previous command's pipe either.
+                    perror("pipe");
+                    close_pipe_left(pipe_desc);
                     break;
                 }
 
-                pipes_len++;
-
                 pipe_desc.read_fd_right = pipes[idx][0];
                 pipe_desc.write_fd_right = pipes[idx][1];
             }
 
+            size_t spawned;
             pid_t pid = run_cmd(
                 ctx,
+                job,
                 &job->piped_cmds[idx],
                 pgid,
                 job_desc->type,
-                pipe_desc
+                pipe_desc,
+                &spawned
             );
 
             // If we failed to spawn the command, then it is probably not a good
-            // idea to continue.
+            // idea to continue. The pipe to the next command is not used by
+            // anything then.
             if (pid < 0) {
+                if (pipe_desc.redirect_stdout) {
+                    close(pipes[idx][0]);
+                    close(pipes[idx][1]);
+                }
                 break;
             }
 
-            // Keep track of the PID, but only if the command was not a
+            // Keep track of the PIDs, but only if the command was not a
             // foreground builtin.
             if (pid > 0) {
-                pids_count++;
+                pids_count += spawned;
 
                 // Set the group ID to the PID of the first spawned command.
                 if (pgid == 0) {
@@ -354,14 +717,6 @@ void run_job_desc(
                 break;
             }
         }
-
-        // If this is true, then that means one of the commands failed to spawn.
-        // This means the last pipe will not have been closed properly, so we
-        // need to close it.
-        if (pipes_len > 0 && pipes_len < job->cmd_count - 1) {
-            close(pipes[pipes_len - 1][0]);
-            close(pipes[pipes_len - 1][1]);
-        }
     }
 
     // When the job is a foreground job and processes were spawned, we want to
@@ -372,7 +727,8 @@ void run_job_desc(
     // `SIGCHLD` so that they don't become zombie processes.
     if (job_desc->type == SH_JOB_FG && pids_count > 0) {
         // Set the terminal foreground process group to the job's process group.
-        if (tcsetpgrp(STDIN_FILENO, pgid) < 0) {
+        // Without a terminal, there is nothing to hand over.
+        if (ctx->is_interactive && tcsetpgrp(STDIN_FILENO, pgid) < 0) {
             perror("tcsetpgrp");
         }
 
@@ -398,19 +754,27 @@ void run_job_desc(
         // However, we need to temporarily ignore `SIGTTOU` first because it
         // will be sent when `tcsetpgrp()` is called from a background process,
         // and our shell process is now a background process.
-        struct sigaction sigact_ign;
-        struct sigaction sigact_ttou_old;
-        sigemptyset(&sigact_ign.sa_mask);
-        sigact_ign.sa_flags = 0;
-        sigact_ign.sa_handler = SIG_IGN;
-        sigaction(SIGTTOU, &sigact_ign, &sigact_ttou_old);
-
-        if (tcsetpgrp(STDIN_FILENO, getpgid(0)) < 0) {
-            perror("tcsetpgrp");
+        if (ctx->is_interactive) {
+            struct sigaction sigact_ign;
+            struct sigaction sigact_ttou_old;
+            sigemptyset(&sigact_ign.sa_mask);
+            sigact_ign.sa_flags = 0;
+            sigact_ign.sa_handler = SIG_IGN;
+            sigaction(SIGTTOU, &sigact_ign, &sigact_ttou_old);
+
+            if (tcsetpgrp(STDIN_FILENO, getpgid(0)) < 0) {
+                perror("tcsetpgrp");
+            }
+
+            // Restore the handler for SIGTTOU.
+            sigaction(SIGTTOU, &sigact_ttou_old, NULL);
         }
+    }
 
-        // Restore the handler for SIGTTOU.
-        sigaction(SIGTTOU, &sigact_ttou_old, NULL);
+    // Now that the shell has the terminal again, go back to raw mode. Anything
+    // typed while the job was running is kept for the next prompt.
+    if (should_toggle_term_mode) {
+        resume_raw_mode(&ctx->orig_termios);
     }
 
     // Unblock SIGCHLD since we're done with waiting.
@@ -420,22 +784,29 @@ void run_job_desc(
 
 pid_t run_cmd(
     struct sh_shell_context *ctx,
+    struct sh_ast_job const *job,
     struct sh_ast_cmd const *cmd,
     pid_t pgid,
     enum sh_job_type job_type,
-    struct sh_pipe_desc pipe_desc
+    struct sh_pipe_desc pipe_desc,
+    size_t *spawned_out
 ) {
-    size_t argc = cmd->simple_cmd.argc;
-    char const *const *argv = cmd->simple_cmd.argv;
+    *spawned_out = 0;
+    size_t argc = cmd->argc;
+    char const *const *argv = job->words + cmd->argv_idx;
     assert(argc != 0);
 
     // Create a description for spawning the command.
     struct sh_spawn_desc desc = {
         .redirection_count = cmd->redirection_count,
-        .redirections = cmd->redirections,
+        .redirections = cmd->redirection_count == 0
+                            ? NULL
+                            : job->redirections + cmd->redirection_idx,
         .argc = argc,
         .argv = argv,
         .pipe_desc = pipe_desc,
+        .keep_pipe_left = false,
+        .redirect_fds = NULL,
     };
 
     // Handle running builtins in the foreground.
@@ -444,8 +815,21 @@ pid_t run_cmd(
         return 0;
     }
 
+    // Programs whose arguments do not fit into the argument space of `exec()`
+    // are run in batches. Without batching, `run_job_desc()` has already
+    // refused to run them.
+    if (ctx->batch_args && !is_builtin(argv[0])) {
+        size_t space = exec_arg_space();
+        if (exec_args_size(argc, argv) > space) {
+            return spawn_batches(ctx, pgid, desc, space, spawned_out);
+        }
+    }
+
     // Run non-builtins. Also run background built-ins.
     pid_t pid = spawn(ctx, pgid, desc);
+    if (pid > 0) {
+        *spawned_out = 1;
+    }
     return pid;
 }
 
@@ -484,52 +868,32 @@ int run_builtin_fg(struct sh_shell_context *ctx, struct sh_spawn_desc desc) {
     // Handle redirection for `>`, `<` and `2>`.
     // Note that, in bash, redirection for `>`, `<` and `2>` has higher
     // priority than redirection for piping, so the redirection here will
-    // "overwrite" the redirection for piping.
-    for (size_t idx = 0; idx < desc.redirection_count; idx++) {
-        struct sh_redirection_desc redir = desc.redirections[idx];
-        assert(redir.file != NULL);
-
-        // Open the file to redirect to.
-        // If we are redirecting stdin, then we open it read-only.
-        // Otherwise, we create and open it write-only.
-        int fd_to = open(
-            redir.file,
-            redir.type == SH_REDIRECT_STDIN ? O_RDONLY
-                                            : O_CREAT | O_WRONLY | O_TRUNC,
-            0644
-        );
-
-        if (fd_to < 0) {
-            perror("open");
-            continue;
-        }
+    // "overwrite" the redirection for piping. If a file cannot be opened, the
+    // builtin is not run, but the pipes are still closed below.
+    int redirect_fds[STD_FILENO_COUNT];
+    bool redirected = open_redirections(desc, redirect_fds);
+    if (redirected) {
+        int *fds_mems[STD_FILENO_COUNT] = {
+            [STDIN_FILENO] = &fds.in,
+            [STDOUT_FILENO] = &fds.out,
+            [STDERR_FILENO] = &fds.err,
+        };
+        for (int std_fileno = 0; std_fileno < STD_FILENO_COUNT; std_fileno++) {
+            if (redirect_fds[std_fileno] < 0) {
+                continue;
+            }
 
-        int *fds_mem = NULL;
-        int std_fileno;
-        switch (redir.type) {
-        case SH_REDIRECT_STDOUT:
-            fds_mem = &fds.out;
-            std_fileno = STDOUT_FILENO;
-            break;
-        case SH_REDIRECT_STDIN:
-            fds_mem = &fds.in;
-            std_fileno = STDIN_FILENO;
-            break;
-        case SH_REDIRECT_STDERR:
-            fds_mem = &fds.err;
-            std_fileno = STDERR_FILENO;
-            break;
+            // If we're overwriting a pipe, close it.
+            int *fds_mem = fds_mems[std_fileno];
+            if (*fds_mem != std_fileno) {
+                close(*fds_mem);
+            }
+            *fds_mem = redirect_fds[std_fileno];
         }
 
-        // If we're overwriting a previous redirection, close it.
-        if (*fds_mem != std_fileno) {
-            close(*fds_mem);
-        }
-        *fds_mem = fd_to;
+        run_builtin(ctx, fds, desc.argc, desc.argv);
     }
 
-    run_builtin(ctx, fds, desc.argc, desc.argv);
-
     // Close file descriptors if there were redirections.
     if (fds.out != STDOUT_FILENO) {
         close(fds.out);
@@ -543,7 +907,7 @@ int run_builtin_fg(struct sh_shell_context *ctx, struct sh_spawn_desc desc) {
         close(fds.err);
     }
 
-    return 0;
+    return redirected ? 0 : -1;
 }
 
 pid_t spawn(
@@ -551,6 +915,30 @@ pid_t spawn(
     pid_t pgid,
     struct sh_spawn_desc desc
 ) {
+    // Programs are spawned without forking. Builtins run in the child process
+    // itself, so they still need a fork. So do programs with a FIFO to
+    // redirect to or from, since opening a FIFO blocks until its other end is
+    // opened, and `posix_spawnp()` would block the shell along with the child.
+    if (!is_builtin(desc.argv[0]) && !has_fifo_redirection(desc)) {
+        // The redirections' files are opened in the shell, so that the child
+        // process only duplicates them, and a file that cannot be opened stops
+        // the program from being run.
+        int redirect_fds[STD_FILENO_COUNT];
+        pid_t pid = 0;
+        if (desc.redirect_fds != NULL) {
+            pid = spawn_program(pgid, desc);
+        } else if (open_redirections(desc, redirect_fds)) {
+            desc.redirect_fds = redirect_fds;
+            pid = spawn_program(pgid, desc);
+            close_redirections(redirect_fds);
+        }
+
+        if (!desc.keep_pipe_left) {
+            close_pipe_left(desc.pipe_desc);
+        }
+        return pid;
+    }
+
     pid_t pid = fork();
     if (pid == 0) {
         // Child process.
@@ -613,42 +1001,29 @@ pid_t spawn(
         // Handle redirection for `>`, `<` and `2>`.
         // Note that, in bash, redirection for `>`, `<` and `2>` has higher
         // priority than redirection for piping, so the redirection here will
-        // "overwrite" the redirection for piping.
-        for (size_t idx = 0; idx < desc.redirection_count; idx++) {
-            struct sh_redirection_desc redir = desc.redirections[idx];
-            assert(redir.file != NULL);
-
-            // Open the file to redirect to.
-            // If we are redirecting stdin, then we open it read-only.
-            // Otherwise, we create and open it write-only.
-            int fd_to = open(
-                redir.file,
-                redir.type == SH_REDIRECT_STDIN ? O_RDONLY
-                                                : O_CREAT | O_WRONLY | O_TRUNC,
-                0644
-            );
-
-            if (fd_to < 0) {
-                perror("open");
-                continue;
+        // "overwrite" the redirection for piping. If a file cannot be opened,
+        // the command is not run.
+        int opened_fds[STD_FILENO_COUNT];
+        int const *redirect_fds = desc.redirect_fds;
+        if (redirect_fds == NULL) {
+            if (!open_redirections(desc, opened_fds)) {
+                exit(EXIT_FAILURE);
             }
-
-            int fd_from = redir.type == SH_REDIRECT_STDOUT
-                              ? STDOUT_FILENO
-                              : (redir.type == SH_REDIRECT_STDIN
-                                     ? STDIN_FILENO
-                                     : STDERR_FILENO);
-
-            if (dup2(fd_to, fd_from) < 0) {
+            redirect_fds = opened_fds;
+        }
+        for (int std_fileno = 0; std_fileno < STD_FILENO_COUNT; std_fileno++) {
+            if (redirect_fds[std_fileno] >= 0
+                && dup2(redirect_fds[std_fileno], std_fileno) < 0)
+            {
                 perror("dup2");
             }
-
-            // Once the redirection is done, we don't need the original file
-            // descriptor around, so we close it. Even if the redirection
-            // failed, we still don't need the original file descriptor anymore.
-            close(fd_to);
         }
 
+        // Once the redirection is done, we don't need the original file
+        // descriptors around, so we close them. Even if the redirection
+        // failed, we still don't need the original file descriptors anymore.
+        close_redirections(redirect_fds);
+
         // Handle builtins that are run in the background.
         if (is_builtin(desc.argv[0])) {
             // No need to change any of these file descriptors since any
@@ -695,13 +1070,437 @@ pid_t spawn(
         // producer would inherit both ends of the pipe, but the consumer would
         // only inherit the read end. This is an equally valid approach, but I
         // don't really like the lack of symmetry in this second approach.
-        if (desc.pipe_desc.redirect_stdin) {
-            // We can't do anything much if `close()` fails:
-            // https://stackoverflow.com/questions/33114152/what-to-do-if-a-posix-close-call-fails
-            close(desc.pipe_desc.read_fd_left);
-            close(desc.pipe_desc.write_fd_left);
+        if (!desc.keep_pipe_left) {
+            close_pipe_left(desc.pipe_desc);
+        }
+    } else if (pid < 0) {
+        perror("fork");
+
+        // Nothing was spawned to read from the pipe.
+        if (!desc.keep_pipe_left) {
+            close_pipe_left(desc.pipe_desc);
         }
     }
 
     return pid;
 }
+
+pid_t spawn_batches(
+    struct sh_shell_context *ctx,
+    pid_t pgid,
+    struct sh_spawn_desc desc,
+    size_t space,
+    size_t *spawned_out
+) {
+    *spawned_out = 0;
+
+    // Find the leading options, which every batch gets. A lone `-` usually
+    // stands for standard input, so it is not an option.
+    size_t prefix_count = 1;
+    size_t prefix_size = exec_arg_size(desc.argv[0]);
+    while (prefix_count < desc.argc) {
+        char const *arg = desc.argv[prefix_count];
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+
+        prefix_count++;
+        prefix_size += exec_arg_size(arg);
+        if (strcmp(arg, "--") == 0) {
+            break;
+        }
+    }
+
+    // The child processes get copies of the argument vector, so the same one
+    // can be filled in for every batch.
+    char const **batch_argv
+        = arena_alloc(&ctx->arena, (desc.argc + 1) * sizeof(char const *));
+    if (batch_argv == NULL) {
+        fprintf(stderr, "error: memory failure\n");
+        close_pipe_left(desc.pipe_desc);
+        return -1;
+    }
+    memcpy(batch_argv, desc.argv, prefix_count * sizeof(char const *));
+
+    // The redirections' files are opened once for every batch, so that the
+    // batches share the files' offsets, rather than each truncating the files
+    // and writing over what the batches before it wrote. A FIFO is still opened
+    // by each batch, since opening it here would block the shell until its
+    // other end is opened.
+    int redirect_fds[STD_FILENO_COUNT];
+    bool opened_redirections
+        = desc.redirect_fds == NULL && !has_fifo_redirection(desc);
+    if (opened_redirections) {
+        if (!open_redirections(desc, redirect_fds)) {
+            close_pipe_left(desc.pipe_desc);
+            return 0;
+        }
+        desc.redirect_fds = redirect_fds;
+    }
+
+    pid_t first_pid = -1;
+    bool closed_pipe = false;
+    size_t idx = prefix_count;
+    while (idx < desc.argc) {
+        size_t batch_argc = prefix_count;
+        size_t batch_size = prefix_size;
+        while (idx < desc.argc) {
+            size_t size = exec_arg_size(desc.argv[idx]);
+            if (batch_size + size > space) {
+                break;
+            }
+
+            batch_argv[batch_argc++] = desc.argv[idx++];
+            batch_size += size;
+        }
+
+        if (batch_argc == prefix_count) {
+            // Not even one argument fits alongside the options.
+            fprintf(stderr, "%s: argument list too long\n", desc.argv[0]);
+            break;
+        }
+        batch_argv[batch_argc] = NULL;
+
+        struct sh_spawn_desc batch_desc = desc;
+        batch_desc.argc = batch_argc;
+        batch_desc.argv = batch_argv;
+        batch_desc.keep_pipe_left = idx < desc.argc;
+
+        pid_t pid = spawn(ctx, pgid, batch_desc);
+        closed_pipe = !batch_desc.keep_pipe_left;
+        if (pid <= 0) {
+            // Every batch runs the same program, so if one cannot be run, the
+            // rest are not tried either.
+            if (pid == 0 && first_pid < 0) {
+                first_pid = 0;
+            }
+            break;
+        }
+
+        (*spawned_out)++;
+        if (first_pid < 0) {
+            first_pid = pid;
+        }
+
+        // The first batch leads the process group if there is none yet.
+        if (pgid == 0) {
+            pgid = pid;
+        }
+    }
+
+    // If the last batch was not spawned, the pipe is still open.
+    if (!closed_pipe) {
+        close_pipe_left(desc.pipe_desc);
+    }
+
+    if (opened_redirections) {
+        close_redirections(redirect_fds);
+    }
+
+    return first_pid;
+}
+
+pid_t spawn_program(pid_t pgid, struct sh_spawn_desc desc) {
+    posix_spawnattr_t attr;
+    int err = posix_spawnattr_init(&attr);
+    if (err != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    err = posix_spawn_file_actions_init(&actions);
+    if (err != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+        posix_spawnattr_destroy(&attr);
+        return -1;
+    }
+
+    pid_t pid = -1;
+    err = set_spawn_attributes(&attr, pgid);
+    if (err == 0) {
+        err = add_spawn_file_actions(&actions, desc);
+    }
+    if (err != 0) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(err));
+        goto ret;
+    }
+
+    // The cast is safe:
+    // http://pubs.opengroup.org/onlinepubs/9699919799/functions/exec.html
+    err = posix_spawnp(
+        &pid,
+        desc.argv[0],
+        &actions,
+        &attr,
+        (char *const *) desc.argv,
+        environ
+    );
+    if (err != 0) {
+        print_spawn_error(desc, err);
+        pid = 0;
+    }
+
+ret:
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    return pid;
+}
+
+int set_spawn_attributes(posix_spawnattr_t *attr, pid_t pgid) {
+    int err = posix_spawnattr_setflags(
+        attr,
+        POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK
+    );
+    if (err != 0) {
+        return err;
+    }
+
+    // The child process joins the process group before the program runs.
+    err = posix_spawnattr_setpgroup(attr, pgid);
+    if (err != 0) {
+        return err;
+    }
+
+    // The child process inherits the ignored stop signals and the blocked
+    // SIGCHLD, so we need to "undo" those changes. The handlers that are
+    // caught are reset by `exec()` anyway, but SIGCHLD is reset as well to
+    // match `spawn()`.
+    sigset_t sigdefault;
+    sigemptyset(&sigdefault);
+    add_stop_signals(&sigdefault);
+    sigaddset(&sigdefault, SIGCHLD);
+    err = posix_spawnattr_setsigdefault(attr, &sigdefault);
+    if (err != 0) {
+        return err;
+    }
+
+    sigset_t sigmask;
+    int sigprocmask_ret = sigprocmask(SIG_BLOCK, NULL, &sigmask);
+    assert(sigprocmask_ret == 0);
+    sigdelset(&sigmask, SIGCHLD);
+    return posix_spawnattr_setsigmask(attr, &sigmask);
+}
+
+int add_spawn_file_actions(
+    posix_spawn_file_actions_t *actions,
+    struct sh_spawn_desc desc
+) {
+    int err;
+
+    // Handle redirection of stdin for piping.
+    if (desc.pipe_desc.redirect_stdin) {
+        // Close the write end, then redirect stdin to the read end.
+        err = posix_spawn_file_actions_addclose(
+            actions,
+            desc.pipe_desc.write_fd_left
+        );
+        if (err != 0) {
+            return err;
+        }
+
+        err = posix_spawn_file_actions_adddup2(
+            actions,
+            desc.pipe_desc.read_fd_left,
+            STDIN_FILENO
+        );
+        if (err != 0) {
+            return err;
+        }
+
+        err = posix_spawn_file_actions_addclose(
+            actions,
+            desc.pipe_desc.read_fd_left
+        );
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    // Handle redirection of stdout for piping.
+    if (desc.pipe_desc.redirect_stdout) {
+        // Close the read end, then redirect stdout to the write end.
+        err = posix_spawn_file_actions_addclose(
+            actions,
+            desc.pipe_desc.read_fd_right
+        );
+        if (err != 0) {
+            return err;
+        }
+
+        err = posix_spawn_file_actions_adddup2(
+            actions,
+            desc.pipe_desc.write_fd_right,
+            STDOUT_FILENO
+        );
+        if (err != 0) {
+            return err;
+        }
+
+        err = posix_spawn_file_actions_addclose(
+            actions,
+            desc.pipe_desc.write_fd_right
+        );
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    // Handle redirection for `>`, `<` and `2>` after piping, as in `spawn()`.
+    // The opened files are closed on `exec()`, but their duplicates are not.
+    for (int std_fileno = 0; std_fileno < STD_FILENO_COUNT; std_fileno++) {
+        if (desc.redirect_fds[std_fileno] < 0) {
+            continue;
+        }
+
+        err = posix_spawn_file_actions_adddup2(
+            actions,
+            desc.redirect_fds[std_fileno],
+            std_fileno
+        );
+        if (err != 0) {
+            return err;
+        }
+    }
+
+    return 0;
+}
+
+void print_spawn_error(struct sh_spawn_desc desc, int err) {
+    if (err == ENOENT) {
+        fprintf(stderr, "%s: command not found\n", desc.argv[0]);
+    } else {
+        fprintf(stderr, "%s: %s\n", desc.argv[0], strerror(err));
+    }
+}
+
+bool open_redirections(
+    struct sh_spawn_desc desc,
+    int fds_out[STD_FILENO_COUNT]
+) {
+    for (int std_fileno = 0; std_fileno < STD_FILENO_COUNT; std_fileno++) {
+        fds_out[std_fileno] = -1;
+    }
+
+    for (size_t idx = 0; idx < desc.redirection_count; idx++) {
+        struct sh_redirection_desc redir = desc.redirections[idx];
+        assert(redir.file != NULL);
+
+        int fd = open(
+            redir.file,
+            redirection_open_flags(redir.type) | O_CLOEXEC,
+            0644
+        );
+        if (fd < 0) {
+            perror(redir.file);
+            close_redirections(fds_out);
+            return false;
+        }
+
+        int std_fileno = redirection_std_fileno(redir.type);
+        if (fds_out[std_fileno] >= 0) {
+            close(fds_out[std_fileno]);
+        }
+        fds_out[std_fileno] = fd;
+    }
+
+    return true;
+}
+
+void close_redirections(int const fds[STD_FILENO_COUNT]) {
+    for (int std_fileno = 0; std_fileno < STD_FILENO_COUNT; std_fileno++) {
+        if (fds[std_fileno] >= 0) {
+            close(fds[std_fileno]);
+        }
+    }
+}
+
+bool has_fifo_redirection(struct sh_spawn_desc desc) {
+    for (size_t idx = 0; idx < desc.redirection_count; idx++) {
+        struct stat st;
+        if (stat(desc.redirections[idx].file, &st) == 0
+            && S_ISFIFO(st.st_mode))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+int redirection_open_flags(enum sh_redirect_type type) {
+    // If we are redirecting stdin, then we open it read-only. Otherwise, we
+    // create and open it write-only.
+    return type == SH_REDIRECT_STDIN ? O_RDONLY : O_CREAT | O_WRONLY | O_TRUNC;
+}
+
+int redirection_std_fileno(enum sh_redirect_type type) {
+    switch (type) {
+    case SH_REDIRECT_STDOUT:
+        return STDOUT_FILENO;
+    case SH_REDIRECT_STDIN:
+        return STDIN_FILENO;
+    case SH_REDIRECT_STDERR:
+        return STDERR_FILENO;
+    default:
+        assert(false);
+        return -1;
+    }
+}
+
+void close_pipe_left(struct sh_pipe_desc pipe_desc) {
+    if (pipe_desc.redirect_stdin) {
+        // We can't do anything much if `close()` fails:
+        // https://stackoverflow.com/questions/33114152/what-to-do-if-a-posix-close-call-fails
+        close(pipe_desc.read_fd_left);
+        close(pipe_desc.write_fd_left);
+    }
+}
+
+size_t exec_arg_space() {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max < 0) {
+        arg_max = _POSIX_ARG_MAX;
+    }
+
+    // The environment shares the space with the arguments. Both are followed
+    // by a null pointer.
+    size_t used = ARG_SPACE_HEADROOM + 2 * sizeof(char *);
+    for (char **var = environ; *var != NULL; var++) {
+        used += exec_arg_size(*var);
+    }
+
+    return (size_t) arg_max > used ? (size_t) arg_max - used : 0;
+}
+
+size_t exec_arg_size(char const *arg) {
+    return strlen(arg) + 1 + sizeof(char *);
+}
+
+size_t exec_args_size(size_t argc, char const *const *argv) {
+    size_t size = 0;
+    for (size_t idx = 0; idx < argc; idx++) {
+        size += exec_arg_size(argv[idx]);
+    }
+    return size;
+}
+
+bool job_args_fit(struct sh_ast_job const *job) {
+    size_t space = exec_arg_space();
+    for (size_t idx = 0; idx < job->cmd_count; idx++) {
+        struct sh_ast_cmd const *cmd = &job->piped_cmds[idx];
+        char const *const *argv = job->words + cmd->argv_idx;
+        if (is_builtin(argv[0])) {
+            continue;
+        }
+
+        if (exec_args_size(cmd->argc, argv) > space) {
+            fprintf(
+                stderr,
+                "%s: argument list too long (see `argbatch`)\n",
+                argv[0]
+            );
+            return false;
+        }
+    }
+    return true;
+}
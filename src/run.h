@@ -14,7 +14,9 @@
 /**
  * Runs a given command line.
  *
- * This function takes a command line string and executes it.
+ * This function takes a command line string and executes it. Memory for the
+ * command line is allocated from the shell context's arena, and freed before
+ * returning.
  *
  * @param ctx the shell context
  * @param line the command line string to run
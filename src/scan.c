@@ -0,0 +1,248 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+/** Signature of the scanner implementations. */
+typedef char const *(*sh_scan_fn)(char const *cp);
+
+/**
+ * Bytes that may be text boundaries. A `2` is only a boundary if it is followed
+ * by `>`, which is checked separately.
+ */
+static bool const BOUNDARY_BYTES[256] = {
+    ['\0'] = true, [' '] = true,  ['\n'] = true, ['\t'] = true, ['\f'] = true,
+    ['\r'] = true, ['\v'] = true, ['&'] = true,  [';'] = true,  ['|'] = true,
+    ['<'] = true,  ['>'] = true,  ['!'] = true,  ['\''] = true, ['"'] = true,
+    ['*'] = true,  ['?'] = true,  ['['] = true,  ['\\'] = true, ['2'] = true,
+};
+
+#ifdef SCAN_X86
+/**
+ * Classes of the low nibbles of the bytes in `BOUNDARY_BYTES`, for the vector
+ * scanners.
+ *
+ * Each bit stands for a high nibble: bit 0 for 0x0, bit 1 for 0x2, bit 2 for
+ * 0x3, bit 3 for 0x5 and bit 4 for 0x7. A low nibble has the bit for a high
+ * nibble set if the byte made of the two nibbles is in `BOUNDARY_BYTES`.
+ */
+static int8_t const LOW_NIBBLE_CLASSES[16] = {
+    0x03, 0x02, 0x06, 0x00, 0x00, 0x00, 0x02, 0x02,
+    0x00, 0x01, 0x03, 0x0D, 0x1D, 0x01, 0x04, 0x04,
+};
+
+/**
+ * Classes of the high nibbles of the bytes in `BOUNDARY_BYTES` (see
+ * `LOW_NIBBLE_CLASSES`). A byte is in `BOUNDARY_BYTES` exactly when the classes
+ * of its nibbles share a bit.
+ */
+static int8_t const HIGH_NIBBLE_CLASSES[16] = {
+    0x01, 0x00, 0x02, 0x04, 0x00, 0x08, 0x00, 0x10,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+#endif
+
+/** The scanner implementation in use, or `NULL` if not yet selected. */
+static sh_scan_fn scan_impl = NULL;
+
+/**
+ * Selects the fastest scanner implementation that the CPU supports.
+ *
+ * @return the scanner implementation
+ */
+sh_scan_fn select_scan_impl();
+
+/**
+ * Scans for a text boundary one byte at a time.
+ *
+ * @param cp a pointer into a null-terminated string
+ * @return a pointer to the first text boundary
+ */
+char const *scan_text_end_scalar(char const *cp);
+
+#ifdef SCAN_X86
+/**
+ * Scans for a text boundary 16 bytes at a time with SSSE3.
+ *
+ * @param cp a pointer into a null-terminated string
+ * @return a pointer to the first text boundary
+ */
+char const *scan_text_end_ssse3(char const *cp);
+
+/**
+ * Scans for a text boundary 32 bytes at a time with AVX2.
+ *
+ * @param cp a pointer into a null-terminated string
+ * @return a pointer to the first text boundary
+ */
+char const *scan_text_end_avx2(char const *cp);
+
+/**
+ * Returns a mask of the bytes in an aligned 16-byte block that may be text
+ * boundaries (see `BOUNDARY_BYTES`).
+ *
+ * @param block a pointer to the block, which must be 16-byte aligned
+ * @return the mask, with bit `i` set if byte `i` may be a text boundary
+ */
+uint32_t boundary_mask_ssse3(char const *block);
+
+/**
+ * Returns a mask of the bytes in an aligned 32-byte block that may be text
+ * boundaries (see `BOUNDARY_BYTES`).
+ *
+ * @param block a pointer to the block, which must be 32-byte aligned
+ * @return the mask, with bit `i` set if byte `i` may be a text boundary
+ */
+uint32_t boundary_mask_avx2(char const *block);
+#endif
+
+/**
+ * Returns the first actual text boundary among the candidates in a block.
+ *
+ * @param block a pointer to the block
+ * @param mask the candidates, with bit `i` set if byte `i` of the block may be
+ * a text boundary
+ * @return a pointer to the text boundary, or `NULL` if none of the candidates
+ * are text boundaries
+ */
+char const *first_boundary(char const *block, uint32_t mask);
+
+char const *scan_text_end(char const *cp) {
+    if (scan_impl == NULL) {
+        scan_impl = select_scan_impl();
+    }
+    return scan_impl(cp);
+}
+
+sh_scan_fn select_scan_impl() {
+#ifdef SCAN_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return scan_text_end_avx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return scan_text_end_ssse3;
+    }
+#endif
+    return scan_text_end_scalar;
+}
+
+char const *scan_text_end_scalar(char const *cp) {
+    while (!BOUNDARY_BYTES[(unsigned char) *cp] || (*cp == '2' && cp[1] != '>'))
+    {
+        cp++;
+    }
+    return cp;
+}
+
+char const *first_boundary(char const *block, uint32_t mask) {
+    while (mask != 0) {
+        char const *cp = block + __builtin_ctz(mask);
+
+        // A candidate comes before the null byte, so the byte after it can be
+        // read.
+        if (*cp != '2' || cp[1] == '>') {
+            return cp;
+        }
+        mask &= mask - 1;
+    }
+    return NULL;
+}
+
+#ifdef SCAN_X86
+// The vector scanners read whole aligned blocks, which may extend past the null
+// byte. An aligned block never crosses a page boundary, so this cannot fault,
+// but the address sanitiser would still complain about it.
+
+__attribute__((target("ssse3"), no_sanitize_address)) char const *
+scan_text_end_ssse3(char const *cp) {
+    // Ignore the bytes in the first block that come before `cp`.
+    size_t misalignment = (uintptr_t) cp % 16;
+    char const *block = cp - misalignment;
+    uint32_t mask = boundary_mask_ssse3(block) & (UINT32_MAX << misalignment);
+
+    while (true) {
+        char const *boundary = first_boundary(block, mask);
+        if (boundary != NULL) {
+            return boundary;
+        }
+
+        block += 16;
+        mask = boundary_mask_ssse3(block);
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) char const *
+scan_text_end_avx2(char const *cp) {
+    // Ignore the bytes in the first block that come before `cp`.
+    size_t misalignment = (uintptr_t) cp % 32;
+    char const *block = cp - misalignment;
+    uint32_t mask = boundary_mask_avx2(block) & (UINT32_MAX << misalignment);
+
+    while (true) {
+        char const *boundary = first_boundary(block, mask);
+        if (boundary != NULL) {
+            return boundary;
+        }
+
+        block += 32;
+        mask = boundary_mask_avx2(block);
+    }
+}
+
+__attribute__((target("ssse3"), no_sanitize_address)) uint32_t
+boundary_mask_ssse3(char const *block) {
+    __m128i bytes = _mm_load_si128((__m128i const *) block);
+    __m128i nibble_mask = _mm_set1_epi8(0x0F);
+    __m128i low = _mm_and_si128(bytes, nibble_mask);
+    __m128i high = _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble_mask);
+
+    // Look up the classes of both nibbles of every byte at once.
+    __m128i classes = _mm_and_si128(
+        _mm_shuffle_epi8(
+            _mm_loadu_si128((__m128i const *) LOW_NIBBLE_CLASSES),
+            low
+        ),
+        _mm_shuffle_epi8(
+            _mm_loadu_si128((__m128i const *) HIGH_NIBBLE_CLASSES),
+            high
+        )
+    );
+
+    __m128i outside = _mm_cmpeq_epi8(classes, _mm_setzero_si128());
+    return ~(uint32_t) _mm_movemask_epi8(outside) & 0xFFFF;
+}
+
+__attribute__((target("avx2"), no_sanitize_address)) uint32_t
+boundary_mask_avx2(char const *block) {
+    __m256i bytes = _mm256_load_si256((__m256i const *) block);
+    __m256i nibble_mask = _mm256_set1_epi8(0x0F);
+    __m256i low = _mm256_and_si256(bytes, nibble_mask);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble_mask);
+
+    // Look up the classes of both nibbles of every byte at once. The shuffles
+    // work within each 16-byte half, so both halves need the tables.
+    __m256i classes = _mm256_and_si256(
+        _mm256_shuffle_epi8(
+            _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((__m128i const *) LOW_NIBBLE_CLASSES)
+            ),
+            low
+        ),
+        _mm256_shuffle_epi8(
+            _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((__m128i const *) HIGH_NIBBLE_CLASSES)
+            ),
+            high
+        )
+    );
+
+    __m256i outside = _mm256_cmpeq_epi8(classes, _mm256_setzero_si256());
+    return ~(uint32_t) _mm256_movemask_epi8(outside);
+}
+#endif
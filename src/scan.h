@@ -0,0 +1,27 @@
+/**
+ * @file scan.h
+ *
+ * Declarations for scanning input strings for text boundaries.
+ *
+ * Lexing spends most of its time looking for the end of runs of text, which
+ * can be very long for generated command lines. The scanner checks many bytes
+ * at a time with SIMD instructions where the CPU supports them, and falls back
+ * to checking one byte at a time otherwise.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+/**
+ * Finds the first text boundary at or after the given character pointer.
+ *
+ * A text boundary is a whitespace delimiter, a special character (including
+ * `2>`, but not a `2` on its own) or the terminating null character. These must
+ * be kept in sync with the character classes in `lex.c`.
+ *
+ * @param cp a pointer into a null-terminated string
+ * @return a pointer to the first text boundary
+ */
+char const *scan_text_end(char const *cp);
+
+#endif
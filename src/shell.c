@@ -4,38 +4,27 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <unistd.h>
 
 #include "input.h"
-#include "run.h"
 #include "shell.h"
 
 #define STOP_SIGNALS_SIZE 3
 static int const STOP_SIGNALS[STOP_SIGNALS_SIZE] = {SIGINT, SIGQUIT, SIGTSTP};
 
-/** Represents the possible results of initializing the shell context. */
-enum sh_init_shell_context_result {
-    SH_INIT_SHELL_CONTEXT_SUCCESS,     /**< Successful initialization. */
-    SH_INIT_SHELL_CONTEXT_MEMORY_ERROR /**< Memory allocation error. */
-};
+/** Set by `handle_sigint()` when SIGINT is caught. */
+static volatile sig_atomic_t sigint_caught = 0;
 
 /**
- * Initializes the shell context.
+ * Returns the path of the history file.
  *
- * @param ctx a pointer to the shell context to initialise
- * @return the result of the initialization
- */
-enum sh_init_shell_context_result
-init_shell_context(struct sh_shell_context *ctx);
-
-/**
- * Destroys the shell context by freeing allocated resources.
+ * The path is taken from the `HISTFILE_ENV` environment variable if it is set,
+ * and is otherwise `DEFAULT_HISTFILE` in the user's home directory.
  *
- * @param ctx a pointer to the shell context
+ * @return the path, which the caller should free, or `NULL` if the history
+ * should not be kept in a file
  */
-void destroy_shell_context(struct sh_shell_context *ctx);
-
-/** Sets up signal handling for the shell. */
-void setup_signals();
+char *get_history_file_path();
 
 /**
  * Handler for the `SIGCHLD` signal.
@@ -45,50 +34,12 @@ void setup_signals();
  */
 void handle_sigchld(int signo);
 
-int main() {
-    setup_signals();
-
-    struct sh_shell_context sh_ctx;
-    if (init_shell_context(&sh_ctx) != SH_INIT_SHELL_CONTEXT_SUCCESS) {
-        perror("shell context initialisation");
-        return EXIT_FAILURE;
-    }
-
-    // Main loop.
-    bool should_exit = false;
-    int exit_code = EXIT_SUCCESS;
-    while (!should_exit) {
-        printf("%s ", sh_ctx.prompt);
-        fflush(stdout);
-
-        // Read user input command.
-        char *line = NULL;
-        size_t line_capacity = 0;
-        // `line_len` contains the number of characters in the line (including
-        // the null byte), not the capacity!
-        ssize_t line_len = read_input(&sh_ctx, &line, &line_capacity);
-        if (line_len < 0) {
-            // Consume the rest of the input in `stdin`.
-            char ch;
-            do {
-                ch = getchar();
-            } while (ch != '\n' && ch != EOF);
-
-            continue;
-        }
-
-        run(&sh_ctx, line);
-        if (sh_ctx.should_exit) {
-            should_exit = true;
-            exit_code = sh_ctx.exit_code;
-        }
-
-        free(line);
-    }
-
-    destroy_shell_context(&sh_ctx);
-    return exit_code;
-}
+/**
+ * Handler for the `SIGINT` signal while it is caught.
+ *
+ * This handler only sets a flag for long-running work in the shell to check.
+ */
+void handle_sigint(int signo);
 
 enum sh_init_shell_context_result
 init_shell_context(struct sh_shell_context *ctx) {
@@ -99,80 +50,137 @@ init_shell_context(struct sh_shell_context *ctx) {
     }
 
     *ctx = (struct sh_shell_context) {
-        .history_capacity = 0,
-        .history_count = 0,
-        .history = NULL,
         .prompt = prompt,
+        .glob_budget = (struct sh_glob_budget) {
+            .timeout_ms = DEFAULT_GLOB_TIMEOUT_MS,
+            .max_matches = DEFAULT_GLOB_MAX_MATCHES,
+            .interrupted = &sigint_caught,
+        },
+        .batch_args = false,
+        .is_interactive = false,
         .should_exit = false,
         .exit_code = EXIT_SUCCESS,
     };
 
+    // The number of history entries to keep can be overridden through the
+    // environment.
+    size_t history_limit = MAX_HISTORY;
+    char const *histsize = getenv(HISTSIZE_ENV);
+    if (histsize != NULL && *histsize != '\0') {
+        char *endptr;
+        unsigned long value = strtoul(histsize, &endptr, 10);
+        if (*endptr == '\0') {
+            history_limit = value;
+        }
+    }
+    init_history(&ctx->history, history_limit);
+    init_arena(&ctx->arena);
+    init_dir_cache(&ctx->dir_cache);
+    init_line_cache(&ctx->line_cache);
+
+    // The shell keeps the terminal in raw mode for the whole session. It is
+    // only switched back to the original mode while a foreground job runs.
+    if (isatty(STDIN_FILENO)) {
+        ctx->is_interactive = enable_raw_mode(&ctx->orig_termios);
+    }
+
+    // Interactive shells keep their history in a file, so that it is not lost
+    // when the shell exits.
+    if (ctx->is_interactive) {
+        char *histfile = get_history_file_path();
+        if (histfile != NULL) {
+            char const *histshare = getenv(HISTSHARE_ENV);
+            bool shared = histshare != NULL && *histshare != '\0';
+            history_load_file(&ctx->history, histfile, shared);
+            free(histfile);
+        }
+    }
+
     return SH_INIT_SHELL_CONTEXT_SUCCESS;
 }
 
-enum sh_add_to_history_result
-add_line_to_history(struct sh_shell_context *ctx, char const *line) {
-    char *line_copy = strdup(line);
-    if (line_copy == NULL) {
-        return SH_ADD_TO_HISTORY_MEMORY_ERROR;
+char *get_history_file_path() {
+    // An empty `HISTFILE` disables the history file.
+    char const *histfile = getenv(HISTFILE_ENV);
+    if (histfile != NULL) {
+        return *histfile != '\0' ? strdup(histfile) : NULL;
     }
 
-    // Grow the history buffer if needed.
-    if (ctx->history_count == ctx->history_capacity) {
-        size_t new_capacity = ctx->history_capacity == 0
-                                  ? 4
-                                  : ctx->history_capacity * 2;
+    char const *home = getenv("HOME");
+    if (home == NULL || *home == '\0') {
+        return NULL;
+    }
 
-        char **tmp = realloc(ctx->history, sizeof(char *) * new_capacity);
-        if (tmp == NULL) {
-            return SH_ADD_TO_HISTORY_MEMORY_ERROR;
-        }
-        ctx->history_capacity = new_capacity;
-        ctx->history = tmp;
+    size_t home_len = strlen(home);
+    size_t name_len = strlen(DEFAULT_HISTFILE);
+    char *path = malloc(sizeof(char) * (home_len + 1 + name_len + 1));
+    if (path == NULL) {
+        return NULL;
     }
+    memcpy(path, home, home_len);
+    path[home_len] = '/';
+    memcpy(path + home_len + 1, DEFAULT_HISTFILE, name_len + 1);
+    return path;
+}
 
-    // Add the line.
-    ctx->history[ctx->history_count] = line_copy;
-    ctx->history_count++;
+enum sh_add_to_history_result
+add_line_to_history(struct sh_shell_context *ctx, char const *line) {
+    if (!history_add(&ctx->history, line)) {
+        return SH_ADD_TO_HISTORY_MEMORY_ERROR;
+    }
     return SH_ADD_TO_HISTORY_SUCCESS;
 }
 
-char *get_command_by_index(struct sh_shell_context *ctx, size_t idx) {
-    if (idx >= ctx->history_count) {
-        return NULL;
-    }
-    return ctx->history[idx];
+char const *
+get_command_by_index(struct sh_shell_context const *ctx, size_t idx) {
+    return history_get(&ctx->history, idx);
 }
 
-char *get_command_by_prefix(struct sh_shell_context *ctx, char const *prefix) {
-    if (ctx->history_count == 0) {
+char const *
+get_command_by_prefix(struct sh_shell_context *ctx, char const *prefix) {
+    size_t idx;
+    if (!history_find_prefix(
+            &ctx->history,
+            prefix,
+            strlen(prefix),
+            history_end_number(&ctx->history),
+            &idx
+        ))
+    {
         return NULL;
     }
+    return history_get(&ctx->history, idx);
+}
 
-    char *match = NULL;
-    size_t prefix_len = strlen(prefix);
-    for (size_t idx = ctx->history_count; idx >= 1; idx--) {
-        size_t history_cmd_len = strlen(ctx->history[idx - 1]);
-        if (prefix_len <= history_cmd_len
-            && strncmp(ctx->history[idx - 1], prefix, prefix_len) == 0)
-        {
-            match = ctx->history[idx - 1];
-            break;
-        }
-    }
-    return match;
+bool find_command_by_substring(
+    struct sh_shell_context *ctx,
+    char const *query,
+    size_t before,
+    size_t *idx_out
+) {
+    return history_find_substring(&ctx->history, query, before, idx_out);
 }
 
 void destroy_shell_context(struct sh_shell_context *ctx) {
-    // Release memory for the history.
-    for (size_t idx = 0; idx < ctx->history_count; idx++) {
-        free(ctx->history[idx]);
+    // Give the terminal back in the state we found it in.
+    if (ctx->is_interactive) {
+        restore_term_mode(&ctx->orig_termios);
     }
-    free(ctx->history);
-    ctx->history = NULL;
+
+    // Release memory for the history.
+    destroy_history(&ctx->history);
 
     // Release memory for the prompt.
     free(ctx->prompt);
+
+    // Release memory for running command lines.
+    destroy_arena(&ctx->arena);
+
+    // Release memory for cached directory listings.
+    destroy_dir_cache(&ctx->dir_cache);
+
+    // Release memory for cached command lines.
+    destroy_line_cache(&ctx->line_cache);
 }
 
 void setup_signals() {
@@ -185,6 +193,14 @@ void setup_signals() {
     sigact_chld.sa_handler = handle_sigchld;
     sigaction(SIGCHLD, &sigact_chld, NULL);
 
+    // Set up SIGWINCH handler so that the line editor only has to query the
+    // window size after a resize.
+    struct sigaction sigact_winch;
+    sigemptyset(&sigact_winch.sa_mask);
+    sigact_winch.sa_flags = SA_RESTART;
+    sigact_winch.sa_handler = handle_sigwinch;
+    sigaction(SIGWINCH, &sigact_winch, NULL);
+
     ignore_stop_signals();
 }
 
@@ -210,6 +226,30 @@ void reset_signal_handlers_for_stop_signals() {
     }
 }
 
+void add_stop_signals(sigset_t *set) {
+    for (size_t idx = 0; idx < STOP_SIGNALS_SIZE; idx++) {
+        int sig = STOP_SIGNALS[idx];
+        sigaddset(set, sig);
+    }
+}
+
+volatile sig_atomic_t const *catch_sigint() {
+    sigint_caught = 0;
+
+    // Slow system calls are interrupted, so that they are noticed sooner.
+    struct sigaction sigact_int;
+    sigemptyset(&sigact_int.sa_mask);
+    sigact_int.sa_flags = 0;
+    sigact_int.sa_handler = handle_sigint;
+    sigaction(SIGINT, &sigact_int, NULL);
+
+    return &sigint_caught;
+}
+
+void handle_sigint(int signo) {
+    sigint_caught = 1;
+}
+
 void handle_sigchld(int signo) {
     // Since signals don't have a queue, it is possible for multiple `SIGCHLD`
     // signals to "combine". Hence, we need to use a loop to consume all current
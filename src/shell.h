@@ -7,19 +7,71 @@
 #ifndef SHELL_H
 #define SHELL_H
 
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <termios.h>
 
+#include "arena.h"
+#include "glob_expand.h"
+#include "history.h"
+#include "line_cache.h"
+
+/** The default maximum number of history entries to keep. */
 #define MAX_HISTORY 100
 
+/** Environment variable for overriding `MAX_HISTORY`. */
+#define HISTSIZE_ENV "HISTSIZE"
+
+/** The default number of milliseconds that expanding a glob may take. */
+#define DEFAULT_GLOB_TIMEOUT_MS 10000
+
+/** The default number of paths that expanding a glob may find. */
+#define DEFAULT_GLOB_MAX_MATCHES 1000000
+
+/** Environment variable for overriding the history file's path. */
+#define HISTFILE_ENV "HISTFILE"
+
+/** Name of the history file in the user's home directory. */
+#define DEFAULT_HISTFILE ".acush_history"
+
+/**
+ * Environment variable for sharing the history file with other shells. The
+ * history file is shared if it is set and not empty.
+ */
+#define HISTSHARE_ENV "HISTSHARE"
+
 /** Keeps track of various stateful information about the current shell. */
 struct sh_shell_context {
-    size_t history_capacity; /**< Capacity of the history array. */
-    size_t history_count;    /**< Current number of entries in the history. */
-    char **history;          /**< Array of command history strings. */
+    struct sh_history history; /**< The command history. Entries are numbered
+                                  from 0, but shown to the user from 1. */
 
     char *prompt; /**< The current shell prompt. */
 
+    struct sh_arena arena; /**< Arena for everything allocated while running a
+                              command line. It is rewound once the command line
+                              has finished running. */
+
+    struct sh_dir_cache dir_cache; /**< Cached directory listings, which are
+                                      kept across command lines. */
+
+    struct sh_line_cache line_cache; /**< Cached command lines, so that lines
+                                        that are run again are not lexed and
+                                        parsed again. */
+
+    struct sh_glob_budget glob_budget; /**< Limits on expanding each glob. They
+                                          are set by the `globlimit`
+                                          builtin. */
+
+    bool batch_args; /**< Whether a command whose arguments are too long to
+                        run at once is run several times with batches of its
+                        arguments. This is set by the `argbatch` builtin. */
+
+    bool is_interactive; /**< Whether the shell's input is a terminal. */
+    struct termios orig_termios; /**< Terminal attributes from before the shell
+                                    put the terminal into raw mode. Only set if
+                                    the shell is interactive. */
+
     bool should_exit; /**< Indicates if the shell should exit. This is set by
                          the `exit` builtin. */
     int exit_code;    /**<
@@ -28,6 +80,28 @@ struct sh_shell_context {
                        */
 };
 
+/** Represents the possible results of initializing the shell context. */
+enum sh_init_shell_context_result {
+    SH_INIT_SHELL_CONTEXT_SUCCESS,     /**< Successful initialization. */
+    SH_INIT_SHELL_CONTEXT_MEMORY_ERROR /**< Memory allocation error. */
+};
+
+/**
+ * Initializes the shell context.
+ *
+ * @param ctx a pointer to the shell context to initialise
+ * @return the result of the initialization
+ */
+enum sh_init_shell_context_result
+init_shell_context(struct sh_shell_context *ctx);
+
+/**
+ * Destroys the shell context by freeing allocated resources.
+ *
+ * @param ctx a pointer to the shell context
+ */
+void destroy_shell_context(struct sh_shell_context *ctx);
+
 /**
  * Represents the possible results for adding a line to the shell's
  * command history.
@@ -47,9 +121,48 @@ enum sh_add_to_history_result {
 enum sh_add_to_history_result
 add_line_to_history(struct sh_shell_context *ctx, char const *line);
 
-char *get_command_by_index(struct sh_shell_context *ctx, size_t idx);
+/**
+ * Returns the history entry with the given index.
+ *
+ * The returned pointer is invalidated when a line is next added to the history.
+ *
+ * @param ctx a pointer to the shell context
+ * @param idx the index of the entry
+ * @return the entry, or `NULL` if there is no such entry (anymore)
+ */
+char const *
+get_command_by_index(struct sh_shell_context const *ctx, size_t idx);
+
+/**
+ * Returns the most recent history entry that starts with the given prefix.
+ *
+ * The returned pointer is invalidated when a line is next added to the history.
+ *
+ * @param ctx a pointer to the shell context
+ * @param prefix the prefix to search for
+ * @return the entry, or `NULL` if there is no such entry
+ */
+char const *
+get_command_by_prefix(struct sh_shell_context *ctx, char const *prefix);
+
+/**
+ * Finds the most recent history entry containing the given substring.
+ *
+ * @param ctx a pointer to the shell context
+ * @param query the substring to search for
+ * @param before only entries with an index less than this are searched
+ * @param idx_out a pointer to write the index of the matching entry to
+ * @return true if a matching entry was found, false otherwise
+ */
+bool find_command_by_substring(
+    struct sh_shell_context *ctx,
+    char const *query,
+    size_t before,
+    size_t *idx_out
+);
 
-char *get_command_by_prefix(struct sh_shell_context *ctx, char const *prefix);
+/** Sets up signal handling for the shell. */
+void setup_signals();
 
 /** Sets up signal handlers for SIGINT (Ctrl+C), SIGQUIT (Ctrl+\) and SIGTSTP
  * (Ctrl+Z) to ignore them. */
@@ -59,4 +172,18 @@ void ignore_stop_signals();
  * (Ctrl+Z) to their defaults. */
 void reset_signal_handlers_for_stop_signals();
 
+/** Adds SIGINT (Ctrl+C), SIGQUIT (Ctrl+\) and SIGTSTP (Ctrl+Z) to a signal
+ * set. */
+void add_stop_signals(sigset_t *set);
+
+/**
+ * Sets up a signal handler for SIGINT (Ctrl+C) that sets a flag instead of
+ * ignoring it, until `ignore_stop_signals()` is called again.
+ *
+ * The flag is cleared first.
+ *
+ * @return a pointer to the flag
+ */
+volatile sig_atomic_t const *catch_sigint();
+
 #endif /* SHELL_H */
@@ -0,0 +1,271 @@
+/**
+ * @file argbatch_redirect.c
+ *
+ * Test for redirecting the output of commands whose arguments are run in
+ * batches (see the `argbatch` builtin).
+ *
+ * The batches of a command run in parallel, so they must share the files they
+ * are redirected to or from. If each batch opened the files itself, each would
+ * truncate the files and write over what the other batches wrote.
+ *
+ * This test fills a temporary directory with enough files that `d/*` does not
+ * fit into the argument space of `exec()`, runs commands on them with `run()`,
+ * and counts the words that end up in the files they are redirected to.
+ *
+ * Build and run with `make test`.
+ */
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "run.h"
+#include "shell.h"
+
+/** Number of digits in the names of the files, which makes them long. */
+#define NAME_DIGITS 48
+
+/** Minimum number of batches that `d/*` should be split into. */
+#define MIN_BATCH_COUNT 2
+
+/** Number of lines in the file that standard input is redirected from. */
+#define INPUT_LINE_COUNT 100000
+
+/** A command line to run, and what it should write to one of its files. */
+struct redirect_case {
+    char const *line;   /**< The command line. */
+    char const *path;   /**< A file that the command line writes to. */
+    bool count_lines;   /**< Whether to count lines rather than words. */
+    size_t file_count;  /**< Number expected per file in `d/`. */
+    size_t extra_count; /**< Number expected besides those. */
+};
+
+/**
+ * Creates a temporary directory with the input file and a directory `d` with
+ * the given number of files in it, and changes into it.
+ *
+ * @param dir_out a buffer to write the path of the directory to, which must
+ * have room for `sizeof("/tmp/acush-argbatch-XXXXXX")` characters
+ * @param file_count the number of files to create in `d`
+ * @return true if successful, false otherwise
+ */
+bool create_fixture(char *dir_out, size_t file_count);
+
+/**
+ * Removes the files and the temporary directory created by `create_fixture()`.
+ *
+ * @param dir the path of the directory
+ * @param file_count the number of files in `d`
+ * @param cases the command lines that were run
+ * @param case_count the number of command lines
+ */
+void remove_fixture(
+    char const *dir,
+    size_t file_count,
+    struct redirect_case const *cases,
+    size_t case_count
+);
+
+/**
+ * Writes the path of one of the files in `d` to a buffer.
+ *
+ * @param path_out a buffer with room for `NAME_DIGITS + 3` characters
+ * @param idx the index of the file
+ */
+void fixture_path(char *path_out, size_t idx);
+
+/**
+ * Counts the whitespace-separated words or the lines in a file.
+ *
+ * @param path the path of the file
+ * @param count_lines whether to count lines rather than words
+ * @return the number of words or lines, or 0 if the file could not be read
+ */
+size_t count_words(char const *path, bool count_lines);
+
+/**
+ * Initialises a shell context for running command lines without a terminal,
+ * with batching of arguments turned on.
+ *
+ * @param ctx a pointer to the shell context to initialise
+ */
+void init_test_context(struct sh_shell_context *ctx);
+
+/**
+ * Destroys a shell context initialised by `init_test_context()`.
+ *
+ * @param ctx a pointer to the shell context
+ */
+void destroy_test_context(struct sh_shell_context *ctx);
+
+int main() {
+    long arg_max = sysconf(_SC_ARG_MAX);
+    if (arg_max < 0) {
+        arg_max = _POSIX_ARG_MAX;
+    }
+    size_t arg_size = sizeof("d/") + NAME_DIGITS + sizeof(char *);
+    size_t file_count = MIN_BATCH_COUNT * (size_t) arg_max / arg_size + 1;
+
+    // `ls` reports the missing file once, in the batch that gets it.
+    struct redirect_case const cases[] = {
+        {"echo d/* > out1", "out1", false, 1, 0},
+        {"ls d/* missing > out2 2> err2", "out2", true, 1, 0},
+        {"ls d/* missing > out2 2> err2", "err2", true, 0, 1},
+        {"cat - d/* < input > out3", "out3", true, 0, INPUT_LINE_COUNT},
+    };
+    size_t case_count = sizeof(cases) / sizeof(cases[0]);
+
+    char dir[] = "/tmp/acush-argbatch-XXXXXX";
+    if (!create_fixture(dir, file_count)) {
+        return EXIT_FAILURE;
+    }
+
+    struct sh_shell_context ctx;
+    init_test_context(&ctx);
+
+    bool failed = false;
+    for (size_t idx = 0; idx < case_count; idx++) {
+        struct redirect_case const *test = &cases[idx];
+        if (idx == 0 || strcmp(test->line, cases[idx - 1].line) != 0) {
+            run(&ctx, test->line);
+        }
+
+        size_t expected = test->file_count * file_count + test->extra_count;
+        size_t actual = count_words(test->path, test->count_lines);
+        if (actual != expected) {
+            printf(
+                "%s: %s has %zu %s, expected %zu\n",
+                test->line,
+                test->path,
+                actual,
+                test->count_lines ? "lines" : "words",
+                expected
+            );
+            failed = true;
+        }
+    }
+
+    destroy_test_context(&ctx);
+    remove_fixture(dir, file_count, cases, case_count);
+
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+    printf(
+        "%zu command lines on %zu files redirected correctly\n",
+        case_count,
+        file_count
+    );
+    return EXIT_SUCCESS;
+}
+
+bool create_fixture(char *dir_out, size_t file_count) {
+    if (mkdtemp(dir_out) == NULL || chdir(dir_out) == -1
+        || mkdir("d", 0755) == -1)
+    {
+        perror(dir_out);
+        return false;
+    }
+
+    for (size_t idx = 0; idx < file_count; idx++) {
+        char path[NAME_DIGITS + 3];
+        fixture_path(path, idx);
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+            perror(path);
+            return false;
+        }
+        fclose(file);
+    }
+
+    FILE *input = fopen("input", "w");
+    if (input == NULL) {
+        perror("input");
+        return false;
+    }
+    for (size_t idx = 0; idx < INPUT_LINE_COUNT; idx++) {
+        fprintf(input, "%zu\n", idx);
+    }
+    fclose(input);
+
+    return true;
+}
+
+void remove_fixture(
+    char const *dir,
+    size_t file_count,
+    struct redirect_case const *cases,
+    size_t case_count
+) {
+    for (size_t idx = 0; idx < file_count; idx++) {
+        char path[NAME_DIGITS + 3];
+        fixture_path(path, idx);
+        unlink(path);
+    }
+    for (size_t idx = 0; idx < case_count; idx++) {
+        unlink(cases[idx].path);
+    }
+    unlink("input");
+    rmdir("d");
+
+    if (chdir("/") == -1 || rmdir(dir) == -1) {
+        perror(dir);
+    }
+}
+
+void fixture_path(char *path_out, size_t idx) {
+    snprintf(path_out, NAME_DIGITS + 3, "d/%0*zu", NAME_DIGITS, idx);
+}
+
+size_t count_words(char const *path, bool count_lines) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    size_t count = 0;
+    bool in_word = false;
+    int c;
+    while ((c = fgetc(file)) != EOF) {
+        bool is_space
+            = c == '\n' || (!count_lines && (c == ' ' || c == '\t'));
+        if (!is_space && !in_word) {
+            count++;
+        }
+        in_word = !is_space;
+    }
+
+    fclose(file);
+    return count;
+}
+
+void init_test_context(struct sh_shell_context *ctx) {
+    *ctx = (struct sh_shell_context) {
+        .prompt = NULL,
+        .glob_budget = (struct sh_glob_budget) {
+            .timeout_ms = DEFAULT_GLOB_TIMEOUT_MS,
+            .max_matches = DEFAULT_GLOB_MAX_MATCHES,
+            .interrupted = NULL,
+        },
+        .batch_args = true,
+        .is_interactive = false,
+        .should_exit = false,
+        .exit_code = EXIT_SUCCESS,
+    };
+    init_history(&ctx->history, MAX_HISTORY);
+    init_arena(&ctx->arena);
+    init_dir_cache(&ctx->dir_cache);
+    init_line_cache(&ctx->line_cache);
+}
+
+void destroy_test_context(struct sh_shell_context *ctx) {
+    destroy_history(&ctx->history);
+    destroy_arena(&ctx->arena);
+    destroy_dir_cache(&ctx->dir_cache);
+    destroy_line_cache(&ctx->line_cache);
+}
@@ -0,0 +1,457 @@
+/**
+ * @file lex_diff.c
+ *
+ * Differential test for the lexer in `src/lex.c`.
+ *
+ * The lexer is a table-driven state machine that handles whole runs of text at
+ * once. This test lexes randomly generated command lines with it, and checks
+ * that the tokens and the result are the same as those of the lexer it
+ * replaced, which is kept in `tests/lex_oracle/`.
+ *
+ * The command lines are lexed in a temporary directory with a few files in it,
+ * so that globs have something to match. The old lexer expands globs with the C
+ * library's `glob()`, and the current one with `expand_glob()`, which only
+ * differ for `**`. Command lines with `**` are not generated, and neither are
+ * ones with empty quoted strings, which the old lexer gets wrong.
+ *
+ * Build and run with `make test`. The number of command lines and the random
+ * seed can be given as arguments.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "lex.h"
+#include "lex_oracle/oracle.h"
+
+/** Number of command lines to generate by default. */
+#define DEFAULT_LINE_COUNT 110000
+
+/** Random seed to use by default. */
+#define DEFAULT_SEED 1
+
+/** Maximum number of pieces in a generated command line. */
+#define MAX_PIECES 12
+
+/** Number of mismatches to report before giving up. */
+#define MAX_REPORTED_MISMATCHES 10
+
+/**
+ * Pieces that command lines are generated from. They cover every character
+ * class, runs of text of different lengths and glob patterns that match some
+ * of the files in `FIXTURE_FILES`.
+ */
+static char const *const PIECES[] = {
+    "a",  "b1", "x",     "2",      "2>",       ">",   "<",    "|",  "&",
+    ";",  "!",  "\"",    "'",      "\\",       "*",   "?",    "[",  "]",
+    " ",  "  ", "\t",    "\n",     "a*",       "[ab]1", "d/*", "d/*/*.c",
+    "s*", "sp", "ace",   "22",     "\\2>",     "-la", "[!a]", "[a-c]*",
+    "thisisalongerrunoftextthanthevectorscannersblocks",
+};
+
+/** Files created in the temporary directory, with their directories first. */
+static char const *const FIXTURE_FILES[] = {
+    "d/",  "d/e/", "d/e/z.c", "d/x.c", "d/y.h", "a",    "b1",
+    "ace", "sp",   "sp ace",  "s2>",   ".a",    "-la",  "a*b",
+};
+
+/** The tokens and the result of lexing a command line. */
+struct lex_output {
+    struct sh_token *tokens; /**< The tokens, in order. */
+    size_t count;            /**< Number of tokens. */
+    size_t capacity;         /**< Capacity of the tokens array. */
+    enum sh_lex_result result; /**< The result that the lex ended with. */
+};
+
+/** A lex output that tokens are appended to, and the arena to allocate from. */
+struct oracle_output {
+    struct lex_output *output; /**< The output. */
+    struct sh_arena *arena;    /**< The arena to allocate from. */
+};
+
+/**
+ * Generates a random command line without `**` or empty quoted strings in it.
+ *
+ * @param line_out a buffer to write the null-terminated command line to, which
+ * must have room for `MAX_PIECES` of the longest piece
+ */
+void generate_line(char *line_out);
+
+/**
+ * Creates a temporary directory with the files in `FIXTURE_FILES`, and changes
+ * into it.
+ *
+ * @param dir_out a buffer to write the path of the directory to, which must
+ * have room for `sizeof("/tmp/acush-lex-diff-XXXXXX")` characters
+ * @return true if successful, false otherwise
+ */
+bool create_fixture(char *dir_out);
+
+/**
+ * Removes the files and the temporary directory created by `create_fixture()`.
+ *
+ * @param dir the path of the directory
+ */
+void remove_fixture(char const *dir);
+
+/**
+ * Lexes a command line with the lexer under test.
+ *
+ * The token buffer is emptied after every call to `lex()`, as the parser does.
+ *
+ * @param line the command line
+ * @param arena the arena to allocate from
+ * @param output_out a pointer to the output to fill in
+ * @return true if successful, false if memory could not be allocated
+ */
+bool lex_line(
+    char const *line,
+    struct sh_arena *arena,
+    struct lex_output *output_out
+);
+
+/**
+ * Lexes a command line with the old lexer.
+ *
+ * @param line the command line
+ * @param arena the arena to allocate from
+ * @param output_out a pointer to the output to fill in
+ * @return true if successful, false if memory could not be allocated
+ */
+bool old_lex_line(
+    char const *line,
+    struct sh_arena *arena,
+    struct lex_output *output_out
+);
+
+/**
+ * Appends a token output by the old lexer to a lex output, copying its text.
+ *
+ * @param data a pointer to the `struct oracle_output` to append to
+ * @param type the type of the token
+ * @param text the text of the token
+ * @return true if successful, false if memory could not be allocated
+ */
+bool append_oracle_token(void *data, int type, char const *text);
+
+/**
+ * Appends a token to a lex output.
+ *
+ * @param output a pointer to the output
+ * @param arena the arena to allocate from
+ * @param type the type of the token
+ * @param text the text of the token, which must stay valid as long as the
+ * output
+ * @return true if successful, false if memory could not be allocated
+ */
+bool append_token(
+    struct lex_output *output,
+    struct sh_arena *arena,
+    enum sh_token_type type,
+    char const *text
+);
+
+/**
+ * Checks whether two lex outputs are the same.
+ *
+ * @param a a pointer to the first output
+ * @param b a pointer to the second output
+ * @return true if the outputs are the same, false otherwise
+ */
+bool outputs_equal(struct lex_output const *a, struct lex_output const *b);
+
+/**
+ * Prints a string with its control characters and quotes escaped.
+ *
+ * @param str the string to print
+ */
+void print_escaped(char const *str);
+
+/**
+ * Prints a lex output.
+ *
+ * @param label the label to print before the output
+ * @param output a pointer to the output
+ */
+void print_output(char const *label, struct lex_output const *output);
+
+int main(int argc, char **argv) {
+    if (argc > 3) {
+        fprintf(stderr, "usage: %s [line-count [seed]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    long line_count = argc > 1 ? atol(argv[1]) : DEFAULT_LINE_COUNT;
+    unsigned seed = argc > 2 ? (unsigned) atol(argv[2]) : DEFAULT_SEED;
+    srand(seed);
+
+    char dir[] = "/tmp/acush-lex-diff-XXXXXX";
+    if (!create_fixture(dir)) {
+        return EXIT_FAILURE;
+    }
+
+    size_t max_piece_len = 0;
+    for (size_t idx = 0; idx < sizeof(PIECES) / sizeof(PIECES[0]); idx++) {
+        size_t len = strlen(PIECES[idx]);
+        if (len > max_piece_len) {
+            max_piece_len = len;
+        }
+    }
+    char *line = malloc(MAX_PIECES * max_piece_len + 1);
+    if (line == NULL) {
+        perror("malloc");
+        remove_fixture(dir);
+        return EXIT_FAILURE;
+    }
+
+    struct sh_arena arena;
+    init_arena(&arena);
+    struct sh_arena_mark mark = arena_mark(&arena);
+
+    long mismatches = 0;
+    bool failed = false;
+    for (long idx = 0; idx < line_count && !failed; idx++) {
+        generate_line(line);
+
+        struct lex_output actual, expected;
+        if (!lex_line(line, &arena, &actual)
+            || !old_lex_line(line, &arena, &expected))
+        {
+            fprintf(stderr, "out of memory\n");
+            failed = true;
+        } else if (!outputs_equal(&actual, &expected)) {
+            mismatches++;
+            printf("mismatch for line %ld: \"", idx);
+            print_escaped(line);
+            printf("\"\n");
+            print_output("  lex:      ", &actual);
+            print_output("  old lex:  ", &expected);
+            failed = mismatches >= MAX_REPORTED_MISMATCHES;
+        }
+
+        arena_rewind(&arena, mark);
+    }
+
+    destroy_arena(&arena);
+    free(line);
+    remove_fixture(dir);
+
+    if (failed || mismatches > 0) {
+        printf("%ld mismatches\n", mismatches);
+        return EXIT_FAILURE;
+    }
+    printf("%ld command lines lexed the same\n", line_count);
+    return EXIT_SUCCESS;
+}
+
+void generate_line(char *line_out) {
+    // Pieces next to each other can still make `**`, which the lexers expand
+    // differently on purpose. The old lexer also takes the text of the word
+    // before an empty quoted string for the string, if the word was expanded,
+    // so empty quoted strings are avoided as well.
+    do {
+        size_t piece_count = rand() % (MAX_PIECES + 1);
+        line_out[0] = '\0';
+        for (size_t idx = 0; idx < piece_count; idx++) {
+            size_t piece_idx = rand() % (sizeof(PIECES) / sizeof(PIECES[0]));
+            strcat(line_out, PIECES[piece_idx]);
+        }
+    } while (strstr(line_out, "**") != NULL || strstr(line_out, "''") != NULL
+             || strstr(line_out, "\"\"") != NULL);
+}
+
+bool create_fixture(char *dir_out) {
+    if (mkdtemp(dir_out) == NULL || chdir(dir_out) == -1) {
+        perror(dir_out);
+        return false;
+    }
+
+    for (size_t idx = 0; idx < sizeof(FIXTURE_FILES) / sizeof(FIXTURE_FILES[0]);
+         idx++)
+    {
+        char const *path = FIXTURE_FILES[idx];
+        size_t len = strlen(path);
+
+        if (path[len - 1] == '/') {
+            if (mkdir(path, 0755) == -1) {
+                perror(path);
+                return false;
+            }
+            continue;
+        }
+
+        FILE *file = fopen(path, "w");
+        if (file == NULL) {
+            perror(path);
+            return false;
+        }
+        fclose(file);
+    }
+
+    return true;
+}
+
+void remove_fixture(char const *dir) {
+    // Remove the files before the directories they are in.
+    for (size_t idx = sizeof(FIXTURE_FILES) / sizeof(FIXTURE_FILES[0]);
+         idx-- > 0;)
+    {
+        char const *path = FIXTURE_FILES[idx];
+        if (path[strlen(path) - 1] != '/') {
+            unlink(path);
+        }
+    }
+    for (size_t idx = sizeof(FIXTURE_FILES) / sizeof(FIXTURE_FILES[0]);
+         idx-- > 0;)
+    {
+        char const *path = FIXTURE_FILES[idx];
+        if (path[strlen(path) - 1] == '/') {
+            rmdir(path);
+        }
+    }
+
+    if (chdir("/") == -1 || rmdir(dir) == -1) {
+        perror(dir);
+    }
+}
+
+bool lex_line(
+    char const *line,
+    struct sh_arena *arena,
+    struct lex_output *output_out
+) {
+    *output_out = (struct lex_output) {
+        .tokens = NULL,
+        .count = 0,
+        .capacity = 0,
+        .result = SH_LEX_ONGOING,
+    };
+
+    struct sh_lex_context ctx;
+    init_lex_context(&ctx, line, arena, NULL, NULL);
+
+    while (output_out->result == SH_LEX_ONGOING) {
+        output_out->result = lex(&ctx);
+
+        for (size_t idx = 0; idx < ctx.tokbuf_len; idx++) {
+            struct sh_token token = ctx.tokbuf[idx];
+            if (!append_token(output_out, arena, token.type, token.text)) {
+                return false;
+            }
+        }
+        ctx.tokbuf_len = 0;
+    }
+
+    return output_out->result != SH_LEX_MEMORY_ERROR;
+}
+
+bool old_lex_line(
+    char const *line,
+    struct sh_arena *arena,
+    struct lex_output *output_out
+) {
+    *output_out = (struct lex_output) {
+        .tokens = NULL,
+        .count = 0,
+        .capacity = 0,
+        .result = SH_LEX_ONGOING,
+    };
+
+    struct oracle_output oracle_output = (struct oracle_output) {
+        .output = output_out,
+        .arena = arena,
+    };
+    int result;
+    bool appended
+        = oracle_lex_line(line, append_oracle_token, &oracle_output, &result);
+    output_out->result = result;
+    return appended && output_out->result != SH_LEX_MEMORY_ERROR;
+}
+
+bool append_oracle_token(void *data, int type, char const *text) {
+    struct oracle_output *oracle_output = data;
+
+    size_t len = strlen(text);
+    char *copy = arena_alloc(oracle_output->arena, len + 1);
+    if (copy == NULL) {
+        return false;
+    }
+    memcpy(copy, text, len + 1);
+
+    return append_token(
+        oracle_output->output,
+        oracle_output->arena,
+        type,
+        copy
+    );
+}
+
+bool append_token(
+    struct lex_output *output,
+    struct sh_arena *arena,
+    enum sh_token_type type,
+    char const *text
+) {
+    if (output->count == output->capacity) {
+        size_t new_capacity = output->capacity == 0 ? 8 : output->capacity * 2;
+        struct sh_token *tokens = arena_grow(
+            arena,
+            output->tokens,
+            sizeof(struct sh_token) * output->capacity,
+            sizeof(struct sh_token) * new_capacity
+        );
+        if (tokens == NULL) {
+            return false;
+        }
+
+        output->tokens = tokens;
+        output->capacity = new_capacity;
+    }
+
+    output->tokens[output->count++] = (struct sh_token) {
+        .type = type,
+        .text = text,
+    };
+    return true;
+}
+
+bool outputs_equal(struct lex_output const *a, struct lex_output const *b) {
+    if (a->result != b->result || a->count != b->count) {
+        return false;
+    }
+
+    for (size_t idx = 0; idx < a->count; idx++) {
+        if (a->tokens[idx].type != b->tokens[idx].type
+            || strcmp(a->tokens[idx].text, b->tokens[idx].text) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_escaped(char const *str) {
+    for (char const *cp = str; *cp != '\0'; cp++) {
+        if (*cp == '"' || *cp == '\\') {
+            printf("\\%c", *cp);
+        } else if ((unsigned char) *cp < ' ') {
+            printf("\\x%02x", *cp);
+        } else {
+            putchar(*cp);
+        }
+    }
+}
+
+void print_output(char const *label, struct lex_output const *output) {
+    printf("%s result %d,", label, output->result);
+    for (size_t idx = 0; idx < output->count; idx++) {
+        printf(" %d:\"", output->tokens[idx].type);
+        print_escaped(output->tokens[idx].text);
+        printf("\"");
+    }
+    printf("\n");
+}
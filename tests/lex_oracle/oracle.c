@@ -0,0 +1,28 @@
+#include "oracle.h"
+
+#include "lex.h"
+
+bool oracle_lex_line(
+    char const *line,
+    oracle_token_fn on_token,
+    void *data,
+    int *result_out
+) {
+    struct sh_lex_context ctx;
+    init_lex_context(&ctx, line);
+
+    enum sh_lex_result result = SH_LEX_ONGOING;
+    while (result == SH_LEX_ONGOING) {
+        result = lex(&ctx);
+    }
+    *result_out = result;
+
+    bool ok = true;
+    for (size_t idx = 0; idx < ctx.tokbuf_len && ok; idx++) {
+        struct sh_token token = ctx.tokbuf[idx];
+        ok = on_token(data, token.type, token.text);
+    }
+
+    destroy_lex_context(&ctx);
+    return ok;
+}
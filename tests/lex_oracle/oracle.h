@@ -0,0 +1,47 @@
+/**
+ * @file oracle.h
+ *
+ * Declarations for lexing with the lexer as it was before it was rewritten as a
+ * state machine, which `tests/lex_diff.c` compares the current lexer against.
+ *
+ * `lex.c`, `lex.h`, `raw_lex.c` and `raw_lex.h` in this directory are copies of
+ * that lexer, unchanged. It expands globs with the C library's `glob()`.
+ */
+
+#ifndef LEX_ORACLE_H
+#define LEX_ORACLE_H
+
+#include <stdbool.h>
+
+/**
+ * A function that is called with every token that the baseline lexer outputs.
+ *
+ * @param data the data passed to `oracle_lex_line()`
+ * @param type the token's type, as an `enum sh_token_type`, which has the same
+ * values in both lexers
+ * @param text the token's text, which is only valid during the call
+ * @return true to continue, false to stop lexing
+ */
+typedef bool (*oracle_token_fn)(void *data, int type, char const *text);
+
+/**
+ * Lexes a command line with the baseline lexer.
+ *
+ * The tokens are passed to `on_token` once the lex has finished, including
+ * those output before the lex failed.
+ *
+ * @param line the command line
+ * @param on_token the function to call with every token
+ * @param data the data to pass to `on_token`
+ * @param result_out a pointer to write the result that the lex ended with to,
+ * as an `enum sh_lex_result`, which has the same values in both lexers
+ * @return true if successful, false if `on_token` returned false
+ */
+bool oracle_lex_line(
+    char const *line,
+    oracle_token_fn on_token,
+    void *data,
+    int *result_out
+);
+
+#endif
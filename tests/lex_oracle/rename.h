@@ -0,0 +1,33 @@
+/**
+ * @file rename.h
+ *
+ * Renames the functions of the baseline lexer in this directory, so that they
+ * do not clash with those of the current lexer in `src/`. Every file in this
+ * directory is compiled with this header included first.
+ */
+
+#ifndef LEX_ORACLE_RENAME_H
+#define LEX_ORACLE_RENAME_H
+
+#define append_to_catbuf oracle_append_to_catbuf
+#define append_to_tokbuf oracle_append_to_tokbuf
+#define destroy_lex_context oracle_destroy_lex_context
+#define destroy_token oracle_destroy_token
+#define end_word oracle_end_word
+#define init_lex_context oracle_init_lex_context
+#define is_unquoted_section_marker oracle_is_unquoted_section_marker
+#define lex oracle_lex
+#define token_type_from_raw_token_type oracle_token_type_from_raw_token_type
+
+#define destroy_raw_token oracle_destroy_raw_token
+#define init_raw_lex_context oracle_init_raw_lex_context
+#define is_quote oracle_is_quote
+#define is_special oracle_is_special
+#define is_text_boundary oracle_is_text_boundary
+#define is_text_char oracle_is_text_char
+#define is_ws_delimiter oracle_is_ws_delimiter
+#define lex_special oracle_lex_special
+#define lex_whitespace oracle_lex_whitespace
+#define raw_lex oracle_raw_lex
+
+#endif